@@ -60,6 +60,9 @@ const int PROBE_SP_LIMIT = 4;
 const int PLT_HEADER_SIZE = 16;
 const int PLT_ENTRY_SIZE = 16;
 const int PERF_REG_PC = 8;  // PERF_REG_X86_IP
+const int PERF_REG_SP = 7;  // PERF_REG_X86_SP
+const int PERF_REG_FP = 6;  // PERF_REG_X86_BP
+const int PERF_REG_LR = -1;
 
 #define spinPause()       asm volatile("pause")
 #define rmb()             asm volatile("lfence" : : : "memory")
@@ -82,6 +85,9 @@ const int PROBE_SP_LIMIT = 0;
 const int PLT_HEADER_SIZE = 20;
 const int PLT_ENTRY_SIZE = 12;
 const int PERF_REG_PC = 15;  // PERF_REG_ARM_PC
+const int PERF_REG_SP = 13;  // PERF_REG_ARM_SP
+const int PERF_REG_FP = 11;  // PERF_REG_ARM_FP
+const int PERF_REG_LR = 14;  // PERF_REG_ARM_LR
 
 #define spinPause()       asm volatile("yield")
 #define rmb()             asm volatile("dmb ish" : : : "memory")
@@ -103,6 +109,9 @@ const int PROBE_SP_LIMIT = 0;
 const int PLT_HEADER_SIZE = 32;
 const int PLT_ENTRY_SIZE = 16;
 const int PERF_REG_PC = 32;  // PERF_REG_ARM64_PC
+const int PERF_REG_SP = 31;  // PERF_REG_ARM64_SP
+const int PERF_REG_FP = 29;  // PERF_REG_ARM64_X29
+const int PERF_REG_LR = 30;  // PERF_REG_ARM64_LR
 
 #define spinPause()       asm volatile("isb")
 #define rmb()             asm volatile("dmb ish" : : : "memory")
@@ -126,6 +135,9 @@ const int PROBE_SP_LIMIT = 0;
 const int PLT_HEADER_SIZE = 24;
 const int PLT_ENTRY_SIZE = 24;
 const int PERF_REG_PC = 32;  // PERF_REG_POWERPC_NIP
+const int PERF_REG_SP = 1;   // PERF_REG_POWERPC_R1
+const int PERF_REG_FP = 1;   // back chain is kept in R1
+const int PERF_REG_LR = 36;  // PERF_REG_POWERPC_LINK
 
 #define spinPause()       asm volatile("yield") // does nothing, but using or 1,1,1 would lead to other problems
 #define rmb()             asm volatile ("sync" : : : "memory") // lwsync would do but better safe than sorry
@@ -151,6 +163,9 @@ const int PROBE_SP_LIMIT = 0;
 const int PLT_HEADER_SIZE = 24; // Best guess from examining readelf
 const int PLT_ENTRY_SIZE = 24;  // ...same...
 const int PERF_REG_PC = 0;      // PERF_REG_RISCV_PC
+const int PERF_REG_SP = 2;      // PERF_REG_RISCV_SP
+const int PERF_REG_FP = 8;      // PERF_REG_RISCV_S0
+const int PERF_REG_LR = 1;      // PERF_REG_RISCV_RA
 
 #define spinPause()       // No architecture support
 #define rmb()             asm volatile ("fence" : : : "memory")
@@ -172,6 +187,9 @@ const int PROBE_SP_LIMIT = 0;
 const int PLT_HEADER_SIZE = 32;
 const int PLT_ENTRY_SIZE = 16;
 const int PERF_REG_PC = 0;      // PERF_REG_LOONGARCH_PC
+const int PERF_REG_SP = 3;      // PERF_REG_LOONGARCH_R3
+const int PERF_REG_FP = 22;     // PERF_REG_LOONGARCH_R22
+const int PERF_REG_LR = 1;      // PERF_REG_LOONGARCH_R1
 
 #define spinPause()       asm volatile("ibar 0x0")
 #define rmb()             asm volatile("dbar 0x0" : : : "memory")
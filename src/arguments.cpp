@@ -48,7 +48,9 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     metrics                 - print profiler metrics in Prometheus format
 //     list                    - show the list of available profiling events
 //     version                 - display the agent version
-//     event=EVENT             - which event to trace (cpu, wall, cache-misses, etc.)
+//     event=EVENT             - which event to trace (cpu, wall, offcpu, cache-misses, etc.)
+//     counters=EV1+EV2...     - perf_events counters to read along with each sample of the event
+//     weight=EV               - weight samples in text outputs by the event or one of the counters
 //     alloc[=BYTES]           - profile allocations with BYTES interval
 //     live                    - build allocation profile from live objects only
 //     nativemem[=BYTES]       - profile native allocations with BYTES interval
@@ -63,7 +65,8 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     flamegraph              - produce Flame Graph in HTML format
 //     tree                    - produce call tree in HTML format
 //     jfr                     - dump events in Java Flight Recorder format
-//     jfropts=OPTIONS         - JFR recording options: numeric bitmask or 'mem'
+//     jfropts=OPTIONS         - JFR recording options: numeric bitmask or 'mem', 'async'
+//     jfrring=SIZE            - keep only the last SIZE bytes of JFR chunks in memory until dump
 //     jfrsync[=CONFIG]        - start Java Flight Recording with the given config along with the profiler
 //     traces[=N]              - dump top N call traces
 //     flat[=N]                - dump top N methods (aka flat profile)
@@ -78,6 +81,9 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     jstackdepth=N           - maximum Java stack depth (default: 2048)
 //     signal=N                - use alternative signal for cpu or wall clock profiling
 //     features=LIST           - advanced stack trace features (mixed, vtable, comptask, pcaddr)"
+//     storage=OPTIONS         - call trace storage options: numeric bitmask or 'shard', 'prefix', 'verify'
+//     storagelimit=SIZE       - memory limit for call trace storage; evict traces not hit recently
+//     storageage=N            - evict call traces not hit for N JFR chunks or dumps (default: 4)
 //     safemode=BITS           - disable stack recovery techniques (default: 0, i.e. everything enabled)
 //     file=FILENAME           - output file name for dumping
 //     log=FILENAME            - log warnings and errors to the given dedicated stream
@@ -91,9 +97,15 @@ const size_t EXTRA_BUF_SIZE = 512;
 //                               MODE is 'fp', 'dwarf', 'lbr', 'vm' or 'no'
 //     clock=SOURCE            - clock source for JFR timestamps: 'tsc' or 'monotonic'
 //     alluser                 - include only user-mode events
+//     lazysymbols             - load symbols and DWARF tables of native libraries on first use
+//     symcache=DIR            - directory for caching parsed native library symbols
 //     fdtransfer              - use fdtransfer to pass fds to the profiler
 //     target-cpu=CPU          - sample threads on a specific CPU (perf_events only, default: -1)
 //     record-cpu              - record which cpu a sample was taken on
+//     percpu                  - open one perf_event per CPU instead of one per thread
+//     nosignal                - collect perf_events samples from ring buffers without signals
+//     userstack=N             - copy N bytes (8K-64K) of user stack with each percpu/nosignal sample
+//                               and unwind them later in the collector thread
 //     simple                  - simple class names instead of FQN
 //     dot                     - dotted class names
 //     norm                    - normalize names of hidden classes / lambdas
@@ -182,8 +194,15 @@ Error Arguments::parse(const char* args) {
                     msg = "Invalid jfropts";
                 } else if (value[0] >= '0' && value[0] <= '9') {
                     _jfr_options = (int)strtol(value, NULL, 0);
-                } else if (strstr(value, "mem")) {
-                    _jfr_options |= IN_MEMORY;
+                } else {
+                    if (strstr(value, "mem")) _jfr_options |= IN_MEMORY;
+                    if (strstr(value, "async")) _jfr_options |= ASYNC_WRITER;
+                }
+
+            CASE("jfrring")
+                _output = OUTPUT_JFR;
+                if (value == NULL || (_jfr_ring = parseUnits(value, BYTES)) <= 0) {
+                    msg = "Invalid jfrring";
                 }
 
             CASE("jfrsync")
@@ -236,6 +255,19 @@ Error Arguments::parse(const char* args) {
                     _event = value;
                 }
 
+            CASE("counters")
+                if (value == NULL || value[0] == 0) {
+                    msg = "counters must not be empty";
+                }
+                _counters = value;
+
+            CASE("weight")
+                if (value == NULL || value[0] == 0) {
+                    msg = "weight must not be empty";
+                }
+                _weight = value;
+                _counter = COUNTER_TOTAL;
+
             CASE("timeout")
                 if (value == NULL || (_timeout = parseTimeout(value)) == -1) {
                     msg = "Invalid timeout";
@@ -334,6 +366,27 @@ Error Arguments::parse(const char* args) {
                     if (strstr(value, "pcaddr"))   _features.pc_addr = 1;
                 }
 
+            CASE("storage")
+                if (value == NULL) {
+                    msg = "Invalid storage";
+                } else if (value[0] >= '0' && value[0] <= '9') {
+                    _storage_options = (int)strtol(value, NULL, 0);
+                } else {
+                    if (strstr(value, "shard"))  _storage_options |= STORAGE_SHARDED;
+                    if (strstr(value, "prefix")) _storage_options |= STORAGE_PREFIX;
+                    if (strstr(value, "verify")) _storage_options |= STORAGE_VERIFY;
+                }
+
+            CASE("storagelimit")
+                if (value == NULL || (_storage_limit = parseUnits(value, BYTES)) < 0) {
+                    msg = "Invalid storagelimit";
+                }
+
+            CASE("storageage")
+                if (value == NULL || (_storage_age = atoi(value)) <= 0) {
+                    msg = "Invalid storageage";
+                }
+
             CASE("safemode") {
                 // Left for compatibility purpose; will be eventually migrated to 'features'
                 int bits = value == NULL ? INT_MAX : (int)strtol(value, NULL, 0);
@@ -395,6 +448,17 @@ Error Arguments::parse(const char* args) {
             CASE("record-cpu")
                 _record_cpu = true;
 
+            CASE("percpu")
+                _percpu = true;
+
+            CASE("nosignal")
+                _nosignal = true;
+
+            CASE("userstack")
+                if (value == NULL || (_user_stack = parseUnits(value, BYTES)) < 8192 || _user_stack > 65536) {
+                    msg = "userstack must be between 8K and 64K";
+                }
+
             CASE("live")
                 _live = true;
 
@@ -404,6 +468,15 @@ Error Arguments::parse(const char* args) {
             CASE("alluser")
                 _alluser = true;
 
+            CASE("lazysymbols")
+                _lazy_symbols = true;
+
+            CASE("symcache")
+                if (value == NULL || value[0] == 0) {
+                    msg = "symcache must not be empty";
+                }
+                _symcache = value;
+
             CASE("cstack")
                 if (value != NULL) {
                     if (strcmp(value, "fp") == 0) {
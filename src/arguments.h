@@ -24,6 +24,7 @@ const char* const EVENT_NATIVELOCK = "nativelock";
 const char* const EVENT_WALL       = "wall";
 const char* const EVENT_CTIMER     = "ctimer";
 const char* const EVENT_ITIMER     = "itimer";
+const char* const EVENT_OFFCPU     = "offcpu";
 
 #define SHORT_ENUM __attribute__((__packed__))
 
@@ -90,10 +91,17 @@ enum JfrOption {
     NO_HEAP_SUMMARY = 0x10,
 
     IN_MEMORY       = 0x100,
+    ASYNC_WRITER    = 0x200,
 
     JFR_SYNC_OPTS   = NO_SYSTEM_INFO | NO_SYSTEM_PROPS | NO_NATIVE_LIBS | NO_CPU_LOAD | NO_HEAP_SUMMARY
 };
 
+enum StorageOption {
+    STORAGE_SHARDED = 0x1,
+    STORAGE_PREFIX  = 0x2,
+    STORAGE_VERIFY  = 0x4
+};
+
 // Keep this in sync with JfrSync.java
 enum EventMask {
     EM_CPU          = 1,
@@ -174,6 +182,8 @@ class Arguments {
     Action _action;
     Counter _counter;
     const char* _event;
+    const char* _counters;
+    const char* _weight;
     std::vector<const char*> _trace;
     int _timeout;
     long _interval;
@@ -201,11 +211,16 @@ class Arguments {
     bool _threads;
     bool _sched;
     bool _record_cpu;
+    bool _percpu;
+    bool _nosignal;
+    int _user_stack;
     bool _live;
     bool _nofree;
     bool _nobatch;
     bool _nostop;
     bool _alluser;
+    bool _lazy_symbols;
+    const char* _symcache;
     bool _fdtransfer;
     const char* _fdtransfer_path;
     int _target_cpu;
@@ -218,6 +233,10 @@ class Arguments {
     long _chunk_time;
     const char* _jfr_sync;
     int _jfr_options;
+    long _jfr_ring;
+    int _storage_options;
+    long _storage_limit;
+    int _storage_age;
     int _dump_traces;
     int _dump_flat;
     unsigned int _file_num;
@@ -235,6 +254,8 @@ class Arguments {
         _action(ACTION_NONE),
         _counter(COUNTER_SAMPLES),
         _event(NULL),
+        _counters(NULL),
+        _weight(NULL),
         _trace(),
         _timeout(0),
         _interval(0),
@@ -262,11 +283,16 @@ class Arguments {
         _threads(false),
         _sched(false),
         _record_cpu(false),
+        _percpu(false),
+        _nosignal(false),
+        _user_stack(0),
         _live(false),
         _nofree(false),
         _nobatch(false),
         _nostop(false),
         _alluser(false),
+        _lazy_symbols(false),
+        _symcache(NULL),
         _fdtransfer(false),
         _fdtransfer_path(NULL),
         _target_cpu(-1),
@@ -279,6 +305,10 @@ class Arguments {
         _chunk_time(3600),
         _jfr_sync(NULL),
         _jfr_options(0),
+        _jfr_ring(0),
+        _storage_options(0),
+        _storage_limit(0),
+        _storage_age(4),
         _dump_traces(0),
         _dump_flat(0),
         _file_num(0),
@@ -3,8 +3,11 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <stdlib.h>
 #include <string.h>
+#include "arguments.h"
 #include "callTraceStorage.h"
+#include "log.h"
 #include "os.h"
 
 #define COMMA ,
@@ -12,6 +15,30 @@
 static const u32 INITIAL_CAPACITY = 65536;
 static const u32 CALL_TRACE_CHUNK = 8 * 1024 * 1024;
 static const u32 OVERFLOW_TRACE_ID = 0x7fffffff;
+static const u32 SHARD_CAPACITY = 4096;
+static const u32 INITIAL_NODE_CAPACITY = 65536;
+
+// Bounded mode: a slot freed by eviction keeps EVICTED_KEY, so that probe chains stay intact.
+// call_trace_id holds a 7-bit slot tag above the 24-bit slot number. The tag changes whenever
+// the slot is evicted, so that a stale id cannot add samples to another trace.
+static const u64 EVICTED_KEY = 1;
+static const u32 SLOT_ID_MASK = 0xffffff;
+static const int SLOT_TAG_SHIFT = 24;
+static const u8 SLOT_TAG_MASK = 0x7f;
+static const u32 MAX_BOUNDED_CAPACITY = 1 << 23;
+static const int FORWARDED_TRACE = -1;
+
+
+// Live sample counters of a call trace for one epoch.
+// Samplers update the current epoch, while a dump collects the other one.
+struct EpochCounters {
+    u64 samples;
+    u64 counter;
+};
+
+// keys + values + live counters for two epochs + hits + tags + pending flags
+static const size_t SLOT_SIZE = sizeof(u64) + sizeof(CallTraceSample) + 2 * sizeof(EpochCounters) +
+                                sizeof(u32) + sizeof(u8) + sizeof(u8);
 
 
 class LongHashTable {
@@ -23,12 +50,12 @@ class LongHashTable {
     volatile u32 _size;
     u32 _padding2[15];
 
+  public:
     static size_t getSize(u32 capacity) {
-        size_t size = sizeof(LongHashTable) + (sizeof(u64) + sizeof(CallTraceSample)) * capacity;
+        size_t size = sizeof(LongHashTable) + SLOT_SIZE * capacity;
         return (size + OS::page_mask) & ~OS::page_mask;
     }
 
-  public:
     static LongHashTable* allocate(LongHashTable* prev, u32 capacity) {
         LongHashTable* table = (LongHashTable*)OS::safeAlloc(getSize(capacity));
         if (table != NULL) {
@@ -73,23 +100,203 @@ class LongHashTable {
         return (CallTraceSample*)(keys() + _capacity);
     }
 
+    // Counters of both epochs for one slot are adjacent: live()[slot * 2 + epoch]
+    EpochCounters* live() {
+        return (EpochCounters*)(values() + _capacity);
+    }
+
+    // Generation of the last hit; maintained only in bounded mode
+    u32* hits() {
+        return (u32*)(live() + _capacity * 2);
+    }
+
+    u8* tags() {
+        return (u8*)(hits() + _capacity);
+    }
+
+    // Nonzero if the call trace has got samples since the last collectTraces
+    u8* pending() {
+        return tags() + _capacity;
+    }
+
     void clear() {
-        memset(keys(), 0, (sizeof(u64) + sizeof(CallTraceSample)) * _capacity);
+        memset(keys(), 0, SLOT_SIZE * _capacity);
         _size = 0;
     }
 };
 
-CallTrace CallTraceStorage::_overflow_trace = {1, {BCI_ERROR, LP64_ONLY(0 COMMA) (jmethodID)"storage_overflow"}};
+// Open addressing set of CallTraceNodes keyed by (parent, frame).
+// When full, a new table of double capacity is chained in front of the old one, like LongHashTable.
+class NodeTable {
+  private:
+    NodeTable* _prev;
+    void* _padding0;
+    u32 _capacity;
+    u32 _padding1[15];
+    volatile u32 _size;
+    u32 _padding2[15];
+
+  public:
+    static size_t getSize(u32 capacity) {
+        size_t size = sizeof(NodeTable) + sizeof(CallTraceNode*) * capacity;
+        return (size + OS::page_mask) & ~OS::page_mask;
+    }
+
+    static NodeTable* allocate(NodeTable* prev, u32 capacity) {
+        NodeTable* table = (NodeTable*)OS::safeAlloc(getSize(capacity));
+        if (table != NULL) {
+            table->_prev = prev;
+            table->_capacity = capacity;
+            table->_size = 0;
+        }
+        return table;
+    }
+
+    NodeTable* destroy() {
+        NodeTable* prev = _prev;
+        OS::safeFree(this, getSize(_capacity));
+        return prev;
+    }
+
+    size_t usedMemory() {
+        return getSize(_capacity);
+    }
+
+    NodeTable* prev() {
+        return _prev;
+    }
+
+    u32 capacity() {
+        return _capacity;
+    }
+
+    u32 incSize() {
+        return __sync_add_and_fetch(&_size, 1);
+    }
+
+    CallTraceNode** nodes() {
+        return (CallTraceNode**)(this + 1);
+    }
+
+    void clear() {
+        memset(nodes(), 0, sizeof(CallTraceNode*) * _capacity);
+        _size = 0;
+    }
+};
+
+// Sample counters accumulated by one group of sampling threads, keyed by call_trace_id.
+// Hot stacks are counted in a shard-local slot rather than in the shared LongHashTable,
+// so that their cache line does not bounce between CPUs on every sample.
+// Pending counters are merged into the main table lazily, when samples are collected.
+// Like the main table, a shard keeps separate counters for the two epochs.
+class CounterShard {
+  private:
+    struct Counter {
+        u64 samples;
+        u64 counter;
+    };
+
+    volatile u32 _size;
+    u32 _padding[15];
+    u32 _keys[SHARD_CAPACITY];
+    Counter _values[2][SHARD_CAPACITY];
+
+  public:
+    static CounterShard* allocate() {
+        return (CounterShard*)OS::safeAlloc(sizeof(CounterShard));
+    }
+
+    void destroy() {
+        OS::safeFree(this, sizeof(CounterShard));
+    }
+
+    // Returns false if the shard is full, in which case the caller updates the shared table
+    bool add(u32 call_trace_id, u64 samples, u64 counter, u32 epoch) {
+        u32 slot = (call_trace_id * 2654435761U) & (SHARD_CAPACITY - 1);
+        u32 step = 0;
+
+        while (_keys[slot] != call_trace_id) {
+            if (_keys[slot] == 0) {
+                if (_size >= SHARD_CAPACITY * 3 / 4) {
+                    return false;
+                }
+                if (!__sync_bool_compare_and_swap(&_keys[slot], 0, call_trace_id)) {
+                    continue;
+                }
+                __sync_add_and_fetch(&_size, 1);
+                break;
+            }
+            if (++step >= SHARD_CAPACITY) {
+                return false;
+            }
+            slot = (slot + step) & (SHARD_CAPACITY - 1);
+        }
+
+        // Atomic, since drain() may run concurrently, but the cache line is not shared with other shards
+        atomicInc(_values[epoch][slot].samples, samples);
+        atomicInc(_values[epoch][slot].counter, counter);
+        return true;
+    }
+
+    // Takes away pending counters of the given epoch.
+    // Keys can be cleared only when no thread updates the shard, and the other epoch is drained.
+    template<typename Func>
+    void drain(u32 epoch, Func func, bool reset_keys) {
+        Counter* values = _values[epoch];
+        for (u32 slot = 0; slot < SHARD_CAPACITY; slot++) {
+            if (_keys[slot] != 0) {
+                u64 samples = __atomic_exchange_n(&values[slot].samples, 0, __ATOMIC_ACQ_REL);
+                u64 counter = __atomic_exchange_n(&values[slot].counter, 0, __ATOMIC_ACQ_REL);
+                if (samples != 0 || counter != 0) {
+                    func(_keys[slot], samples, counter);
+                }
+            }
+        }
+
+        if (reset_keys) {
+            memset(_keys, 0, sizeof(_keys));
+            _size = 0;
+        }
+    }
+};
+
+void CallTrace::rootFirst(std::vector<const ASGCT_CallFrame*>& list) const {
+    list.resize(num_frames);
+    int i = num_frames;
+    for (CallTraceIterator it(this); it.hasNext(); ) {
+        list[--i] = &it.next();
+    }
+}
+
+CallTrace CallTraceStorage::_overflow_trace = {1, NULL, {BCI_ERROR, LP64_ONLY(0 COMMA) (jmethodID)"storage_overflow"}};
 
 CallTraceStorage::CallTraceStorage() : _allocator(CALL_TRACE_CHUNK) {
     _current_table = LongHashTable::allocate(NULL, INITIAL_CAPACITY);
+    _node_table = NULL;
+    _shards = NULL;
+    _num_shards = 0;
+    _prefix_shared = false;
     _overflow = 0;
+    _unpublished = 0;
+    _collisions = 0;
+    _hash_mask = ~0ULL;
+    _epoch = 0;
+    _verify_frames = false;
+    _max_memory = 0;
+    _table_memory = 0;
+    _max_age = 0;
+    _generation = 0;
+    _evicted = 0;
 }
 
 CallTraceStorage::~CallTraceStorage() {
     while (_current_table != NULL) {
         _current_table = _current_table->destroy();
     }
+    while (_node_table != NULL) {
+        _node_table = _node_table->destroy();
+    }
+    destroyShards();
 }
 
 void CallTraceStorage::clear() {
@@ -97,8 +304,140 @@ void CallTraceStorage::clear() {
         _current_table = _current_table->destroy();
     }
     _current_table->clear();
+    if (_node_table != NULL) {
+        while (_node_table->prev() != NULL) {
+            _node_table = _node_table->destroy();
+        }
+        _node_table->clear();
+    }
     _allocator.clear();
     _overflow = 0;
+    _unpublished = 0;
+    _collisions = 0;
+    _evicted = 0;
+    _table_memory = tableMemory();
+
+    for (int i = 0; i < _num_shards; i++) {
+        _shards[i]->drain(0, [](u32 call_trace_id, u64 samples, u64 counter) {}, false);
+        _shards[i]->drain(1, [](u32 call_trace_id, u64 samples, u64 counter) {}, true);
+    }
+}
+
+// Must be called when no samples are being recorded
+void CallTraceStorage::setOptions(int options, int num_shards) {
+    mergeShards(_epoch ^ 1, true);
+    destroyShards();
+
+    _verify_frames = (options & STORAGE_VERIFY) != 0;
+    _prefix_shared = (options & STORAGE_PREFIX) != 0;
+    if (_prefix_shared && _node_table == NULL) {
+        _node_table = NodeTable::allocate(NULL, INITIAL_NODE_CAPACITY);
+        _prefix_shared = _node_table != NULL;
+    }
+
+    if ((options & STORAGE_SHARDED) && num_shards > 0) {
+        CounterShard** shards = (CounterShard**)calloc(num_shards, sizeof(CounterShard*));
+        for (int i = 0; i < num_shards; i++) {
+            if (shards == NULL || (shards[i] = CounterShard::allocate()) == NULL) {
+                Log::warn("Not enough memory for sharded call trace storage");
+                _shards = shards;
+                _num_shards = i;
+                destroyShards();
+                return;
+            }
+        }
+        _shards = shards;
+        _num_shards = num_shards;
+    }
+}
+
+// Must be called when no samples are being recorded
+void CallTraceStorage::setMemoryLimit(size_t max_memory, int max_age) {
+    // Half of the budget goes to hash tables, the other half to call traces themselves.
+    // Tables replaced by bigger ones stay allocated until clear(), and count towards the limit.
+    if (max_memory != 0 && max_memory < MIN_STORAGE_LIMIT) {
+        max_memory = MIN_STORAGE_LIMIT;
+    }
+    _max_memory = max_memory;
+    _max_age = max_memory == 0 ? 0 : max_age > 0 ? max_age : 1;
+    _table_memory = tableMemory();
+    _allocator.setLimit(max_memory - max_memory / 2);
+}
+
+void CallTraceStorage::destroyShards() {
+    for (int i = 0; i < _num_shards; i++) {
+        _shards[i]->destroy();
+    }
+    free(_shards);
+    _shards = NULL;
+    _num_shards = 0;
+}
+
+// Moves counters of the given epoch pending in shards to the shared table.
+// reset = true is allowed only when no samples are being recorded:
+// then counters of both epochs are moved, and shards are emptied.
+void CallTraceStorage::mergeShards(u32 epoch, bool reset) {
+    for (int i = 0; i < _num_shards; i++) {
+        _shards[i]->drain(epoch, [this, epoch](u32 call_trace_id, u64 samples, u64 counter) {
+            addShared(call_trace_id, samples, counter, epoch);
+        }, false);
+        if (reset) {
+            _shards[i]->drain(epoch ^ 1, [this, epoch](u32 call_trace_id, u64 samples, u64 counter) {
+                addShared(call_trace_id, samples, counter, epoch ^ 1);
+            }, true);
+        }
+    }
+}
+
+// Moves counters of both epochs to the shared table and frees shard capacity taken by
+// call traces that are no longer sampled
+void CallTraceStorage::resetShard(int shard) {
+    if (shard >= _num_shards) {
+        return;
+    }
+    _shards[shard]->drain(0, [this](u32 call_trace_id, u64 samples, u64 counter) {
+        addShared(call_trace_id, samples, counter, 0);
+    }, false);
+    _shards[shard]->drain(1, [this](u32 call_trace_id, u64 samples, u64 counter) {
+        addShared(call_trace_id, samples, counter, 1);
+    }, true);
+}
+
+void CallTraceStorage::swapEpoch() {
+    __atomic_store_n(&_epoch, _epoch ^ 1, __ATOMIC_RELEASE);
+}
+
+// Adds live counters of a frozen epoch to the totals reported by collectSamples
+void CallTraceStorage::foldEpoch(u32 epoch, bool reset_shards) {
+    mergeShards(epoch, reset_shards);
+
+    for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
+        u64* keys = table->keys();
+        CallTraceSample* values = table->values();
+        EpochCounters* live = table->live();
+        u32* hits = table->hits();
+        u8* pending = table->pending();
+        u32 capacity = table->capacity();
+
+        for (u32 slot = 0; slot < capacity; slot++) {
+            EpochCounters& c = live[slot * 2 + epoch];
+            if (keys[slot] == 0 || (c.samples == 0 && c.counter == 0)) {
+                continue;
+            }
+            // Late updates from samplers that started before the swap are not lost:
+            // they will be collected together with the next epoch
+            u64 samples = __atomic_exchange_n(&c.samples, 0, __ATOMIC_ACQ_REL);
+            u64 counter = __atomic_exchange_n(&c.counter, 0, __ATOMIC_ACQ_REL);
+            values[slot].samples += samples;
+            values[slot].counter += counter;
+            if (samples != 0) {
+                pending[slot] = 1;
+                if (_max_memory != 0) {
+                    hits[slot] = _generation;
+                }
+            }
+        }
+    }
 }
 
 u32 CallTraceStorage::capacity() {
@@ -108,44 +447,82 @@ u32 CallTraceStorage::capacity() {
 }
 
 size_t CallTraceStorage::usedMemory() {
-    size_t bytes = _allocator.usedMemory();
+    return _allocator.usedMemory() + shardMemory() + tableMemory();
+}
+
+size_t CallTraceStorage::shardMemory() {
+    return _num_shards * sizeof(CounterShard);
+}
+
+size_t CallTraceStorage::tableMemory() {
+    size_t bytes = 0;
     for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
         bytes += table->usedMemory();
     }
+    for (NodeTable* table = _node_table; table != NULL; table = table->prev()) {
+        bytes += table->usedMemory();
+    }
     return bytes;
 }
 
+// Accounts a new hash table against the memory limit. Signal safe.
+bool CallTraceStorage::reserveTableMemory(size_t bytes) {
+    if (_max_memory == 0) {
+        return true;
+    }
+
+    size_t used;
+    do {
+        used = _table_memory;
+        if (used + bytes > _max_memory / 2) {
+            return false;
+        }
+    } while (!__sync_bool_compare_and_swap(&_table_memory, used, used + bytes));
+    return true;
+}
+
+u32 CallTraceStorage::slotId(u32 call_trace_id) {
+    return _max_memory == 0 ? call_trace_id : call_trace_id & SLOT_ID_MASK;
+}
+
+// Reports call traces that have got samples in the frozen epoch. The epoch must have been swapped
+// while samplers were paused: then every event recorded before the swap refers to a reported trace.
 void CallTraceStorage::collectTraces(std::map<u32, CallTrace*>& map) {
+    foldEpoch(_epoch ^ 1, false);
+
     for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
-        u64* keys = table->keys();
         CallTraceSample* values = table->values();
         u32 capacity = table->capacity();
+        u8* tags = table->tags();
+        u8* pending = table->pending();
 
         for (u32 slot = 0; slot < capacity; slot++) {
-            if (keys[slot] != 0 && loadAcquire(values[slot].samples) != 0) {
-                // Reset samples to avoid duplication of call traces between JFR chunks
-                values[slot].samples = 0;
+            if (pending[slot] != 0) {
+                // Reset the flag to avoid duplication of call traces between JFR chunks
+                pending[slot] = 0;
                 CallTrace* trace = values[slot].acquireTrace();
                 if (trace != NULL) {
-                    map[capacity - (INITIAL_CAPACITY - 1) + slot] = trace;
+                    map[(capacity - (INITIAL_CAPACITY - 1) + slot) | (u32)tags[slot] << SLOT_TAG_SHIFT] = trace;
                 }
             }
         }
     }
 
-    if (_overflow > 0) {
+    if (_overflow > 0 || _unpublished > 0) {
         map[OVERFLOW_TRACE_ID] = &_overflow_trace;
     }
 }
 
 void CallTraceStorage::collectSamples(std::vector<CallTraceSample*>& samples) {
+    foldEpoch(_epoch ^ 1, false);
+
     for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
         u64* keys = table->keys();
         CallTraceSample* values = table->values();
         u32 capacity = table->capacity();
 
         for (u32 slot = 0; slot < capacity; slot++) {
-            if (keys[slot] != 0) {
+            if (keys[slot] != 0 && keys[slot] != EVICTED_KEY) {
                 samples.push_back(&values[slot]);
             }
         }
@@ -153,6 +530,8 @@ void CallTraceStorage::collectSamples(std::vector<CallTraceSample*>& samples) {
 }
 
 void CallTraceStorage::collectSamples(std::map<u64, CallTraceSample>& map) {
+    foldEpoch(_epoch ^ 1, false);
+
     for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
         u64* keys = table->keys();
         CallTraceSample* values = table->values();
@@ -195,14 +574,118 @@ u64 CallTraceStorage::calcHash(int num_frames, ASGCT_CallFrame* frames) {
     h *= M;
     h ^= h >> R;
 
-    return h;
+    return (h & _hash_mask) | ~_hash_mask;
+}
+
+static inline bool sameFrame(const ASGCT_CallFrame& a, const ASGCT_CallFrame& b) {
+    return a.method_id == b.method_id && a.bci == b.bci;
+}
+
+static inline u64 nodeHash(CallTraceNode* parent, const ASGCT_CallFrame& frame) {
+    u64 h = (u64)(uintptr_t)parent * 0xc6a4a7935bd1e995ULL;
+    h ^= (u64)(uintptr_t)frame.method_id + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= (u64)(u32)frame.bci * 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 29);
+}
+
+CallTraceNode* CallTraceStorage::findNode(NodeTable* table, u64 hash, CallTraceNode* parent, const ASGCT_CallFrame& frame) {
+    for (; table != NULL; table = table->prev()) {
+        CallTraceNode** nodes = table->nodes();
+        u32 capacity = table->capacity();
+        u32 slot = hash & (capacity - 1);
+        u32 step = 0;
+
+        CallTraceNode* node;
+        while ((node = __atomic_load_n(&nodes[slot], __ATOMIC_ACQUIRE)) != NULL) {
+            if (node->parent == parent && sameFrame(node->frame, frame)) {
+                return node;
+            }
+            if (++step >= capacity) break;
+            slot = (slot + step) & (capacity - 1);
+        }
+    }
+    return NULL;
+}
+
+// Returns a node for (parent, frame), creating it if needed. Signal safe.
+CallTraceNode* CallTraceStorage::addNode(CallTraceNode* parent, const ASGCT_CallFrame& frame) {
+    u64 hash = nodeHash(parent, frame);
+
+    NodeTable* table = _node_table;
+    CallTraceNode** nodes = table->nodes();
+    u32 capacity = table->capacity();
+    u32 slot = hash & (capacity - 1);
+    u32 step = 0;
+    CallTraceNode* new_node = NULL;
+
+    while (true) {
+        CallTraceNode* node = __atomic_load_n(&nodes[slot], __ATOMIC_ACQUIRE);
+        if (node == NULL) {
+            if (new_node == NULL) {
+                // Nodes are not migrated when the table grows, so look into older tables first
+                if ((node = findNode(table->prev(), hash, parent, frame)) != NULL) {
+                    return node;
+                }
+                if ((new_node = (CallTraceNode*)_allocator.alloc(sizeof(CallTraceNode))) == NULL) {
+                    return NULL;
+                }
+                new_node->parent = parent;
+                new_node->frame = frame;
+            }
+
+            if (!__sync_bool_compare_and_swap(&nodes[slot], NULL, new_node)) {
+                continue;
+            }
+
+            if (table->incSize() == capacity * 3 / 4 && reserveTableMemory(NodeTable::getSize(capacity * 2))) {
+                NodeTable* next_table = NodeTable::allocate(table, capacity * 2);
+                if (next_table != NULL) {
+                    __sync_bool_compare_and_swap(&_node_table, table, next_table);
+                }
+            }
+            return new_node;
+        }
+
+        if (node->parent == parent && sameFrame(node->frame, frame)) {
+            return node;
+        }
+
+        if (++step >= capacity) {
+            // The table is full and could not grow: the node remains unshared
+            if (new_node == NULL && (new_node = (CallTraceNode*)_allocator.alloc(sizeof(CallTraceNode))) != NULL) {
+                new_node->parent = parent;
+                new_node->frame = frame;
+            }
+            return new_node;
+        }
+        slot = (slot + step) & (capacity - 1);
+    }
 }
 
 CallTrace* CallTraceStorage::storeCallTrace(int num_frames, ASGCT_CallFrame* frames) {
     const size_t header_size = sizeof(CallTrace) - sizeof(ASGCT_CallFrame);
+
+    if (_prefix_shared && num_frames > 0) {
+        // Build the chain starting from the bottom frame, so that common roots are shared
+        CallTraceNode* node = NULL;
+        for (int i = num_frames - 1; i >= 0; i--) {
+            if ((node = addNode(node, frames[i])) == NULL) {
+                return NULL;
+            }
+        }
+
+        CallTrace* buf = (CallTrace*)_allocator.alloc(header_size);
+        if (buf != NULL) {
+            buf->num_frames = num_frames;
+            buf->top = node;
+        }
+        return buf;
+    }
+
     CallTrace* buf = (CallTrace*)_allocator.alloc(header_size + num_frames * sizeof(ASGCT_CallFrame));
     if (buf != NULL) {
         buf->num_frames = num_frames;
+        buf->top = NULL;
         // Do not use memcpy inside signal handler
         for (int i = 0; i < num_frames; i++) {
             buf->frames[i] = frames[i];
@@ -211,13 +694,56 @@ CallTrace* CallTraceStorage::storeCallTrace(int num_frames, ASGCT_CallFrame* fra
     return buf;
 }
 
-CallTrace* CallTraceStorage::findCallTrace(LongHashTable* table, u64 hash) {
+// Compares frames 16 bytes at a time: one frame on 64-bit platforms, which maps onto
+// a single SSE2/NEON register. Differences are OR-accumulated to avoid a branch per word.
+// Plain loads only, so that it is safe to call from a signal handler (unlike memcmp).
+static bool sameFrames(const ASGCT_CallFrame* a, const ASGCT_CallFrame* b, int num_frames) {
+    const u64* x = (const u64*)a;
+    const u64* y = (const u64*)b;
+    size_t words = num_frames * sizeof(ASGCT_CallFrame) / sizeof(u64);
+
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        u64 diff = (x[i] ^ y[i]) | (x[i + 1] ^ y[i + 1]) | (x[i + 2] ^ y[i + 2]) | (x[i + 3] ^ y[i + 3]);
+        if (diff != 0) {
+            return false;
+        }
+    }
+
+    u64 diff = 0;
+    for (; i < words; i++) {
+        diff |= x[i] ^ y[i];
+    }
+    return diff == 0;
+}
+
+// True if the stored trace has exactly the given frames.
+// A slot without a trace (still being published, or not stored at all) matches nothing.
+static bool sameTrace(const CallTrace* trace, int num_frames, const ASGCT_CallFrame* frames) {
+    if (trace == NULL) {
+        return false;
+    } else if (trace->num_frames != num_frames) {
+        return false;
+    } else if (trace->top == NULL) {
+        return sameFrames(trace->frames, frames, num_frames);
+    }
+
+    const ASGCT_CallFrame* frame = frames;
+    for (CallTraceIterator it(trace); it.hasNext(); frame++) {
+        if (!sameFrames(&it.next(), frame, 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CallTrace* CallTraceStorage::findCallTrace(LongHashTable* table, u64 hash, int num_frames, ASGCT_CallFrame* frames) {
     u64* keys = table->keys();
     u32 capacity = table->capacity();
     u32 slot = hash & (capacity - 1);
     u32 step = 0;
 
-    while (keys[slot] != hash) {
+    while (keys[slot] != hash || (_verify_frames && !sameTrace(table->values()[slot].trace, num_frames, frames))) {
         if (keys[slot] == 0) {
             return NULL;
         }
@@ -230,7 +756,37 @@ CallTrace* CallTraceStorage::findCallTrace(LongHashTable* table, u64 hash) {
     return table->values()[slot].trace;
 }
 
-u32 CallTraceStorage::put(int num_frames, ASGCT_CallFrame* frames, u64 counter) {
+// Takes a free or evicted slot of the current table for a new call trace
+bool CallTraceStorage::claimSlot(LongHashTable* table, u32 slot, u64 expected_key, u64 hash,
+                                 int num_frames, ASGCT_CallFrame* frames) {
+    if (!__sync_bool_compare_and_swap(&table->keys()[slot], expected_key, hash)) {
+        return false;
+    }
+
+    // Increment the table size, and if the load factor exceeds 0.75, reserve a new table.
+    // Evicted slots are already counted.
+    u32 capacity = table->capacity();
+    if (expected_key == 0 && table->incSize() == capacity * 3 / 4 &&
+        (_max_memory == 0 || capacity < MAX_BOUNDED_CAPACITY) &&
+        reserveTableMemory(LongHashTable::getSize(capacity * 2))) {
+        LongHashTable* new_table = LongHashTable::allocate(table, capacity * 2);
+        if (new_table != NULL) {
+            __sync_bool_compare_and_swap(&_current_table, table, new_table);
+        }
+    }
+
+    // Migrate from a previous table to save space
+    CallTrace* trace = table->prev() == NULL ? NULL : findCallTrace(table->prev(), hash, num_frames, frames);
+    if (trace == NULL || trace == &_overflow_trace) {
+        trace = storeCallTrace(num_frames, frames);
+    }
+    // Unlike NULL, which lasts only until the trace is published, the placeholder
+    // tells other samplers that this slot will not get a trace
+    table->values()[slot].setTrace(trace != NULL ? trace : &_overflow_trace);
+    return true;
+}
+
+u32 CallTraceStorage::put(int num_frames, ASGCT_CallFrame* frames, u64 counter, int shard) {
     u64 hash = calcHash(num_frames, frames);
 
     LongHashTable* table = _current_table;
@@ -238,31 +794,59 @@ u32 CallTraceStorage::put(int num_frames, ASGCT_CallFrame* frames, u64 counter)
     u32 capacity = table->capacity();
     u32 slot = hash & (capacity - 1);
     u32 step = 0;
+    u32 evicted_slot = capacity;  // the first slot freed by eviction on the probe path
+    bool claimed = false;
+    bool collided = false;
 
-    while (keys[slot] != hash) {
-        if (keys[slot] == 0) {
-            if (!__sync_bool_compare_and_swap(&keys[slot], 0, hash)) {
-                continue;
+    while (true) {
+        u64 key = keys[slot];
+        if (key == hash) {
+            if (!_verify_frames) {
+                break;
             }
-
-            // Increment the table size, and if the load factor exceeds 0.75, reserve a new table
-            if (table->incSize() == capacity * 3 / 4) {
-                LongHashTable* new_table = LongHashTable::allocate(table, capacity * 2);
-                if (new_table != NULL) {
-                    __sync_bool_compare_and_swap(&_current_table, table, new_table);
-                }
-            }
-
-            // Migrate from a previous table to save space
-            CallTrace* trace = table->prev() == NULL ? NULL : findCallTrace(table->prev(), hash);
+            CallTrace* trace = table->values()[slot].acquireTrace();
             if (trace == NULL) {
-                trace = storeCallTrace(num_frames, frames);
+                // Claimed, but the trace is not published yet. Cannot tell if this is the same trace:
+                // neither merge with it nor take another slot
+                atomicInc(_unpublished);
+                return OVERFLOW_TRACE_ID;
+            } else if (trace == &_overflow_trace) {
+                // The trace could not be stored: its samples are overflow, as for the claimer
+                atomicInc(_overflow);
+                return OVERFLOW_TRACE_ID;
+            } else if (sameTrace(trace, num_frames, frames)) {
+                break;
             }
-            table->values()[slot].setTrace(trace);
+            // Different trace with the same hash: keep probing, it will get its own slot
+            collided = true;
+        } else if (key == EVICTED_KEY) {
+            if (evicted_slot == capacity) {
+                evicted_slot = slot;
+            }
+        } else if (key == 0) {
+            if (evicted_slot == capacity) {
+                if (!claimSlot(table, slot, 0, hash, num_frames, frames)) {
+                    continue;
+                }
+            } else if (claimSlot(table, evicted_slot, EVICTED_KEY, hash, num_frames, frames)) {
+                slot = evicted_slot;
+            } else {
+                // Someone else has reused the slot: the trace might be there now, start over
+                slot = hash & (capacity - 1);
+                step = 0;
+                evicted_slot = capacity;
+                continue;
+            }
+            claimed = true;
             break;
         }
 
         if (++step >= capacity) {
+            if (evicted_slot != capacity && claimSlot(table, evicted_slot, EVICTED_KEY, hash, num_frames, frames)) {
+                slot = evicted_slot;
+                claimed = true;
+                break;
+            }
             // Very unlikely case of a table overflow
             atomicInc(_overflow);
             return OVERFLOW_TRACE_ID;
@@ -271,43 +855,176 @@ u32 CallTraceStorage::put(int num_frames, ASGCT_CallFrame* frames, u64 counter)
         slot = (slot + step) & (capacity - 1);
     }
 
-    if (counter != 0) {
-        CallTraceSample& s = table->values()[slot];
-        atomicInc(s.samples);
-        atomicInc(s.counter, counter);
+    if (claimed && collided) {
+        // Counted once per stored trace rather than on every lookup
+        atomicInc(_collisions);
     }
 
-    return capacity - (INITIAL_CAPACITY - 1) + slot;
+    u32 call_trace_id = capacity - (INITIAL_CAPACITY - 1) + slot;
+
+    if (table->values()[slot].trace == &_overflow_trace) {
+        // Out of memory. In bounded mode, the slot will be reclaimed by the next eviction
+        atomicInc(_overflow);
+        return OVERFLOW_TRACE_ID;
+    }
+
+    if (_max_memory != 0) {
+        u32* hits = table->hits();
+        if (hits[slot] != _generation) {
+            hits[slot] = _generation;
+        }
+        call_trace_id |= (u32)table->tags()[slot] << SLOT_TAG_SHIFT;
+    }
+
+    u32 epoch = _epoch;
+    if (counter != 0 && (shard < 0 || shard >= _num_shards || !_shards[shard]->add(call_trace_id, 1, counter, epoch))) {
+        EpochCounters& c = table->live()[slot * 2 + epoch];
+        atomicInc(c.samples);
+        atomicInc(c.counter, counter);
+    }
+
+    return call_trace_id;
 }
 
-void CallTraceStorage::add(u32 call_trace_id, u64 samples, u64 counter) {
-    if (call_trace_id > capacity()) {  // this also covers call_trace_id == OVERFLOW_TRACE_ID
+void CallTraceStorage::add(u32 call_trace_id, u64 samples, u64 counter, int shard) {
+    u32 epoch = _epoch;
+    if (shard >= 0 && shard < _num_shards && slotId(call_trace_id) <= capacity() &&
+        _shards[shard]->add(call_trace_id, samples, counter, epoch)) {
         return;
     }
+    addShared(call_trace_id, samples, counter, epoch);
+}
 
-    call_trace_id += (INITIAL_CAPACITY - 1);
+void CallTraceStorage::addShared(u32 call_trace_id, u64 samples, u64 counter, u32 epoch) {
+    u32 id = slotId(call_trace_id);
+    if (id > capacity()) {  // this also covers call_trace_id == OVERFLOW_TRACE_ID
+        return;
+    }
+
+    id += (INITIAL_CAPACITY - 1);
     for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
-        if (call_trace_id >= table->capacity()) {
-            CallTraceSample& s = table->values()[call_trace_id - table->capacity()];
-            atomicInc(s.samples, samples);
-            atomicInc(s.counter, counter);
+        if (id >= table->capacity()) {
+            u32 slot = id - table->capacity();
+            if (_max_memory != 0 && table->tags()[slot] != call_trace_id >> SLOT_TAG_SHIFT) {
+                // The trace has been evicted since the id was obtained
+                return;
+            }
+            EpochCounters& c = table->live()[slot * 2 + epoch];
+            atomicInc(c.samples, samples);
+            atomicInc(c.counter, counter);
             break;
         }
     }
 }
 
-void CallTraceStorage::resetCounters() {
-     for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
+void CallTraceStorage::evict() {
+    if (_max_memory == 0) {
+        return;
+    }
+
+    // Pending counters mark their traces as hit
+    swapEpoch();
+    foldEpoch(_epoch ^ 1, true);
+
+    u64 evicted = 0;
+    for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
         u64* keys = table->keys();
+        CallTraceSample* values = table->values();
+        u32* hits = table->hits();
+        u8* tags = table->tags();
+        u32 capacity = table->capacity();
+
+        for (u32 slot = 0; slot < capacity; slot++) {
+            if (keys[slot] == 0 || keys[slot] == EVICTED_KEY) {
+                continue;
+            }
+            // A trace that could not be stored is always reclaimed, so that it has another chance
+            CallTrace* trace = values[slot].trace;
+            if (trace != NULL && trace != &_overflow_trace && _generation - hits[slot] < _max_age) {
+                continue;
+            }
+            keys[slot] = EVICTED_KEY;
+            values[slot].trace = NULL;
+            values[slot].samples = 0;
+            values[slot].counter = 0;
+            memset(&table->live()[slot * 2], 0, 2 * sizeof(EpochCounters));
+            table->pending()[slot] = 0;
+            tags[slot] = (tags[slot] + 1) & SLOT_TAG_MASK;
+            evicted++;
+        }
+    }
+
+    _generation++;
+    _evicted += evicted;
+
+    size_t arena_limit = _max_memory - _max_memory / 2;
+    if (evicted > 0 && _allocator.usedMemory() > arena_limit / 2) {
+        compact();
+    }
+    _table_memory = tableMemory();
+}
+
+// Moves surviving call traces to a new arena and releases the old one with all evicted traces.
+// Prefix-shared traces get a new node table, so that unreferenced nodes are dropped as well.
+void CallTraceStorage::compact() {
+    LinearAllocator old_allocator(CALL_TRACE_CHUNK);
+    old_allocator.swap(_allocator);
+
+    NodeTable* old_node_table = _node_table;
+    if (old_node_table != NULL) {
+        _node_table = NodeTable::allocate(NULL, INITIAL_NODE_CAPACITY);
+        _prefix_shared = _node_table != NULL;
+        _table_memory = tableMemory();
+    }
+
+    std::vector<ASGCT_CallFrame> frames;
+    for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
         CallTraceSample* values = table->values();
         u32 capacity = table->capacity();
 
         for (u32 slot = 0; slot < capacity; slot++) {
-            if (keys[slot] != 0) {
-                CallTraceSample& s = values[slot];
-                storeRelease(s.samples, 0);
-                storeRelease(s.counter, 0);
+            CallTrace* trace = values[slot].trace;
+            if (trace == NULL || trace == &_overflow_trace) {
+                continue;
+            } else if (trace->num_frames == FORWARDED_TRACE) {
+                // Already moved on behalf of another table
+                values[slot].trace = (CallTrace*)trace->top;
+                continue;
+            }
+
+            frames.resize(trace->num_frames);
+            int i = 0;
+            for (CallTraceIterator it(trace); it.hasNext(); ) {
+                frames[i++] = it.next();
             }
+
+            CallTrace* copy = storeCallTrace(trace->num_frames, frames.data());
+            trace->num_frames = FORWARDED_TRACE;
+            trace->top = (CallTraceNode*)copy;
+            values[slot].trace = copy;
+        }
+    }
+
+    while (old_node_table != NULL) {
+        old_node_table = old_node_table->destroy();
+    }
+    _allocator.setLimit(_max_memory - _max_memory / 2);
+}
+
+// Forgets counters collected so far, including the frozen epoch. The caller must swap the epoch
+// and wait for samplers to leave it, like before collectSamples; samples of the current epoch are kept.
+// Only the dumping thread updates totals, so this does not race with samplers,
+// and JFR still sees which call traces have got samples.
+void CallTraceStorage::resetCounters() {
+    foldEpoch(_epoch ^ 1, false);
+
+    for (LongHashTable* table = _current_table; table != NULL; table = table->prev()) {
+        CallTraceSample* values = table->values();
+        u32 capacity = table->capacity();
+
+        for (u32 slot = 0; slot < capacity; slot++) {
+            values[slot].samples = 0;
+            values[slot].counter = 0;
         }
     }
 }
@@ -13,11 +13,55 @@
 #include "vmEntry.h"
 
 
+// Smallest memory limit of a bounded storage. The storage always holds one 8 MB chunk of call traces
+// and the initial hash tables, which take the call trace half and less than the table half of the limit
+const size_t MIN_STORAGE_LIMIT = 16 * 1024 * 1024;
+
 class LongHashTable;
+class CounterShard;
+class NodeTable;
+
+// A frame of a prefix-shared call trace. Traces with the same bottom part
+// of the stack refer to the same chain of parent nodes.
+struct CallTraceNode {
+    CallTraceNode* parent;
+    ASGCT_CallFrame frame;
+};
 
 struct CallTrace {
     int num_frames;
+    CallTraceNode* top;  // NULL if frames are stored inline
     ASGCT_CallFrame frames[1];
+
+    // Fills the list of frames from the bottom (root) to the top of the stack
+    // without copying frame contents
+    void rootFirst(std::vector<const ASGCT_CallFrame*>& list) const;
+};
+
+// Iterates over frames from the top of the stack, whichever way the trace is stored
+class CallTraceIterator {
+  private:
+    const CallTrace* _trace;
+    const CallTraceNode* _node;
+    int _index;
+
+  public:
+    CallTraceIterator(const CallTrace* trace) : _trace(trace), _node(trace->top), _index(0) {
+    }
+
+    bool hasNext() const {
+        return _index < _trace->num_frames;
+    }
+
+    const ASGCT_CallFrame& next() {
+        if (_node == NULL) {
+            return _trace->frames[_index++];
+        }
+        const ASGCT_CallFrame& frame = _node->frame;
+        _node = _node->parent;
+        _index++;
+        return frame;
+    }
 };
 
 struct CallTraceSample {
@@ -43,31 +87,88 @@ struct CallTraceSample {
 
 class CallTraceStorage {
   private:
+    // Also stands in for a trace that could not be stored in its slot
     static CallTrace _overflow_trace;
 
     LinearAllocator _allocator;
     LongHashTable* _current_table;
+    NodeTable* _node_table;
+    CounterShard** _shards;
+    int _num_shards;
+    bool _prefix_shared;
+    bool _verify_frames;
     u64 _overflow;
+    u64 _unpublished;
+    u64 _collisions;
+    u64 _hash_mask;
+    volatile u32 _epoch;
+
+    // Bounded mode: memory limit (0 = unlimited) and the number of generations
+    // a call trace may stay without hits before it is evicted
+    size_t _max_memory;
+    volatile size_t _table_memory;
+    u32 _max_age;
+    u32 _generation;
+    u64 _evicted;
 
     u64 calcHash(int num_frames, ASGCT_CallFrame* frames);
     CallTrace* storeCallTrace(int num_frames, ASGCT_CallFrame* frames);
-    CallTrace* findCallTrace(LongHashTable* table, u64 hash);
+    CallTraceNode* findNode(NodeTable* table, u64 hash, CallTraceNode* parent, const ASGCT_CallFrame& frame);
+    CallTraceNode* addNode(CallTraceNode* parent, const ASGCT_CallFrame& frame);
+    CallTrace* findCallTrace(LongHashTable* table, u64 hash, int num_frames, ASGCT_CallFrame* frames);
+    bool claimSlot(LongHashTable* table, u32 slot, u64 expected_key, u64 hash, int num_frames, ASGCT_CallFrame* frames);
+    bool reserveTableMemory(size_t bytes);
+    size_t tableMemory();
+    u32 slotId(u32 call_trace_id);
+    void compact();
+    void addShared(u32 call_trace_id, u64 samples, u64 counter, u32 epoch);
+    void mergeShards(u32 epoch, bool reset);
+    void foldEpoch(u32 epoch, bool reset_shards);
+    void destroyShards();
 
   public:
     CallTraceStorage();
     ~CallTraceStorage();
 
     void clear();
+    void setOptions(int options, int num_shards);
+    void setMemoryLimit(size_t max_memory, int max_age);
     u32 capacity();
     size_t usedMemory();
+    size_t shardMemory();
     u64 overflow() { return _overflow; }
+    // Samples that found their slot claimed by another sampler still storing the trace
+    u64 unpublished() { return _unpublished; }
+    u64 collisions() { return _collisions; }
+    u64 evicted() { return _evicted; }
+
+    // Drops hash bits to provoke collisions in tests; masked-out bits are set,
+    // so that a hash never turns into an empty or evicted key
+    void setHashMask(u64 mask) { _hash_mask = mask; }
+
+    // In bounded mode, the storage must not be updated without a Profiler lock,
+    // since evict() may run concurrently
+    bool bounded() { return _max_memory != 0; }
+
+    // Completes a generation: forgets call traces not hit for max_age generations
+    // and reclaims their memory. Must be called with all Profiler locks held.
+    void evict();
+
+    // Directs new samples to the other set of counters, freezing the current epoch.
+    // A dump should swap the epoch and wait until samplers leave the frozen epoch
+    // before calling collectSamples, which then sees a consistent snapshot.
+    void swapEpoch();
+
+    // Must be called with the Profiler lock of the same index held
+    void resetShard(int shard);
 
     void collectTraces(std::map<u32, CallTrace*>& map);
     void collectSamples(std::vector<CallTraceSample*>& samples);
     void collectSamples(std::map<u64, CallTraceSample>& map);
 
-    u32 put(int num_frames, ASGCT_CallFrame* frames, u64 counter);
-    void add(u32 call_trace_id, u64 samples, u64 counter);
+    // If shard >= 0, the caller must hold the Profiler lock with the same index
+    u32 put(int num_frames, ASGCT_CallFrame* frames, u64 counter, int shard = -1);
+    void add(u32 call_trace_id, u64 samples, u64 counter, int shard = -1);
     void resetCounters();
 };
 
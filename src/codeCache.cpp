@@ -11,6 +11,69 @@
 #include "dwarf.h"
 #include "log.h"
 #include "os.h"
+#include "symbols.h"
+
+
+const size_t MIN_NAME_CHUNK = 4096;
+const size_t MAX_NAME_CHUNK = 256 * 1024;
+
+// Rough per-allocation overhead of malloc, used to estimate savings of NameArena
+const size_t MALLOC_OVERHEAD = 2 * sizeof(void*);
+
+// How many preceding symbols are checked for one that encloses a nested symbol
+const int MAX_ENCLOSING_LOOKBACK = 16;
+
+
+NameArena::~NameArena() {
+    while (_chunk != NULL) {
+        char* prev = *(char**)_chunk;
+        free(_chunk);
+        _chunk = prev;
+    }
+}
+
+char* NameArena::alloc(size_t size) {
+    // NativeFunc starts with a short
+    size = (size + 1) & ~(size_t)1;
+
+    if (_chunk == NULL || _offset + size > _chunk_size) {
+        size_t chunk_size = _chunk_size == 0 ? MIN_NAME_CHUNK : _chunk_size < MAX_NAME_CHUNK ? _chunk_size * 2 : MAX_NAME_CHUNK;
+        if (chunk_size < sizeof(char*) + size) {
+            chunk_size = sizeof(char*) + size;
+        }
+
+        char* chunk = (char*)malloc(chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        *(char**)chunk = _chunk;
+        _chunk = chunk;
+        _offset = sizeof(char*);
+        _chunk_size = chunk_size;
+        _allocated += chunk_size;
+    }
+
+    char* result = _chunk + _offset;
+    _offset += size;
+    return result;
+}
+
+void NameArena::swap(NameArena& other) {
+    char* chunk = _chunk;
+    size_t offset = _offset;
+    size_t chunk_size = _chunk_size;
+    size_t allocated = _allocated;
+
+    _chunk = other._chunk;
+    _offset = other._offset;
+    _chunk_size = other._chunk_size;
+    _allocated = other._allocated;
+
+    other._chunk = chunk;
+    other._offset = offset;
+    other._chunk_size = chunk_size;
+    other._allocated = allocated;
+}
 
 
 char* NativeFunc::create(const char* name, short lib_index) {
@@ -20,6 +83,16 @@ char* NativeFunc::create(const char* name, short lib_index) {
     return strcpy(f->_name, name);
 }
 
+char* NativeFunc::create(const char* name, short lib_index, NameArena* arena) {
+    NativeFunc* f = (NativeFunc*)arena->alloc(sizeof(NativeFunc) + 1 + strlen(name));
+    if (f == NULL) {
+        return NULL;
+    }
+    f->_lib_index = lib_index;
+    f->_mark = 0;
+    return strcpy(f->_name, name);
+}
+
 void NativeFunc::destroy(char* name) {
     free(from(name));
 }
@@ -47,21 +120,41 @@ CodeCache::CodeCache(const char* name, short lib_index,
     _imports_patchable = false;
     _debug_symbols = false;
 
-    _dwarf_table = NULL;
-    _dwarf_table_length = 0;
+    _frame_table = NULL;
 
     _capacity = INITIAL_CODE_CACHE_CAPACITY;
     _count = 0;
     _blobs = new CodeBlob[_capacity];
+
+    _index_base = NULL;
+    _index_starts = NULL;
+    _index_lengths = NULL;
+    _index_names = NULL;
+    _saved_memory = 0;
+    _extra = NULL;
+    _mapping = NULL;
+    _mapping_size = 0;
+
+    _symbols_state = LAZY_NONE;
+    _dwarf_state = LAZY_NONE;
 }
 
 CodeCache::~CodeCache() {
-    for (int i = 0; i < _count; i++) {
-        NativeFunc::destroy(_blobs[i]._name);
-    }
     NativeFunc::destroy(_name);
     delete[] _blobs;
-    free(_dwarf_table);
+    if (_mapping != NULL) {
+        munmap(_mapping, _mapping_size);
+    } else {
+        free(_index_starts);
+        free(_index_lengths);
+    }
+    free(_index_names);
+    while (_extra != NULL) {
+        ExtraCodeBlob* next = _extra->next;
+        delete _extra;
+        _extra = next;
+    }
+    delete _frame_table;
 }
 
 void CodeCache::expand() {
@@ -76,21 +169,35 @@ void CodeCache::expand() {
 }
 
 void CodeCache::add(const void* start, int length, const char* name, bool update_bounds) {
-    char* name_copy = NativeFunc::create(name, _lib_index);
+    char* name_copy = NativeFunc::create(name, _lib_index, &_names);
+    if (name_copy == NULL) {
+        return;
+    }
     // Replace non-printable characters
     for (char* s = name_copy; *s != 0; s++) {
         if (*s < ' ') *s = '?';
     }
 
-    if (_count >= _capacity) {
-        expand();
-    }
-
     const void* end = (const char*)start + length;
-    _blobs[_count]._start = start;
-    _blobs[_count]._end = end;
-    _blobs[_count]._name = name_copy;
-    _count++;
+
+    if (_index_names != NULL) {
+        // The compact index is immutable. Samplers may already walk the list, so publish a complete node
+        ExtraCodeBlob* e = new ExtraCodeBlob;
+        e->blob._start = start;
+        e->blob._end = end;
+        e->blob._name = name_copy;
+        e->next = _extra;
+        __atomic_store_n(&_extra, e, __ATOMIC_RELEASE);
+    } else {
+        if (_count >= _capacity) {
+            expand();
+        }
+
+        _blobs[_count]._start = start;
+        _blobs[_count]._end = end;
+        _blobs[_count]._name = name_copy;
+        _count++;
+    }
 
     if (update_bounds) {
         updateBounds(start, end);
@@ -103,25 +210,208 @@ void CodeCache::updateBounds(const void* start, const void* end) {
 }
 
 void CodeCache::sort() {
-    if (_count == 0) return;
+    if (_count == 0 || _index_names != NULL) return;
 
     qsort(_blobs, _count, sizeof(CodeBlob), CodeBlob::comparator);
 
     if (_min_address == NO_MIN_ADDRESS) _min_address = _blobs[0]._start;
     if (_max_address == NO_MAX_ADDRESS) _max_address = _blobs[_count - 1]._end;
+
+    buildIndex();
+}
+
+// In-order traversal of an implicit 1-based Eytzinger tree of n nodes
+static int eytzingerFirst(int n) {
+    int k = 1;
+    while (k * 2 <= n) k *= 2;
+    return n > 0 ? k : 0;
+}
+
+static int eytzingerNext(int k, int n) {
+    if (k * 2 + 1 <= n) {
+        k = k * 2 + 1;
+        while (k * 2 <= n) k *= 2;
+        return k;
+    }
+    while (k & 1) k >>= 1;
+    return k >> 1;
+}
+
+static int eytzingerPrev(int k, int n) {
+    if (k * 2 <= n) {
+        k = k * 2;
+        while (k * 2 + 1 <= n) k = k * 2 + 1;
+        return k;
+    }
+    while (!(k & 1)) k >>= 1;
+    return k >> 1;
 }
 
-CodeBlob* CodeCache::findBlob(const char* name) {
+void CodeCache::buildIndex() {
+    const char* base = (const char*)_blobs[0]._start;
     for (int i = 0; i < _count; i++) {
-        const char* blob_name = _blobs[i]._name;
-        if (blob_name != NULL && strcmp(blob_name, name) == 0) {
-            return &_blobs[i];
+        const char* start = (const char*)_blobs[i]._start;
+        const char* end = (const char*)_blobs[i]._end;
+        if ((u64)(start - base) > 0xffffffffULL || end < start || (u64)(end - start) > 0xffffffffULL) {
+            // Does not fit in 32-bit offsets; keep the plain array
+            return;
         }
     }
-    return NULL;
+
+    u32* starts = (u32*)malloc((_count + 1) * sizeof(u32));
+    u32* lengths = (u32*)malloc((_count + 1) * sizeof(u32));
+    char** names = (char**)malloc((_count + 1) * sizeof(char*));
+    if (starts == NULL || lengths == NULL || names == NULL) {
+        free(starts);
+        free(lengths);
+        free(names);
+        return;
+    }
+
+    int i = 0;
+    for (int k = eytzingerFirst(_count); k != 0; k = eytzingerNext(k, _count), i++) {
+        starts[k] = (u32)((const char*)_blobs[i]._start - base);
+        lengths[k] = (u32)((const char*)_blobs[i]._end - (const char*)_blobs[i]._start);
+        names[k] = _blobs[i]._name;
+    }
+
+    size_t index_size = (_count + 1) * (2 * sizeof(u32) + sizeof(char*));
+    size_t blobs_size = _capacity * sizeof(CodeBlob) + _count * MALLOC_OVERHEAD;
+    if (blobs_size > index_size) {
+        _saved_memory = blobs_size - index_size;
+    }
+
+    _index_base = base;
+    _index_starts = starts;
+    _index_lengths = lengths;
+    _index_names = names;
+
+    delete[] _blobs;
+    _blobs = NULL;
+    _capacity = 0;
+}
+
+// Async signal safe: asks the loader thread to load the deferred part of a library once
+static void requestLazyLoad(volatile int* state) {
+    if (*state == LAZY_PENDING && __sync_bool_compare_and_swap(state, LAZY_PENDING, LAZY_REQUESTED)) {
+        Symbols::wakeupLoader();
+    }
+}
+
+void CodeCache::ensureSymbols() {
+    if (symbolsPending()) {
+        Symbols::loadSymbols(this);
+    }
+}
+
+void CodeCache::adoptSymbols(CodeCache* other) {
+    if (other->_index_names != NULL) {
+        _names.swap(other->_names);
+        _index_base = other->_index_base;
+        _index_starts = other->_index_starts;
+        _index_lengths = other->_index_lengths;
+        _index_names = other->_index_names;
+        _count = other->_count;
+        _saved_memory = other->_saved_memory;
+
+        other->_index_starts = NULL;
+        other->_index_lengths = NULL;
+        other->_index_names = NULL;
+        other->_count = 0;
+
+        delete[] _blobs;
+        _blobs = NULL;
+        _capacity = 0;
+    } else if (other->_count > 0) {
+        Log::debug("Symbols of %s do not fit in the compact index", _name);
+    }
+
+    _plt_offset = other->_plt_offset;
+    _plt_size = other->_plt_size;
+    _debug_symbols = other->_debug_symbols;
+
+    // Samplers do not look at the symbols until the state is published
+    __atomic_store_n(&_symbols_state, LAZY_NONE, __ATOMIC_RELEASE);
+}
+
+void CodeCache::adoptMappedIndex(void* mapping, size_t mapping_size, const char* base,
+                                 u32* starts, u32* lengths, char** names, int count) {
+    _mapping = mapping;
+    _mapping_size = mapping_size;
+    _index_base = base;
+    _index_starts = starts;
+    _index_lengths = lengths;
+    _index_names = names;
+    _count = count;
+
+    delete[] _blobs;
+    _blobs = NULL;
+    _capacity = 0;
+}
+
+void CodeCache::finishLazyDwarf() {
+    __atomic_store_n(&_dwarf_state, LAZY_NONE, __ATOMIC_RELEASE);
+}
+
+// Returns the Eytzinger position of the last symbol that starts at or below the address, or 0
+int CodeCache::findIndex(const void* address) {
+    if (address < _index_base) {
+        return 0;
+    }
+
+    u64 offset = (const char*)address - _index_base;
+    u32 target = offset > 0xffffffffULL ? 0xffffffff : (u32)offset;
+
+    // Branch-free descent: each step appends 1 to k when going right
+    int k = 1;
+    while (k <= _count) {
+        __builtin_prefetch(_index_starts + k * 16);
+        k = k * 2 + (_index_starts[k] <= target);
+    }
+    // The last right turn is the predecessor
+    return k >> __builtin_ffs(k);
+}
+
+void CodeCache::blobAt(int k, CodeBlob* blob) {
+    blob->_start = _index_base + _index_starts[k];
+    blob->_end = _index_base + _index_starts[k] + _index_lengths[k];
+    blob->_name = _index_names[k];
+}
+
+bool CodeCache::findBlob(const char* name, CodeBlob* blob) {
+    ensureSymbols();
+
+    if (_index_names != NULL) {
+        for (int k = eytzingerFirst(_count); k != 0; k = eytzingerNext(k, _count)) {
+            if (strcmp(_index_names[k], name) == 0) {
+                blobAt(k, blob);
+                return true;
+            }
+        }
+    } else {
+        for (int i = 0; i < _count; i++) {
+            const char* blob_name = _blobs[i]._name;
+            if (blob_name != NULL && strcmp(blob_name, name) == 0) {
+                *blob = _blobs[i];
+                return true;
+            }
+        }
+    }
+
+    for (ExtraCodeBlob* e = __atomic_load_n(&_extra, __ATOMIC_ACQUIRE); e != NULL; e = e->next) {
+        if (strcmp(e->blob._name, name) == 0) {
+            *blob = e->blob;
+            return true;
+        }
+    }
+    return false;
 }
 
 CodeBlob* CodeCache::findBlobByAddress(const void* address) {
+    if (_blobs == NULL) {
+        return findExtraBlob(address);
+    }
+
     for (int i = 0; i < _count; i++) {
         if (address >= _blobs[i]._start && address < _blobs[i]._end) {
             return &_blobs[i];
@@ -130,7 +420,44 @@ CodeBlob* CodeCache::findBlobByAddress(const void* address) {
     return NULL;
 }
 
+CodeBlob* CodeCache::findExtraBlob(const void* address) {
+    for (ExtraCodeBlob* e = __atomic_load_n(&_extra, __ATOMIC_ACQUIRE); e != NULL; e = e->next) {
+        if (address >= e->blob._start && address < e->blob._end) {
+            return &e->blob;
+        }
+    }
+    return NULL;
+}
+
 const char* CodeCache::binarySearch(const void* address) {
+    if (__atomic_load_n(&_symbols_state, __ATOMIC_ACQUIRE) != LAZY_NONE) {
+        // The library name serves as a placeholder frame until symbols are loaded
+        requestLazyLoad(&_symbols_state);
+        return _name;
+    }
+
+    if (_index_names != NULL) {
+        int k = findIndex(address);
+        if (k != 0) {
+            const char* start = _index_base + _index_starts[k];
+            const char* end = start + _index_lengths[k];
+            // Symbols with zero size can be valid functions: e.g. ASM entry points or kernel code.
+            // Also, in some cases (endless loop) the return address may point beyond the function.
+            if (address < end || start == end || address == end) {
+                return _index_names[k];
+            }
+
+            // The predecessor may be nested in a larger symbol that starts earlier
+            for (int i = 0; i < MAX_ENCLOSING_LOOKBACK && (k = eytzingerPrev(k, _count)) != 0; i++) {
+                if ((const char*)address < _index_base + _index_starts[k] + _index_lengths[k]) {
+                    return _index_names[k];
+                }
+            }
+        }
+        CodeBlob* extra = findExtraBlob(address);
+        return extra != NULL ? extra->_name : _name;
+    }
+
     int low = 0;
     int high = _count - 1;
 
@@ -145,17 +472,20 @@ const char* CodeCache::binarySearch(const void* address) {
         }
     }
 
-    // Symbols with zero size can be valid functions: e.g. ASM entry points or kernel code.
-    // Also, in some cases (endless loop) the return address may point beyond the function.
     if (low > 0 && (_blobs[low - 1]._start == _blobs[low - 1]._end || _blobs[low - 1]._end == address)) {
         return _blobs[low - 1]._name;
     }
+    for (int i = low - 2; i >= 0 && i >= low - 1 - MAX_ENCLOSING_LOOKBACK; i--) {
+        if (address < _blobs[i]._end) {
+            return _blobs[i]._name;
+        }
+    }
     return _name;
 }
 
 const void* CodeCache::findSymbol(const char* name) {
-    CodeBlob* blob = findBlob(name);
-    return blob == NULL ? NULL : blob->_start;
+    CodeBlob blob;
+    return findBlob(name, &blob) ? blob._start : NULL;
 }
 
 const void* CodeCache::findSymbolByPrefix(const char* prefix) {
@@ -163,11 +493,14 @@ const void* CodeCache::findSymbolByPrefix(const char* prefix) {
 }
 
 const void* CodeCache::findSymbolByPrefix(const char* prefix, int prefix_len) {
+    ensureSymbols();
+
     const void* result = NULL;
-    for (int i = 0; i < _count; i++) {
-        const char* blob_name = _blobs[i]._name;
+    int k = _index_names != NULL ? eytzingerFirst(_count) : 0;
+    for (int i = 0; i < _count; i++, k = k != 0 ? eytzingerNext(k, _count) : 0) {
+        const char* blob_name = k != 0 ? _index_names[k] : _blobs[i]._name;
         if (blob_name != NULL && strncmp(blob_name, prefix, prefix_len) == 0) {
-            result = _blobs[i]._start;
+            result = k != 0 ? _index_base + _index_starts[k] : _blobs[i]._start;
             // Symbols which contain a dot are only patched if no alternative is found,
             // see #1247
             if (strchr(blob_name + prefix_len, '.') == NULL) {
@@ -175,6 +508,14 @@ const void* CodeCache::findSymbolByPrefix(const char* prefix, int prefix_len) {
             }
         }
     }
+    for (ExtraCodeBlob* e = __atomic_load_n(&_extra, __ATOMIC_ACQUIRE); e != NULL; e = e->next) {
+        if (strncmp(e->blob._name, prefix, prefix_len) == 0) {
+            result = e->blob._start;
+            if (strchr(e->blob._name + prefix_len, '.') == NULL) {
+                return result;
+            }
+        }
+    }
     return result;
 }
 
@@ -287,28 +628,21 @@ bool CodeCache::makeImportsPatchable() {
 }
 
 void CodeCache::setDwarfTable(FrameDesc* table, int length) {
-    _dwarf_table = table;
-    _dwarf_table_length = length;
+    _frame_table = FrameTable::build(table, length);
+    free(table);
 }
 
 FrameDesc* CodeCache::findFrameDesc(const void* pc) {
-    u32 target_loc = (const char*)pc - _text_base;
-    int low = 0;
-    int high = _dwarf_table_length - 1;
-
-    while (low <= high) {
-        int mid = (unsigned int)(low + high) >> 1;
-        if (_dwarf_table[mid].loc < target_loc) {
-            low = mid + 1;
-        } else if (_dwarf_table[mid].loc > target_loc) {
-            high = mid - 1;
-        } else {
-            return &_dwarf_table[mid];
-        }
+    if (__atomic_load_n(&_dwarf_state, __ATOMIC_ACQUIRE) != LAZY_NONE) {
+        requestLazyLoad(&_dwarf_state);
+        return &FrameDesc::default_frame;
     }
 
-    if (low > 0) {
-        return &_dwarf_table[low - 1];
+    u32 target_loc = (const char*)pc - _text_base;
+    FrameDesc* f = _frame_table != NULL ? _frame_table->find(target_loc) : NULL;
+
+    if (f != NULL) {
+        return f;
     } else if (target_loc - _plt_offset < _plt_size) {
         return &FrameDesc::empty_frame;
     } else {
@@ -318,10 +652,167 @@ FrameDesc* CodeCache::findFrameDesc(const void* pc) {
 
 size_t CodeCache::usedMemory() {
     size_t bytes = _capacity * sizeof(CodeBlob);
-    bytes += _dwarf_table_length * sizeof(FrameDesc);
-    bytes += NativeFunc::usedMemory(_name);
-    for (int i = 0; i < _count; i++) {
-        bytes += NativeFunc::usedMemory(_blobs[i]._name);
+    if (_mapping != NULL) {
+        bytes += (_count + 1) * sizeof(char*);
+    } else if (_index_names != NULL) {
+        bytes += (_count + 1) * (2 * sizeof(u32) + sizeof(char*));
+    }
+    if (_frame_table != NULL) {
+        bytes += _frame_table->usedMemory();
+    }
+    for (ExtraCodeBlob* e = _extra; e != NULL; e = e->next) {
+        bytes += sizeof(ExtraCodeBlob);
     }
+    bytes += NativeFunc::usedMemory(_name);
+    bytes += _names.usedMemory();
     return bytes + sizeof(CodeCache);
 }
+
+
+static int compareRanges(const void* a, const void* b) {
+    const CodeCacheRange* r1 = (const CodeCacheRange*)a;
+    const CodeCacheRange* r2 = (const CodeCacheRange*)b;
+    if (r1->start != r2->start) {
+        return r1->start < r2->start ? -1 : 1;
+    }
+    return r1->order - r2->order;
+}
+
+static size_t indexSize(int lib_count) {
+    return sizeof(CodeCacheIndex) + (lib_count > 0 ? lib_count - 1 : 0) * sizeof(CodeCacheRange);
+}
+
+CodeCacheArray::~CodeCacheArray() {
+    free(_index);
+    while (_retired != NULL) {
+        CodeCacheIndex* next = _retired->next_retired;
+        free(_retired);
+        _retired = next;
+    }
+}
+
+void CodeCacheArray::freeRetired(CodeCacheIndex* retired) {
+    while (retired != NULL) {
+        CodeCacheIndex* next = retired->next_retired;
+        __sync_fetch_and_sub(&_used_memory, indexSize(retired->lib_count));
+        free(retired);
+        retired = next;
+    }
+}
+
+void CodeCacheArray::publish() {
+    CodeCacheIndex* current = _index;
+    int count = _count;
+    if (current != NULL && current->lib_count == count) {
+        return;
+    }
+
+    size_t size = indexSize(count);
+    CodeCacheIndex* index = (CodeCacheIndex*)malloc(size);
+    if (index == NULL) {
+        return;
+    }
+
+    // Libraries with empty bounds can never match an address
+    int length = 0;
+    for (int i = 0; i < count; i++) {
+        CodeCache* lib = _libs[i];
+        if (lib->minAddress() < lib->maxAddress()) {
+            CodeCacheRange* r = &index->ranges[length++];
+            r->start = lib->minAddress();
+            r->end = lib->maxAddress();
+            r->lib = lib;
+            r->order = i;
+        }
+    }
+    qsort(index->ranges, length, sizeof(CodeCacheRange), compareRanges);
+
+    const void* max_end = NULL;
+    for (int i = 0; i < length; i++) {
+        if (index->ranges[i].end > max_end) max_end = index->ranges[i].end;
+        index->ranges[i].max_end = max_end;
+    }
+
+    index->next_retired = NULL;
+    index->lib_count = count;
+    index->length = length;
+
+    __sync_fetch_and_add(&_used_memory, size);
+    __atomic_store_n(&_index, index, __ATOMIC_RELEASE);
+
+    // A signal handler may still be searching the old snapshot
+    if (current != NULL) {
+        do {
+            current->next_retired = _retired;
+        } while (!__sync_bool_compare_and_swap(&_retired, current->next_retired, current));
+    }
+}
+
+size_t CodeCacheArray::usedMemory() {
+    size_t bytes = _used_memory;
+    int count = this->count();
+    for (int i = 0; i < count; i++) {
+        bytes += _libs[i]->usedMemory();
+    }
+    return bytes;
+}
+
+size_t CodeCacheArray::savedMemory() {
+    size_t bytes = 0;
+    int count = this->count();
+    for (int i = 0; i < count; i++) {
+        bytes += _libs[i]->savedMemory();
+    }
+    return bytes;
+}
+
+CodeCache* CodeCacheArray::findLibrary(const void* address) {
+    CodeCacheIndex* index = __atomic_load_n(&_index, __ATOMIC_ACQUIRE);
+    int first_unindexed = 0;
+
+    if (index != NULL) {
+        first_unindexed = index->lib_count;
+
+        // Find the last range that starts at or below the address
+        int low = 0;
+        int high = index->length - 1;
+        while (low <= high) {
+            int mid = (unsigned int)(low + high) >> 1;
+            if (index->ranges[mid].start <= address) {
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+
+        // Ranges may overlap: prefer the library added first, as a linear scan would
+        CodeCacheRange* match = NULL;
+        for (int i = high; i >= 0 && index->ranges[i].max_end > address; i--) {
+            CodeCacheRange* r = &index->ranges[i];
+            if (address < r->end && (match == NULL || r->order < match->order)) {
+                match = r;
+            }
+        }
+        if (match != NULL) {
+            return match->lib;
+        }
+    }
+
+    int count = this->count();
+    for (int i = first_unindexed; i < count; i++) {
+        if (_libs[i]->contains(address)) {
+            return _libs[i];
+        }
+    }
+    return NULL;
+}
+
+CodeCache* CodeCacheArray::scanLibraries(const void* address) {
+    int count = this->count();
+    for (int i = 0; i < count; i++) {
+        if (_libs[i]->contains(address)) {
+            return _libs[i];
+        }
+    }
+    return NULL;
+}
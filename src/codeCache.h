@@ -7,6 +7,7 @@
 #define _CODECACHE_H
 
 #include <jvmti.h>
+#include "arch.h"
 
 
 #define NO_MIN_ADDRESS  ((const void*)-1)
@@ -40,6 +41,12 @@ enum ImportType {
     NUM_IMPORT_TYPES
 };
 
+enum LazyState {
+    LAZY_NONE,       // loaded, or nothing to load
+    LAZY_PENDING,    // only the mapping is known
+    LAZY_REQUESTED,  // a sample has asked the loader thread for it
+};
+
 enum Mark {
     MARK_VM_RUNTIME = 1,
     MARK_INTERPRETER = 2,
@@ -48,6 +55,31 @@ enum Mark {
 };
 
 
+// Packs symbol names of a library into a few large allocations instead of one per name.
+// Names never move, since they double as method IDs of native frames.
+class NameArena {
+  private:
+    char* _chunk;  // the first word links to the previous chunk
+    size_t _offset;
+    size_t _chunk_size;
+    size_t _allocated;
+
+  public:
+    NameArena() : _chunk(NULL), _offset(0), _chunk_size(0), _allocated(0) {
+    }
+
+    ~NameArena();
+
+    char* alloc(size_t size);
+
+    void swap(NameArena& other);
+
+    size_t usedMemory() {
+        return _allocated;
+    }
+};
+
+
 class NativeFunc {
   private:
     short _lib_index;
@@ -61,6 +93,7 @@ class NativeFunc {
 
   public:
     static char* create(const char* name, short lib_index);
+    static char* create(const char* name, short lib_index, NameArena* arena);
     static void destroy(char* name);
 
     static size_t usedMemory(const char* name);
@@ -100,8 +133,15 @@ class CodeBlob {
     }
 };
 
+// Symbol added after the compact index is built
+struct ExtraCodeBlob {
+    CodeBlob blob;
+    ExtraCodeBlob* next;
+};
+
 
 class FrameDesc;
+class FrameTable;
 
 class CodeCache {
   private:
@@ -119,14 +159,32 @@ class CodeCache {
     bool _imports_patchable;
     bool _debug_symbols;
 
-    FrameDesc* _dwarf_table;
-    int _dwarf_table_length;
+    FrameTable* _frame_table;
 
+    // Symbols are collected in _blobs until sort() packs them into a compact index:
+    // 32-bit offsets from _index_base in Eytzinger order (1-based) for a cache-friendly search.
+    // Caches that do not fit in 32 bits, or are never sorted, keep the _blobs array.
     int _capacity;
     int _count;
     CodeBlob* _blobs;
+    const char* _index_base;
+    u32* _index_starts;
+    u32* _index_lengths;
+    char** _index_names;
+    size_t _saved_memory;
+    ExtraCodeBlob* _extra;  // the index is immutable, so later symbols are prepended to this list
+    NameArena _names;
+    void* _mapping;  // holds _index_starts and _index_lengths when the index is shared with other processes
+    size_t _mapping_size;
+
+    volatile int _symbols_state;
+    volatile int _dwarf_state;
 
     void expand();
+    void ensureSymbols();
+    void buildIndex();
+    int findIndex(const void* address);
+    void blobAt(int k, CodeBlob* blob);
     bool makeImportsPatchable();
     void saveImport(ImportId id, void** entry);
 
@@ -155,6 +213,10 @@ class CodeCache {
         return _image_base;
     }
 
+    short libIndex() const {
+        return _lib_index;
+    }
+
     bool contains(const void* address) const {
         return address >= _min_address && address < _max_address;
     }
@@ -176,18 +238,54 @@ class CodeCache {
         _debug_symbols = debug_symbols;
     }
 
+    // Defers loading of symbols and DWARF table until the first lookup
+    void setLazy(bool symbols, bool dwarf) {
+        _symbols_state = symbols ? LAZY_PENDING : LAZY_NONE;
+        _dwarf_state = dwarf ? LAZY_PENDING : LAZY_NONE;
+    }
+
+    bool symbolsRequested() const {
+        return _symbols_state == LAZY_REQUESTED;
+    }
+
+    bool dwarfRequested() const {
+        return _dwarf_state == LAZY_REQUESTED;
+    }
+
+    bool symbolsPending() const {
+        return _symbols_state != LAZY_NONE;
+    }
+
+    bool dwarfPending() const {
+        return _dwarf_state != LAZY_NONE;
+    }
+
+    // Takes over the sorted symbols of another cache and makes them visible to samplers
+    void adoptSymbols(CodeCache* other);
+    void finishLazyDwarf();
+
+    // Uses an index prepared elsewhere, with starts and lengths inside a private mapping that is unmapped with the cache
+    void adoptMappedIndex(void* mapping, size_t mapping_size, const char* base,
+                          u32* starts, u32* lengths, char** names, int count);
+
     void add(const void* start, int length, const char* name, bool update_bounds = false);
     void updateBounds(const void* start, const void* end);
     void sort();
 
     template <typename NamePredicate>
     inline void mark(NamePredicate predicate, char value) {
+        ensureSymbols();
         for (int i = 0; i < _count; i++) {
-            const char* blob_name = _blobs[i]._name;
+            const char* blob_name = _index_names != NULL ? _index_names[i + 1] : _blobs[i]._name;
             if (blob_name != NULL && predicate(blob_name)) {
                 NativeFunc::mark(blob_name, value);
             }
         }
+        for (ExtraCodeBlob* e = _extra; e != NULL; e = e->next) {
+            if (predicate(e->blob._name)) {
+                NativeFunc::mark(e->blob._name, value);
+            }
+        }
 
         if (value == MARK_VM_RUNTIME && _name != NULL) {
             // In case a library has no debug symbols
@@ -199,32 +297,66 @@ class CodeCache {
     void** findImport(ImportId id);
     void patchImport(ImportId id, void* hook_func);
 
-    CodeBlob* findBlob(const char* name);
+    bool findBlob(const char* name, CodeBlob* blob);
+    // Linear scan for caches that are never sorted, such as runtime stubs
     CodeBlob* findBlobByAddress(const void* address);
+    CodeBlob* findExtraBlob(const void* address);
     const char* binarySearch(const void* address);
     const void* findSymbol(const char* name);
     const void* findSymbolByPrefix(const char* prefix);
     const void* findSymbolByPrefix(const char* prefix, int prefix_len);
 
+    // Packs a malloc'ed array of FrameDesc records sorted by loc into a FrameTable and frees the array
     void setDwarfTable(FrameDesc* table, int length);
     FrameDesc* findFrameDesc(const void* pc);
 
     size_t usedMemory();
 
+    // Bytes saved by the compact index compared to a CodeBlob array with a heap block per name
+    size_t savedMemory() {
+        return _saved_memory;
+    }
+
+    friend class SymbolCache;
     friend class UnloadProtection;
 };
 
 
+// Address range of a library in the sorted lookup index
+struct CodeCacheRange {
+    const void* start;
+    const void* end;
+    const void* max_end;  // max end of this and all preceding ranges
+    CodeCache* lib;
+    int order;            // position of the library in CodeCacheArray
+};
+
+// Immutable snapshot of library ranges sorted by start address.
+// Readers search it from a signal handler without locking or writing shared memory;
+// a replaced snapshot is retired, and the profiler frees it once samplers have moved on.
+struct CodeCacheIndex {
+    CodeCacheIndex* next_retired;
+    int lib_count;
+    int length;
+    CodeCacheRange ranges[1];
+};
+
+
 class CodeCacheArray {
   private:
     CodeCache* _libs[MAX_NATIVE_LIBS];
     int _count;
     size_t _used_memory;
+    CodeCacheIndex* _index;
+    CodeCacheIndex* volatile _retired;
+    int _generation;
 
   public:
-    CodeCacheArray() : _count(0) {
+    CodeCacheArray() : _count(0), _used_memory(0), _index(NULL), _retired(NULL), _generation(0) {
     }
 
+    ~CodeCacheArray();
+
     CodeCache* operator[](int index) {
         return _libs[index];
     }
@@ -233,16 +365,43 @@ class CodeCacheArray {
         return __atomic_load_n(&_count, __ATOMIC_ACQUIRE);
     }
 
-    size_t usedMemory() {
-        return _used_memory;
+    // Libraries loaded lazily grow after they are added, so the sums are computed on demand
+    size_t usedMemory();
+    size_t savedMemory();
+
+    // Changes whenever a library is added or loads its symbols, so that cached address lookups can be dropped
+    int generation() {
+        return __atomic_load_n(&_generation, __ATOMIC_ACQUIRE);
+    }
+
+    void invalidate() {
+        __atomic_add_fetch(&_generation, 1, __ATOMIC_RELEASE);
     }
 
     void add(CodeCache* lib) {
         int index = __atomic_load_n(&_count, __ATOMIC_ACQUIRE);
         _libs[index] = lib;
-        _used_memory += lib->usedMemory();
         __atomic_store_n(&_count, index + 1, __ATOMIC_RELEASE);
+        invalidate();
     }
+
+    // Rebuilds the sorted index over all added libraries. Must not run concurrently with add()
+    void publish();
+
+    // Detaches snapshots replaced so far. The caller frees them with freeRetired()
+    // after every lookup that could have loaded one of them has finished
+    CodeCacheIndex* takeRetired() {
+        return __sync_lock_test_and_set(&_retired, (CodeCacheIndex*)NULL);
+    }
+
+    void freeRetired(CodeCacheIndex* retired);
+
+    // Async signal safe: O(log n) over the published index plus a scan of libraries added since.
+    // The snapshot is only read, so callers must be known to the code that frees retired snapshots
+    CodeCache* findLibrary(const void* address);
+
+    // Linear scan that never touches a snapshot; safe for callers outside of sampler slots
+    CodeCache* scanLibraries(const void* address);
 };
 
 #endif // _CODECACHE_H
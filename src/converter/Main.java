@@ -116,6 +116,8 @@ public class Main {
                 "     --tail RATIO       Ignore tail allocations for leak profiling (10% by default)\n" +
                 "     --lock             Lock contention profile\n" +
                 "     --nativelock       Native (pthread) lock contention profile\n" +
+                "     --offcpu           Off-CPU profile (OffCpuSample)\n" +
+                "     --counter NAME     Profile weighted by a perf_events counter recorded with --counters\n" +
                 "     --trace            Method traces / latency profile\n" +
                 "  -t --threads          Split stack traces by threads\n" +
                 "  -s --state LIST       Filter thread states: runnable, sleeping\n" +
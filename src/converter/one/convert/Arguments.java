@@ -15,6 +15,7 @@ public class Arguments {
     public String highlight;
     public String output;
     public String state;
+    public String counter;
     public Pattern include;
     public Pattern exclude;
     public double minwidth;
@@ -30,6 +31,7 @@ public class Arguments {
     public boolean alloc;
     public boolean nativemem;
     public boolean nativelock;
+    public boolean offcpu;
     public boolean leak;
     public boolean live;
     public boolean lock;
@@ -56,7 +56,9 @@ public abstract class JfrConverter extends Classifier {
     }
 
     protected void collectEvents() throws IOException {
-        Class<? extends Event> eventClass = args.nativelock ? NativeLockEvent.class
+        Class<? extends Event> eventClass = args.counter != null ? PerfCounterSample.class
+                : args.nativelock ? NativeLockEvent.class
+                : args.offcpu ? OffCpuSample.class
                 : args.nativemem ? MallocEvent.class
                 : args.live ? LiveObject.class
                 : args.alloc ? AllocationSample.class
@@ -82,9 +84,20 @@ public abstract class JfrConverter extends Classifier {
         long startTicks = args.from != 0 ? toTicks(args.from) : Long.MIN_VALUE;
         long endTicks = args.to != 0 ? toTicks(args.to) : Long.MAX_VALUE;
 
+        int counterIndex = -1;
+
         for (Event event; (event = jfr.readEvent(eventClass)) != null; ) {
+            if (event instanceof PerfCounterSample) {
+                // Counter names are known from the recording settings, which precede samples
+                if (counterIndex < 0) {
+                    counterIndex = getCounterIndex(args.counter);
+                }
+                event = ((PerfCounterSample) event).select(counterIndex);
+            }
             if (event.time >= startTicks && event.time <= endTicks) {
-                if (threadStates == null || threadStates.get(((ExecutionSample) event).threadState)) {
+                // Only execution samples carry a thread state; other events are not filtered by it
+                if (threadStates == null || !(event instanceof ExecutionSample)
+                        || threadStates.get(((ExecutionSample) event).threadState)) {
                     collector.collect(event);
                 }
             }
@@ -107,6 +120,19 @@ public abstract class JfrConverter extends Classifier {
         throw new IllegalArgumentException("Unknown thread state: " + name);
     }
 
+    protected int getCounterIndex(String name) {
+        String counters = jfr.settings.get("counters");
+        if (counters != null) {
+            String[] names = counters.split(",");
+            for (int i = 0; i < names.length; i++) {
+                if (names[i].equals(name)) {
+                    return i;
+                }
+            }
+        }
+        throw new IllegalArgumentException("Unknown counter: " + name);
+    }
+
     protected BitSet getThreadStates(boolean cpu) {
         BitSet set = new BitSet();
         Map<Integer, String> threadStates = jfr.enums.get("jdk.types.ThreadState");
@@ -266,9 +292,11 @@ public abstract class JfrConverter extends Classifier {
     }
 
     public String getValueType() {
+        if (args.counter != null) return args.counter;
         if (args.nativemem) return "malloc";
         if (args.alloc || args.live) return "allocations";
         if (args.lock) return "locks";
+        if (args.offcpu) return "offcpu";
         return "cpu";
     }
 
@@ -277,18 +305,19 @@ public abstract class JfrConverter extends Classifier {
     }
 
     public String getTotalUnits() {
+        if (args.counter != null) return "count";
         if (args.nativemem || args.alloc || args.live) return "bytes";
         return "nanoseconds";
     }
 
     public double counterFactor() {
-        return (args.lock || args.nativelock) ? 1e9 / jfr.ticksPerSec : 1.0;
+        return (args.lock || args.nativelock || args.offcpu) ? 1e9 / jfr.ticksPerSec : 1.0;
     }
 
-    // Select sum(samples) or sum(value) depending on the --total option.
-    // For lock and nativelock events, convert lock duration from ticks to nanoseconds.
+    // Select sum(samples) or sum(value) depending on the --total option; --counter always sums values.
+    // For lock, nativelock and offcpu events, convert duration from ticks to nanoseconds.
     protected abstract class AggregatedEventVisitor implements EventCollector.Visitor {
-        private final double factor = !args.total ? 0.0 : counterFactor();
+        private final double factor = !args.total && args.counter == null ? 0.0 : counterFactor();
 
         @Override
         public final void visit(Event event, long samples, long value) {
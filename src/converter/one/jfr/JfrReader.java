@@ -79,6 +79,8 @@ public class JfrReader implements Closeable {
     private int free;
     private int cpuTimeSample;
     private int nativeLock;
+    private int perfCounterSample;
+    private int offCpuSample;
 
     public JfrReader(String fileName) throws IOException {
         this.ch = FileChannel.open(Paths.get(fileName), StandardOpenOption.READ);
@@ -204,6 +206,10 @@ public class JfrReader implements Closeable {
                 if (cls == null || cls == ContendedLock.class) return (E) readContendedLock(true);
             } else if (type == nativeLock) {
                 if (cls == null || cls == NativeLockEvent.class) return (E) readNativeLockEvent();
+            } else if (type == perfCounterSample) {
+                if (cls == null || cls == PerfCounterSample.class) return (E) readPerfCounterSample();
+            } else if (type == offCpuSample) {
+                if (cls == null || cls == OffCpuSample.class) return (E) readOffCpuSample();
             } else if (type == activeSetting) {
                 readActiveSetting();
             } else {
@@ -273,6 +279,25 @@ public class JfrReader implements Closeable {
         return new NativeLockEvent(time, tid, stackTraceId, address, duration);
     }
 
+    private PerfCounterSample readPerfCounterSample() {
+        long time = getVarlong();
+        int tid = getVarint();
+        int stackTraceId = getVarint();
+        long[] counters = new long[getVarint()];
+        for (int i = 0; i < counters.length; i++) {
+            counters[i] = getVarlong();
+        }
+        return new PerfCounterSample(time, tid, stackTraceId, counters);
+    }
+
+    private OffCpuSample readOffCpuSample() {
+        long time = getVarlong();
+        long duration = getVarlong();
+        int tid = getVarint();
+        int stackTraceId = getVarint();
+        return new OffCpuSample(time, tid, stackTraceId, duration);
+    }
+
     private MallocEvent readMallocEvent(boolean hasSize) {
         long time = getVarlong();
         int tid = getVarint();
@@ -609,6 +634,8 @@ public class JfrReader implements Closeable {
         free = getTypeId("profiler.Free");
         cpuTimeSample = getTypeId("jdk.CPUTimeSample");
         nativeLock = getTypeId("profiler.NativeLock");
+        perfCounterSample = getTypeId("profiler.PerfCounterSample");
+        offCpuSample = getTypeId("profiler.OffCpuSample");
 
         registerEvent("jdk.CPULoad", CPULoad.class);
         registerEvent("jdk.GCHeapSummary", GCHeapSummary.class);
@@ -0,0 +1,20 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package one.jfr.event;
+
+public class OffCpuSample extends Event {
+    public final long duration;
+
+    public OffCpuSample(long time, int tid, int stackTraceId, long duration) {
+        super(time, tid, stackTraceId);
+        this.duration = duration;
+    }
+
+    @Override
+    public long value() {
+        return duration;
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package one.jfr.event;
+
+public class PerfCounterSample extends Event {
+    public final long[] counters;
+    public final int index;
+
+    public PerfCounterSample(long time, int tid, int stackTraceId, long[] counters) {
+        this(time, tid, stackTraceId, counters, 0);
+    }
+
+    private PerfCounterSample(long time, int tid, int stackTraceId, long[] counters, int index) {
+        super(time, tid, stackTraceId);
+        this.counters = counters;
+        this.index = index;
+    }
+
+    // The same sample valued by another counter of the group
+    public PerfCounterSample select(int index) {
+        return index == this.index ? this : new PerfCounterSample(time, tid, stackTraceId, counters, index);
+    }
+
+    @Override
+    public long value() {
+        return index < counters.length ? counters[index] : 0;
+    }
+}
@@ -4,6 +4,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "dwarf.h"
 #include "log.h"
 
@@ -355,3 +356,85 @@ FrameDesc* DwarfParser::addRecordRaw(u32 loc, int cfa, int fp_off, int pc_off) {
     f->pc_off = pc_off;
     return f;
 }
+
+
+const int MIN_FRAME_PAGE_BITS = 12;
+
+static u32 hashRule(const FrameDesc* f) {
+    return ((u32)f->cfa * 31 + (u32)f->fp_off) * 0x9e3779b1 + (u32)f->pc_off;
+}
+
+static bool sameRule(const FrameDesc* f1, const FrameDesc* f2) {
+    return f1->cfa == f2->cfa && f1->fp_off == f2->fp_off && f1->pc_off == f2->pc_off;
+}
+
+FrameTable::~FrameTable() {
+    free(_rules);
+    free(_records);
+    free(_pages);
+}
+
+FrameTable* FrameTable::build(const FrameDesc* table, int count) {
+    if (count <= 0) {
+        return NULL;
+    }
+
+    // Keep the first level no longer than the record array
+    int page_bits = MIN_FRAME_PAGE_BITS;
+    u32 last_loc = table[count - 1].loc;
+    while (page_bits < 31 && (last_loc >> page_bits) >= (u32)count) {
+        page_bits++;
+    }
+    int page_count = (last_loc >> page_bits) + 1;
+
+    u32 hash_size = 16;
+    while (hash_size < (u32)count * 2) hash_size *= 2;
+
+    FrameTable* ft = new FrameTable();
+    ft->_rules = (FrameDesc*)malloc(count * sizeof(FrameDesc));
+    ft->_records = (FrameRecord*)malloc(count * sizeof(FrameRecord));
+    ft->_pages = (u32*)malloc((page_count + 1) * sizeof(u32));
+    u32* hash = (u32*)malloc(hash_size * sizeof(u32));
+    if (ft->_rules == NULL || ft->_records == NULL || ft->_pages == NULL || hash == NULL) {
+        free(hash);
+        delete ft;
+        return NULL;
+    }
+    memset(hash, 0xff, hash_size * sizeof(u32));
+
+    int rule_count = 0;
+    int page = 0;
+    for (int i = 0; i < count; i++) {
+        const FrameDesc* f = &table[i];
+        u32 slot = hashRule(f) & (hash_size - 1);
+        while (hash[slot] != 0xffffffff && !sameRule(&ft->_rules[hash[slot]], f)) {
+            slot = (slot + 1) & (hash_size - 1);
+        }
+        if (hash[slot] == 0xffffffff) {
+            FrameDesc* rule = &ft->_rules[rule_count];
+            *rule = *f;
+            rule->loc = 0;
+            hash[slot] = rule_count++;
+        }
+
+        while (page <= (int)(f->loc >> page_bits)) {
+            ft->_pages[page++] = i;
+        }
+        ft->_records[i].loc = f->loc;
+        ft->_records[i].rule = hash[slot];
+    }
+    while (page <= page_count) {
+        ft->_pages[page++] = count;
+    }
+    free(hash);
+
+    FrameDesc* rules = (FrameDesc*)realloc(ft->_rules, rule_count * sizeof(FrameDesc));
+    if (rules != NULL) {
+        ft->_rules = rules;
+    }
+    ft->_rule_count = rule_count;
+    ft->_count = count;
+    ft->_page_count = page_count;
+    ft->_page_bits = page_bits;
+    return ft;
+}
@@ -83,6 +83,72 @@ struct FrameDesc {
 };
 
 
+// Unwind record packed into 8 bytes: code offset and index of a distinct rule
+struct FrameRecord {
+    u32 loc;
+    u32 rule;
+};
+
+// Lookup table for the FrameDesc records of one library.
+// Records share a small table of distinct rules, and the first level maps a text page
+// to its range of records, so that a lookup searches only a few adjacent records.
+class FrameTable {
+  private:
+    FrameDesc* _rules;
+    FrameRecord* _records;
+    u32* _pages;  // _pages[p] is the first record at or above page p; _pages[_page_count] == _count
+    int _rule_count;
+    int _count;
+    int _page_count;
+    int _page_bits;
+
+    FrameTable() : _rules(NULL), _records(NULL), _pages(NULL), _rule_count(0), _count(0), _page_count(0), _page_bits(0) {
+    }
+
+  public:
+    ~FrameTable();
+
+    // Builds a table from FrameDesc records sorted by loc. Returns NULL if empty or out of memory
+    static FrameTable* build(const FrameDesc* table, int count);
+
+    // Async signal safe: rule of the last record at or before loc, NULL if loc precedes all records
+    FrameDesc* find(u32 loc) const {
+        u32 page = loc >> _page_bits;
+        if (page >= (u32)_page_count) {
+            return &_rules[_records[_count - 1].rule];
+        }
+
+        // Records below _pages[page] are all before loc, so the answer is at most one record earlier
+        int low = _pages[page];
+        int high = _pages[page + 1] - 1;
+        while (low <= high) {
+            int mid = (unsigned int)(low + high) >> 1;
+            if (_records[mid].loc <= loc) {
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+        return low > 0 ? &_rules[_records[low - 1].rule] : NULL;
+    }
+
+    int count() const {
+        return _count;
+    }
+
+    int ruleCount() const {
+        return _rule_count;
+    }
+
+    size_t usedMemory() const {
+        return sizeof(FrameTable) + _rule_count * sizeof(FrameDesc) + _count * sizeof(FrameRecord)
+            + (_page_count + 1) * sizeof(u32);
+    }
+
+    friend class SymbolCache;
+};
+
+
 class DwarfParser {
   private:
     const char* _name;
@@ -49,6 +49,10 @@ class Engine {
     virtual Error start(Arguments& args);
     virtual void stop();
 
+    // Records samples the engine holds back while profiling, e.g. of unfinished intervals
+    virtual void flush() {
+    }
+
     void enableEvents(bool enabled) {
         _enabled = enabled;
     }
@@ -11,11 +11,15 @@
 #include "os.h"
 
 
+// Extra perf_events counters read together with the sampling event
+const int MAX_PERF_COUNTERS = 4;
+
 // The order is important: look for event_type comparison
 enum EventType {
     PERF_SAMPLE,
     EXECUTION_SAMPLE,
     WALL_CLOCK_SAMPLE,
+    OFF_CPU_SAMPLE,
     NATIVE_LOCK_SAMPLE,
     MALLOC_SAMPLE,
     INSTRUMENTED_METHOD,
@@ -45,6 +49,14 @@ class ExecutionEvent : public Event {
     ExecutionEvent(u64 start_time) : _start_time(start_time), _thread_state(THREAD_UNKNOWN) {}
 };
 
+class PerfSampleEvent : public ExecutionEvent {
+  public:
+    u32 _num_counters;
+    u64 _counters[MAX_PERF_COUNTERS + 1];  // sampling event first, then counters in the order of the group
+
+    PerfSampleEvent(u64 start_time) : ExecutionEvent(start_time), _num_counters(0) {}
+};
+
 class MethodTraceEvent : public Event {
   public:
     u64 _start_time;
@@ -60,6 +72,13 @@ class WallClockEvent : public Event {
     u32 _samples;
 };
 
+// Interval between switch-out and switch-in of a thread
+class OffCpuEvent : public Event {
+  public:
+    u64 _start_time;
+    u64 _end_time;
+};
+
 class AllocEvent : public EventWithClassId {
   public:
     u64 _start_time;
@@ -36,6 +36,7 @@ struct perf_fd_request {
     int tid;
     int target_cpu;
     struct perf_event_attr attr;
+    // kprobe/uprobe function, or the tracepoint to be resolved by the server if attr.config is 0
     char probe_name[MAX_PROBE_LEN];
 };
 
@@ -51,6 +52,34 @@ struct perf_fd_response {
     int tid;
 };
 
+// Servers that do not know the flags ignore the extra field and reply with a copy of /proc/kallsyms
+#define KALLSYMS_IMAGE  1
+
+struct kallsyms_fd_request {
+    struct fd_request header;
+    unsigned int flags;
+};
+
+#define KALLSYMS_IMAGE_MAGIC    0x4d59534b  // "KSYM"
+#define KALLSYMS_IMAGE_VERSION  1
+
+// Kernel text symbols parsed once by the server into a sealed memfd, which all clients map.
+// The header is followed by u32 starts[count + 1], u32 lengths[count + 1] and u32 name_offsets[count + 1]
+// in Eytzinger order with slot 0 unused, and then by names_size bytes of names.
+// Each name is 2-byte aligned and preceded by a 4-byte NativeFunc header: short lib_index = -1, char mark, char reserved.
+struct kallsyms_image {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int count;
+    unsigned int names_size;
+    unsigned long long base;  // address that starts are relative to
+    unsigned long long max_address;
+};
+
+static inline size_t kallsymsImageSize(const struct kallsyms_image *image) {
+    return sizeof(*image) + ((size_t)image->count + 1) * 3 * sizeof(unsigned int) + image->names_size;
+}
+
 static inline bool socketPath(const char *path, struct sockaddr_un *sun, socklen_t *addrlen) {
     const int path_len = strlen(path);
     if (path_len > sizeof(sun->sun_path)) {
@@ -27,6 +27,7 @@ class FdTransferClient {
     }
 
     static int requestPerfFd(int* tid, int target_cpu, struct perf_event_attr* attr, const char* probe_name);
+    // Returns either a kallsyms_image memfd or a copy of /proc/kallsyms, depending on the server version
     static int requestKallsymsFd();
 };
 
@@ -76,8 +76,9 @@ int FdTransferClient::requestPerfFd(int* tid, int target_cpu, struct perf_event_
 }
 
 int FdTransferClient::requestKallsymsFd() {
-    struct fd_request request;
-    request.type = KALLSYMS_FD;
+    struct kallsyms_fd_request request;
+    request.header.type = KALLSYMS_FD;
+    request.flags = KALLSYMS_IMAGE;
 
     if (RESTARTABLE(send(_peer, &request, sizeof(request), 0)) != sizeof(request)) {
         Log::warn("FdTransferClient send(): %s", strerror(errno));
@@ -85,7 +86,7 @@ int FdTransferClient::requestKallsymsFd() {
     }
 
     struct fd_response resp;
-    int fd = recvFd(request.type, &resp, sizeof(resp));
+    int fd = recvFd(request.header.type, &resp, sizeof(resp));
     if (fd == -1) {
         errno = resp.error;
     }
@@ -85,6 +85,12 @@ class Node {
 
 
 Trie* FlameGraph::addChild(Trie* f, const char* name, FrameTypeId type, u64 value) {
+    Trie* child = this->child(f, name, type);
+    count(f, child, type, value);
+    return child;
+}
+
+Trie* FlameGraph::child(Trie* f, const char* name, FrameTypeId type) {
     size_t len = strlen(name);
     bool has_suffix = len > 4 && name[len - 4] == '_' && name[len - 3] == '[' && name[len - 1] == ']';
     std::string s(name, has_suffix ? len - 4 : len);
@@ -94,20 +100,31 @@ Trie* FlameGraph::addChild(Trie* f, const char* name, FrameTypeId type, u64 valu
         name_index = _cpool[s] = _cpool.size();
     }
 
+    switch (type) {
+        case FRAME_INLINED:
+        case FRAME_C1_COMPILED:
+        case FRAME_INTERPRETED:
+            return f->child(name_index, FRAME_JIT_COMPILED);
+        default:
+            return f->child(name_index, type);
+    }
+}
+
+void FlameGraph::count(Trie* f, Trie* child, FrameTypeId type, u64 value) {
     f->_total += value;
 
     switch (type) {
         case FRAME_INLINED:
-            (f = f->child(name_index, FRAME_JIT_COMPILED))->_inlined += value;
-            return f;
+            child->_inlined += value;
+            break;
         case FRAME_C1_COMPILED:
-            (f = f->child(name_index, FRAME_JIT_COMPILED))->_c1_compiled += value;
-            return f;
+            child->_c1_compiled += value;
+            break;
         case FRAME_INTERPRETED:
-            (f = f->child(name_index, FRAME_JIT_COMPILED))->_interpreted += value;
-            return f;
+            child->_interpreted += value;
+            break;
         default:
-            return f->child(name_index, type);
+            break;
     }
 }
 
@@ -112,6 +112,10 @@ class FlameGraph {
 
     Trie* addChild(Trie* f, const char* name, FrameTypeId type, u64 value);
 
+    // addChild in two steps, so that callers can remember the child and count more values later
+    Trie* child(Trie* f, const char* name, FrameTypeId type);
+    static void count(Trie* f, Trie* child, FrameTypeId type, u64 value);
+
     void dump(Writer& out, bool tree);
 };
 
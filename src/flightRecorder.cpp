@@ -6,19 +6,24 @@
 #include <assert.h>
 #include <map>
 #include <string>
+#include <vector>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 #include "flightRecorder.h"
 #include "incbin.h"
+#include "index.h"
 #include "jfrMetadata.h"
 #include "lookup.h"
+#include "mutex.h"
 #include "os.h"
 #include "processSampler.h"
 #include "profiler.h"
@@ -43,6 +48,8 @@ const int SMALL_BUFFER_LIMIT = SMALL_BUFFER_SIZE - 128;
 const int RECORDING_BUFFER_SIZE = 65536;
 const int RECORDING_BUFFER_LIMIT = RECORDING_BUFFER_SIZE - 4096;
 const int MAX_STRING_LENGTH = 8191;
+const int ASYNC_QUEUE_SLOTS_PER_BUFFER = 2;
+const u64 ASYNC_WRITER_INTERVAL = 10000;  // us
 const u64 MAX_JLONG = 0x7fffffffffffffffULL;
 const u64 MIN_JLONG = 0x8000000000000000ULL;
 
@@ -219,6 +226,23 @@ class RecordingBuffer : public Buffer {
     }
 };
 
+// Log events that arrive while a chunk switch holds _rec_lock exclusively.
+// They are written to the recording as soon as the switch is over.
+static SpinLock _pending_logs_lock;
+static RecordingBuffer _pending_logs;
+
+
+// Constant pool references of a class, resolved once per recording
+struct ClassRef {
+    u32 symbol;   // 0 if not resolved yet
+    u32 package;
+};
+
+// A completed chunk retained in memory in the ring buffer mode
+struct RingChunk {
+    int fd;
+    off_t size;
+};
 
 class Recording {
   private:
@@ -227,20 +251,36 @@ class Recording {
     static char* _jvm_flags;
     static char* _java_command;
 
-    RecordingBuffer _buf[CONCURRENCY_LEVEL];
+    // Two sets of event buffers and recorded threads: samplers fill one set,
+    // while the previous chunk is being finished with the other.
+    // Each set has a buffer per sampler slot; memory of a buffer is not touched until its slot is used.
+    int _num_bufs;
+    RecordingBuffer* _bufs[2];
+    RecordingBuffer* _buf;
+    ThreadFilter _thread_sets[2];
+    ThreadFilter* _thread_set;
     int _fd;
     int _memfd;
     char* _master_recording_file;
     off_t _chunk_start;
-    ThreadFilter _thread_set;
+
+    // Constant pool dictionaries live as long as the recording. Each chunk emits
+    // only the symbols and packages marked as referenced by its methods and classes.
     MethodMap _method_map;
+    Index _symbols;
+    Index _packages;
+    std::vector<ClassRef> _class_refs;
+    std::vector<u32> _package_symbols;
+    std::vector<bool> _symbol_marks;
+    std::vector<bool> _package_marks;
+    u64 _cpool_time;
+    u64 _cpool_count;
 
     u64 _start_time;
     u64 _start_ticks;
     u64 _stop_time;
     u64 _stop_ticks;
 
-    u64 _base_id;
     u64 _bytes_written;
     u64 _chunk_size;
     u64 _chunk_time;
@@ -257,23 +297,76 @@ class Recording {
     RecordingBuffer _proc_buf;
     ProcessSampler _process_sampler;
 
+    // Async writer: signal handlers copy filled event buffers to free queue slots,
+    // and the writer thread periodically drains ready slots to the file
+    enum SlotState {
+        SLOT_FREE,
+        SLOT_BUSY,
+        SLOT_READY
+    };
+
+    // The queue has ASYNC_QUEUE_SLOTS_PER_BUFFER slots per event buffer, so that it scales with the sampler slots
+    RecordingBuffer* _queue;
+    volatile int* _queue_state;
+    int _queue_size;
+    struct iovec* _queue_iov;  // scratch arrays of drainQueue, guarded by _writer_lock
+    int* _queue_slots;
+    volatile int _queue_next;
+    u64 _bytes_dropped;
+    WaitableMutex _writer_lock;
+    volatile bool _writer_running;
+    pthread_t _writer_thread;
+
+    // Ring buffer mode: every chunk is written to its own memory file, and _fd points to the current one.
+    // Completed chunks are kept up to _ring_limit bytes; the output file is written only on dump or stop.
+    int _out_fd;
+    off_t _ring_base;
+    size_t _ring_limit;
+    size_t _ring_bytes;
+    std::vector<RingChunk> _ring;
+
+    // Where samplers write events. During a chunk switch, the next chunk starts in the staging
+    // memory file, so that samplers do not wait until the constant pool of the previous one is written.
+    volatile int _event_fd;
+    int _staging_fd;
+
+    static void* writerEntry(void* rec) {
+        ((Recording*)rec)->writerLoop();
+        return NULL;
+    }
+
     static float ratio(float value) {
         return value < 0 ? 0 : value > 1 ? 1 : value;
     }
 
   public:
-    Recording(int fd, const char* master_recording_file, Arguments& args) : _fd(fd), _thread_set(), _method_map() {
+    Recording(int fd, const char* master_recording_file, Arguments& args) : _fd(fd), _method_map(), _symbols(1), _packages(1) {
+        _num_bufs = Profiler::instance()->concurrencyLevel();
+        _bufs[0] = new RecordingBuffer[_num_bufs];
+        _bufs[1] = new RecordingBuffer[_num_bufs];
+        _buf = _bufs[0];
+        _thread_set = &_thread_sets[0];
         _master_recording_file = master_recording_file == NULL ? NULL : strdup(master_recording_file);
+        _out_fd = -1;
+        _ring_bytes = 0;
+        if (args._jfr_ring > 0 && _master_recording_file == NULL) {
+            startRing(args._jfr_ring);
+        }
         _chunk_start = lseek(_fd, 0, SEEK_END);
         _start_time = OS::micros();
         _start_ticks = TSC::ticks();
-        _base_id = 0;
+        _cpool_time = 0;
+        _cpool_count = 0;
         _bytes_written = 0;
         _memfd = -1;
         _in_memory = false;
 
         _chunk_size = args._chunk_size <= 0 ? MAX_JLONG : (args._chunk_size < 262144 ? 262144 : args._chunk_size);
         _chunk_time = args._chunk_time <= 0 ? MAX_JLONG : (args._chunk_time < 5 ? 5 : args._chunk_time) * 1000000ULL;
+        if (_out_fd >= 0 && _chunk_size > _ring_limit / 4) {
+            // Keep several chunks in the ring, so that dropping the oldest one loses a small part of the window
+            _chunk_size = _ring_limit / 4 < 262144 ? 262144 : _ring_limit / 4;
+        }
 
         _available_processors = OS::getCpuCount();
 
@@ -296,9 +389,11 @@ class Recording {
         }
         flush(_buf);
 
-        if (args.hasOption(IN_MEMORY) && (_memfd = OS::createMemoryFile("async-profiler-recording")) >= 0) {
+        if (args.hasOption(IN_MEMORY) && _out_fd < 0 && (_memfd = OS::createMemoryFile("async-profiler-recording")) >= 0) {
             _in_memory = true;
         }
+        _event_fd = _in_memory ? _memfd : _fd;
+        _staging_fd = OS::createMemoryFile("async-profiler-chunk");
 
         _cpu_monitor_enabled = !args.hasOption(NO_CPU_LOAD);
         if (_cpu_monitor_enabled) {
@@ -312,50 +407,96 @@ class Recording {
         if (args._proc > 0) {
             _process_sampler.enable(args._proc * 1000000);
         }
+
+        _queue = NULL;
+        _queue_size = _num_bufs * ASYNC_QUEUE_SLOTS_PER_BUFFER;
+        _queue_next = 0;
+        _bytes_dropped = 0;
+        _writer_running = false;
+        if (args.hasOption(ASYNC_WRITER)) {
+            startWriter();
+        }
     }
 
     ~Recording() {
+        stopWriter();
         off_t chunk_end = finishChunk();
 
+        if (_queue != NULL) {
+            freeQueue();
+            if (_bytes_dropped > 0) {
+                Log::warn("JFR writer could not keep up: %llu bytes of events dropped", _bytes_dropped);
+            }
+        }
+
         if (_memfd >= 0) {
             close(_memfd);
         }
+        if (_staging_fd >= 0) {
+            close(_staging_fd);
+        }
 
         if (_master_recording_file != NULL) {
             appendRecording(_master_recording_file, chunk_end);
             free(_master_recording_file);
         }
 
+        if (_out_fd >= 0) {
+            int fd = retainChunk(chunk_end);
+            if (fd >= 0) {
+                close(fd);
+            }
+            writeRing();
+            for (size_t i = 0; i < _ring.size(); i++) {
+                close(_ring[i].fd);
+            }
+            _fd = _out_fd;
+        }
+
         close(_fd);
+        delete[] _bufs[0];
+        delete[] _bufs[1];
     }
 
+    // Called when no events are being recorded
     off_t finishChunk() {
+        drainQueue();
+        _stop_time = OS::micros();
+        _stop_ticks = TSC::ticks();
+        Profiler::instance()->_call_trace_storage.swapEpoch();
+        return finishChunk(_buf, _thread_set);
+    }
+
+    // Completes the chunk with events from the given buffers and the constant pool.
+    // The first buffer is reused for writing the constant pool.
+    off_t finishChunk(RecordingBuffer* bufs, ThreadFilter* threads) {
+        Buffer* buf = bufs;
         flush(&_monitor_buf);
         flush(&_proc_buf);
 
-        writeNativeLibraries(_buf);
+        writeNativeLibraries(buf);
 
-        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
-            flush(&_buf[i]);
+        for (int i = 0; i < _num_bufs; i++) {
+            flush(&bufs[i]);
         }
 
-        _stop_time = OS::micros();
-        _stop_ticks = TSC::ticks();
-
         if (_memfd >= 0) {
             OS::copyFile(_memfd, _fd, 0, lseek(_memfd, 0, SEEK_CUR));
             _in_memory = false;
         }
 
         off_t cpool_offset = lseek(_fd, 0, SEEK_CUR);
-        writeCpool(_buf);
-        flush(_buf);
+        u64 cpool_start = OS::nanotime();
+        writeCpool(buf, threads);
+        flush(buf);
+        _cpool_time += OS::nanotime() - cpool_start;
+        _cpool_count++;
 
         off_t chunk_end = lseek(_fd, 0, SEEK_CUR);
 
         // Patch cpool size field
-        _buf->putVar32(0, chunk_end - cpool_offset);
-        ssize_t result = pwrite(_fd, _buf->data(), 5, cpool_offset);
+        buf->putVar32(0, chunk_end - cpool_offset);
+        ssize_t result = pwrite(_fd, buf->data(), 5, cpool_offset);
         (void)result;
 
         // Workaround for JDK-8191415: compute actual TSC frequency, in case JFR is wrong
@@ -368,27 +509,110 @@ class Recording {
         }
 
         // Patch chunk header
-        _buf->put64(chunk_end - _chunk_start);
-        _buf->put64(cpool_offset - _chunk_start);
-        _buf->put64(68);
-        _buf->put64(_start_time * 1000);
-        _buf->put64((_stop_time - _start_time) * 1000);
-        _buf->put64(_start_ticks);
-        _buf->put64(tsc_frequency);
-        result = pwrite(_fd, _buf->data(), 56, _chunk_start + 8);
+        buf->put64(chunk_end - _chunk_start);
+        buf->put64(cpool_offset - _chunk_start);
+        buf->put64(68);
+        buf->put64(_start_time * 1000);
+        buf->put64((_stop_time - _start_time) * 1000);
+        buf->put64(_start_ticks);
+        buf->put64(tsc_frequency);
+        result = pwrite(_fd, buf->data(), 56, _chunk_start + 8);
         (void)result;
 
         OS::freePageCache(_fd, _chunk_start);
 
-        _buf->reset();
+        buf->reset();
         return chunk_end;
     }
 
+    // Samplers are paused only to swap event buffers, thread sets and call trace epochs.
+    // Meanwhile, the next chunk is written to the staging file, and the previous one
+    // is completed without holding any locks.
     void switchChunk() {
+        if (_staging_fd < 0) {
+            switchChunkLocked();
+            return;
+        }
+
+        Profiler* profiler = Profiler::instance();
+        RecordingBuffer* prev_buf = _buf;
+        ThreadFilter* prev_threads = _thread_set;
+        RecordingBuffer* next_buf = _buf == _bufs[0] ? _bufs[1] : _bufs[0];
+        ThreadFilter* next_threads = _thread_set == &_thread_sets[0] ? &_thread_sets[1] : &_thread_sets[0];
+
+        // The header of the next chunk is patched when the chunk is finished,
+        // so the start time written here need not be exact
+        u64 start_time = _start_time;
+        u64 start_ticks = _start_ticks;
+        _start_time = OS::micros();
+        _start_ticks = TSC::ticks();
+        truncateFile(_staging_fd);
+        writeHeader(next_buf);
+        writeMetadata(next_buf);
+        writeRecordingInfo(next_buf);
+        flush(next_buf, _staging_fd);
+        _stop_time = _start_time;
+        _stop_ticks = _start_ticks;
+        _start_time = start_time;
+        _start_ticks = start_ticks;
+
+        profiler->lockAll();
+        drainQueue();
+        _buf = next_buf;
+        _thread_set = next_threads;
+        _event_fd = _staging_fd;
+        profiler->_call_trace_storage.swapEpoch();
+        profiler->unlockAll();
+
+        off_t chunk_end = finishChunk(prev_buf, prev_threads);
+        // Final writes of the previous chunk do not count towards the size of the next one,
+        // which has been growing in the staging file all along
+        storeRelease(_bytes_written, lseek(_staging_fd, 0, SEEK_CUR));
+        _start_time = _stop_time;
+        _start_ticks = _stop_ticks;
+
+        if (_out_fd >= 0) {
+            // Ring buffer mode: the staging file simply becomes the current chunk
+            int fd = retainChunk(chunk_end);
+            _fd = _staging_fd;
+            _chunk_start = 0;
+            _staging_fd = fd >= 0 ? fd : OS::createMemoryFile("async-profiler-chunk");
+            return;
+        }
+
+        _chunk_start = chunk_end;
+        if (_memfd >= 0) {
+            truncateFile(_memfd);
+            _in_memory = true;
+        }
+
+        // Most of the staged data is moved without locks; the rest is appended
+        // while samplers are paused, right before they are switched to the recording file
+        off_t staged = lseek(_staging_fd, 0, SEEK_CUR);
+        OS::copyFile(_staging_fd, _fd, 0, staged);
+
+        profiler->lockAll();
+        drainQueue();
+        off_t staged_end = lseek(_staging_fd, 0, SEEK_CUR);
+        OS::copyFile(_staging_fd, _fd, staged, staged_end - staged);
+        _event_fd = _in_memory ? _memfd : _fd;
+        profiler->unlockAll();
+
+        truncateFile(_staging_fd);
+    }
+
+    // Fallback when a staging file is not available: the whole switch happens with samplers paused
+    void switchChunkLocked() {
+        Profiler* profiler = Profiler::instance();
+        profiler->lockAll();
+
         _chunk_start = finishChunk();
+        if (_out_fd >= 0) {
+            _fd = nextRingFile(_chunk_start);
+            _chunk_start = 0;
+        }
         _start_time = _stop_time;
         _start_ticks = _stop_ticks;
-        _base_id += 0x1000000;
         _bytes_written = 0;
 
         writeHeader(_buf);
@@ -397,18 +621,100 @@ class Recording {
         flush(_buf);
 
         if (_memfd >= 0) {
-            while (ftruncate(_memfd, 0) < 0 && errno == EINTR);  // restart if interrupted
+            truncateFile(_memfd);
             _in_memory = true;
         }
+        _event_fd = _in_memory ? _memfd : _fd;
+
+        profiler->unlockAll();
+    }
+
+    static void truncateFile(int fd) {
+        while (ftruncate(fd, 0) < 0 && errno == EINTR);  // restart if interrupted
+        lseek(fd, 0, SEEK_SET);
+    }
+
+    void startRing(size_t limit) {
+        int fd = OS::createMemoryFile("async-profiler-ring");
+        if (fd < 0) {
+            Log::warn("JFR ring buffer is not supported, writing to the file directly");
+            return;
+        }
+        _out_fd = _fd;
+        _ring_base = lseek(_out_fd, 0, SEEK_END);
+        _ring_limit = limit;
+        _fd = fd;
+    }
+
+    // Keeps the completed chunk, dropping the oldest ones beyond the memory limit.
+    // Returns a memory file of a dropped chunk ready for reuse, or -1.
+    int retainChunk(off_t size) {
+        RingChunk chunk = {_fd, size};
+        _ring.push_back(chunk);
+        _ring_bytes += size;
+
+        int free_fd = -1;
+        while (_ring_bytes > _ring_limit && _ring.size() > 1) {
+            RingChunk oldest = _ring.front();
+            _ring.erase(_ring.begin());
+            _ring_bytes -= oldest.size;
+            if (free_fd < 0) {
+                free_fd = oldest.fd;
+            } else {
+                close(oldest.fd);
+            }
+        }
+        return free_fd;
+    }
+
+    int nextRingFile(off_t completed_size) {
+        int fd = retainChunk(completed_size);
+        if (fd < 0 && (fd = OS::createMemoryFile("async-profiler-ring")) < 0) {
+            // Cannot grow the ring: sacrifice the oldest chunk
+            fd = _ring.front().fd;
+            _ring_bytes -= _ring.front().size;
+            _ring.erase(_ring.begin());
+        }
+        truncateFile(fd);
+        return fd;
+    }
+
+    // Replaces the previous contents of the output file with all chunks retained in the ring
+    void writeRing() {
+        if (_out_fd < 0) return;
+
+        if (ftruncate(_out_fd, _ring_base) < 0) {
+            Log::warn("Failed to truncate JFR recording: %s", strerror(errno));
+        }
+        lseek(_out_fd, _ring_base, SEEK_SET);
+        for (size_t i = 0; i < _ring.size(); i++) {
+            OS::copyFile(_ring[i].fd, _out_fd, 0, _ring[i].size);
+        }
     }
 
     bool needSwitchChunk(u64 wall_time) {
         return loadAcquire(_bytes_written) >= _chunk_size || wall_time - _start_time >= _chunk_time;
     }
 
+    u64 cpoolTime(u64* chunks) {
+        *chunks = _cpool_count;
+        return _cpool_time;
+    }
+
     size_t usedMemory() {
-        return _method_map.usedMemory() + _thread_set.usedMemory() +
-               (_memfd >= 0 ? lseek(_memfd, 0, SEEK_CUR) : 0);
+        return _method_map.usedMemory() + _symbols.usedMemory() + _packages.usedMemory() +
+               _class_refs.capacity() * sizeof(ClassRef) + _thread_sets[0].usedMemory() + _thread_sets[1].usedMemory() + _ring_bytes +
+               (_memfd >= 0 ? lseek(_memfd, 0, SEEK_CUR) : 0) +
+               (_staging_fd >= 0 ? lseek(_staging_fd, 0, SEEK_CUR) : 0) +
+               (_out_fd >= 0 ? lseek(_fd, 0, SEEK_CUR) : 0);
+    }
+
+    size_t slotMemory() {
+        size_t bytes = 2 * _num_bufs * sizeof(RecordingBuffer);
+        if (_queue != NULL) {
+            bytes += _queue_size * (sizeof(RecordingBuffer) + 2 * sizeof(int) + sizeof(struct iovec));
+        }
+        return bytes;
     }
 
     void cpuMonitorCycle() {
@@ -557,11 +863,34 @@ class Recording {
     }
 
     void flush(Buffer* buf) {
-        ssize_t result = write(_in_memory ? _memfd : _fd, buf->data(), buf->offset());
-        if (result > 0) {
+        flush(buf, _in_memory ? _memfd : _fd);
+    }
+
+    void flush(Buffer* buf, int fd) {
+        struct iovec iov = {(void*)buf->data(), (size_t)buf->offset()};
+        writeFully(fd, &iov, 1);
+        buf->reset();
+    }
+
+    // Resumes after a partial write until all buffers are written or an error occurs.
+    // The iovec array is modified
+    void writeFully(int fd, struct iovec* iov, int count) {
+        while (count > 0) {
+            ssize_t result = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+            if (result <= 0) {
+                if (result < 0 && errno == EINTR) continue;
+                break;
+            }
             atomicInc(_bytes_written, result);
+
+            for (; count > 0 && (size_t)result >= iov->iov_len; iov++, count--) {
+                result -= iov->iov_len;
+            }
+            if (count > 0) {
+                iov->iov_base = (char*)iov->iov_base + result;
+                iov->iov_len -= result;
+            }
         }
-        buf->reset();
     }
 
     void flushIfNeeded(Buffer* buf, int limit = RECORDING_BUFFER_LIMIT) {
@@ -570,6 +899,105 @@ class Recording {
         }
     }
 
+    // Called from signal handlers: in async mode, never blocks on I/O
+    void flushEventBuffer(Buffer* buf) {
+        if (buf->offset() < RECORDING_BUFFER_LIMIT) {
+            return;
+        } else if (_queue == NULL) {
+            flush(buf, _event_fd);
+        } else if (!enqueue(buf)) {
+            // All slots are waiting for the writer; discard events to keep handler latency bounded
+            atomicInc(_bytes_dropped, buf->offset());
+            buf->reset();
+        }
+    }
+
+    bool enqueue(Buffer* buf) {
+        int start = atomicInc(_queue_next);
+        for (int i = 0; i < _queue_size; i++) {
+            int slot = (unsigned int)(start + i) % _queue_size;
+            if (__sync_bool_compare_and_swap(&_queue_state[slot], SLOT_FREE, SLOT_BUSY)) {
+                _queue[slot].reset();
+                _queue[slot].put(buf->data(), buf->offset());
+                buf->reset();
+                __atomic_store_n(&_queue_state[slot], SLOT_READY, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Writes all ready slots with as few writev calls as possible. Slots are independent sequences
+    // of complete events, so the order in which they reach the file does not matter.
+    void drainQueue() {
+        if (_queue == NULL) return;
+
+        MutexLocker ml(_writer_lock);
+
+        struct iovec* iov = _queue_iov;
+        int* slots = _queue_slots;
+        int count = 0;
+
+        for (int slot = 0; slot < _queue_size; slot++) {
+            if (__atomic_load_n(&_queue_state[slot], __ATOMIC_ACQUIRE) == SLOT_READY) {
+                iov[count].iov_base = (void*)_queue[slot].data();
+                iov[count].iov_len = _queue[slot].offset();
+                slots[count++] = slot;
+            }
+        }
+
+        if (count > 0) {
+            // A slot is reused only after all of its bytes have been written
+            writeFully(_event_fd, iov, count);
+            for (int i = 0; i < count; i++) {
+                __atomic_store_n(&_queue_state[slots[i]], SLOT_FREE, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    void startWriter() {
+        _queue = new RecordingBuffer[_queue_size];
+        _queue_state = new int[_queue_size];
+        _queue_iov = new struct iovec[_queue_size];
+        _queue_slots = new int[_queue_size];
+        for (int i = 0; i < _queue_size; i++) {
+            _queue_state[i] = SLOT_FREE;
+        }
+
+        _writer_running = true;
+        if (pthread_create(&_writer_thread, NULL, writerEntry, this) != 0) {
+            Log::warn("Unable to create JFR writer thread");
+            _writer_running = false;
+            freeQueue();
+        }
+    }
+
+    void freeQueue() {
+        delete[] _queue;
+        delete[] _queue_state;
+        delete[] _queue_iov;
+        delete[] _queue_slots;
+        _queue = NULL;
+    }
+
+    void stopWriter() {
+        if (_writer_running) {
+            _writer_lock.lock();
+            _writer_running = false;
+            _writer_lock.notify();
+            _writer_lock.unlock();
+            pthread_join(_writer_thread, NULL);
+        }
+    }
+
+    void writerLoop() {
+        MutexLocker ml(_writer_lock);
+        while (_writer_running) {
+            _writer_lock.waitUntil(OS::micros() + ASYNC_WRITER_INTERVAL);
+            drainQueue();
+        }
+    }
+
     void writeHeader(Buffer* buf) {
         buf->put("FLR\0", 4);            // magic
         buf->put16(2);                   // major
@@ -658,6 +1086,14 @@ class Recording {
             writeIntSetting(buf, T_EXECUTION_SAMPLE, "interval", args._interval);
             writeBoolSetting(buf, T_EXECUTION_SAMPLE, "alluser", args._alluser);
         }
+        if (args._counters != NULL) {
+            // Counter names in the order of values in PerfCounterSample, the sampling event first
+            snprintf(str, sizeof(str), "%s+%s", args._event, args._counters);
+            for (char* c = str; *c != 0; c++) {
+                if (*c == '+') *c = ',';
+            }
+            writeStringSetting(buf, T_PERF_COUNTER_SAMPLE, "counters", str);
+        }
         if (args._wall >= 0) {
             writeIntSetting(buf, T_EXECUTION_SAMPLE, "wall", args._wall);
             writeBoolSetting(buf, T_EXECUTION_SAMPLE, "nobatch", args._nobatch);
@@ -825,7 +1261,7 @@ class Recording {
         _recorded_lib_count = native_lib_count;
     }
 
-    void writeCpool(Buffer* buf) {
+    void writeCpool(Buffer* buf, ThreadFilter* thread_set) {
         buf->skip(5);  // size will be patched later
         buf->putVar32(T_CPOOL);
         buf->putVar64(_start_ticks);
@@ -835,13 +1271,11 @@ class Recording {
 
         buf->putVar32(11);
 
-        Index packages(1);
-        Index symbols(1);
-        Lookup lookup(&_method_map, Profiler::instance()->classMap(), &packages, &symbols, OUTPUT_JFR);
+        Lookup lookup(&_method_map, Profiler::instance()->classMap(), &_packages, &_symbols, OUTPUT_JFR);
         writeFrameTypes(buf);
         writeThreadStates(buf);
         writeGCWhen(buf);
-        writeThreads(buf);
+        writeThreads(buf, thread_set);
         writeStackTraces(buf, &lookup);
         writeMethods(buf, &lookup);
         writeClasses(buf, &lookup);
@@ -895,10 +1329,10 @@ class Recording {
         buf->putVar32(AFTER_GC);           buf->putUtf8("After GC");
     }
 
-    void writeThreads(Buffer* buf) {
+    void writeThreads(Buffer* buf, ThreadFilter* thread_set) {
         std::vector<int> threads;
-        _thread_set.collect(threads);
-        _thread_set.clear();
+        thread_set->collect(threads);
+        thread_set->clear();
 
         Profiler* profiler = Profiler::instance();
         MutexLocker ml(profiler->_thread_names_lock);
@@ -943,11 +1377,12 @@ class Recording {
             buf->putVar32(it->first);
             buf->putVar32(0);  // truncated
             buf->putVar32(trace->num_frames);
-            for (int i = 0; i < trace->num_frames; i++) {
-                MethodInfo* mi = lookup->resolveMethod(trace->frames[i]);
+            for (CallTraceIterator frames(trace); frames.hasNext(); ) {
+                const ASGCT_CallFrame& frame = frames.next();
+                MethodInfo* mi = lookup->resolveMethod(frame);
                 buf->putVar32(mi->_key);
                 if (mi->_type == FRAME_INTERPRETED) {
-                    jint bci = trace->frames[i].bci;
+                    jint bci = frame.bci;
                     FrameTypeId type = FrameType::decode(bci);
                     bci = (bci & 0x10000) ? 0 : (bci & 0xffff);
                     buf->putVar32(mi->getLineNumber(bci));
@@ -981,8 +1416,8 @@ class Recording {
                 mi._mark = false;
                 buf->putVar32(mi._key);
                 buf->putVar32(mi._class);
-                buf->putVar64(mi._name | _base_id);
-                buf->putVar64(mi._sig | _base_id);
+                buf->putVar64(markSymbol(mi._name));
+                buf->putVar64(markSymbol(mi._sig));
                 buf->putVar32(mi._modifiers);
                 buf->putVar32(0);  // hidden
                 flushIfNeeded(buf);
@@ -996,31 +1431,79 @@ class Recording {
 
         writePoolHeader(buf, T_CLASS, classes.size());
         for (std::map<u32, const char*>::const_iterator it = classes.begin(); it != classes.end(); ++it) {
+            if (it->first >= _class_refs.size()) {
+                _class_refs.resize(it->first + 1);
+            }
+            ClassRef& ref = _class_refs[it->first];
+            if (ref.symbol == 0) {
+                ref.symbol = lookup->_symbols->indexOf(it->second);
+                ref.package = lookup->getPackage(it->second);
+            }
+
             buf->putVar32(it->first);
             buf->putVar32(0);  // classLoader
-            buf->putVar64(lookup->_symbols->indexOf(it->second) | _base_id);
-            buf->putVar64(lookup->getPackage(it->second) | _base_id);
+            buf->putVar64(markSymbol(ref.symbol));
+            buf->putVar64(markPackage(ref.package));
             buf->putVar32(0);  // access flags
             flushIfNeeded(buf);
         }
     }
 
     void writePackages(Buffer* buf, Lookup* lookup) {
-        writePoolHeader(buf, T_PACKAGE, lookup->_packages->size());
-        lookup->_packages->forEachOrdered([&] (size_t idx, const std::string& s) {
-            buf->putVar64(idx | _base_id);
-            buf->putVar64(lookup->_symbols->indexOf(s) | _base_id);
+        writePoolHeader(buf, T_PACKAGE, countMarks(_package_marks));
+        for (size_t idx = 0; idx < _package_marks.size(); idx++) {
+            if (!_package_marks[idx]) continue;
+            _package_marks[idx] = false;
+
+            if (idx >= _package_symbols.size()) {
+                _package_symbols.resize(idx + 1);
+            }
+            u32& symbol = _package_symbols[idx];
+            if (symbol == 0) {
+                symbol = lookup->_symbols->indexOf(lookup->_packages->valueAt(idx));
+            }
+
+            buf->putVar64(idx);
+            buf->putVar64(markSymbol(symbol));
             flushIfNeeded(buf);
-        });
+        }
     }
 
     void writeSymbols(Buffer* buf, Lookup* lookup) {
-        writePoolHeader(buf, T_SYMBOL, lookup->_symbols->size());
-        lookup->_symbols->forEachOrdered([&] (size_t idx, const std::string& s) {
+        writePoolHeader(buf, T_SYMBOL, countMarks(_symbol_marks));
+        for (size_t idx = 0; idx < _symbol_marks.size(); idx++) {
+            if (!_symbol_marks[idx]) continue;
+            _symbol_marks[idx] = false;
+
             flushIfNeeded(buf, RECORDING_BUFFER_LIMIT - MAX_STRING_LENGTH);
-            buf->putVar64(idx | _base_id);
-            buf->putUtf8(s.c_str());
-        });
+            buf->putVar64(idx);
+            buf->putUtf8(lookup->_symbols->valueAt(idx).c_str());
+        }
+    }
+
+    u32 markSymbol(u32 idx) {
+        return mark(_symbol_marks, idx);
+    }
+
+    u32 markPackage(u32 idx) {
+        // Package 0 stands for a class without a package
+        return idx == 0 ? 0 : mark(_package_marks, idx);
+    }
+
+    static u32 mark(std::vector<bool>& marks, u32 idx) {
+        if (idx >= marks.size()) {
+            marks.resize(idx + 1);
+        }
+        marks[idx] = true;
+        return idx;
+    }
+
+    static u32 countMarks(const std::vector<bool>& marks) {
+        u32 count = 0;
+        for (size_t i = 0; i < marks.size(); i++) {
+            if (marks[i]) count++;
+        }
+        return count;
     }
 
     void writeLogLevels(Buffer* buf) {
@@ -1054,6 +1537,19 @@ class Recording {
         buf->put8(start, buf->offset() - start);
     }
 
+    void recordPerfCounterSample(Buffer* buf, int tid, u32 call_trace_id, PerfSampleEvent* event) {
+        int start = buf->skip(1);
+        buf->put8(T_PERF_COUNTER_SAMPLE);
+        buf->putVar64(event->_start_time);
+        buf->putVar32(tid);
+        buf->putVar32(call_trace_id);
+        buf->putVar32(event->_num_counters);
+        for (u32 i = 0; i < event->_num_counters; i++) {
+            buf->putVar64(event->_counters[i]);
+        }
+        buf->put8(start, buf->offset() - start);
+    }
+
     void recordMethodTrace(Buffer* buf, int tid, u32 call_trace_id, MethodTraceEvent* event) {
         int start = buf->skip(1);
         buf->put8(T_METHOD_TRACE);
@@ -1076,6 +1572,16 @@ class Recording {
         buf->put8(start, buf->offset() - start);
     }
 
+    void recordOffCpuSample(Buffer* buf, int tid, u32 call_trace_id, OffCpuEvent* event) {
+        int start = buf->skip(1);
+        buf->put8(T_OFF_CPU_SAMPLE);
+        buf->putVar64(event->_start_time);
+        buf->putVar64(event->_end_time - event->_start_time);
+        buf->putVar32(tid);
+        buf->putVar32(call_trace_id);
+        buf->put8(start, buf->offset() - start);
+    }
+
     void recordAllocationInNewTLAB(Buffer* buf, int tid, u32 call_trace_id, AllocEvent* event) {
         int start = buf->skip(1);
         buf->put8(T_ALLOC_IN_NEW_TLAB);
@@ -1254,8 +1760,8 @@ class Recording {
     }
 
     void addThread(int tid) {
-        if (!_thread_set.accept(tid)) {
-            _thread_set.add(tid);
+        if (!_thread_set->accept(tid)) {
+            _thread_set->add(tid);
         }
     }
 };
@@ -1299,6 +1805,7 @@ Error FlightRecorder::start(Arguments& args, bool reset) {
         free(filename_tmp);
     }
 
+    clearPendingLogs();
     _rec = new Recording(fd, master_recording_file, args);
     _rec_lock.unlock();
     return Error::OK;
@@ -1314,6 +1821,7 @@ void FlightRecorder::stop() {
 
         delete _rec;
         _rec = NULL;
+        clearPendingLogs();
     }
 }
 
@@ -1321,8 +1829,30 @@ void FlightRecorder::flush() {
     if (_rec != NULL) {
         _rec_lock.lock();
         _rec->switchChunk();
+        flushPendingLogs(_rec);
+        _rec_lock.unlock();
+    }
+}
+
+void FlightRecorder::dump() {
+    if (_rec != NULL) {
+        _rec_lock.lock();
+        _rec->switchChunk();
+        _rec->writeRing();
+        flushPendingLogs(_rec);
+        _rec_lock.unlock();
+    }
+}
+
+u64 FlightRecorder::cpoolTime(u64* chunks) {
+    u64 time = 0;
+    *chunks = 0;
+    if (_rec != NULL) {
+        _rec_lock.lock();
+        time = _rec->cpoolTime(chunks);
         _rec_lock.unlock();
     }
+    return time;
 }
 
 size_t FlightRecorder::usedMemory() {
@@ -1335,6 +1865,16 @@ size_t FlightRecorder::usedMemory() {
     return bytes;
 }
 
+size_t FlightRecorder::slotMemory() {
+    size_t bytes = 0;
+    if (_rec != NULL) {
+        _rec_lock.lock();
+        bytes = _rec->slotMemory();
+        _rec_lock.unlock();
+    }
+    return bytes;
+}
+
 bool FlightRecorder::timerTick(u64 wall_time, u32 gc_id) {
     if (!_rec_lock.tryLockShared()) {
         // No active recording
@@ -1427,6 +1967,11 @@ void FlightRecorder::recordEvent(int lock_index, int tid, u32 call_trace_id,
         Buffer* buf = _rec->buffer(lock_index);
         switch (event_type) {
             case PERF_SAMPLE:
+                _rec->recordExecutionSample(buf, tid, call_trace_id, (ExecutionEvent*)event);
+                if (((PerfSampleEvent*)event)->_num_counters > 0) {
+                    _rec->recordPerfCounterSample(buf, tid, call_trace_id, (PerfSampleEvent*)event);
+                }
+                break;
             case EXECUTION_SAMPLE:
             case INSTRUMENTED_METHOD:
                 _rec->recordExecutionSample(buf, tid, call_trace_id, (ExecutionEvent*)event);
@@ -1437,6 +1982,9 @@ void FlightRecorder::recordEvent(int lock_index, int tid, u32 call_trace_id,
             case WALL_CLOCK_SAMPLE:
                 _rec->recordWallClockSample(buf, tid, call_trace_id, (WallClockEvent*)event);
                 break;
+            case OFF_CPU_SAMPLE:
+                _rec->recordOffCpuSample(buf, tid, call_trace_id, (OffCpuEvent*)event);
+                break;
             case MALLOC_SAMPLE:
                 _rec->recordMallocSample(buf, tid, call_trace_id, (MallocEvent*)event);
                 break;
@@ -1465,13 +2013,14 @@ void FlightRecorder::recordEvent(int lock_index, int tid, u32 call_trace_id,
                 _rec->recordUserEvent(buf, tid, (UserEvent*)event);
                 break;
         }
-        _rec->flushIfNeeded(buf);
+        _rec->flushEventBuffer(buf);
         _rec->addThread(tid);
     }
 }
 
 void FlightRecorder::recordLog(LogLevel level, const char* message, size_t len) {
-    if (!_rec_lock.tryLockShared()) {
+    bool locked = _rec_lock.tryLockShared();
+    if (!locked && _rec == NULL) {
         // No active recording
         return;
     }
@@ -1486,7 +2035,36 @@ void FlightRecorder::recordLog(LogLevel level, const char* message, size_t len)
     buf->put8(level);
     buf->putUtf8(message, len);
     buf->putVar32(start, buf->offset() - start);
+
+    if (!locked) {
+        // The recording is switching chunks. The event is dropped only if too many are waiting
+        _pending_logs_lock.lock();
+        if (_pending_logs.offset() + buf->offset() <= RECORDING_BUFFER_LIMIT) {
+            _pending_logs.put(buf->data(), buf->offset());
+        }
+        _pending_logs_lock.unlock();
+        return;
+    }
+
+    if (_pending_logs.offset() > 0) {
+        flushPendingLogs(_rec);
+    }
     _rec->flush(buf);
 
     _rec_lock.unlockShared();
 }
+
+// Called with _rec_lock held
+void FlightRecorder::flushPendingLogs(Recording* rec) {
+    _pending_logs_lock.lock();
+    if (_pending_logs.offset() > 0) {
+        rec->flush(&_pending_logs);
+    }
+    _pending_logs_lock.unlock();
+}
+
+void FlightRecorder::clearPendingLogs() {
+    _pending_logs_lock.lock();
+    _pending_logs.reset();
+    _pending_logs_lock.unlock();
+}
@@ -20,6 +20,9 @@ class FlightRecorder {
     Error startMasterRecording(Arguments& args, const char* filename);
     void stopMasterRecording();
 
+    static void flushPendingLogs(Recording* rec);
+    static void clearPendingLogs();
+
   public:
     static const LogLevel MIN_LOG_LEVEL = LogLevel::LOG_DEBUG;
 
@@ -28,8 +31,15 @@ class FlightRecorder {
 
     Error start(Arguments& args, bool reset);
     void stop();
+    // Switches to a new chunk. Takes Profiler locks only for a short time: must not be called with them held
     void flush();
+    // Like flush, but in the ring buffer mode also writes retained chunks to the output file
+    void dump();
     size_t usedMemory();
+    // Event buffers and the async write queue, both sized by the number of sampler slots
+    size_t slotMemory();
+    // Total time spent writing constant pools, and the number of chunks written
+    u64 cpoolTime(u64* chunks);
     bool timerTick(u64 wall_time, u32 gc_id);
 
     bool active() const {
@@ -247,7 +247,7 @@ void FrameName::javaClassName(const char* symbol, size_t length, int style) {
     }
 }
 
-const char* FrameName::name(ASGCT_CallFrame& frame, bool for_matching) {
+const char* FrameName::name(const ASGCT_CallFrame& frame, bool for_matching) {
     if (frame.method_id == NULL) {
         return "[unknown]";
     }
@@ -324,7 +324,7 @@ const char* FrameName::name(ASGCT_CallFrame& frame, bool for_matching) {
     }
 }
 
-FrameTypeId FrameName::type(ASGCT_CallFrame& frame) {
+FrameTypeId FrameName::type(const ASGCT_CallFrame& frame) {
     if (frame.method_id == NULL) {
         return FRAME_NATIVE;
     }
@@ -16,6 +16,7 @@
 class Index {
   private:
     std::unordered_map<std::string, size_t> _idx_map;
+    std::vector<const std::string*> _values;
     size_t _start_index;
 
   public:
@@ -38,24 +39,41 @@ class Index {
     }
 
     size_t indexOf(const std::string& value) {
-        return _idx_map.insert({value, _start_index + _idx_map.size()}).first->second;
+        auto result = _idx_map.insert({value, _start_index + _idx_map.size()});
+        if (result.second) {
+            _values.push_back(&result.first->first);
+        }
+        return result.first->second;
     }
 
     size_t indexOf(std::string&& value) {
-        return _idx_map.insert({std::move(value), _start_index + _idx_map.size()}).first->second;
+        auto result = _idx_map.insert({std::move(value), _start_index + _idx_map.size()});
+        if (result.second) {
+            _values.push_back(&result.first->first);
+        }
+        return result.first->second;
+    }
+
+    // Keys of unordered_map never move, so the value of an index can be returned by reference
+    const std::string& valueAt(size_t idx) const {
+        return *_values[idx - _start_index];
     }
 
     size_t size() const {
         return _idx_map.size();
     }
 
-    void forEachOrdered(const std::function<void(size_t idx, const std::string&)>& consumer) const {
-        std::vector<const std::string*> arr(_idx_map.size());
-        for (const auto& it : _idx_map) {
-            arr[it.second - _start_index] = &it.first;
+    size_t usedMemory() const {
+        size_t bytes = _values.capacity() * sizeof(const std::string*);
+        for (const std::string* value : _values) {
+            bytes += sizeof(std::pair<std::string, size_t>) + sizeof(void*) * 2 + value->capacity();
         }
+        return bytes;
+    }
+
+    void forEachOrdered(const std::function<void(size_t idx, const std::string&)>& consumer) const {
         for (size_t idx = 0; idx < size(); ++idx) {
-            consumer(idx + _start_index, *arr[idx]);
+            consumer(idx + _start_index, *_values[idx]);
         }
     }
 };
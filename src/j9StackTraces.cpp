@@ -126,7 +126,9 @@ void J9StackTraces::timerLoop() {
                 }
             }
 
+            Profiler::instance()->lockLookups();
             int num_frames = Profiler::instance()->convertNativeTrace(notif->num_frames, notif->addr, frames, EXECUTION_SAMPLE);
+            Profiler::instance()->unlockLookups();
 
             for (int j = 0; j < num_jvmti_frames; j++) {
                 frames[num_frames].method_id = jvmti_frames[j].method;
@@ -68,6 +68,8 @@ enum JfrType {
     T_USER_EVENT = 122,
     T_PROCESS_SAMPLE = 123,
     T_NATIVE_LOCK = 124,
+    T_PERF_COUNTER_SAMPLE = 125,
+    T_OFF_CPU_SAMPLE = 126,
 
     // types after T_ANNOTATION inherit from java.lang.annotation.Annotation, see JfrMetadata::type
     T_ANNOTATION = 200,
@@ -9,6 +9,8 @@
 
 LinearAllocator::LinearAllocator(size_t chunk_size) {
     _chunk_size = chunk_size;
+    _limit = 0;
+    _chunks = 0;
     _reserve = _tail = allocateChunk(NULL);
 }
 
@@ -38,6 +40,23 @@ size_t LinearAllocator::usedMemory() {
     return bytes;
 }
 
+void LinearAllocator::swap(LinearAllocator& other) {
+    size_t limit = _limit;
+    size_t chunks = _chunks;
+    Chunk* tail = _tail;
+    Chunk* reserve = _reserve;
+
+    _limit = other._limit;
+    _chunks = other._chunks;
+    _tail = other._tail;
+    _reserve = other._reserve;
+
+    other._limit = limit;
+    other._chunks = chunks;
+    other._tail = tail;
+    other._reserve = reserve;
+}
+
 void* LinearAllocator::alloc(size_t size) {
     Chunk* chunk = _tail;
 
@@ -58,16 +77,25 @@ void* LinearAllocator::alloc(size_t size) {
 }
 
 Chunk* LinearAllocator::allocateChunk(Chunk* current) {
+    size_t chunks = __sync_add_and_fetch(&_chunks, 1);
+    if (_limit != 0 && chunks * _chunk_size > _limit && current != NULL) {
+        __sync_sub_and_fetch(&_chunks, 1);
+        return NULL;
+    }
+
     Chunk* chunk = (Chunk*)OS::safeAlloc(_chunk_size);
     if (chunk != NULL) {
         chunk->prev = current;
         chunk->offs = sizeof(Chunk);
+    } else {
+        __sync_sub_and_fetch(&_chunks, 1);
     }
     return chunk;
 }
 
 void LinearAllocator::freeChunk(Chunk* current) {
     OS::safeFree(current, _chunk_size);
+    __sync_sub_and_fetch(&_chunks, 1);
 }
 
 void LinearAllocator::reserveChunk(Chunk* current) {
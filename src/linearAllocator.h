@@ -19,6 +19,8 @@ struct Chunk {
 class LinearAllocator {
   private:
     size_t _chunk_size;
+    size_t _limit;
+    volatile size_t _chunks;
     Chunk* _tail;
     Chunk* _reserve;
 
@@ -34,6 +36,14 @@ class LinearAllocator {
     void clear();
     size_t usedMemory();
 
+    // Maximum number of bytes in all chunks, including the reserved one; 0 means no limit
+    void setLimit(size_t limit) {
+        _limit = limit;
+    }
+
+    // Exchanges all allocated chunks with another allocator of the same chunk size
+    void swap(LinearAllocator& other);
+
     void* alloc(size_t size);
 };
 
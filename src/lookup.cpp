@@ -41,21 +41,19 @@ size_t MethodMap::usedMemory() {
     return bytes;
 }
 
-MethodInfo* Lookup::resolveMethod(ASGCT_CallFrame& frame) {
+MethodInfo* Lookup::resolveMethod(const ASGCT_CallFrame& frame) {
     jmethodID method = frame.method_id;
     MethodInfo* mi = &(*_method_map)[method];
 
-    bool first_time = mi->_key == 0;
-    if (first_time) {
+    // Symbols and classes of a method are indexed for the whole recording, so the method
+    // is resolved only once; later chunks just mark it as referenced
+    mi->_mark = true;
+    if (mi->_key == 0) {
         mi->_key = _method_map->size();
-    }
-
-    if (!mi->_mark) {
-        mi->_mark = true;
         if (method == NULL) {
             fillNativeMethodInfo(mi, "unknown", NULL);
         } else if (frame.bci > BCI_NATIVE_FRAME) {
-            if (!fillJavaMethodInfo(mi, method, first_time)) {
+            if (!fillJavaMethodInfo(mi, method)) {
                 fillNativeMethodInfo(mi, "stale_jmethodID", NULL);
             }
         } else if (frame.bci == BCI_NATIVE_FRAME) {
@@ -131,7 +129,7 @@ void Lookup::fillNativeMethodInfo(MethodInfo* mi, const char* name, const char*
     }
 }
 
-bool Lookup::fillJavaMethodInfo(MethodInfo* mi, jmethodID method, bool first_time) {
+bool Lookup::fillJavaMethodInfo(MethodInfo* mi, jmethodID method) {
     if (VMMethod::isStaleMethodId(method)) {
         return false;
     }
@@ -165,11 +163,11 @@ bool Lookup::fillJavaMethodInfo(MethodInfo* mi, jmethodID method, bool first_tim
         return false;
     }
 
-    if (first_time && jvmti->GetMethodModifiers(method, &mi->_modifiers) != 0) {
+    if (jvmti->GetMethodModifiers(method, &mi->_modifiers) != 0) {
         mi->_modifiers = 0;
     }
 
-    if (first_time && jvmti->GetLineNumberTable(method, &mi->_line_number_table_size, &mi->_line_number_table) != 0) {
+    if (jvmti->GetLineNumberTable(method, &mi->_line_number_table_size, &mi->_line_number_table) != 0) {
         mi->_line_number_table_size = 0;
         mi->_line_number_table = NULL;
     }
@@ -56,7 +56,7 @@ class Lookup {
         assert(_packages != nullptr || output != OUTPUT_JFR);
     }
 
-    MethodInfo* resolveMethod(ASGCT_CallFrame& frame);
+    MethodInfo* resolveMethod(const ASGCT_CallFrame& frame);
     u32 getPackage(const char* class_name);
 
   private:
@@ -64,7 +64,7 @@ class Lookup {
     Output _output_type;
 
     void fillNativeMethodInfo(MethodInfo* mi, const char* name, const char* lib_name);
-    bool fillJavaMethodInfo(MethodInfo* mi, jmethodID method, bool first_time);
+    bool fillJavaMethodInfo(MethodInfo* mi, jmethodID method);
     void fillJavaClassInfo(MethodInfo* mi, u32 class_id);
 };
 
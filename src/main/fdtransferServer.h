@@ -14,8 +14,12 @@ class FdTransferServer {
   private:
     static int _server;
     static int _peer;
+    static int _kallsyms_image;
+    static unsigned long long _kallsyms_modules;
 
     static int copyFile(const char* src_name, const char* dst_name, mode_t mode);
+    static int createKallsymsImage();
+    static void refreshKallsymsImage();
     static bool sendFd(int fd, struct fd_response *resp, size_t resp_size);
 
     static bool bindServer(struct sockaddr_un *sun, socklen_t addrlen, int accept_timeout);
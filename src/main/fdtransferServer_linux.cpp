@@ -25,8 +25,96 @@
 #include "../jattach/psutil.h"
 
 
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING  2
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS   1033
+#define F_SEAL_SEAL   0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW   0x0004
+#define F_SEAL_WRITE  0x0008
+#endif
+
+
+// The same lookup as in PerfEventType, done here since tracefs is usually readable only by root.
+// The name comes from the peer, so anything but "category:event" is rejected
+// rather than turned into a path outside of the events directory.
+static int findTracepointId(const char* name) {
+    static const char* const dirs[] = {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"};
+
+    if (strchr(name, ':') == NULL || strchr(name, '/') != NULL || strstr(name, "..") != NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        char path[256];
+        if ((size_t)snprintf(path, sizeof(path), "%s/events/%s/id", dirs[i], name) >= sizeof(path)) {
+            return 0;
+        }
+        *strrchr(path, ':') = '/';  // make path from event name
+
+        int fd = open(path, O_RDONLY);
+        if (fd != -1) {
+            char num[16] = "0";
+            ssize_t r = read(fd, num, sizeof(num) - 1);
+            (void) r;
+            close(fd);
+            return atoi(num);
+        }
+    }
+    return 0;
+}
+
+
 int FdTransferServer::_server;
 int FdTransferServer::_peer;
+int FdTransferServer::_kallsyms_image = -1;
+unsigned long long FdTransferServer::_kallsyms_modules = 0;
+
+// Hashes name, size and load address of every loaded module. Reference counts are skipped,
+// since they change without affecting kernel symbols
+static unsigned long long modulesSignature() {
+    FILE* f = fopen("/proc/modules", "r");
+    if (f == NULL) {
+        return 0;
+    }
+
+    unsigned long long hash = 14695981039346656037ULL;
+    char line[1024];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char* name_end = strchr(line, ' ');
+        char* size_end = name_end != NULL ? strchr(name_end + 1, ' ') : NULL;
+        char* address = strrchr(line, ' ');
+        if (size_end == NULL) {
+            continue;
+        }
+        for (const char* c = line; c < size_end; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+        }
+        for (const char* c = address; *c != 0; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+        }
+    }
+
+    fclose(f);
+    return hash;
+}
+
+// Module symbols come and go with the modules, so the image is rebuilt once /proc/modules changes
+void FdTransferServer::refreshKallsymsImage() {
+    unsigned long long modules = modulesSignature();
+    if (_kallsyms_image != -1 && modules == _kallsyms_modules) {
+        return;
+    }
+
+    if (_kallsyms_image != -1) {
+        close(_kallsyms_image);
+    }
+    _kallsyms_image = createKallsymsImage();
+    _kallsyms_modules = modules;
+}
 
 bool FdTransferServer::bindServer(struct sockaddr_un *sun, socklen_t addrlen, int accept_timeout) {
     _server = socket(AF_UNIX, SOCK_SEQPACKET, 0);
@@ -116,7 +204,12 @@ bool FdTransferServer::serveRequests(int peer_pid) {
             int perf_fd = -1;
             int error;
 
-            if (request->probe_name[0]) {
+            if (request->attr.type == PERF_TYPE_TRACEPOINT) {
+                if (request->attr.config == 0 && request->probe_name[0]) {
+                    request->probe_name[sizeof(request->probe_name) - 1] = 0;
+                    request->attr.config = findTracepointId(request->probe_name);
+                }
+            } else if (request->probe_name[0]) {
                 // kprobe/uprobe name must be in the address space of the current process
                 request->attr.config1 = (__u64)(uintptr_t)request->probe_name;
             }
@@ -160,6 +253,19 @@ bool FdTransferServer::serveRequests(int peer_pid) {
         }
 
         case KALLSYMS_FD: {
+            struct kallsyms_fd_request *request = (struct kallsyms_fd_request*)req;
+            if (ret >= (ssize_t)sizeof(*request) && (request->flags & KALLSYMS_IMAGE) != 0) {
+                refreshKallsymsImage();
+                if (_kallsyms_image != -1) {
+                    struct fd_response resp;
+                    resp.type = req->type;
+                    resp.error = 0;
+                    sendFd(_kallsyms_image, &resp, sizeof(resp));
+                    break;
+                }
+                // Fall back to a plain copy, e.g. if the symbols do not fit in 32-bit offsets
+            }
+
             // can't directly pass the fd of /proc/kallsyms, because before Linux 4.15 the permission check
             // was conducted on each read.
             // it's simpler to copy the file to a temporary location and pass the fd of it (compared to passing the
@@ -221,6 +327,155 @@ int FdTransferServer::copyFile(const char* src_name, const char* dst_name, mode_
     return 0;
 }
 
+struct KernelSymbol {
+    unsigned long long addr;
+    unsigned int name_offset;
+};
+
+static int compareKernelSymbols(const void* s1, const void* s2) {
+    unsigned long long a1 = ((const KernelSymbol*)s1)->addr;
+    unsigned long long a2 = ((const KernelSymbol*)s2)->addr;
+    return a1 < a2 ? -1 : a1 > a2 ? 1 : 0;
+}
+
+// In-order traversal of an implicit 1-based Eytzinger tree, same as in CodeCache
+static unsigned int eytzingerFirst(unsigned int n) {
+    unsigned int k = 1;
+    while (k * 2 <= n) k *= 2;
+    return n > 0 ? k : 0;
+}
+
+static unsigned int eytzingerNext(unsigned int k, unsigned int n) {
+    if (k * 2 + 1 <= n) {
+        k = k * 2 + 1;
+        while (k * 2 <= n) k *= 2;
+        return k;
+    }
+    while (k & 1) k >>= 1;
+    return k >> 1;
+}
+
+// Parses kernel text symbols the same way as Symbols::parseKernelSymbols does
+// into a sealed memfd with the layout described by struct kallsyms_image.
+// The image is shared by all clients of this server until the set of kernel modules changes.
+int FdTransferServer::createKallsymsImage() {
+    FILE* f = fopen("/proc/kallsyms", "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    KernelSymbol* symbols = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    char* names = NULL;
+    size_t names_size = 0;
+    size_t names_capacity = 0;
+    bool have_symbols = false;
+    bool ok = true;
+
+    char str[256];
+    while (ok && fgets(str, sizeof(str) - 8, f) != NULL) {
+        size_t len = strlen(str) - 1;  // trim the '\n'
+        strcpy(str + len, "_[k]");
+
+        char* desc = strchr(str, ' ');
+        if (desc == NULL) continue;
+        char type = desc[1];
+        if (type != 'T' && type != 't' && type != 'W' && type != 'w') continue;
+
+        unsigned long long addr = strtoull(str, NULL, 16);
+        const char* name = desc + 3;
+        if (addr == 0) continue;
+        if (!have_symbols) {
+            if (strncmp(name, "__LOAD_PHYSICAL_ADDR", 20) == 0 || strncmp(name, "phys_startup", 12) == 0) {
+                continue;
+            }
+            have_symbols = true;
+        }
+
+        size_t entry_size = (4 + strlen(name) + 1 + 1) & ~(size_t)1;
+        if (count >= capacity || names_size + entry_size > names_capacity) {
+            capacity = capacity == 0 ? 65536 : capacity * 2;
+            names_capacity = names_capacity == 0 ? 4 * 1024 * 1024 : names_capacity * 2;
+            KernelSymbol* new_symbols = (KernelSymbol*)realloc(symbols, capacity * sizeof(KernelSymbol));
+            char* new_names = (char*)realloc(names, names_capacity);
+            if (new_symbols != NULL) symbols = new_symbols;
+            if (new_names != NULL) names = new_names;
+            if (new_symbols == NULL || new_names == NULL) {
+                ok = false;
+                break;
+            }
+        }
+
+        // NativeFunc header: lib_index = -1, mark = 0, reserved = 0
+        char* entry = names + names_size;
+        short lib_index = -1;
+        memcpy(entry, &lib_index, sizeof(lib_index));
+        entry[2] = 0;
+        entry[3] = 0;
+        char* s = strcpy(entry + 4, name);
+        for (; *s != 0; s++) {
+            if (*s < ' ') *s = '?';
+        }
+        memset(s, 0, entry + entry_size - s);
+
+        symbols[count].addr = addr;
+        symbols[count].name_offset = names_size;
+        count++;
+        names_size += entry_size;
+    }
+    fclose(f);
+
+    int fd = -1;
+    if (ok && count > 0 && count < 0x7fffffff && names_size < 0xffffffffULL) {
+        qsort(symbols, count, sizeof(KernelSymbol), compareKernelSymbols);
+        ok = symbols[count - 1].addr - symbols[0].addr <= 0xffffffffULL;
+    } else {
+        ok = false;
+    }
+
+    unsigned int* arrays = NULL;
+    if (ok) {
+        arrays = (unsigned int*)calloc((count + 1) * 3, sizeof(unsigned int));
+        ok = arrays != NULL;
+    }
+
+    if (ok) {
+        unsigned int* starts = arrays;
+        unsigned int* name_offsets = arrays + 2 * (count + 1);
+        size_t i = 0;
+        for (unsigned int k = eytzingerFirst(count); k != 0; k = eytzingerNext(k, count), i++) {
+            starts[k] = symbols[i].addr - symbols[0].addr;
+            name_offsets[k] = symbols[i].name_offset;
+        }
+
+        struct kallsyms_image header;
+        header.magic = KALLSYMS_IMAGE_MAGIC;
+        header.version = KALLSYMS_IMAGE_VERSION;
+        header.count = count;
+        header.names_size = names_size;
+        header.base = symbols[0].addr;
+        header.max_address = symbols[count - 1].addr;
+
+        fd = syscall(__NR_memfd_create, "async-profiler-kallsyms", MFD_ALLOW_SEALING);
+        ok = fd != -1
+            && write(fd, &header, sizeof(header)) == sizeof(header)
+            && write(fd, arrays, (count + 1) * 3 * sizeof(unsigned int)) == (ssize_t)((count + 1) * 3 * sizeof(unsigned int))
+            && write(fd, names, names_size) == (ssize_t)names_size
+            && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0;
+        if (!ok && fd != -1) {
+            perror("kallsyms image");
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    free(arrays);
+    free(names);
+    free(symbols);
+    return fd;
+}
+
 bool FdTransferServer::sendFd(int fd, struct fd_response *resp, size_t resp_size) {
     struct msghdr msg = {0};
 
@@ -318,6 +573,9 @@ bool FdTransferServer::runLoop(const char *path) {
         return false;
     }
 
+    // Children inherit the image, so kallsyms is parsed once for all clients until a module is loaded or unloaded
+    refreshKallsymsImage();
+
     printf("Server ready at '%s'\n", path);
 
     while (true) {
@@ -333,6 +591,7 @@ bool FdTransferServer::runLoop(const char *path) {
         }
 
         printf("Serving PID %d\n", peer_pid);
+        refreshKallsymsImage();
 
         // We fork(), to actually move a PID namespace.
         if (fork() == 0) {
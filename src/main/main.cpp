@@ -81,6 +81,8 @@ static const char USAGE_STRING[] =
     "                      nativemem and lock profiling simultaneously\n"
     "  --total             accumulate the total value (time, bytes, etc.)\n"
     "  --all-user          only include user-mode events\n"
+    "  --lazy-symbols      load native library symbols on first use\n"
+    "  --symcache dir      cache parsed native library symbols in dir\n"
     "  --sched             group threads by scheduling policy\n"
     "  --cstack mode       how to traverse C stack: fp|dwarf|lbr|vm|no\n"
     "  --signal num        use alternative signal for cpu or wall clock profiling\n"
@@ -89,12 +91,21 @@ static const char USAGE_STRING[] =
     "  --end function      end profiling when function is executed\n"
     "  --ttsp              only time-to-safepoint profiling \n"
     "  --nostop            do not stop profiling outside --begin/--end window\n"
-    "  --jfropts opts      JFR recording options: mem\n"
+    "  --jfropts opts      JFR recording options: mem, async\n"
+    "  --jfrring size      keep only the last chunks of JFR recording in memory\n"
     "  --jfrsync config    synchronize profiler with JFR recording\n"
     "  --libpath path      full path to libasyncProfiler.so in the container\n"
     "  --fdtransfer        run separate fdtransfer process to serve perf requests\n"
     "                      from the non-privileged target\n"
     "  --target-cpu cpu    sample threads on a specific CPU (perf_events only, default: -1)\n"
+    "  --counters list     perf_events counters to read with every sample, e.g. instructions,cache-misses\n"
+    "  --weight event      weight samples by the given event or one of the counters\n"
+    "  --percpu            open perf_events per CPU rather than per thread\n"
+    "  --nosignal          collect perf_events samples in a background thread without signals\n"
+    "  --userstack N       with --percpu or --nosignal, copy N bytes of user stack for offline unwinding\n"
+    "  --storage opts      call trace storage options: shard, prefix, verify\n"
+    "  --storage-limit N   memory limit for call trace storage\n"
+    "  --storage-age N     evict call traces not hit for N chunks or dumps\n"
     "\n"
     "<pid> is a numeric process ID of the target JVM\n"
     "      or 'jps' keyword to find running JVM automatically\n"
@@ -501,13 +512,14 @@ int main(int argc, const char** argv) {
             format << "," << (arg.str() + 2) << "=" << args.next();
 
         } else if (arg == "--reverse" || arg == "--inverted" || arg == "--samples" || arg == "--total" ||
-                   arg == "--sched" || arg == "--live" || arg == "--nofree" || arg == "--record-cpu") {
+                   arg == "--sched" || arg == "--live" || arg == "--nofree" || arg == "--record-cpu" ||
+                   arg == "--percpu" || arg == "--nosignal") {
             format << "," << (arg.str() + 2);
 
         } else if (arg == "--alloc" || arg == "--nativemem" || arg == "--nativelock" || arg == "--lock" ||
                    arg == "--wall" || arg == "--trace" || arg == "--chunksize" || arg == "--chunktime" ||
                    arg == "--cstack" || arg == "--signal" || arg == "--clock" || arg == "--begin" || arg == "--end" ||
-                   arg == "--target-cpu" || arg == "--proc") {
+                   arg == "--target-cpu" || arg == "--proc" || arg == "--userstack") {
             params << "," << (arg.str() + 2) << "=" << args.next();
 
         } else if (arg == "--ttsp") {
@@ -522,11 +534,40 @@ int main(int argc, const char** argv) {
         } else if (arg == "--all-user") {
             params << ",alluser";
 
+        } else if (arg == "--lazy-symbols") {
+            params << ",lazysymbols";
+
+        } else if (arg == "--counters") {
+            params << ",counters=" << String(args.next()).replace(',', "+");
+
+        } else if (arg == "--weight") {
+            params << ",weight=" << args.next();
+
+        } else if (arg == "--symcache") {
+            params << ",symcache=" << args.next();
+
         } else if (arg == "--safe-mode") {
             params << ",safemode=" << args.next();
 
-        } else if (arg == "--jfrsync" || arg == "--jfropts") {
-            params << "," << (arg.str() + 2) << "=" << args.next();
+        } else if (arg == "--jfrsync") {
+            params << ",jfrsync=" << args.next();
+            output = "jfr";
+
+        } else if (arg == "--storage") {
+            params << ",storage=" << String(args.next()).replace(',', "+");
+
+        } else if (arg == "--storage-limit") {
+            params << ",storagelimit=" << args.next();
+
+        } else if (arg == "--storage-age") {
+            params << ",storageage=" << args.next();
+
+        } else if (arg == "--jfropts") {
+            params << ",jfropts=" << String(args.next()).replace(',', "+");
+            output = "jfr";
+
+        } else if (arg == "--jfrring") {
+            params << ",jfrring=" << args.next();
             output = "jfr";
 
         } else if (arg == "--timeout" || arg == "--loop") {
@@ -119,7 +119,7 @@ static void* nested_malloc_hook(size_t size) {
 // In some implementations, specifically on musl, calloc() calls malloc() internally,
 // and posix_memalign() calls aligned_alloc(). Detect such cases to prevent double-accounting.
 static void detectNestedMalloc() {
-    CodeCache* libc = Profiler::instance()->findLibraryByAddress((void*)_orig_calloc);
+    CodeCache* libc = Profiler::instance()->nativeLibs()->scanLibraries((void*)_orig_calloc);
     if (libc == NULL) {
         return;
     }
@@ -150,7 +150,7 @@ static void resolveMallocSymbols() {
 }
 
 void MallocTracer::initialize() {
-    CodeCache* lib = Profiler::instance()->findLibraryByAddress((void*)MallocTracer::initialize);
+    CodeCache* lib = Profiler::instance()->nativeLibs()->scanLibraries((void*)MallocTracer::initialize);
     assert(lib);
 
     resolveMallocSymbols();
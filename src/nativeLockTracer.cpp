@@ -82,7 +82,7 @@ volatile bool NativeLockTracer::_running = false;
 volatile u64 NativeLockTracer::_total_duration;  // for interval sampling
 
 void NativeLockTracer::initialize() {
-    CodeCache* lib = Profiler::instance()->findLibraryByAddress((void*)NativeLockTracer::initialize);
+    CodeCache* lib = Profiler::instance()->nativeLibs()->scanLibraries((void*)NativeLockTracer::initialize);
     assert(lib);
 
     lib->mark(
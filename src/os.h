@@ -111,6 +111,8 @@ class OS {
     static int getMaxThreadId();
     static int processId();
     static int threadId();
+    // CPU the calling thread runs on, or -1 if unknown. Signal safe
+    static int currentCpu();
     static const char* schedPolicy(int thread_id);
     static bool threadName(int thread_id, char* name_buf, size_t name_len);
     static ThreadState threadState(int thread_id);
@@ -177,6 +177,10 @@ int OS::threadId() {
     return syscall(__NR_gettid);
 }
 
+int OS::currentCpu() {
+    return sched_getcpu();
+}
+
 const char* OS::schedPolicy(int thread_id) {
     int sched_policy = sched_getscheduler(thread_id);
     if (sched_policy >= SCHED_BATCH) {
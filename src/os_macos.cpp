@@ -173,6 +173,11 @@ int OS::threadId() {
     return (int)port;
 }
 
+int OS::currentCpu() {
+    // Not supported on macOS
+    return -1;
+}
+
 const char* OS::schedPolicy(int thread_id) {
     // Not used on macOS
     return "SCHED_OTHER";
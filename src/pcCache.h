@@ -0,0 +1,71 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _PCCACHE_H
+#define _PCCACHE_H
+
+#include <string.h>
+#include "arch.h"
+
+
+const int PC_CACHE_BITS = 10;
+const int PC_CACHE_SIZE = 1 << PC_CACHE_BITS;
+
+struct PcCacheEntry {
+    const void* pc;
+    const char* name;
+    char mark;
+};
+
+// Direct-mapped cache of native PC resolutions, owned by one sampler slot.
+// Only the thread holding the slot lock may access it, so no atomics are needed;
+// the whole cache is dropped whenever the set of native libraries changes.
+class PcCache {
+  private:
+    PcCacheEntry _entries[PC_CACHE_SIZE];
+    int _generation;
+    u64 _hits;
+    u64 _misses;
+
+    static u32 hash(const void* pc) {
+        return (u32)(((u64)(uintptr_t)pc * 0x9e3779b97f4a7c15ULL) >> (64 - PC_CACHE_BITS));
+    }
+
+  public:
+    void validate(int generation) {
+        if (_generation != generation) {
+            memset(_entries, 0, sizeof(_entries));
+            _generation = generation;
+        }
+    }
+
+    PcCacheEntry* lookup(const void* pc) {
+        PcCacheEntry* e = &_entries[hash(pc)];
+        if (e->pc == pc && pc != NULL) {
+            _hits++;
+            return e;
+        }
+        _misses++;
+        return NULL;
+    }
+
+    PcCacheEntry* put(const void* pc, const char* name, char mark) {
+        PcCacheEntry* e = &_entries[hash(pc)];
+        e->pc = pc;
+        e->name = name;
+        e->mark = mark;
+        return e;
+    }
+
+    u64 hits() {
+        return _hits;
+    }
+
+    u64 misses() {
+        return _misses;
+    }
+};
+
+#endif // _PCCACHE_H
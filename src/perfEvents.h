@@ -8,11 +8,17 @@
 
 #include "arch.h"
 #include "cpuEngine.h"
+#include "event.h"
 
 #ifdef __linux__
 
+#include <pthread.h>
+#include "spinLock.h"
+#include "vmEntry.h"
+
 class PerfEvent;
 class PerfEventType;
+class RingBuffer;
 class StackContext;
 
 class PerfEvents : public CpuEngine {
@@ -26,17 +32,63 @@ class PerfEvents : public CpuEngine {
     static bool _use_perf_mmap;
     static bool _record_cpu;
     static int _target_cpu;
-
-    static u64 readCounter(siginfo_t* siginfo, void* ucontext);
+    static int _num_counters;
+    static int _weight_index;
+    static int* _counter_fds;
+    static bool _percpu;
+    static int _max_cpus;
+    static PerfEvent* _cpu_events;
+    static int _cgroup_fd;
+    static int _pid;
+    static int _max_stack_depth;
+    static u64 _lost_samples;
+    static bool _nosignal;
+    static bool _offcpu;
+    static bool _stopping;
+    static int _epoll_fd;
+    static bool _stack_copy_dropped;
+    static SpinLock _watched_lock;
+    static int* _watched;
+    static int _num_watched;
+    static int _watched_capacity;
+    static u32 _user_stack;
+    static pthread_t _collector;
+    static int _collector_pipe[2];
+
+    static Error parseCounters(const char* counters, const char* weight, const char* event);
+    static u64 readGroup(int fd, PerfSampleEvent* event);
+    static u64 readCounter(siginfo_t* siginfo, void* ucontext, PerfSampleEvent* event);
     static void signalHandler(int signo, siginfo_t* siginfo, void* ucontext);
     static void signalHandlerJ9(int signo, siginfo_t* siginfo, void* ucontext);
 
+    static void* collectorEntry(void* unused) {
+        collectorLoop();
+        return NULL;
+    }
+
+    static Error startCollector();
+    static void stopCollector();
+    static int watchEvent(PerfEvent* event);
+    static int addWatched(int tid);
+    static void removeWatched(int tid);
+    static int nextWatched(int index);
+    static size_t scratchSize();
+    static void collectorLoop();
+    static void drainBuffer(PerfEvent* event, ASGCT_CallFrame* frames, bool flush_pending = false);
+
     int createForThread(int tid);
+    int createCounters(int tid, int group_fd);
+    void destroyCounters(int tid);
     void destroyForThread(int tid);
+    int createForCpu(int cpu);
+    void destroyForCpu(int cpu);
+    Error startPerCpu();
+    void stopPerCpu();
 
   public:
     Error start(Arguments& args);
     void stop();
+    void flush();
 
     const char* type() {
         return "perf_events";
@@ -50,6 +102,13 @@ class PerfEvents : public CpuEngine {
 
     static bool supported();
     static const char* getEventName(int event_id);
+
+    // Returns the cgroup path of a /proc/self/cgroup line if its hierarchy supports perf_events, or NULL.
+    // unified is set for the cgroup v2 hierarchy. The line is modified.
+    static const char* parseCgroupLine(char* line, bool* unified);
+
+    // Converts the callchain of a sample record, starting at the word that holds the number of entries
+    static int convertCallchain(RingBuffer& ring, ASGCT_CallFrame* frames, int max_depth);
 };
 
 #else
@@ -14,18 +14,24 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/utsname.h>
+#include <sys/vfs.h>
 #include <linux/perf_event.h>
 #include "arch.h"
 #include "fdtransferClient.h"
 #include "j9StackTraces.h"
 #include "log.h"
 #include "perfEvents.h"
+#include "perfRingBuffer.h"
 #include "profiler.h"
 #include "spinLock.h"
 #include "stackFrame.h"
@@ -51,6 +57,30 @@ struct f_owner_ex {
 #define PERF_FLAG_FD_CLOEXEC  8
 #endif // PERF_FLAG_FD_CLOEXEC
 
+#ifndef CGROUP_SUPER_MAGIC
+#define CGROUP_SUPER_MAGIC   0x27e0eb
+#define CGROUP2_SUPER_MAGIC  0x63677270
+#endif // CGROUP_SUPER_MAGIC
+
+// Ring buffers drained by the collector, not counting the header page
+const int PERCPU_DATA_PAGES = 16;
+const int NOSIGNAL_DATA_PAGES = 4;
+const int COLLECTOR_POLL_MS = 100;
+const int COLLECTOR_BATCH = 64;
+
+// Switch-out of a thread is sampled at this tracepoint in offcpu mode
+const char* const OFFCPU_TRACEPOINT = "sched:sched_switch";
+
+// Fields of PERF_RECORD_SAMPLE expected by the collector, in the order the kernel writes them
+const u64 COLLECTED_SAMPLE_TYPE = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU | PERF_SAMPLE_PERIOD | PERF_SAMPLE_CALLCHAIN;
+
+// Registers needed to unwind a copy of the user stack
+const u64 USER_REGS_MASK = 1ULL << PERF_REG_PC | 1ULL << PERF_REG_SP | 1ULL << PERF_REG_FP |
+                           (PERF_REG_LR >= 0 ? 1ULL << PERF_REG_LR : 0);
+
+// The whole sample record, including the stack copy, must fit in u16 header.size
+const u32 MAX_USER_STACK = 65528;
+
 enum {
     HW_BREAKPOINT_R  = 1,
     HW_BREAKPOINT_W  = 2,
@@ -154,6 +184,96 @@ static void adjustFDLimit() {
     }
 }
 
+// Ring of at least the given number of pages that holds a few samples with stack copies
+static size_t collectedDataSize(int pages, u32 user_stack) {
+    size_t size = pages * OS::page_size;
+    while (user_stack > 0 && size < 4 * (user_stack + OS::page_size)) {
+        size *= 2;
+    }
+    return size;
+}
+
+// With a stack copy, the user part of the callchain is unwound by the collector
+static void requestUserStack(struct perf_event_attr* attr, u32 user_stack) {
+    if (user_stack > 0) {
+        attr->sample_type |= PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+        attr->sample_regs_user = USER_REGS_MASK;
+        attr->sample_stack_user = user_stack;
+        attr->exclude_callchain_user = 1;
+    }
+}
+
+// Opens <mount><path> if <mount> is a cgroup hierarchy of the given type
+static int openCgroupDir(const char* mount, const char* path, unsigned long magic) {
+    struct statfs fs;
+    if (statfs(mount, &fs) != 0 || (unsigned long)fs.f_type != magic) {
+        return -1;
+    }
+
+    char buf[PATH_MAX];
+    if ((size_t)snprintf(buf, sizeof(buf), "%s%s", mount, path) >= sizeof(buf)) {
+        return -1;
+    }
+    return open(buf, O_RDONLY | O_CLOEXEC);
+}
+
+const char* PerfEvents::parseCgroupLine(char* line, bool* unified) {
+    // hierarchy-ID:controller-list:cgroup-path
+    char* controllers = strchr(line, ':');
+    char* path = controllers != NULL ? strchr(controllers + 1, ':') : NULL;
+    if (path == NULL) {
+        return NULL;
+    }
+    *path++ = 0;
+    path[strcspn(path, "\n")] = 0;
+
+    if (controllers[1] == 0) {
+        *unified = true;
+        return path;
+    }
+
+    char* saveptr;
+    for (char* c = strtok_r(controllers + 1, ",", &saveptr); c != NULL; c = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(c, "perf_event") == 0) {
+            *unified = false;
+            return path;
+        }
+    }
+    return NULL;
+}
+
+// Finds the cgroup of the current process that perf_events can be bound to:
+// the perf_event controller of cgroup v1, or the unified hierarchy otherwise.
+// Returns a directory fd suitable for PERF_FLAG_PID_CGROUP, or -1.
+static int openPerfCgroup() {
+    FILE* f = fopen("/proc/self/cgroup", "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    int fd = -1;
+    char line[PATH_MAX];
+    while (fd == -1 && fgets(line, sizeof(line), f) != NULL) {
+        bool unified;
+        const char* path = PerfEvents::parseCgroupLine(line, &unified);
+        if (path == NULL) {
+            continue;
+        }
+
+        if (unified) {
+            fd = openCgroupDir("/sys/fs/cgroup", path, CGROUP2_SUPER_MAGIC);
+            if (fd == -1) {
+                fd = openCgroupDir("/sys/fs/cgroup/unified", path, CGROUP2_SUPER_MAGIC);
+            }
+        } else {
+            fd = openCgroupDir("/sys/fs/cgroup/perf_event", path, CGROUP_SUPER_MAGIC);
+        }
+    }
+
+    fclose(f);
+    return fd;
+}
+
 // Workaround for the kernel bug: PERF_EVENT_IOC_REFRESH can hang
 // the entire system on Linux 6.16.x and 6.17.x.
 // See https://github.com/async-profiler/async-profiler/issues/1578
@@ -442,6 +562,11 @@ struct PerfEventType {
                 (tracepoint_id = findTracepointId("debug/tracing", name)) > 0) {
                 return getTracepoint(tracepoint_id);
             }
+            if (FdTransferClient::hasPeer() && strlen(name) < sizeof(probe_func)) {
+                // tracefs is often readable only by root; let fdtransfer resolve the name
+                strcpy(probe_func, name);
+                return getTracepoint(0);
+            }
         }
 
         // Finally, treat event as a function name and return an execution breakpoint
@@ -505,38 +630,17 @@ FunctionWithCounter PerfEventType::KNOWN_FUNCTIONS[] = {
 
 char PerfEventType::probe_func[MAX_PROBE_LEN];
 
-
-class RingBuffer {
-  private:
-    const char* _start;
-    unsigned long _offset;
-
-  public:
-    RingBuffer(struct perf_event_mmap_page* page) {
-        _start = (const char*)page + OS::page_size;
-    }
-
-    struct perf_event_header* seek(u64 offset) {
-        _offset = (unsigned long)offset & OS::page_mask;
-        return (struct perf_event_header*)(_start + _offset);
-    }
-
-    u64 next() {
-        _offset = (_offset + sizeof(u64)) & OS::page_mask;
-        return *(u64*)(_start + _offset);
-    }
-
-    u64 peek(unsigned long words) {
-        unsigned long peek_offset = (_offset + words * sizeof(u64)) & OS::page_mask;
-        return *(u64*)(_start + peek_offset);
-    }
-};
+// Copies of the counter types, since forName() reuses static slots for parameterized events
+static PerfEventType counter_types[MAX_PERF_COUNTERS];
 
 
 class PerfEvent : public SpinLock {
   private:
     int _fd;
     struct perf_event_mmap_page* _page;
+    size_t _data_size;
+    bool _user_stack;  // samples carry registers and a stack copy
+    u64 _offcpu_flushed;  // time up to which the pending switch-out sample is recorded
 
     friend class PerfEvents;
 };
@@ -551,6 +655,28 @@ bool PerfEvents::_kernel_stack;
 bool PerfEvents::_use_perf_mmap;
 bool PerfEvents::_record_cpu;
 int PerfEvents::_target_cpu;
+int PerfEvents::_num_counters = 0;
+int PerfEvents::_weight_index = 0;
+int* PerfEvents::_counter_fds = NULL;
+bool PerfEvents::_percpu = false;
+int PerfEvents::_max_cpus = 0;
+PerfEvent* PerfEvents::_cpu_events = NULL;
+int PerfEvents::_cgroup_fd = -1;
+int PerfEvents::_pid;
+int PerfEvents::_max_stack_depth;
+u64 PerfEvents::_lost_samples;
+bool PerfEvents::_nosignal = false;
+bool PerfEvents::_offcpu = false;
+bool PerfEvents::_stopping = false;
+int PerfEvents::_epoll_fd = -1;
+bool PerfEvents::_stack_copy_dropped = false;
+SpinLock PerfEvents::_watched_lock;
+int* PerfEvents::_watched = NULL;
+int PerfEvents::_num_watched = 0;
+int PerfEvents::_watched_capacity = 0;
+u32 PerfEvents::_user_stack = 0;
+pthread_t PerfEvents::_collector = 0;
+int PerfEvents::_collector_pipe[2];
 
 int PerfEvents::createForThread(int tid) {
     if (tid >= _max_events) {
@@ -587,7 +713,8 @@ int PerfEvents::createForThread(int tid) {
     attr.disabled = 1;
     attr.wakeup_events = 1;
 
-    if (_alluser) {
+    // Tracepoints fire in the kernel, so offcpu can only drop kernel frames
+    if (_alluser && !_offcpu) {
         attr.exclude_kernel = 1;
     }
 
@@ -613,7 +740,34 @@ int PerfEvents::createForThread(int tid) {
         attr.sample_type |= PERF_SAMPLE_CPU;
     }
 
+    if (_num_counters > 0) {
+        attr.read_format = PERF_FORMAT_GROUP;
+    }
+
+    // fdtransfer server maps a one page ring itself, and the same size must be mapped here
+    size_t data_size = _nosignal && !FdTransferClient::hasPeer() ? collectedDataSize(NOSIGNAL_DATA_PAGES, _user_stack) : OS::page_size;
+
+    if (_nosignal) {
+        // Without a signal, the whole stack comes from the kernel, and the collector
+        // needs to know the time of each sample
+        attr.sample_type = COLLECTED_SAMPLE_TYPE;
+        attr.exclude_callchain_user = 0;
+        attr.watermark = 1;
+        attr.wakeup_watermark = data_size / 2;
+        attr.use_clockid = 1;
+        attr.clockid = CLOCK_MONOTONIC;
+        requestUserStack(&attr, _user_stack);
+    }
+
+    if (_offcpu) {
+        // PERF_RECORD_SWITCH tells when the thread gets back on CPU
+        attr.context_switch = 1;
+        attr.sample_id_all = 1;
+    }
+
     int fd;
+    void* page = NULL;
+reopen:
     if (FdTransferClient::hasPeer()) {
         fd = FdTransferClient::requestPerfFd(&tid, _target_cpu, &attr, PerfEventType::probe_func);
     } else {
@@ -624,6 +778,36 @@ int PerfEvents::createForThread(int tid) {
         }
     }
 
+    if (fd != -1 && (_use_perf_mmap || _nosignal)) {
+        page = mmap(NULL, OS::page_size + data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (page == MAP_FAILED && attr.sample_stack_user > 0) {
+            // Rings with stack copies of all threads quickly exhaust perf_event_mlock_kb.
+            // Threads over the limit are sampled with the frame pointer callchain instead.
+            if (!__sync_lock_test_and_set(&_stack_copy_dropped, true)) {
+                Log::warn("Not enough locked memory for userstack rings of all threads. Check perf_event_mlock_kb");
+            }
+            close(fd);
+            data_size = collectedDataSize(NOSIGNAL_DATA_PAGES, 0);
+            attr.sample_type &= ~(PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER);
+            attr.sample_regs_user = 0;
+            attr.sample_stack_user = 0;
+            attr.exclude_callchain_user = 0;
+            attr.wakeup_watermark = data_size / 2;
+            goto reopen;
+        } else if (page == MAP_FAILED && data_size > OS::page_size) {
+            // Larger ring does not fit in perf_event_mlock_kb. The event is opened again,
+            // since the kernel would clamp the wakeup watermark to the full one page ring
+            close(fd);
+            data_size = OS::page_size;
+            attr.wakeup_watermark = data_size / 2;
+            goto reopen;
+        }
+        if (page == MAP_FAILED) {
+            Log::warn("perf_event mmap failed: %s", strerror(errno));
+            page = NULL;
+        }
+    }
+
     if (fd == -1) {
         int err = errno;
         Log::warn("perf_event_open for TID %d failed: %s", tid, strerror(err));
@@ -635,37 +819,52 @@ int PerfEvents::createForThread(int tid) {
         return err;
     }
 
-    void* page = NULL;
-    if (_use_perf_mmap) {
-        page = mmap(NULL, 2 * OS::page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (page == MAP_FAILED) {
-            Log::warn("perf_event mmap failed: %s", strerror(errno));
-            page = NULL;
+    if (_num_counters > 0) {
+        int err = createCounters(tid, fd);
+        if (err != 0) {
+            if (page != NULL) {
+                munmap(page, OS::page_size + data_size);
+            }
+            close(fd);
+            _events[tid]._fd = 0;
+            return err;
         }
     }
 
     _events[tid].reset();
     _events[tid]._fd = fd;
     _events[tid]._page = (struct perf_event_mmap_page*)page;
+    _events[tid]._data_size = data_size;
+    _events[tid]._user_stack = attr.sample_stack_user > 0;
+    _events[tid]._offcpu_flushed = 0;
 
     struct f_owner_ex ex;
     ex.type = F_OWNER_TID;
     ex.pid = tid;
 
     int err;
-    if (fcntl(fd, F_SETFL, O_ASYNC) < 0 || fcntl(fd, F_SETSIG, _signal) < 0 || fcntl(fd, F_SETOWN_EX, &ex) < 0) {
+    if (_nosignal && page == NULL) {
+        err = ENOMEM;
+    } else if (!_nosignal && (fcntl(fd, F_SETFL, O_ASYNC) < 0 || fcntl(fd, F_SETSIG, _signal) < 0 || fcntl(fd, F_SETOWN_EX, &ex) < 0)) {
         err = errno;
         Log::warn("perf_event fcntl failed: %s", strerror(err));
     } else if (ioctl(fd, PERF_EVENT_IOC_RESET, 0) < 0 || ioctl(fd, _ioc_enable, 1) < 0) {
         err = errno;
         Log::warn("perf_event ioctl failed: %s", strerror(err));
+    } else if (_nosignal && (err = watchEvent(&_events[tid])) != 0) {
+        Log::warn("epoll_ctl failed: %s", strerror(err));
+    } else if (_nosignal && (err = addWatched(tid)) != 0) {
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
     } else {
         return 0;
     }
 
     // Failed to setup perf_event - rollback changes
+    if (_num_counters > 0) {
+        destroyCounters(tid);
+    }
     if (page != NULL) {
-        munmap(page, 2 * OS::page_size);
+        munmap(page, OS::page_size + data_size);
         _events[tid]._page = NULL;
     }
     close(fd);
@@ -674,6 +873,57 @@ int PerfEvents::createForThread(int tid) {
     return err;
 }
 
+// Opens the counters of the group led by group_fd. Counters are created enabled,
+// so they run whenever the leader runs, and are read and reset together with it.
+int PerfEvents::createCounters(int tid, int group_fd) {
+    int* fds = &_counter_fds[tid * _num_counters];
+
+    for (int i = 0; i < _num_counters; i++) {
+        PerfEventType* event_type = &counter_types[i];
+        struct perf_event_attr attr = {0};
+        attr.size = sizeof(attr);
+        attr.type = event_type->type;
+
+        if (attr.type == PERF_TYPE_BREAKPOINT) {
+            attr.bp_type = event_type->config;
+        } else {
+            attr.config = event_type->config;
+        }
+        attr.config1 = event_type->config1;
+        attr.config2 = event_type->config2;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        if (_alluser) {
+            attr.exclude_kernel = 1;
+        }
+
+        int fd = syscall(__NR_perf_event_open, &attr, tid, _target_cpu, group_fd, PERF_FLAG_FD_CLOEXEC);
+        if (fd == -1 && errno == EINVAL) {
+            fd = syscall(__NR_perf_event_open, &attr, tid, _target_cpu, group_fd, 0);
+        }
+
+        if (fd == -1) {
+            int err = errno;
+            Log::warn("perf_event_open of %s for TID %d failed: %s", event_type->name, tid, strerror(err));
+            destroyCounters(tid);
+            return err;
+        }
+        fds[i] = fd;
+    }
+
+    return 0;
+}
+
+void PerfEvents::destroyCounters(int tid) {
+    int* fds = &_counter_fds[tid * _num_counters];
+    for (int i = 0; i < _num_counters; i++) {
+        if (fds[i] > 0) {
+            close(fds[i]);
+            fds[i] = 0;
+        }
+    }
+}
+
 void PerfEvents::destroyForThread(int tid) {
     if (tid >= _max_events) {
         return;
@@ -682,24 +932,551 @@ void PerfEvents::destroyForThread(int tid) {
     PerfEvent* event = &_events[tid];
     int fd = event->_fd;
     if (fd > 0 && __sync_bool_compare_and_swap(&event->_fd, fd, 0)) {
+        if (_nosignal) {
+            // The mapped ring keeps the file open, so close() alone does not remove it from epoll
+            epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            removeWatched(tid);
+        }
         ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (_num_counters > 0) {
+            destroyCounters(tid);
+        }
         close(fd);
     }
     if (event->_page != NULL) {
         event->lock();
-        munmap(event->_page, 2 * OS::page_size);
-        event->_page = NULL;
+        if (event->_page != NULL) {
+            if (_nosignal) {
+                // Samples of an exiting thread would be lost otherwise
+                drainBuffer(event, NULL, true);
+            }
+            munmap(event->_page, OS::page_size + event->_data_size);
+            event->_page = NULL;
+        }
         event->unlock();
     }
 }
 
-u64 PerfEvents::readCounter(siginfo_t* siginfo, void* ucontext) {
+// Per-CPU mode opens one event per CPU bound to the cgroup of the process, or to the whole
+// system if the cgroup is not available. Samples of other processes are dropped by PID.
+int PerfEvents::createForCpu(int cpu) {
+    PerfEventType* event_type = _event_type;
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = event_type->type;
+
+    if (attr.type == PERF_TYPE_BREAKPOINT) {
+        attr.bp_type = event_type->config;
+    } else {
+        attr.config = event_type->config;
+    }
+    attr.config1 = event_type->config1;
+    attr.config2 = event_type->config2;
+
+    if (attr.type == PERF_TYPE_SOFTWARE) {
+        attr.precise_ip = 2;
+    }
+
+    attr.sample_period = _interval;
+    attr.sample_type = COLLECTED_SAMPLE_TYPE;
+    attr.disabled = 1;
+    attr.watermark = 1;
+    attr.wakeup_watermark = collectedDataSize(PERCPU_DATA_PAGES, _user_stack) / 2;
+
+    // Timestamps are converted to TSC ticks by the collector
+    attr.use_clockid = 1;
+    attr.clockid = CLOCK_MONOTONIC;
+
+    if (_alluser) {
+        attr.exclude_kernel = 1;
+    }
+
+    if (!_kernel_stack) {
+        attr.exclude_callchain_kernel = 1;
+    }
+
+    requestUserStack(&attr, _user_stack);
+
+    int fd = -1;
+    if (_cgroup_fd >= 0) {
+        fd = syscall(__NR_perf_event_open, &attr, _cgroup_fd, cpu, -1, PERF_FLAG_PID_CGROUP | PERF_FLAG_FD_CLOEXEC);
+        if (fd == -1 && errno != EACCES && errno != EPERM && errno != ENODEV) {
+            Log::debug("perf_event cgroup is not usable: %s", strerror(errno));
+            close(_cgroup_fd);
+            _cgroup_fd = -1;
+        }
+    }
+    if (_cgroup_fd < 0) {
+        fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    if (fd == -1) {
+        int err = errno;
+        if (err != ENODEV) {
+            Log::warn("perf_event_open for CPU %d failed: %s", cpu, strerror(err));
+        }
+        return err;
+    }
+
+    size_t data_size = collectedDataSize(PERCPU_DATA_PAGES, _user_stack);
+    void* page = mmap(NULL, OS::page_size + data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        int err = errno;
+        Log::warn("perf_event mmap failed: %s", strerror(err));
+        close(fd);
+        return err;
+    }
+
+    PerfEvent* event = &_cpu_events[cpu];
+    event->reset();
+    event->_fd = fd;
+    event->_page = (struct perf_event_mmap_page*)page;
+    event->_data_size = data_size;
+    event->_user_stack = _user_stack > 0;
+
+    int err = watchEvent(event);
+    if (err != 0) {
+        Log::warn("epoll_ctl failed: %s", strerror(err));
+        destroyForCpu(cpu);
+        return err;
+    }
+
+    if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+        err = errno;
+        Log::warn("perf_event ioctl failed: %s", strerror(err));
+        destroyForCpu(cpu);
+        return err;
+    }
+    return 0;
+}
+
+void PerfEvents::destroyForCpu(int cpu) {
+    PerfEvent* event = &_cpu_events[cpu];
+    if (event->_fd > 0) {
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, event->_fd, NULL);
+        ioctl(event->_fd, PERF_EVENT_IOC_DISABLE, 0);
+        close(event->_fd);
+        event->_fd = 0;
+    }
+    if (event->_page != NULL) {
+        munmap(event->_page, OS::page_size + event->_data_size);
+        event->_page = NULL;
+    }
+}
+
+Error PerfEvents::startPerCpu() {
+    int max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (max_cpus != _max_cpus) {
+        free(_cpu_events);
+        _cpu_events = (PerfEvent*)calloc(max_cpus, sizeof(PerfEvent));
+        _max_cpus = max_cpus;
+    }
+
+    Error error = startCollector();
+    if (error) {
+        return error;
+    }
+
+    _cgroup_fd = openPerfCgroup();
+
+    // Offline CPUs fail with ENODEV; any other CPU is enough to start
+    int result = ENODEV;
+    for (int cpu = 0; cpu < _max_cpus; cpu++) {
+        if (_target_cpu >= 0 && cpu != _target_cpu) {
+            continue;
+        }
+        int err = createForCpu(cpu);
+        if (err == 0 || result != 0) {
+            result = err;
+        }
+        if (isResourceLimit(err)) {
+            result = err;
+            break;
+        }
+    }
+
+    if (result != 0) {
+        stopPerCpu();
+        if (result == EACCES || result == EPERM) {
+            return Error("Per-CPU perf events unavailable. Try 'sysctl kernel.perf_event_paranoid=0' or CAP_PERFMON");
+        } else if (isResourceLimit(result)) {
+            return Error("Perf events resource limit. Check 'ulimit -n'");
+        } else {
+            return Error("Perf events unavailable");
+        }
+    }
+
+    return Error::OK;
+}
+
+void PerfEvents::stopPerCpu() {
+    for (int cpu = 0; cpu < _max_cpus; cpu++) {
+        if (_cpu_events[cpu]._fd > 0) {
+            ioctl(_cpu_events[cpu]._fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    // The collector drains what is left in the buffers before exiting
+    stopCollector();
+
+    for (int cpu = 0; cpu < _max_cpus; cpu++) {
+        destroyForCpu(cpu);
+    }
+
+    if (_cgroup_fd >= 0) {
+        close(_cgroup_fd);
+        _cgroup_fd = -1;
+    }
+}
+
+// The collector thread consumes samples from the rings of percpu and nosignal events.
+// Rings are registered in an epoll set; the read end of the pipe wakes it up on stop.
+Error PerfEvents::startCollector() {
+    _pid = getpid();
+    _lost_samples = 0;
+
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd < 0) {
+        return Error("Failed to create epoll instance");
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (pipe(_collector_pipe) != 0) {
+        close(_epoll_fd);
+        _epoll_fd = -1;
+        return Error("Failed to create pipe");
+    }
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _collector_pipe[0], &ev);
+
+    if (pthread_create(&_collector, NULL, collectorEntry, NULL) != 0) {
+        _collector = 0;
+        close(_collector_pipe[0]);
+        close(_collector_pipe[1]);
+        close(_epoll_fd);
+        _epoll_fd = -1;
+        return Error("Unable to create collector thread");
+    }
+
+    return Error::OK;
+}
+
+void PerfEvents::stopCollector() {
+    if (_collector != 0) {
+        close(_collector_pipe[1]);
+        pthread_join(_collector, NULL);
+        close(_collector_pipe[0]);
+        close(_epoll_fd);
+        _epoll_fd = -1;
+        _collector = 0;
+    }
+
+    if (_lost_samples > 0) {
+        Log::info("%llu perf samples were lost, since the collector could not keep up", _lost_samples);
+        _lost_samples = 0;
+    }
+}
+
+// Per-thread rings wake up the collector only when half full. The collector also sweeps
+// the rings listed here on every tick, so that a dump sees recent samples of idle threads.
+int PerfEvents::addWatched(int tid) {
+    _watched_lock.lock();
+    if (_num_watched == _watched_capacity) {
+        int capacity = _watched_capacity == 0 ? 256 : _watched_capacity * 2;
+        int* watched = (int*)realloc(_watched, capacity * sizeof(int));
+        if (watched == NULL) {
+            _watched_lock.unlock();
+            return ENOMEM;
+        }
+        _watched = watched;
+        _watched_capacity = capacity;
+    }
+    _watched[_num_watched++] = tid;
+    _watched_lock.unlock();
+    return 0;
+}
+
+void PerfEvents::removeWatched(int tid) {
+    _watched_lock.lock();
+    for (int i = 0; i < _num_watched; i++) {
+        if (_watched[i] == tid) {
+            _watched[i] = _watched[--_num_watched];
+            break;
+        }
+    }
+    _watched_lock.unlock();
+}
+
+// A ring removed concurrently may cause another one to be skipped until the next tick
+int PerfEvents::nextWatched(int index) {
+    _watched_lock.lock();
+    int tid = index < _num_watched ? _watched[index] : -1;
+    _watched_lock.unlock();
+    return tid;
+}
+
+// Frames of one sample followed by room for one stack copy
+size_t PerfEvents::scratchSize() {
+    return (_max_stack_depth + MAX_NATIVE_FRAMES + RESERVED_FRAMES) * sizeof(ASGCT_CallFrame) + _user_stack;
+}
+
+// Events of exited threads stay readable but never get new samples
+int PerfEvents::watchEvent(PerfEvent* event) {
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = event;
+    return epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, event->_fd, &ev) == 0 ? 0 : errno;
+}
+
+// Resolves a kernel callchain into frames. Compiled Java frames are decoded through CodeHeap
+// when the JVM runs with -XX:+PreserveFramePointer; without it, the chain ends at the first Java frame.
+// Each interpreted Java frame shows up as a single "Interpreter" frame, since its method is on the stack.
+int PerfEvents::convertCallchain(RingBuffer& ring, ASGCT_CallFrame* frames, int max_depth) {
+    Profiler* profiler = Profiler::instance();
+    const void* callchain[MAX_NATIVE_FRAMES];
+    int native_frames = 0;
+    int depth = 0;
+
+    // The whole chain is consumed, since more sample fields may follow
+    for (u64 nr = ring.next(); nr > 0; nr--) {
+        u64 ip = ring.next();
+        if (ip >= PERF_CONTEXT_MAX || depth + native_frames >= max_depth) {
+            continue;
+        }
+
+        const void* pc = (const void*)ip;
+        if (CodeHeap::contains(pc)) {
+            depth += profiler->convertNativeTrace(native_frames, callchain, frames + depth, PERF_SAMPLE);
+            native_frames = 0;
+            if (depth < max_depth) {
+                depth += StackWalker::walkCompiled(pc, frames + depth, max_depth - depth);
+            }
+        } else if (native_frames < MAX_NATIVE_FRAMES) {
+            callchain[native_frames++] = pc;
+        }
+    }
+
+    return depth + profiler->convertNativeTrace(native_frames, callchain, frames + depth, PERF_SAMPLE);
+}
+
+// Unwinds the copy of the user stack that follows the callchain in a sample record
+static int unwindUserStack(RingBuffer& ring, ASGCT_CallFrame* frames, int max_depth, char* stack_buf) {
+    StackSnapshot snapshot = {0};
+
+    u64 abi = ring.next();
+    if (abi != PERF_SAMPLE_REGS_ABI_NONE) {
+        for (int reg = 0; reg < 64; reg++) {
+            if (USER_REGS_MASK & (1ULL << reg)) {
+                u64 value = ring.next();
+                if (reg == PERF_REG_PC) snapshot.pc = (const void*)value;
+                if (reg == PERF_REG_SP) snapshot.sp = value;
+                if (reg == PERF_REG_FP) snapshot.fp = value;
+                if (reg == PERF_REG_LR) snapshot.lr = value;
+            }
+        }
+    }
+
+    u64 size = ring.next();
+    if (size == 0) {
+        // Kernel thread, or the stack could not be copied
+        return 0;
+    }
+    snapshot.data = ring.bytes(size, stack_buf);
+    u64 dyn_size = ring.next();
+    snapshot.size = dyn_size < size ? dyn_size : size;
+
+    if (abi == PERF_SAMPLE_REGS_ABI_NONE || max_depth <= 0) {
+        return 0;
+    }
+    return StackWalker::walkSnapshot(&snapshot, frames, max_depth);
+}
+
+// Perf timestamps are CLOCK_MONOTONIC; projects one onto the profiler clock
+static inline u64 projectTime(u64 time, u64 now_ticks, u64 now_nanos) {
+    u64 age = now_nanos > time ? now_nanos - time : 0;
+    return now_ticks - age * TSC::frequency() / NANOTIME_FREQ;
+}
+
+// Records samples of this process from the event's ring. The caller holds the event lock.
+// Without a frame buffer, one is allocated only if there is something to drain.
+// In offcpu mode, flush_pending also records the time a thread has been off CPU so far;
+// the rest is recorded when the thread gets back on CPU.
+void PerfEvents::drainBuffer(PerfEvent* event, ASGCT_CallFrame* frames, bool flush_pending) {
+    struct perf_event_mmap_page* page = event->_page;
+    if (page == NULL) {
+        return;
+    }
+
+    u64 tail = page->data_tail;
+    u64 head = page->data_head;
+    rmb();
+
+    if (tail == head) {
+        return;
+    }
+
+    int max_frames = _max_stack_depth + MAX_NATIVE_FRAMES + RESERVED_FRAMES;
+    ASGCT_CallFrame* own_frames = NULL;
+    if (frames == NULL && (frames = own_frames = (ASGCT_CallFrame*)malloc(scratchSize())) == NULL) {
+        return;
+    }
+
+    // Stack copies that wrap around the end of the ring are glued together after the frames
+    char* stack_buf = (char*)(frames + max_frames);
+
+    u64 now_ticks = TSC::ticks();
+    u64 now_nanos = OS::nanotime();
+
+    RingBuffer ring(page, event->_data_size);
+
+    while (tail < head) {
+        struct perf_event_header* hdr = ring.seek(tail);
+
+        if (hdr->type == PERF_RECORD_SAMPLE && (_enabled || _stopping)) {
+            u64 switch_in = 0;
+            bool pending = _offcpu && (switch_in = RingBuffer(page, event->_data_size).findSwitchIn(tail + hdr->size, head)) == 0;
+            if (pending) {
+                if (!flush_pending) {
+                    // Leave the switch-out sample in the ring until the thread runs again
+                    break;
+                }
+                switch_in = now_nanos;
+            }
+
+            u64 pid_tid = ring.next();
+            int pid = (int)(u32)pid_tid;
+            int tid = (int)(pid_tid >> 32);
+
+            if (pid == _pid) {
+                u64 time = ring.next();
+                u32 sample_cpu = (u32)ring.next();
+                u64 period = ring.next();
+                Profiler::instance()->lockLookups();
+                int num_frames = convertCallchain(ring, frames, max_frames - RESERVED_FRAMES);
+                if (event->_user_stack) {
+                    num_frames += unwindUserStack(ring, frames + num_frames, max_frames - RESERVED_FRAMES - num_frames, stack_buf);
+                }
+                Profiler::instance()->unlockLookups();
+
+                if (_offcpu) {
+                    // Weighted by the time spent off CPU, including the wait in the run queue.
+                    // The part recorded by an earlier flush is not counted again.
+                    u64 from = time > event->_offcpu_flushed ? time : event->_offcpu_flushed;
+                    u64 to = switch_in > from ? switch_in : from;
+                    OffCpuEvent off_cpu;
+                    off_cpu._start_time = projectTime(from, now_ticks, now_nanos);
+                    off_cpu._end_time = projectTime(to, now_ticks, now_nanos);
+                    Profiler::instance()->recordExternalSample(to - from, tid, OFF_CPU_SAMPLE, &off_cpu, num_frames, frames,
+                                                               _record_cpu ? (int)sample_cpu : -1);
+                    event->_offcpu_flushed = pending ? now_nanos : 0;
+                } else {
+                    PerfSampleEvent sample(projectTime(time, now_ticks, now_nanos));
+                    Profiler::instance()->recordExternalSample(period, tid, PERF_SAMPLE, &sample, num_frames, frames,
+                                                               _record_cpu ? (int)sample_cpu : -1);
+                }
+            }
+
+            if (pending) {
+                // The rest of the interval is recorded at switch-in
+                break;
+            }
+        } else if (hdr->type == PERF_RECORD_LOST) {
+            ring.next();  // id
+            _lost_samples += ring.next();
+        }
+
+        tail += hdr->size;
+    }
+
+    __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+    free(own_frames);
+}
+
+void PerfEvents::collectorLoop() {
+    // Decoding of compiled frames is crash protected only in threads known to the JVM
+    bool attached = VM::loaded() && VM::attachThread("Async-profiler Perf Collector") != NULL;
+
+    ASGCT_CallFrame* frames = (ASGCT_CallFrame*)malloc(scratchSize());
+    struct epoll_event ready[COLLECTOR_BATCH];
+    bool stopping = false;
+
+    while (!stopping) {
+        int count = epoll_wait(_epoll_fd, ready, COLLECTOR_BATCH, COLLECTOR_POLL_MS);
+        if (count < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            PerfEvent* event = (PerfEvent*)ready[i].data.ptr;
+            if (event == NULL) {
+                // stop() has closed the pipe
+                stopping = true;
+            } else if (event->tryLock()) {
+                drainBuffer(event, frames);
+                if ((ready[i].events & EPOLLHUP) && event->_fd > 0) {
+                    // The thread has exited without notifying the profiler
+                    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, event->_fd, NULL);
+                }
+                event->unlock();
+            }
+        }
+
+        // Rings wake up only when half full; sweep them on every tick
+        for (int cpu = 0; _percpu && cpu < _max_cpus; cpu++) {
+            PerfEvent* event = &_cpu_events[cpu];
+            if (event->tryLock()) {
+                drainBuffer(event, frames);
+                event->unlock();
+            }
+        }
+        for (int i = 0, tid; !_percpu && (tid = nextWatched(i)) >= 0; i++) {
+            PerfEvent* event = &_events[tid];
+            if (event->tryLock()) {
+                drainBuffer(event, frames);
+                event->unlock();
+            }
+        }
+    }
+
+    free(frames);
+
+    if (attached) {
+        VM::detachThread();
+    }
+}
+
+// Reads the whole group in one call: {nr, leader value, counter values...} since the last reset.
+// Returns the value of the weight event
+u64 PerfEvents::readGroup(int fd, PerfSampleEvent* event) {
+    u64 values[MAX_PERF_COUNTERS + 2];
+    ssize_t size = (_num_counters + 2) * sizeof(u64);
+    if (read(fd, values, size) != size || values[0] != (u64)_num_counters + 1) {
+        return 1;
+    }
+
+    if (event != NULL) {
+        event->_num_counters = _num_counters + 1;
+        memcpy(event->_counters, values + 1, (_num_counters + 1) * sizeof(u64));
+    }
+    return values[1 + _weight_index];
+}
+
+u64 PerfEvents::readCounter(siginfo_t* siginfo, void* ucontext, PerfSampleEvent* event) {
+    u64 group_value = _num_counters > 0 ? readGroup(siginfo->si_fd, event) : 0;
+    if (_weight_index > 0) {
+        return group_value;
+    }
+
     switch (_event_type->counter_arg) {
         case 1: return StackFrame(ucontext).arg0();
         case 2: return StackFrame(ucontext).arg1();
         case 3: return StackFrame(ucontext).arg2();
         case 4: return StackFrame(ucontext).arg3();
         default: {
+            if (_num_counters > 0) {
+                return group_value;
+            }
             u64 counter;
             return read(siginfo->si_fd, &counter, sizeof(counter)) == sizeof(counter) ? counter : 1;
         }
@@ -717,14 +1494,14 @@ void PerfEvents::signalHandler(int signo, siginfo_t* siginfo, void* ucontext) {
     }
 
     if (_enabled) {
-        ExecutionEvent event(TSC::ticks());
-        u64 counter = readCounter(siginfo, ucontext);
+        PerfSampleEvent event(TSC::ticks());
+        u64 counter = readCounter(siginfo, ucontext, &event);
         Profiler::instance()->recordSample(ucontext, counter, PERF_SAMPLE, &event);
     } else {
         resetBuffer(OS::threadId());
     }
 
-    ioctl(siginfo->si_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(siginfo->si_fd, PERF_EVENT_IOC_RESET, _num_counters > 0 ? PERF_IOC_FLAG_GROUP : 0);
     ioctl(siginfo->si_fd, _ioc_enable, 1);
 }
 
@@ -739,7 +1516,7 @@ void PerfEvents::signalHandlerJ9(int signo, siginfo_t* siginfo, void* ucontext)
     }
 
     if (_enabled) {
-        u64 counter = readCounter(siginfo, ucontext);
+        u64 counter = readCounter(siginfo, ucontext, NULL);
         J9StackTraceNotification notif;
         StackContext java_ctx;
         notif.num_frames = _cstack == CSTACK_NO ? 0 : walk(OS::threadId(), ucontext, notif.addr, MAX_J9_NATIVE_FRAMES, &java_ctx);
@@ -748,12 +1525,16 @@ void PerfEvents::signalHandlerJ9(int signo, siginfo_t* siginfo, void* ucontext)
         resetBuffer(OS::threadId());
     }
 
-    ioctl(siginfo->si_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(siginfo->si_fd, PERF_EVENT_IOC_RESET, _num_counters > 0 ? PERF_IOC_FLAG_GROUP : 0);
     ioctl(siginfo->si_fd, _ioc_enable, 1);
 }
 
 const char* PerfEvents::title() {
-    if (_event_type == NULL || strcmp(_event_type->name, "cpu-clock") == 0) {
+    if (_offcpu) {
+        return "Off-CPU profile";
+    } else if (_weight_index > 0) {
+        return counter_types[_weight_index - 1].name;
+    } else if (_event_type == NULL || strcmp(_event_type->name, "cpu-clock") == 0) {
         return "CPU profile";
     } else if (_event_type->type == PERF_TYPE_SOFTWARE || _event_type->type == PERF_TYPE_HARDWARE || _event_type->type == PERF_TYPE_HW_CACHE) {
         return _event_type->name;
@@ -763,18 +1544,81 @@ const char* PerfEvents::title() {
 }
 
 const char* PerfEvents::units() {
-    return _event_type == NULL || strcmp(_event_type->name, "cpu-clock") == 0 ? "ns" : "total";
+    const char* name = _weight_index > 0 ? counter_types[_weight_index - 1].name : _event_type != NULL ? _event_type->name : NULL;
+    return _offcpu || name == NULL || strcmp(name, "cpu-clock") == 0 ? "ns" : "total";
+}
+
+// Parses a '+' separated list of counter events into counter_types.
+// The weight is either the sampling event (index 0) or one of the counters
+Error PerfEvents::parseCounters(const char* counters, const char* weight, const char* event) {
+    _num_counters = 0;
+    _weight_index = 0;
+    if (counters == NULL) {
+        return weight == NULL ? Error::OK : Error("weight requires counters");
+    }
+
+    char buf[256];
+    strncpy(buf, counters, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+
+    for (char* name = strtok(buf, "+"); name != NULL; name = strtok(NULL, "+")) {
+        if (_num_counters >= MAX_PERF_COUNTERS) {
+            return Error("Too many counters");
+        }
+
+        PerfEventType* event_type = PerfEventType::forName(name);
+        if (event_type == NULL) {
+            return Error("Unsupported counter event");
+        } else if (event_type == &PerfEventType::AVAILABLE_EVENTS[PerfEventType::IDX_KPROBE] ||
+                   event_type == &PerfEventType::AVAILABLE_EVENTS[PerfEventType::IDX_UPROBE]) {
+            return Error("Probes cannot be used as counters");
+        }
+        if (weight != NULL && _weight_index == 0 && strcmp(name, weight) == 0) {
+            _weight_index = _num_counters + 1;
+        }
+        counter_types[_num_counters++] = *event_type;
+    }
+
+    if (weight != NULL && _weight_index == 0 && strcmp(weight, event) != 0) {
+        return Error("weight must be the sampling event or one of the counters");
+    }
+    return Error::OK;
 }
 
 Error PerfEvents::start(Arguments& args) {
-    _event_type = PerfEventType::forName(args._event);
-    if (_event_type == NULL) {
+    _offcpu = strcmp(args._event, EVENT_OFFCPU) == 0;
+
+    if (args._counters != NULL && FdTransferClient::hasPeer()) {
+        return Error("counters are not supported with fdtransfer");
+    } else if (args._percpu && FdTransferClient::hasPeer()) {
+        return Error("percpu is not supported with fdtransfer");
+    } else if (_offcpu && args._percpu) {
+        return Error("offcpu does not support percpu mode");
+    } else if ((args._percpu || args._nosignal || _offcpu) && args._counters != NULL) {
+        return Error("counters require signal based sampling");
+    } else if (args._user_stack > 0 && !args._percpu && !args._nosignal && !_offcpu) {
+        return Error("userstack requires percpu or nosignal mode");
+    } else if (args._user_stack > 0 && FdTransferClient::hasPeer()) {
+        return Error("userstack is not supported with fdtransfer");
+    }
+
+    // Counters go first, since resolving the main event may set up probe_func
+    Error error = parseCounters(args._counters, args._weight, args._event);
+    if (error) {
+        return error;
+    }
+
+    _event_type = PerfEventType::forName(_offcpu ? OFFCPU_TRACEPOINT : args._event);
+    if (_event_type == NULL && _offcpu) {
+        return Error("sched:sched_switch tracepoint is not accessible. Try --fdtransfer or check tracefs permissions");
+    } else if (_event_type == NULL) {
         return Error("Unsupported event type");
     } else if (_event_type->counter_arg > 4) {
         return Error("Only arguments 1-4 can be counted");
     }
 
-    if (!setupThreadHook()) {
+    _percpu = args._percpu;
+    if (!_percpu && !setupThreadHook()) {
         return Error("Could not set pthread hook");
     }
 
@@ -801,7 +1645,19 @@ Error PerfEvents::start(Arguments& args) {
     }
     _use_perf_mmap = _kernel_stack || _cstack == CSTACK_DEFAULT || _cstack == CSTACK_LBR || _record_cpu;
 
-    if (strcmp(_event_type->name, "cpu-clock") == 0 && hasPerfEventRefreshBug()) {
+    // Stacks of collected samples come from the kernel callchain, regardless of cstack.
+    // offcpu samples are paired with switch-in records, so they are always collected from the rings
+    _nosignal = (args._nosignal || _offcpu) && !_percpu;
+    _max_stack_depth = args._jstackdepth;
+    _user_stack = args._user_stack < MAX_USER_STACK ? args._user_stack & ~7 : MAX_USER_STACK;
+    _stack_copy_dropped = false;
+    if (_percpu) {
+        return startPerCpu();
+    }
+
+    if (_nosignal) {
+        _ioc_enable = PERF_EVENT_IOC_ENABLE;   // events run continuously, nothing to re-arm
+    } else if (strcmp(_event_type->name, "cpu-clock") == 0 && hasPerfEventRefreshBug()) {
         Log::debug("Enable workaround for PERF_EVENT_IOC_REFRESH bug");
         _ioc_enable = PERF_EVENT_IOC_ENABLE;   // opt-in for manual enable/disable
     } else {
@@ -817,9 +1673,21 @@ Error PerfEvents::start(Arguments& args) {
         _max_events = max_events;
     }
 
-    if (VM::isOpenJ9()) {
+    // Only touched pages of the counter table are backed by memory
+    free(_counter_fds);
+    _counter_fds = _num_counters > 0 ? (int*)calloc((size_t)max_events * _num_counters, sizeof(int)) : NULL;
+    if (_num_counters > 0 && _counter_fds == NULL) {
+        return Error("Not enough memory for perf counters");
+    }
+
+    if (_nosignal) {
+        error = startCollector();
+        if (error) {
+            return error;
+        }
+    } else if (VM::isOpenJ9()) {
         OS::installSignalHandler(_signal, signalHandlerJ9);
-        Error error = J9StackTraces::start(args);
+        error = J9StackTraces::start(args);
         if (error) {
             return error;
         }
@@ -846,13 +1714,43 @@ Error PerfEvents::start(Arguments& args) {
 }
 
 void PerfEvents::stop() {
+    if (_percpu) {
+        stopPerCpu();
+        return;
+    }
+
     disableThreadHook();
+    // Rings that the collector did not get to are drained while destroying events.
+    // Events are already disabled by the profiler, but samples taken before stop are still recorded.
+    _stopping = true;
+    stopCollector();
     for (int i = 0; i < _max_events; i++) {
         destroyForThread(i);
     }
+    _stopping = false;
     J9StackTraces::stop();
 }
 
+// Threads that are off CPU at the time of a dump would otherwise appear only in the next one
+void PerfEvents::flush() {
+    if (!_offcpu) {
+        return;
+    }
+
+    ASGCT_CallFrame* frames = (ASGCT_CallFrame*)malloc(scratchSize());
+    if (frames == NULL) {
+        return;
+    }
+
+    for (int i = 0, tid; (tid = nextWatched(i)) >= 0; i++) {
+        PerfEvent* event = &_events[tid];
+        event->lock();
+        drainBuffer(event, frames, true);
+        event->unlock();
+    }
+    free(frames);
+}
+
 int PerfEvents::walk(int tid, void* ucontext, const void** callchain, int max_depth, StackContext* java_ctx) {
     PerfEvent* event = &_events[tid];
     if (!event->tryLock()) {
@@ -0,0 +1,78 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _PERFRINGBUFFER_H
+#define _PERFRINGBUFFER_H
+
+#ifdef __linux__
+
+#include <string.h>
+#include <linux/perf_event.h>
+#include "arch.h"
+#include "os.h"
+
+
+// Reader of the data area of a perf_event ring, which follows the header page.
+// The data size is a power of 2; records may wrap around its end.
+class RingBuffer {
+  private:
+    const char* _start;
+    unsigned long _mask;
+    unsigned long _offset;
+
+  public:
+    RingBuffer(struct perf_event_mmap_page* page, unsigned long data_size = OS::page_size) {
+        _start = (const char*)page + OS::page_size;
+        _mask = data_size - 1;
+    }
+
+    struct perf_event_header* seek(u64 offset) {
+        _offset = (unsigned long)offset & _mask;
+        return (struct perf_event_header*)(_start + _offset);
+    }
+
+    u64 next() {
+        _offset = (_offset + sizeof(u64)) & _mask;
+        return *(u64*)(_start + _offset);
+    }
+
+    u64 peek(unsigned long words) {
+        unsigned long peek_offset = (_offset + words * sizeof(u64)) & _mask;
+        return *(u64*)(_start + peek_offset);
+    }
+
+    // Skips size bytes following the current word and returns them,
+    // copied to buf if they wrap around the end of the ring
+    const char* bytes(size_t size, char* buf) {
+        unsigned long start = (_offset + sizeof(u64)) & _mask;
+        _offset = (start + size - sizeof(u64)) & _mask;
+        if (start + size <= _mask + 1) {
+            return _start + start;
+        }
+
+        size_t first = _mask + 1 - start;
+        memcpy(buf, _start + start, first);
+        memcpy(buf + first, _start, size - first);
+        return buf;
+    }
+
+    // Time of the first switch-in record between tail and head, or 0 if the thread is still off CPU.
+    // Switch records carry sample_id with TID and TIME first.
+    u64 findSwitchIn(u64 tail, u64 head) {
+        while (tail < head) {
+            struct perf_event_header* hdr = seek(tail);
+            if (hdr->type == PERF_RECORD_SWITCH && !(hdr->misc & PERF_RECORD_MISC_SWITCH_OUT)) {
+                next();  // pid, tid
+                return next();
+            }
+            tail += hdr->size;
+        }
+        return 0;
+    }
+};
+
+#endif // __linux__
+
+#endif // _PERFRINGBUFFER_H
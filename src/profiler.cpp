@@ -4,6 +4,7 @@
  */
 
 #include <algorithm>
+#include <unordered_map>
 #include <assert.h>
 #include <dlfcn.h>
 #include <unistd.h>
@@ -91,6 +92,7 @@ static inline int hasNativeStack(EventType event_type) {
         (1 << PERF_SAMPLE)        |
         (1 << EXECUTION_SAMPLE)   |
         (1 << WALL_CLOCK_SAMPLE)  |
+        (1 << OFF_CPU_SAMPLE)     |
         (1 << NATIVE_LOCK_SAMPLE) |
         (1 << MALLOC_SAMPLE)      |
         (1 << ALLOC_SAMPLE)       |
@@ -123,9 +125,15 @@ void Profiler::addJavaMethod(const void* address, int length, jmethodID method)
 
 void Profiler::addRuntimeStub(const void* address, int length, const char* name) {
     _stubs_lock.lock();
-    _runtime_stubs.add(address, length, name, true);
+    _runtime_stubs.add(address, length, name);
+    StubSnapshot* retired = _runtime_stubs.takeRetired();
     _stubs_lock.unlock();
 
+    if (retired != NULL) {
+        waitForLookups();
+        StubCache::freeRetired(retired);
+    }
+
     if (strcmp(name, "call_stub") == 0) {
         _call_stub_begin = address;
         _call_stub_end = (const char*)address + length;
@@ -186,14 +194,40 @@ const char* Profiler::asgctError(int code) {
 }
 
 inline u32 Profiler::getLockIndex(int tid) {
-    u32 lock_index = tid;
-    lock_index ^= lock_index >> 8;
-    lock_index ^= lock_index >> 4;
-    return lock_index % CONCURRENCY_LEVEL;
+    // Handlers running on different CPUs start from different slots
+    int cpu = OS::currentCpu();
+    u32 lock_index = cpu;
+    if (cpu < 0) {
+        lock_index = tid;
+        lock_index ^= lock_index >> 8;
+        lock_index ^= lock_index >> 4;
+    }
+    return lock_index & (_concurrency_level - 1);
+}
+
+// Takes a free sampler slot, starting from the one of the current CPU. There are at least
+// as many slots as CPUs, so a few probes find a free slot unless handlers were preempted,
+// or samplers are paused by lockAll. A sample is dropped rather than scanning every slot.
+int Profiler::lockSlot(int tid) {
+    u32 mask = _concurrency_level - 1;
+    u32 lock_index = getLockIndex(tid);
+    for (int i = 0; i < SLOT_PROBES; i++) {
+        lock_index = (lock_index + i) & mask;
+        if (_locks[lock_index].tryLock()) {
+            return lock_index;
+        }
+    }
+    return -1;
 }
 
 void Profiler::updateSymbols(bool kernel_symbols) {
     Symbols::parseLibraries(&_native_libs, kernel_symbols);
+
+    CodeCacheIndex* retired = _native_libs.takeRetired();
+    if (retired != NULL) {
+        waitForLookups();
+        _native_libs.freeRetired(retired);
+    }
 }
 
 void Profiler::mangle(const char* name, char* buf, size_t size) {
@@ -276,13 +310,7 @@ CodeCache* Profiler::findLibraryByName(const char* lib_name) {
 }
 
 CodeCache* Profiler::findLibraryByAddress(const void* address) {
-    const int native_lib_count = _native_libs.count();
-    for (int i = 0; i < native_lib_count; i++) {
-        if (_native_libs[i]->contains(address)) {
-            return _native_libs[i];
-        }
-    }
-    return NULL;
+    return _native_libs.findLibrary(address);
 }
 
 const char* Profiler::findNativeMethod(const void* address) {
@@ -290,8 +318,8 @@ const char* Profiler::findNativeMethod(const void* address) {
     return lib == NULL ? NULL : lib->binarySearch(address);
 }
 
-CodeBlob* Profiler::findRuntimeStub(const void* address) {
-    return _runtime_stubs.findBlobByAddress(address);
+bool Profiler::findRuntimeStub(const void* address, CodeBlob* stub) {
+    return _runtime_stubs.findBlobByAddress(address, stub);
 }
 
 bool Profiler::isAddressInCode(const void* pc) {
@@ -313,7 +341,7 @@ jmethodID Profiler::getCurrentCompileTask() {
     return NULL;
 }
 
-int Profiler::getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, EventType event_type, int tid, StackContext* java_ctx) {
+int Profiler::getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, EventType event_type, int tid, StackContext* java_ctx, PcCache* pc_cache) {
     const void* callchain[MAX_NATIVE_FRAMES];
     int native_frames;
 
@@ -328,17 +356,33 @@ int Profiler::getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, EventType
         native_frames = StackWalker::walkFP(ucontext, callchain, MAX_NATIVE_FRAMES, java_ctx);
     }
 
-    return convertNativeTrace(native_frames, callchain, frames, event_type);
+    return convertNativeTrace(native_frames, callchain, frames, event_type, pc_cache);
 }
 
-int Profiler::convertNativeTrace(int native_frames, const void** callchain, ASGCT_CallFrame* frames, EventType event_type) {
+int Profiler::convertNativeTrace(int native_frames, const void** callchain, ASGCT_CallFrame* frames, EventType event_type, PcCache* pc_cache) {
     int depth = 0;
     jmethodID prev_method = NULL;
 
+    if (pc_cache != NULL) {
+        pc_cache->validate(_native_libs.generation());
+    }
+
     for (int i = 0; i < native_frames; i++) {
-        const char* current_method_name = findNativeMethod(callchain[i]);
+        const char* current_method_name;
         char mark;
-        if (current_method_name != NULL && (mark = NativeFunc::mark(current_method_name)) != 0) {
+        PcCacheEntry* cached;
+        if (pc_cache != NULL && (cached = pc_cache->lookup(callchain[i])) != NULL) {
+            current_method_name = cached->name;
+            mark = cached->mark;
+        } else {
+            current_method_name = findNativeMethod(callchain[i]);
+            mark = current_method_name != NULL ? NativeFunc::mark(current_method_name) : 0;
+            if (pc_cache != NULL) {
+                pc_cache->put(callchain[i], current_method_name, mark);
+            }
+        }
+
+        if (mark != 0) {
             if (mark == MARK_VM_RUNTIME && event_type >= ALLOC_SAMPLE) {
                 // Skip all internal frames above VM runtime entry for allocation samples
                 depth = 0;
@@ -426,16 +470,10 @@ int Profiler::getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max
     }
 
     if ((trace.num_frames == ticks_unknown_Java || trace.num_frames == ticks_not_walkable_Java) && _features.unknown_java && ucontext != NULL) {
-        CodeBlob* stub = NULL;
-        _stubs_lock.lockShared();
-        if (_runtime_stubs.contains((const void*)frame.pc())) {
-            stub = findRuntimeStub((const void*)frame.pc());
-        }
-        _stubs_lock.unlockShared();
-
-        if (stub != NULL) {
+        CodeBlob stub;
+        if (_runtime_stubs.contains((const void*)frame.pc()) && findRuntimeStub((const void*)frame.pc(), &stub)) {
             if (_cstack != CSTACK_NO) {
-                if (_features.vtable_target && isVTableStub(stub->_name)) {
+                if (_features.vtable_target && isVTableStub(stub._name)) {
                     uintptr_t receiver = frame.jarg0();
                     if (receiver != 0) {
                         VMSymbol* symbol = VMKlass::fromOop(receiver)->name();
@@ -443,9 +481,9 @@ int Profiler::getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max
                         max_depth -= makeFrame(trace.frames++, BCI_ALLOC, class_id);
                     }
                 }
-                max_depth -= makeFrame(trace.frames++, BCI_NATIVE_FRAME, stub->_name);
+                max_depth -= makeFrame(trace.frames++, BCI_NATIVE_FRAME, stub._name);
             }
-            if (_features.unwind_stub && frame.unwindStub((instruction_t*)stub->_start, stub->_name)
+            if (_features.unwind_stub && frame.unwindStub((instruction_t*)stub._start, stub._name)
                     && isAddressInCode((const void*)frame.pc())) {
                 java_ctx->pc = (const void*)frame.pc();
                 VM::_asyncGetCallTrace(&trace, max_depth, ucontext);
@@ -608,11 +646,8 @@ u64 Profiler::recordSample(void* ucontext, u64 counter, EventType event_type, Ev
     atomicInc(_total_samples);
 
     int tid = OS::threadId();
-    u32 lock_index = getLockIndex(tid);
-    if (!_locks[lock_index].tryLock() &&
-        !_locks[lock_index = (lock_index + 1) % CONCURRENCY_LEVEL].tryLock() &&
-        !_locks[lock_index = (lock_index + 2) % CONCURRENCY_LEVEL].tryLock())
-    {
+    int lock_index = lockSlot(tid);
+    if (lock_index < 0) {
         // Too many concurrent signals already
         atomicInc(_failures[-ticks_skipped]);
 
@@ -644,15 +679,21 @@ u64 Profiler::recordSample(void* ucontext, u64 counter, EventType event_type, Ev
             num_frames += makeFrame(frames + num_frames, BCI_ADDRESS, StackFrame(ucontext).pc());
         }
         if (_cstack != CSTACK_NO) {
-            num_frames += getNativeTrace(ucontext, frames + num_frames, event_type, tid, &java_ctx);
+            num_frames += getNativeTrace(ucontext, frames + num_frames, event_type, tid, &java_ctx, _pc_cache[lock_index]);
         }
     }
 
+    ScopeCache* scope_cache = _scope_cache[lock_index];
+    if (scope_cache != NULL && !VMStructs::hasNMethodCompileId()) {
+        // Without compile ids, cached scopes may belong to an unloaded nmethod at the same address
+        scope_cache->validate(_nmethod_epoch);
+    }
+
     if (_features.mixed) {
-        num_frames += StackWalker::walkVM(ucontext, frames + num_frames, _max_stack_depth, _features, event_type);
+        num_frames += StackWalker::walkVM(ucontext, frames + num_frames, _max_stack_depth, _features, event_type, scope_cache);
     } else if (event_type <= MALLOC_SAMPLE) {
         if (_cstack == CSTACK_VM) {
-            num_frames += StackWalker::walkVM(ucontext, frames + num_frames, _max_stack_depth, _features, event_type);
+            num_frames += StackWalker::walkVM(ucontext, frames + num_frames, _max_stack_depth, _features, event_type, scope_cache);
         } else {
             int java_frames = getJavaTraceAsync(ucontext, frames + num_frames, _max_stack_depth, &java_ctx);
             if (java_frames > 0 && java_ctx.pc != NULL && VMStructs::hasMethodStructs()) {
@@ -696,14 +737,15 @@ u64 Profiler::recordSample(void* ucontext, u64 counter, EventType event_type, Ev
         atomicInc(_total_stack_walk_time, stack_walk_end - stack_walk_begin);
     }
 
-    u32 call_trace_id = _call_trace_storage.put(num_frames, frames, counter);
+    u32 call_trace_id = _call_trace_storage.put(num_frames, frames, counter, lock_index);
     _jfr.recordEvent(lock_index, tid, call_trace_id, event_type, event);
 
     _locks[lock_index].unlock();
     return (u64)tid << 32 | call_trace_id;
 }
 
-void Profiler::recordExternalSample(u64 counter, int tid, EventType event_type, Event* event, int num_frames, ASGCT_CallFrame* frames) {
+void Profiler::recordExternalSample(u64 counter, int tid, EventType event_type, Event* event, int num_frames, ASGCT_CallFrame* frames,
+                                    int cpu) {
     atomicInc(_total_samples);
 
     if (_add_thread_frame) {
@@ -712,35 +754,37 @@ void Profiler::recordExternalSample(u64 counter, int tid, EventType event_type,
     if (_add_sched_frame) {
         num_frames += makeFrame(frames + num_frames, BCI_ERROR, OS::schedPolicy(tid));
     }
+    if (_add_cpu_frame && cpu >= 0) {
+        num_frames += makeFrame(frames + num_frames, BCI_CPU, cpu | 0x8000);
+    }
 
-    u32 call_trace_id = _call_trace_storage.put(num_frames, frames, counter);
-
-    u32 lock_index = getLockIndex(tid);
-    if (!_locks[lock_index].tryLock() &&
-        !_locks[lock_index = (lock_index + 1) % CONCURRENCY_LEVEL].tryLock() &&
-        !_locks[lock_index = (lock_index + 2) % CONCURRENCY_LEVEL].tryLock())
-    {
-        // Too many concurrent signals already
+    int lock_index = lockSlot(tid);
+    if (lock_index < 0) {
+        // Too many concurrent signals already.
+        // Bounded storage is updated only under a lock, since it may be evicting call traces.
+        if (!_call_trace_storage.bounded()) {
+            _call_trace_storage.put(num_frames, frames, counter);
+        }
         atomicInc(_failures[-ticks_skipped]);
         return;
     }
 
+    u32 call_trace_id = _call_trace_storage.put(num_frames, frames, counter, lock_index);
     _jfr.recordEvent(lock_index, tid, call_trace_id, event_type, event);
 
     _locks[lock_index].unlock();
 }
 
 void Profiler::recordExternalSamples(u64 samples, u64 counter, int tid, u32 call_trace_id, EventType event_type, Event* event) {
-    _call_trace_storage.add(call_trace_id, samples, counter);
-
-    u32 lock_index = getLockIndex(tid);
-    if (!_locks[lock_index].tryLock() &&
-        !_locks[lock_index = (lock_index + 1) % CONCURRENCY_LEVEL].tryLock() &&
-        !_locks[lock_index = (lock_index + 2) % CONCURRENCY_LEVEL].tryLock())
-    {
+    int lock_index = lockSlot(tid);
+    if (lock_index < 0) {
+        if (!_call_trace_storage.bounded()) {
+            _call_trace_storage.add(call_trace_id, samples, counter);
+        }
         return;
     }
 
+    _call_trace_storage.add(call_trace_id, samples, counter, lock_index);
     _jfr.recordEvent(lock_index, tid, call_trace_id, event_type, event);
 
     _locks[lock_index].unlock();
@@ -752,11 +796,8 @@ void Profiler::recordEventOnly(EventType event_type, Event* event) {
     }
 
     int tid = OS::threadId();
-    u32 lock_index = getLockIndex(tid);
-    if (!_locks[lock_index].tryLock() &&
-        !_locks[lock_index = (lock_index + 1) % CONCURRENCY_LEVEL].tryLock() &&
-        !_locks[lock_index = (lock_index + 2) % CONCURRENCY_LEVEL].tryLock())
-    {
+    int lock_index = lockSlot(tid);
+    if (lock_index < 0) {
         return;
     }
 
@@ -766,12 +807,10 @@ void Profiler::recordEventOnly(EventType event_type, Event* event) {
 }
 
 void Profiler::tryResetCounters() {
-    // Reset counters only for non-JFR recording, otherwise resetting may cause missing stack traces for some
-    // allocation events and skewed incorrect number of samples.
-    // In JFR recording, each sample is recorded individually, so accumulated counters are not actually used.
-    if (!_jfr.active()) {
-        _call_trace_storage.resetCounters();
-    }
+    // Samplers update counters of the current epoch only, so resetting the collected ones is safe
+    // even during JFR recording: it does not lose stack traces referenced by events.
+    swapCounterEpoch();
+    _call_trace_storage.resetCounters();
 }
 
 void Profiler::writeLog(LogLevel level, const char* message) {
@@ -897,7 +936,7 @@ void Profiler::setupSignalHandlers() {
 
     // HotSpot tolerates interposed SIGSEGV/SIGBUS handler; other JVMs don't
     if (!VM::isOpenJ9() && !VM::isZing()) {
-        CodeCache* profiler_lib = instance()->findLibraryByAddress((void*)crashHandler);
+        CodeCache* profiler_lib = instance()->nativeLibs()->scanLibraries((void*)crashHandler);
         if (profiler_lib != NULL) {
             // Record boundaries of our own library for the signal handler to check
             // if a crash has happened in the profiler code
@@ -974,8 +1013,8 @@ bool Profiler::excludeTrace(FrameName* fn, CallTrace* trace) {
         return false;
     }
 
-    for (int i = 0; i < trace->num_frames; i++) {
-        const char* frame_name = fn->name(trace->frames[i], true);
+    for (CallTraceIterator it(trace); it.hasNext(); ) {
+        const char* frame_name = fn->name(it.next(), true);
         if (check_exclude && fn->exclude(frame_name)) {
             return true;
         }
@@ -1110,6 +1149,10 @@ Error Profiler::start(Arguments& args, bool reset) {
         }
     }
 
+    if (args._storage_limit != 0 && (size_t)args._storage_limit < MIN_STORAGE_LIMIT) {
+        return Error("storagelimit must be at least 16m");
+    }
+
     // Save the arguments for shutdown or restart
     args.save();
 
@@ -1124,6 +1167,8 @@ Error Profiler::start(Arguments& args, bool reset) {
         _class_map.clear();
         _thread_filter.clear();
         _call_trace_storage.clear();
+        _call_trace_storage.setOptions(args._storage_options, _concurrency_level);
+        _call_trace_storage.setMemoryLimit(args._storage_limit, args._storage_age);
         // Make sure frame structure is consistent throughout the entire recording
         _add_event_frame = args._output != OUTPUT_JFR;
         _add_thread_frame = args._threads && args._output != OUTPUT_JFR;
@@ -1142,7 +1187,7 @@ Error Profiler::start(Arguments& args, bool reset) {
         _max_stack_depth = args._jstackdepth;
         size_t nelem = _max_stack_depth + MAX_NATIVE_FRAMES + RESERVED_FRAMES;
 
-        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+        for (int i = 0; i < _concurrency_level; i++) {
             free(_calltrace_buffer[i]);
             _calltrace_buffer[i] = (CallTraceBuffer*)calloc(nelem, sizeof(CallTraceBuffer));
             if (_calltrace_buffer[i] == NULL) {
@@ -1152,6 +1197,13 @@ Error Profiler::start(Arguments& args, bool reset) {
         }
     }
 
+    // PC caches are optional and live as long as the profiler: a missing one only disables caching
+    for (int i = 0; i < _concurrency_level; i++) {
+        if (_pc_cache[i] == NULL) {
+            _pc_cache[i] = (PcCache*)calloc(1, sizeof(PcCache));
+        }
+    }
+
     _features = args._features;
     if (VM::hotspot_version() < 8) {
         _features.java_anchor = 0;
@@ -1174,6 +1226,12 @@ Error Profiler::start(Arguments& args, bool reset) {
         return Error("target-cpu is only supported with perf_events");
     } else if (_engine != &perf_events && args._record_cpu) {
         return Error("record-cpu is only supported with perf_events");
+    } else if (_engine != &perf_events && (args._counters != NULL || args._weight != NULL)) {
+        return Error("counters are only supported with perf_events");
+    } else if (_engine != &perf_events && args._percpu) {
+        return Error("percpu is only supported with perf_events");
+    } else if (_engine != &perf_events && args._nosignal) {
+        return Error("nosignal is only supported with perf_events");
     } else if (_engine == &instrument && !args._trace.empty()) {
         return Error("Running method tracing and Java method sampling in parallel is not supported");
     }
@@ -1201,6 +1259,20 @@ Error Profiler::start(Arguments& args, bool reset) {
         return Error("mixed feature is only allowed with VMStructs stack walking");
     }
 
+    // Scope caches are only consulted by the VMStructs stack walker
+    if (_cstack == CSTACK_VM) {
+        for (int i = 0; i < _concurrency_level; i++) {
+            if (_scope_cache[i] == NULL) {
+                _scope_cache[i] = (ScopeCache*)calloc(1, sizeof(ScopeCache));
+            }
+        }
+    }
+
+    Symbols::setLazy(args._lazy_symbols);
+    if (args._symcache != NULL) {
+        Symbols::setCacheDir(args._symcache);
+    }
+
     // Kernel symbols are useful only for perf_events without --all-user
     updateSymbols(_engine == &perf_events && !args._alluser);
 
@@ -1301,6 +1373,7 @@ error1:
     _jfr.stop();
     unlockAll();
 
+    Symbols::stopLoader();
     FdTransferClient::closePeer();
     return error;
 }
@@ -1338,6 +1411,9 @@ Error Profiler::stop(bool restart) {
     _jfr.stop();
     unlockAll();
 
+    // Symbols still pending are loaded synchronously when dumping
+    Symbols::stopLoader();
+
     if (!restart) {
         FdTransferClient::closePeer();
     }
@@ -1360,9 +1436,9 @@ Error Profiler::flushJfr() {
     updateJavaThreadNames();
     updateNativeThreadNames();
 
-    lockAll();
+    // Samplers are paused only for a moment while the chunk is being switched
     _jfr.flush();
-    unlockAll();
+    finishGeneration();
 
     return Error::OK;
 }
@@ -1374,10 +1450,15 @@ Error Profiler::dump(Writer& out, Arguments& args) {
     }
 
     if (_state == RUNNING) {
+        _engine->flush();
         updateJavaThreadNames();
         updateNativeThreadNames();
     }
 
+    if (args._output != OUTPUT_JFR) {
+        swapCounterEpoch();
+    }
+
     switch (args._output) {
         case OUTPUT_COLLAPSED:
             dumpCollapsed(out, args);
@@ -1393,9 +1474,7 @@ Error Profiler::dump(Writer& out, Arguments& args) {
             break;
         case OUTPUT_JFR:
             if (_state == RUNNING) {
-                lockAll();
-                _jfr.flush();
-                unlockAll();
+                _jfr.dump();
             }
             break;
         case OUTPUT_OTLP:
@@ -1405,9 +1484,26 @@ Error Profiler::dump(Writer& out, Arguments& args) {
             return Error("No output format selected");
     }
 
+    if (_state == RUNNING) {
+        finishGeneration();
+    }
+
     return Error::OK;
 }
 
+// Memory that grows with the number of sampler slots, wherever it is accounted otherwise
+size_t Profiler::slotMemory() {
+    size_t bytes = _concurrency_level * (sizeof(SlotLock) + sizeof(CallTraceBuffer*) + sizeof(PcCache*) + sizeof(ScopeCache*));
+    if (_max_stack_depth > 0) {
+        bytes += _concurrency_level * (_max_stack_depth + MAX_NATIVE_FRAMES + RESERVED_FRAMES) * sizeof(CallTraceBuffer);
+    }
+    for (int i = 0; i < _concurrency_level; i++) {
+        if (_pc_cache[i] != NULL) bytes += sizeof(PcCache);
+        if (_scope_cache[i] != NULL) bytes += sizeof(ScopeCache);
+    }
+    return bytes + _call_trace_storage.shardMemory() + _jfr.slotMemory();
+}
+
 void Profiler::writeMetrics(Writer& out) {
     constexpr size_t KB = 1024;
     out << "mem_calltracestorage_kb " << (u64) _call_trace_storage.usedMemory() / KB << '\n';
@@ -1416,16 +1512,51 @@ void Profiler::writeMetrics(Writer& out) {
     out << "mem_threadfilter_kb " << (u64) _thread_filter.usedMemory() / KB << '\n';
     out << "mem_runtimestubs_kb " << (u64) _runtime_stubs.usedMemory() / KB << '\n';
     out << "mem_nativelibs_kb " << (u64) _native_libs.usedMemory() / KB << '\n';
+    out << "mem_nativelibs_saved_kb " << (u64) _native_libs.savedMemory() / KB << '\n';
+    out << "mem_samplerslots_kb " << (u64) slotMemory() / KB << '\n';
+    out << "sampler_slots " << _concurrency_level << '\n';
 
     out << "samples_total " << _total_samples << '\n';
     out << "samples_skipped_total " << _failures[-ticks_skipped] << '\n';
     out << "calltracestorage_overflows_total " << _call_trace_storage.overflow() << '\n';
+    out << "calltracestorage_unpublished_total " << _call_trace_storage.unpublished() << '\n';
+    out << "calltracestorage_collisions_total " << _call_trace_storage.collisions() << '\n';
+    out << "calltracestorage_evicted_total " << _call_trace_storage.evicted() << '\n';
+
+    u64 pc_cache_hits = 0;
+    u64 pc_cache_misses = 0;
+    for (int i = 0; i < _concurrency_level; i++) {
+        if (_pc_cache[i] != NULL) {
+            pc_cache_hits += _pc_cache[i]->hits();
+            pc_cache_misses += _pc_cache[i]->misses();
+        }
+    }
+    out << "pccache_hits_total " << pc_cache_hits << '\n';
+    out << "pccache_misses_total " << pc_cache_misses << '\n';
+
+    u64 scope_cache_hits = 0;
+    u64 scope_cache_misses = 0;
+    for (int i = 0; i < _concurrency_level; i++) {
+        if (_scope_cache[i] != NULL) {
+            scope_cache_hits += _scope_cache[i]->hits();
+            scope_cache_misses += _scope_cache[i]->misses();
+        }
+    }
+    out << "scopecache_hits_total " << scope_cache_hits << '\n';
+    out << "scopecache_misses_total " << scope_cache_misses << '\n';
 
     if (_total_stack_walk_time != 0) {
         out << "stackwalk_ns_total " << _total_stack_walk_time << '\n';
         u64 stacks = _total_samples - _failures[-ticks_skipped];
         out << "stackwalk_ns_avg " << (_total_stack_walk_time / stacks) << '\n';
     }
+
+    u64 cpool_chunks;
+    u64 cpool_time = _jfr.cpoolTime(&cpool_chunks);
+    if (cpool_chunks != 0) {
+        out << "jfr_cpool_ns_total " << cpool_time << '\n';
+        out << "jfr_cpool_ns_avg " << (cpool_time / cpool_chunks) << '\n';
+    }
 }
 
 void Profiler::logStats() {
@@ -1437,11 +1568,49 @@ void Profiler::logStats() {
 }
 
 void Profiler::lockAll() {
-    for (int i = 0; i < CONCURRENCY_LEVEL; i++) _locks[i].lock();
+    for (int i = 0; i < _concurrency_level; i++) _locks[i].lock();
 }
 
 void Profiler::unlockAll() {
-    for (int i = 0; i < CONCURRENCY_LEVEL; i++) _locks[i].unlock();
+    for (int i = 0; i < _concurrency_level; i++) _locks[i].unlock();
+}
+
+// Freezes sample counters for a dump. Locks are taken one at a time, only to wait
+// for samplers that may still be updating the previous epoch.
+void Profiler::swapCounterEpoch() {
+    _call_trace_storage.swapEpoch();
+    for (int i = 0; i < _concurrency_level; i++) {
+        _locks[i].lock();
+        _locks[i].unlock();
+    }
+}
+
+// Address lookups do not announce themselves: samplers search library and stub snapshots
+// only while holding a slot, engine threads only under the lookup lock. Passing through
+// every slot and the lock waits for lookups that may have loaded a snapshot replaced earlier.
+void Profiler::waitForLookups() {
+    for (int i = 0; i < _concurrency_level; i++) {
+        _locks[i].lock();
+        _locks[i].unlock();
+    }
+    _lookup_lock.lock();
+    _lookup_lock.unlock();
+}
+
+// Each JFR chunk or dump completes a generation of bounded call trace storage.
+// Otherwise, counter shards are emptied one at a time, without pausing all samplers.
+void Profiler::finishGeneration() {
+    if (_call_trace_storage.bounded()) {
+        lockAll();
+        _call_trace_storage.evict();
+        unlockAll();
+    } else {
+        for (int i = 0; i < _concurrency_level; i++) {
+            _locks[i].lock();
+            _call_trace_storage.resetShard(i);
+            _locks[i].unlock();
+        }
+    }
 }
 
 void Profiler::switchThreadEvents(jvmtiEventMode mode) {
@@ -1453,6 +1622,58 @@ void Profiler::switchThreadEvents(jvmtiEventMode mode) {
     }
 }
 
+// Frames of prefix-shared call traces are shared between traces, so the dumpers
+// name each CallTraceNode once instead of re-expanding every trace from the root
+static void collectNodes(const CallTrace* trace, std::vector<const CallTraceNode*>& nodes) {
+    nodes.clear();
+    for (const CallTraceNode* node = trace->top; node != NULL; node = node->parent) {
+        nodes.push_back(node);
+    }
+}
+
+// Flame graph node of a CallTraceNode, linked to the entry of its parent
+struct NodeTrie {
+    Trie* parent;
+    Trie* trie;
+    FrameTypeId type;
+    NodeTrie* up;
+};
+
+// Adds a prefix-shared trace to the flame graph. Only the frames above the part shared with
+// previous traces are named and looked up; the shared part is counted by following NodeTrie links
+static Trie* addSharedTrace(FlameGraph& flamegraph, FrameName& fn, const CallTrace* trace, u64 counter,
+                            std::unordered_map<const CallTraceNode*, NodeTrie>& node_tries,
+                            std::vector<const CallTraceNode*>& nodes) {
+    nodes.clear();
+    NodeTrie* known = NULL;
+    for (const CallTraceNode* node = trace->top; node != NULL; node = node->parent) {
+        auto it = node_tries.find(node);
+        if (it != node_tries.end()) {
+            known = &it->second;
+            break;
+        }
+        nodes.push_back(node);
+    }
+
+    for (NodeTrie* e = known; e != NULL; e = e->up) {
+        FlameGraph::count(e->parent, e->trie, e->type, counter);
+    }
+
+    Trie* f = known != NULL ? known->trie : flamegraph.root();
+    for (size_t i = nodes.size(); i-- > 0; ) {
+        const ASGCT_CallFrame& frame = nodes[i]->frame;
+        NodeTrie& e = node_tries[nodes[i]];
+        e.parent = f;
+        e.type = fn.type(frame);
+        e.trie = flamegraph.child(f, fn.name(frame), e.type);
+        e.up = known;
+        FlameGraph::count(e.parent, e.trie, e.type, counter);
+        f = e.trie;
+        known = &e;
+    }
+    return f;
+}
+
 /*
  * Dump stacks in FlameGraph input format:
  *
@@ -1465,6 +1686,9 @@ void Profiler::dumpCollapsed(Writer& out, Arguments& args) {
 
     std::vector<CallTraceSample*> samples;
     _call_trace_storage.collectSamples(samples);
+    std::vector<const ASGCT_CallFrame*> frames;
+    std::vector<const CallTraceNode*> nodes;
+    std::unordered_map<const CallTraceNode*, std::string> node_names;
 
     for (std::vector<CallTraceSample*>::const_iterator it = samples.begin(); it != samples.end(); ++it) {
         CallTrace* trace = (*it)->acquireTrace();
@@ -1473,9 +1697,21 @@ void Profiler::dumpCollapsed(Writer& out, Arguments& args) {
         u64 counter = args._counter == COUNTER_SAMPLES ? (*it)->samples : (*it)->counter;
         if (counter == 0) continue;
 
-        for (int j = trace->num_frames - 1; j >= 0; j--) {
-            const char* frame_name = fn.name(trace->frames[j]);
-            out << frame_name << (j == 0 ? ' ' : ';');
+        if (trace->top != NULL) {
+            collectNodes(trace, nodes);
+            for (int j = trace->num_frames - 1; j >= 0; j--) {
+                std::string& name = node_names[nodes[j]];
+                if (name.empty()) {
+                    name = fn.name(nodes[j]->frame);
+                }
+                out << name.c_str() << (j == 0 ? ' ' : ';');
+            }
+        } else {
+            trace->rootFirst(frames);
+            for (int j = 0; j < trace->num_frames; j++) {
+                const char* frame_name = fn.name(*frames[j]);
+                out << frame_name << (j == trace->num_frames - 1 ? ' ' : ';');
+            }
         }
         // Beware of locale-sensitive conversion
         out.write(buf, snprintf(buf, sizeof(buf), "%llu\n", counter));
@@ -1503,6 +1739,9 @@ void Profiler::dumpFlameGraph(Writer& out, Arguments& args, bool tree) {
 
         std::vector<CallTraceSample*> samples;
         _call_trace_storage.collectSamples(samples);
+        std::vector<const ASGCT_CallFrame*> frames;
+        std::vector<const CallTraceNode*> nodes;
+        std::unordered_map<const CallTraceNode*, NodeTrie> node_tries;
 
         for (std::vector<CallTraceSample*>::const_iterator it = samples.begin(); it != samples.end(); ++it) {
             CallTrace* trace = (*it)->acquireTrace();
@@ -1511,33 +1750,44 @@ void Profiler::dumpFlameGraph(Writer& out, Arguments& args, bool tree) {
             u64 counter = args._counter == COUNTER_SAMPLES ? (*it)->samples : (*it)->counter;
             if (counter == 0) continue;
 
+            if (trace->top != NULL && !args._reverse) {
+                Trie* f = addSharedTrace(flamegraph, fn, trace, counter, node_tries, nodes);
+                f->_total += counter;
+                f->_self += counter;
+                printed_sample_count++;
+                continue;
+            }
+
+            // frames[0] is the bottom of the stack
+            trace->rootFirst(frames);
             int num_frames = trace->num_frames;
 
             Trie* f = flamegraph.root();
             if (args._reverse) {
                 // Thread frames always come first
+                int bottom = 0;
                 if (_add_sched_frame) {
-                    const char* frame_name = fn.name(trace->frames[--num_frames]);
+                    const char* frame_name = fn.name(*frames[bottom++]);
                     f = flamegraph.addChild(f, frame_name, FRAME_NATIVE, counter);
                 }
                 if (_add_thread_frame) {
-                    const char* frame_name = fn.name(trace->frames[--num_frames]);
+                    const char* frame_name = fn.name(*frames[bottom++]);
                     f = flamegraph.addChild(f, frame_name, FRAME_NATIVE, counter);
                 }
                 if (_add_cpu_frame) {
-                    const char* frame_name = fn.name(trace->frames[--num_frames]);
+                    const char* frame_name = fn.name(*frames[bottom++]);
                     f = flamegraph.addChild(f, frame_name, FRAME_NATIVE, counter);
                 }
 
-                for (int j = 0; j < num_frames; j++) {
-                    const char* frame_name = fn.name(trace->frames[j]);
-                    FrameTypeId frame_type = fn.type(trace->frames[j]);
+                for (int j = num_frames - 1; j >= bottom; j--) {
+                    const char* frame_name = fn.name(*frames[j]);
+                    FrameTypeId frame_type = fn.type(*frames[j]);
                     f = flamegraph.addChild(f, frame_name, frame_type, counter);
                 }
             } else {
-                for (int j = num_frames - 1; j >= 0; j--) {
-                    const char* frame_name = fn.name(trace->frames[j]);
-                    FrameTypeId frame_type = fn.type(trace->frames[j]);
+                for (int j = 0; j < num_frames; j++) {
+                    const char* frame_name = fn.name(*frames[j]);
+                    FrameTypeId frame_type = fn.type(*frames[j]);
                     f = flamegraph.addChild(f, frame_name, frame_type, counter);
                 }
             }
@@ -1606,9 +1856,9 @@ void Profiler::dumpText(Writer& out, Arguments& args) {
                      it->samples, it->samples == 1 ? "" : "s");
             out << buf;
 
-            CallTrace* trace = it->trace;
-            for (int j = 0; j < trace->num_frames; j++) {
-                const char* frame_name = fn.name(trace->frames[j]);
+            int j = 0;
+            for (CallTraceIterator frames(it->trace); frames.hasNext(); j++) {
+                const char* frame_name = fn.name(frames.next());
                 snprintf(buf, sizeof(buf) - 1, "  [%2d] %s\n", j, frame_name);
                 out << buf;
             }
@@ -1620,7 +1870,7 @@ void Profiler::dumpText(Writer& out, Arguments& args) {
     if (args._dump_flat > 0) {
         std::map<std::string, MethodSample> histogram;
         for (std::vector<CallTraceSample>::const_iterator it = samples.begin(); it != samples.end(); ++it) {
-            const char* frame_name = fn.name(it->trace->frames[0]);
+            const char* frame_name = fn.name(CallTraceIterator(it->trace).next());
             histogram[frame_name].add(it->samples, it->counter);
         }
 
@@ -1687,9 +1937,10 @@ void Profiler::dumpOtlp(Writer& out, Arguments& args) {
         otlp_buffer.field(Sample::locations_length, trace->num_frames);
 
         u32 thread_name_idx = 0;
-        for (int j = 0; j < trace->num_frames; j++) {
-            if (trace->frames[j].bci == BCI_THREAD_ID) {
-                int tid = (int)(uintptr_t) trace->frames[j].method_id;
+        for (CallTraceIterator frames(trace); frames.hasNext(); ) {
+            const ASGCT_CallFrame& frame = frames.next();
+            if (frame.bci == BCI_THREAD_ID) {
+                int tid = (int)(uintptr_t) frame.method_id;
                 MutexLocker ml(_thread_names_lock);
                 ThreadMap::iterator it = _thread_names.find(tid);
                 if (it != _thread_names.end()) {
@@ -1699,7 +1950,7 @@ void Profiler::dumpOtlp(Writer& out, Arguments& args) {
             }
 
             // To be written below in Profile.location_indices
-            location_indices.push_back(functions.indexOf(fn.name(trace->frames[j])));
+            location_indices.push_back(functions.indexOf(fn.name(frame)));
             ++frames_seen;
         }
         if (thread_name_idx != 0) {
@@ -1957,6 +2208,9 @@ Error Profiler::runInternal(Arguments& args, Writer& out) {
             if (CTimer::supported()) {
                 out << "  " << EVENT_CTIMER << "\n";
             }
+            if (PerfEvents::supported()) {
+                out << "  " << EVENT_OFFCPU << "\n";
+            }
 
             out << "Java method calls:\n";
             out << "  ClassName.methodName\n";
@@ -7,6 +7,7 @@
 #define _PROFILER_H
 
 #include <map>
+#include <stdlib.h>
 #include <string>
 #include "arch.h"
 #include "arguments.h"
@@ -18,7 +19,11 @@
 #include "flightRecorder.h"
 #include "log.h"
 #include "mutex.h"
+#include "os.h"
+#include "pcCache.h"
+#include "scopeCache.h"
 #include "spinLock.h"
+#include "stubCache.h"
 #include "threadFilter.h"
 #include "trap.h"
 #include "vmEntry.h"
@@ -27,7 +32,11 @@
 
 const int MAX_NATIVE_FRAMES = 128;
 const int RESERVED_FRAMES   = 10;  // for synthetic frames
+// Number of sampler slots is chosen at startup from the CPU count, within these bounds
 const int CONCURRENCY_LEVEL = 16;
+const int MAX_CONCURRENCY_LEVEL = 1024;
+// Slots a handler tries before it gives up on a sample
+const int SLOT_PROBES = 3;
 
 
 union CallTraceBuffer {
@@ -35,6 +44,12 @@ union CallTraceBuffer {
     jvmtiFrameInfo _jvmti_frames[1];
 };
 
+// Sampler slot lock padded to a cache line, so that handlers on different CPUs do not contend
+class SlotLock : public SpinLock {
+  private:
+    char _padding[64 - sizeof(SpinLock)];
+};
+
 
 class FrameName;
 class NMethod;
@@ -77,8 +92,12 @@ class Profiler {
     u64 _total_stack_walk_time;
     u64 _failures[ASGCT_FAILURE_TYPES];
 
-    SpinLock _locks[CONCURRENCY_LEVEL];
-    CallTraceBuffer* _calltrace_buffer[CONCURRENCY_LEVEL];
+    int _concurrency_level;
+    SlotLock* _locks;
+    CallTraceBuffer** _calltrace_buffer;
+    PcCache** _pc_cache;
+    ScopeCache** _scope_cache;
+    volatile int _nmethod_epoch;
     int _max_stack_depth;
     StackWalkFeatures _features;
     CStack _cstack;
@@ -89,8 +108,9 @@ class Profiler {
     bool _update_thread_names;
     volatile jvmtiEventMode _thread_events_state;
 
+    SpinLock _lookup_lock;
     SpinLock _stubs_lock;
-    CodeCache _runtime_stubs;
+    StubCache _runtime_stubs;
     CodeCacheArray _native_libs;
     const void* _call_stub_begin;
     const void* _call_stub_end;
@@ -112,8 +132,9 @@ class Profiler {
 
     const char* asgctError(int code);
     u32 getLockIndex(int tid);
+    int lockSlot(int tid);
     jmethodID getCurrentCompileTask();
-    int getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, EventType event_type, int tid, StackContext* java_ctx);
+    int getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, EventType event_type, int tid, StackContext* java_ctx, PcCache* pc_cache);
     int getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max_depth, StackContext* java_ctx);
     int getJavaTraceJvmti(jvmtiFrameInfo* jvmti_frames, ASGCT_CallFrame* frames, int start_depth, int max_depth);
     void fillFrameTypes(ASGCT_CallFrame* frames, int num_frames, NMethod* nmethod);
@@ -146,6 +167,9 @@ class Profiler {
 
     void lockAll();
     void unlockAll();
+    void swapCounterEpoch();
+    void finishGeneration();
+    void waitForLookups();
 
     void dumpCollapsed(Writer& out, Arguments& args);
     void dumpFlameGraph(Writer& out, Arguments& args, bool tree);
@@ -166,25 +190,40 @@ class Profiler {
         _epoch(0),
         _gc_id(0),
         _timer_id(NULL),
+        _nmethod_epoch(0),
         _max_stack_depth(0),
         _thread_events_state(JVMTI_DISABLE),
+        _lookup_lock(),
         _stubs_lock(),
-        _runtime_stubs("[stubs]"),
+        _runtime_stubs(),
         _native_libs(),
         _call_stub_begin(NULL),
         _call_stub_end(NULL),
         _dlopen_entry(NULL) {
 
-        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
-            _calltrace_buffer[i] = NULL;
-        }
+        // Slot count stays fixed, since handlers may use slots at any time
+        _concurrency_level = slotsForCpus(OS::getCpuCount());
+        _locks = new SlotLock[_concurrency_level];
+        _calltrace_buffer = (CallTraceBuffer**)calloc(_concurrency_level, sizeof(CallTraceBuffer*));
+        _pc_cache = (PcCache**)calloc(_concurrency_level, sizeof(PcCache*));
+        _scope_cache = (ScopeCache**)calloc(_concurrency_level, sizeof(ScopeCache*));
     }
 
     static Profiler* instance() {
         return _instance;
     }
 
+    // Enough slots for every CPU to run a signal handler at the same time
+    static int slotsForCpus(int cpus) {
+        int slots = CONCURRENCY_LEVEL;
+        while (slots < cpus && slots < MAX_CONCURRENCY_LEVEL) {
+            slots *= 2;
+        }
+        return slots;
+    }
+
     u64 total_samples() { return _total_samples; }
+    int concurrencyLevel() { return _concurrency_level; }
     long uptime()       { return (OS::micros() - _start_time) / 1000000ULL; }
 
     Dictionary* classMap() { return &_class_map; }
@@ -201,25 +240,33 @@ class Profiler {
     Error flushJfr();
     Error dump(Writer& out, Arguments& args);
     void logStats();
+    size_t slotMemory();
     void writeMetrics(Writer& out);
     void switchThreadEvents(jvmtiEventMode mode);
-    int convertNativeTrace(int native_frames, const void** callchain, ASGCT_CallFrame* frames, EventType event_type);
+    int convertNativeTrace(int native_frames, const void** callchain, ASGCT_CallFrame* frames, EventType event_type, PcCache* pc_cache = NULL);
     u64 recordSample(void* ucontext, u64 counter, EventType event_type, Event* event);
-    void recordExternalSample(u64 counter, int tid, EventType event_type, Event* event, int num_frames, ASGCT_CallFrame* frames);
+    void recordExternalSample(u64 counter, int tid, EventType event_type, Event* event, int num_frames, ASGCT_CallFrame* frames,
+                              int cpu = -1);
     void recordExternalSamples(u64 samples, u64 counter, int tid, u32 call_trace_id, EventType event_type, Event* event);
     void recordEventOnly(EventType event_type, Event* event);
     void tryResetCounters();
     void writeLog(LogLevel level, const char* message);
     void writeLog(LogLevel level, const char* message, size_t len);
 
+    // Engine threads that resolve native frames outside of a signal handler hold the lookup lock
+    // meanwhile, since snapshots searched by findLibraryByAddress are freed only after waitForLookups()
+    void lockLookups()   { _lookup_lock.lockShared(); }
+    void unlockLookups() { _lookup_lock.unlockShared(); }
+
     void updateSymbols(bool kernel_symbols);
     const void* resolveSymbol(const char* name);
     const char* getLibraryName(const char* native_symbol);
     CodeCache* findJvmLibrary(const char* lib_name);
     CodeCache* findLibraryByName(const char* lib_name);
+    // Callers hold a sampler slot or the lookup lock; others use nativeLibs()->scanLibraries()
     CodeCache* findLibraryByAddress(const void* address);
     const char* findNativeMethod(const void* address);
-    CodeBlob* findRuntimeStub(const void* address);
+    bool findRuntimeStub(const void* address, CodeBlob* stub);
     bool isAddressInCode(const void* pc);
 
     void trapHandler(int signo, siginfo_t* siginfo, void* ucontext);
@@ -235,6 +282,12 @@ class Profiler {
         instance()->addJavaMethod(code_addr, code_size, method);
     }
 
+    // An unloaded nmethod may be replaced at the same address, so cached inlining scopes become stale
+    // unless they are keyed by compile id
+    static void JNICALL CompiledMethodUnload(jvmtiEnv* jvmti, jmethodID method, const void* code_addr) {
+        __sync_fetch_and_add(&instance()->_nmethod_epoch, 1);
+    }
+
     static void JNICALL DynamicCodeGenerated(jvmtiEnv* jvmti, const char* name,
                                              const void* address, jint length) {
         instance()->addRuntimeStub(address, length, name);
@@ -0,0 +1,124 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SCOPECACHE_H
+#define _SCOPECACHE_H
+
+#include <jvmti.h>
+#include <string.h>
+#include "arch.h"
+#include "vmEntry.h"
+
+
+const int SCOPE_CACHE_BITS = 8;
+const int SCOPE_CACHE_SIZE = 1 << SCOPE_CACHE_BITS;
+const int SCOPE_CACHE_MAX_FRAMES = 12;
+
+class NMethod;
+class VMMethod;
+
+// Inlining chain at a compiled PC, innermost method first
+struct ScopeCacheEntry {
+    NMethod* nm;
+    const void* pc;
+    VMMethod* method;  // nmethod owner at the time of decoding, guards against reuse of the address
+    int compile_id;    // tells apart nmethods of the same method at the same address
+    int count;
+    int bci[SCOPE_CACHE_MAX_FRAMES];
+    jmethodID method_id[SCOPE_CACHE_MAX_FRAMES];
+
+    // Fills at most max_depth frames; only the outermost frame of a complete chain is compiled
+    int expand(ASGCT_CallFrame* frames, int max_depth, FrameTypeId inlined_type, FrameTypeId compiled_type) const {
+        int depth = 0;
+        for (int i = 0; i < count && depth < max_depth; i++, depth++) {
+            frames[depth].bci = FrameType::encode(i < count - 1 ? inlined_type : compiled_type, bci[i]);
+            frames[depth].method_id = method_id[i];
+        }
+        return depth;
+    }
+};
+
+// Direct-mapped cache of decoded ScopeDesc chains, owned by one sampler slot like PcCache.
+// Entries are keyed by compile id where the JVM exports it. Otherwise, the whole cache
+// is dropped when the nmethod epoch changes, i.e. after any nmethod is unloaded.
+class ScopeCache {
+  private:
+    ScopeCacheEntry _entries[SCOPE_CACHE_SIZE];
+    int _epoch;
+    u64 _hits;
+    u64 _misses;
+
+    static u32 hash(const void* pc) {
+        return (u32)(((u64)(uintptr_t)pc * 0x9e3779b97f4a7c15ULL) >> (64 - SCOPE_CACHE_BITS));
+    }
+
+  public:
+    void validate(int epoch) {
+        if (_epoch != epoch) {
+            memset(_entries, 0, sizeof(_entries));
+            _epoch = epoch;
+        }
+    }
+
+    ScopeCacheEntry* lookup(NMethod* nm, const void* pc, VMMethod* method, int compile_id) {
+        ScopeCacheEntry* e = &_entries[hash(pc)];
+        if (e->pc == pc && e->nm == nm && e->method == method && e->compile_id == compile_id && pc != NULL) {
+            _hits++;
+            return e;
+        }
+        _misses++;
+        return NULL;
+    }
+
+    // The entry is unkeyed until commit(), so a crash while decoding leaves no partial chain behind
+    ScopeCacheEntry* reserve(const void* pc) {
+        ScopeCacheEntry* e = &_entries[hash(pc)];
+        e->pc = NULL;
+        e->count = 0;
+        return e;
+    }
+
+    void commit(ScopeCacheEntry* e, NMethod* nm, const void* pc, VMMethod* method, int compile_id) {
+        e->nm = nm;
+        e->method = method;
+        e->compile_id = compile_id;
+        e->pc = pc;
+    }
+
+    // Returns the inlining chain at pc, taking it from the decoder on a miss.
+    // decoder.next(&bci, &method_id) yields scopes innermost first and returns false after the last one.
+    // NULL means the chain cannot be cached: it is too deep, or a method ID is not yet assigned.
+    template<class Decoder>
+    ScopeCacheEntry* find(NMethod* nm, const void* pc, VMMethod* method, int compile_id, Decoder& decoder) {
+        ScopeCacheEntry* e = lookup(nm, pc, method, compile_id);
+        if (e != NULL) {
+            return e;
+        }
+
+        e = reserve(pc);
+        int bci;
+        jmethodID method_id;
+        while (decoder.next(&bci, &method_id)) {
+            if (e->count == SCOPE_CACHE_MAX_FRAMES || method_id == NULL) {
+                return NULL;
+            }
+            e->bci[e->count] = bci;
+            e->method_id[e->count++] = method_id;
+        }
+
+        commit(e, nm, pc, method, compile_id);
+        return e;
+    }
+
+    u64 hits() {
+        return _hits;
+    }
+
+    u64 misses() {
+        return _misses;
+    }
+};
+
+#endif // _SCOPECACHE_H
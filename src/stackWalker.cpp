@@ -8,6 +8,7 @@
 #include "dwarf.h"
 #include "profiler.h"
 #include "safeAccess.h"
+#include "scopeCache.h"
 #include "stackFrame.h"
 #include "vmStructs.h"
 
@@ -58,6 +59,34 @@ static inline void fillFrame(ASGCT_CallFrame& frame, FrameTypeId type, int bci,
     frame.method_id = method;
 }
 
+// Decodes the ScopeDesc chain at a compiled PC for ScopeCache::find
+class ScopeDecoder {
+  private:
+    int _scope_offset;
+    ScopeDesc _scope;
+
+  public:
+    ScopeDecoder(NMethod* nm, const void* pc) : _scope_offset(nm->findScopeOffset(pc)), _scope(nm) {
+    }
+
+    bool next(int* bci, jmethodID* method_id) {
+        if (_scope_offset <= 0) {
+            return false;
+        }
+        _scope_offset = _scope.decode(_scope_offset);
+        *bci = _scope.bci();
+        *method_id = _scope.method()->id();
+        return true;
+    }
+};
+
+// Returns the inlining chain at pc, decoding it on a cache miss.
+// NULL means the chain cannot be cached, and the caller decodes it directly.
+static ScopeCacheEntry* findScopes(ScopeCache* cache, NMethod* nm, const void* pc) {
+    ScopeDecoder decoder(nm, pc);
+    return cache->find(nm, pc, nm->method(), nm->compileId(), decoder);
+}
+
 static jmethodID getMethodId(VMMethod* method) {
     if (!inDeadZone(method) && aligned((uintptr_t)method)) {
         return method->validatedId();
@@ -207,13 +236,13 @@ int StackWalker::walkDwarf(void* ucontext, const void** callchain, int max_depth
 }
 
 int StackWalker::walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth,
-                        StackWalkFeatures features, EventType event_type) {
+                        StackWalkFeatures features, EventType event_type, ScopeCache* scope_cache) {
     if (ucontext == NULL) {
-        return walkVM(&empty_ucontext, frames, max_depth, features, event_type,
+        return walkVM(&empty_ucontext, frames, max_depth, features, event_type, scope_cache,
                       callerPC(), (uintptr_t)callerSP(), (uintptr_t)callerFP());
     } else {
         StackFrame frame(ucontext);
-        return walkVM(ucontext, frames, max_depth, features, event_type,
+        return walkVM(ucontext, frames, max_depth, features, event_type, scope_cache,
                       (const void*)frame.pc(), frame.sp(), frame.fp());
     }
 }
@@ -235,11 +264,11 @@ int StackWalker::walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth,
     }
 
     StackWalkFeatures no_features{};
-    return walkVM(ucontext, frames, max_depth, no_features, event_type, pc, sp, fp);
+    return walkVM(ucontext, frames, max_depth, no_features, event_type, NULL, pc, sp, fp);
 }
 
 int StackWalker::walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth,
-                        StackWalkFeatures features, EventType event_type,
+                        StackWalkFeatures features, EventType event_type, ScopeCache* scope_cache,
                         const void* pc, uintptr_t sp, uintptr_t fp) {
     StackFrame frame(ucontext);
     uintptr_t bottom = (uintptr_t)&frame + MAX_WALK_SIZE;
@@ -306,18 +335,26 @@ int StackWalker::walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth,
                         continue;
                     }
 
-                    int scope_offset = nm->findScopeOffset(pc);
-                    if (scope_offset > 0) {
-                        depth--;
-                        ScopeDesc scope(nm);
-                        do {
-                            scope_offset = scope.decode(scope_offset);
-                            if (details) {
-                                type = scope_offset > 0 ? FRAME_INLINED :
-                                       level >= 1 && level <= 3 ? FRAME_C1_COMPILED : FRAME_JIT_COMPILED;
-                            }
-                            fillFrame(frames[depth++], type, scope.bci(), scope.method()->id());
-                        } while (scope_offset > 0 && depth < max_depth);
+                    ScopeCacheEntry* scopes = scope_cache != NULL ? findScopes(scope_cache, nm, pc) : NULL;
+                    if (scopes != NULL) {
+                        if (scopes->count > 0) {
+                            depth--;
+                            depth += scopes->expand(frames + depth, max_depth - depth, details ? FRAME_INLINED : type, type);
+                        }
+                    } else {
+                        int scope_offset = nm->findScopeOffset(pc);
+                        if (scope_offset > 0) {
+                            depth--;
+                            ScopeDesc scope(nm);
+                            do {
+                                scope_offset = scope.decode(scope_offset);
+                                if (details) {
+                                    type = scope_offset > 0 ? FRAME_INLINED :
+                                           level >= 1 && level <= 3 ? FRAME_C1_COMPILED : FRAME_JIT_COMPILED;
+                                }
+                                fillFrame(frames[depth++], type, scope.bci(), scope.method()->id());
+                            } while (scope_offset > 0 && depth < max_depth);
+                        }
                     }
 
                     // Handle situations when sp is temporarily changed in the compiled code
@@ -405,9 +442,10 @@ int StackWalker::walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth,
                     }
                 }
 
-                CodeBlob* stub = profiler->findRuntimeStub(pc);
-                const void* start = stub != NULL ? stub->_start : nm->code();
-                const char* name = stub != NULL ? stub->_name : nm->name();
+                CodeBlob stub;
+                bool found = profiler->findRuntimeStub(pc, &stub);
+                const void* start = found ? stub._start : nm->code();
+                const char* name = found ? stub._name : nm->name();
 
                 if (details) {
                     fillFrame(frames[depth++], BCI_NATIVE_FRAME, name);
@@ -512,6 +550,230 @@ int StackWalker::walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth,
     return depth;
 }
 
+// Frames of a compiled method at pc, innermost inlined method first
+static int fillCompiledFrames(NMethod* nm, const void* pc, ASGCT_CallFrame* frames, int max_depth) {
+    int level = nm->level();
+    FrameTypeId type = level >= 1 && level <= 3 ? FRAME_C1_COMPILED : FRAME_JIT_COMPILED;
+    int scope_offset = nm->isFrameCompleteAt(pc) ? nm->findScopeOffset(pc) : 0;
+    if (scope_offset <= 0) {
+        fillFrame(frames[0], type, 0, getMethodId(nm->method()));
+        return 1;
+    }
+
+    int depth = 0;
+    ScopeDesc scope(nm);
+    do {
+        scope_offset = scope.decode(scope_offset);
+        fillFrame(frames[depth++], scope_offset > 0 ? FRAME_INLINED : type, scope.bci(), getMethodId(scope.method()));
+    } while (scope_offset > 0 && depth < max_depth);
+    return depth;
+}
+
+// Resolves a single compiled PC, including inlined frames, without access to the stack it came from,
+// e.g. a return address collected by the kernel. The code blob may have been replaced since then.
+int StackWalker::walkCompiled(const void* pc, ASGCT_CallFrame* frames, int max_depth) {
+    VMThread* vm_thread = VMThread::current();
+    if (vm_thread == NULL) {
+        // Not safe to touch VM structures without crash protection
+        fillFrame(frames[0], BCI_ERROR, "unknown_nmethod");
+        return 1;
+    }
+
+    jmp_buf crash_protection_ctx;
+    void* saved_exception = vm_thread->exception();
+
+    // Should be preserved across setjmp/longjmp
+    volatile int depth = 0;
+
+    vm_thread->exception() = &crash_protection_ctx;
+    if (setjmp(crash_protection_ctx) != 0) {
+        vm_thread->exception() = saved_exception;
+        if (depth < max_depth) {
+            fillFrame(frames[depth++], BCI_ERROR, "break_not_walkable");
+        }
+        return depth;
+    }
+
+    NMethod* nm = CodeHeap::findNMethod(pc);
+    if (nm == NULL) {
+        fillFrame(frames[depth++], BCI_ERROR, "unknown_nmethod");
+    } else if (nm->isNMethod()) {
+        depth = fillCompiledFrames(nm, pc, frames, max_depth);
+    } else {
+        fillFrame(frames[depth++], BCI_NATIVE_FRAME, nm->name());
+    }
+
+    vm_thread->exception() = saved_exception;
+    return depth;
+}
+
+// Mixed-mode unwinding of a stack copy, long after the sampled thread has moved on.
+// Only the copy is read from the stack; native frames are unwound with DWARF,
+// compiled frames by the nmethod frame size, interpreted frames and stubs by the FP chain.
+int StackWalker::walkSnapshot(const StackSnapshot* snapshot, ASGCT_CallFrame* frames, int max_depth) {
+    const void* pc = snapshot->pc;
+    uintptr_t sp = snapshot->sp;
+    uintptr_t fp = snapshot->fp;
+    uintptr_t bottom = snapshot->sp + snapshot->size;
+
+    Profiler* profiler = Profiler::instance();
+    int bcp_offset = InterpreterFrame::bcp_offset();
+
+    jmp_buf crash_protection_ctx;
+    VMThread* vm_thread = VMThread::current();
+    void* saved_exception = vm_thread != NULL ? vm_thread->exception() : NULL;
+
+    // Should be preserved across setjmp/longjmp
+    volatile int depth = 0;
+
+    if (vm_thread != NULL) {
+        vm_thread->exception() = &crash_protection_ctx;
+        if (setjmp(crash_protection_ctx) != 0) {
+            vm_thread->exception() = saved_exception;
+            if (depth < max_depth) {
+                fillFrame(frames[depth++], BCI_ERROR, "break_not_walkable");
+            }
+            return depth;
+        }
+    }
+
+    while (depth < max_depth) {
+        uintptr_t prev_sp = sp;
+
+        if (CodeHeap::contains(pc)) {
+            NMethod* nm = vm_thread != NULL ? CodeHeap::findNMethod(pc) : NULL;
+            if (nm == NULL) {
+                fillFrame(frames[depth++], BCI_ERROR, "unknown_nmethod");
+                break;
+            }
+
+            uintptr_t next_pc;
+            if (nm->isNMethod()) {
+                if (depth == 0 && !nm->isFrameCompleteAt(pc)) {
+                    fillFrame(frames[depth++], BCI_ERROR, "break_compiled");
+                    break;
+                }
+                depth += fillCompiledFrames(nm, pc, frames + depth, max_depth - depth);
+
+                sp += nm->frameSize() * sizeof(void*);
+                if (!snapshot->load(sp - (FRAME_PC_SLOT + 1) * sizeof(void*), &fp) ||
+                    !snapshot->load(sp - FRAME_PC_SLOT * sizeof(void*), &next_pc)) {
+                    break;
+                }
+            } else if (nm->isInterpreter()) {
+                uintptr_t method, bcp, sender_sp;
+                bool is_plausible_interpreter_frame = !inDeadZone((const void*)fp) && aligned(fp)
+                    && sp > fp - MAX_INTERPRETER_FRAME_SIZE
+                    && sp < fp + bcp_offset * sizeof(void*)
+                    && snapshot->load(fp + InterpreterFrame::method_offset * sizeof(void*), &method)
+                    && snapshot->load(fp + bcp_offset * sizeof(void*), &bcp)
+                    && snapshot->load(fp + InterpreterFrame::sender_sp_offset * sizeof(void*), &sender_sp)
+                    && snapshot->load(fp + FRAME_PC_SLOT * sizeof(void*), &next_pc);
+
+                jmethodID method_id = is_plausible_interpreter_frame ? getMethodId((VMMethod*)method) : NULL;
+                if (method_id == NULL) {
+                    fillFrame(frames[depth++], BCI_ERROR, "break_interpreted");
+                    break;
+                }
+
+                const char* bytecode_start = ((VMMethod*)method)->bytecode();
+                int bci = bytecode_start == NULL || (const char*)bcp < bytecode_start ? 0 : (const char*)bcp - bytecode_start;
+                fillFrame(frames[depth++], FRAME_INTERPRETED, bci, method_id);
+
+                sp = sender_sp;
+                if (!snapshot->load(fp, &fp)) {
+                    break;
+                }
+            } else {
+                fillFrame(frames[depth++], BCI_NATIVE_FRAME, nm->name());
+
+                if (depth > 1 && nm->frameSize() > 0) {
+                    sp += nm->frameSize() * sizeof(void*);
+                    if (!snapshot->load(sp - (FRAME_PC_SLOT + 1) * sizeof(void*), &fp) ||
+                        !snapshot->load(sp - FRAME_PC_SLOT * sizeof(void*), &next_pc)) {
+                        break;
+                    }
+                } else {
+                    // Stubs without a fixed frame, e.g. the call stub, keep the frame pointer chain
+                    if (!snapshot->load(fp + FRAME_PC_SLOT * sizeof(void*), &next_pc)) {
+                        break;
+                    }
+                    sp = fp + (FRAME_PC_SLOT + 1) * sizeof(void*);
+                    if (!snapshot->load(fp, &fp)) {
+                        break;
+                    }
+                }
+            }
+
+            pc = stripPointer((void*)next_pc);
+            if (sp <= prev_sp || sp >= bottom || !aligned(sp) || inDeadZone(pc)) {
+                break;
+            }
+            continue;
+        }
+
+        fillFrame(frames[depth++], BCI_NATIVE_FRAME, profiler->findNativeMethod(pc));
+
+        CodeCache* cc = profiler->findLibraryByAddress(pc);
+        FrameDesc* f = cc != NULL ? cc->findFrameDesc(pc) : &FrameDesc::default_frame;
+
+        u8 cfa_reg = (u8)f->cfa;
+        int cfa_off = f->cfa >> 8;
+        if (cfa_reg == DW_REG_SP) {
+            sp = sp + cfa_off;
+        } else if (cfa_reg == DW_REG_FP) {
+            sp = fp + cfa_off;
+        } else if (cfa_reg == DW_REG_PLT) {
+            sp += ((uintptr_t)pc & 15) >= 11 ? cfa_off * 2 : cfa_off;
+        } else {
+            break;
+        }
+
+        if (sp < prev_sp || sp >= prev_sp + MAX_FRAME_SIZE || sp >= bottom || !aligned(sp)) {
+            break;
+        }
+
+        const void* prev_pc = pc;
+        if (f->fp_off & DW_PC_OFFSET) {
+            pc = (const char*)pc + (f->fp_off >> 1);
+        } else {
+            uintptr_t next_pc;
+            if (f->fp_off != DW_SAME_FP && f->fp_off < MAX_FRAME_SIZE && f->fp_off > -MAX_FRAME_SIZE) {
+                if (!snapshot->load(sp + f->fp_off, &fp)) {
+                    break;
+                }
+            }
+
+            if (EMPTY_FRAME_SIZE > 0 || f->pc_off != DW_LINK_REGISTER) {
+                if (!snapshot->load(sp + f->pc_off, &next_pc)) {
+                    break;
+                }
+                pc = stripPointer((void*)next_pc);
+            } else if (depth == 1) {
+                pc = (const void*)snapshot->lr;
+            } else {
+                break;
+            }
+
+            if (EMPTY_FRAME_SIZE == 0 && cfa_off == 0 && f->fp_off != DW_SAME_FP) {
+                // AArch64 default_frame
+                sp = defaultSenderSP(sp, fp);
+                if (sp < prev_sp || sp >= bottom || !aligned(sp)) {
+                    break;
+                }
+            }
+        }
+
+        if (inDeadZone(pc) || (pc == prev_pc && sp == prev_sp)) {
+            break;
+        }
+    }
+
+    if (vm_thread != NULL) vm_thread->exception() = saved_exception;
+
+    return depth;
+}
+
 void StackWalker::checkFault() {
     if (VMThread::key() < 0) {
         // JVM has not been loaded or VMStructs have not been initialized yet
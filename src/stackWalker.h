@@ -7,12 +7,14 @@
 #define _STACKWALKER_H
 
 #include <stdint.h>
+#include <string.h>
 #include "arguments.h"
 #include "event.h"
 #include "vmEntry.h"
 
 
 class JavaFrameAnchor;
+class ScopeCache;
 
 struct StackContext {
     const void* pc;
@@ -27,17 +29,38 @@ struct StackContext {
     }
 };
 
+// Registers and a copy of the user stack, taken by the kernel at the time of a sample
+struct StackSnapshot {
+    const void* pc;
+    uintptr_t sp;
+    uintptr_t fp;
+    uintptr_t lr;
+    const char* data;  // stack contents starting at sp
+    size_t size;
+
+    bool load(uintptr_t address, uintptr_t* value) const {
+        if (address < sp || address - sp + sizeof(uintptr_t) > size) {
+            return false;
+        }
+        memcpy(value, data + (address - sp), sizeof(uintptr_t));
+        return true;
+    }
+};
+
 class StackWalker {
   private:
     static int walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth,
-                      StackWalkFeatures features, EventType event_type,
+                      StackWalkFeatures features, EventType event_type, ScopeCache* scope_cache,
                       const void* pc, uintptr_t sp, uintptr_t fp);
 
   public:
     static int walkFP(void* ucontext, const void** callchain, int max_depth, StackContext* java_ctx);
     static int walkDwarf(void* ucontext, const void** callchain, int max_depth, StackContext* java_ctx);
-    static int walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth, StackWalkFeatures features, EventType event_type);
+    static int walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth, StackWalkFeatures features, EventType event_type,
+                      ScopeCache* scope_cache = NULL);
     static int walkVM(void* ucontext, ASGCT_CallFrame* frames, int max_depth, JavaFrameAnchor* anchor, EventType event_type);
+    static int walkCompiled(const void* pc, ASGCT_CallFrame* frames, int max_depth);
+    static int walkSnapshot(const StackSnapshot* snapshot, ASGCT_CallFrame* frames, int max_depth);
 
     static void checkFault();
 };
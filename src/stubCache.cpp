@@ -0,0 +1,178 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "stubCache.h"
+
+
+static u32 hashName(const char* name) {
+    u32 h = 2166136261U;
+    for (const char* s = name; *s != 0; s++) {
+        h = (h ^ (u8)*s) * 16777619U;
+    }
+    return h;
+}
+
+static size_t snapshotSize(int capacity, int count, u32 hash_size) {
+    return sizeof(StubSnapshot) + (capacity - 1) * sizeof(CodeBlob) + count * sizeof(void*) + hash_size * sizeof(int);
+}
+
+
+StubCache::~StubCache() {
+    if (_snapshot != NULL) {
+        free(_snapshot);
+    }
+    freeRetired(_retired);
+}
+
+void StubCache::freeRetired(StubSnapshot* retired) {
+    while (retired != NULL) {
+        StubSnapshot* next = retired->next_retired;
+        free(retired);
+        retired = next;
+    }
+}
+
+StubSnapshot* StubCache::rebuild(StubSnapshot* old) {
+    int count = old != NULL ? old->count + old->tail : 0;
+    int capacity = count + STUB_TAIL_CAPACITY;
+    u32 hash_size = 16;
+    while (hash_size < (u32)count * 2) hash_size *= 2;
+
+    size_t size = snapshotSize(capacity, count, hash_size);
+    StubSnapshot* s = (StubSnapshot*)malloc(size);
+    if (s == NULL) {
+        return NULL;
+    }
+
+    // The max end array and the name index live right after the blobs
+    s->next_retired = NULL;
+    s->max_end = (const void**)&s->blobs[capacity];
+    s->hash = (int*)&s->max_end[count];
+    s->hash_mask = hash_size - 1;
+    s->count = count;
+    s->tail = 0;
+
+    if (count > 0) {
+        memcpy(s->blobs, old->blobs, count * sizeof(CodeBlob));
+        qsort(s->blobs, count, sizeof(CodeBlob), CodeBlob::comparator);
+    }
+
+    const void* max_end = NULL;
+    for (int i = 0; i < count; i++) {
+        if (s->blobs[i]._end > max_end) max_end = s->blobs[i]._end;
+        s->max_end[i] = max_end;
+    }
+
+    memset(s->hash, 0xff, hash_size * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        u32 slot = hashName(s->blobs[i]._name) & s->hash_mask;
+        while (s->hash[slot] >= 0) {
+            slot = (slot + 1) & s->hash_mask;
+        }
+        s->hash[slot] = i;
+    }
+
+    _snapshot_size = size;
+    return s;
+}
+
+void StubCache::add(const void* start, int length, const char* name) {
+    char* name_copy = NativeFunc::create(name, -1, &_names);
+    if (name_copy == NULL) {
+        return;
+    }
+    // Replace non-printable characters
+    for (char* s = name_copy; *s != 0; s++) {
+        if (*s < ' ') *s = '?';
+    }
+
+    StubSnapshot* s = _snapshot;
+    if (s == NULL || s->tail >= STUB_TAIL_CAPACITY) {
+        StubSnapshot* merged = rebuild(s);
+        if (merged == NULL) {
+            return;
+        }
+        __atomic_store_n(&_snapshot, merged, __ATOMIC_RELEASE);
+        // A lookup may still be searching the old snapshot
+        if (s != NULL) {
+            s->next_retired = _retired;
+            _retired = s;
+        }
+        s = merged;
+    }
+
+    CodeBlob* blob = &s->blobs[s->count + s->tail];
+    blob->_start = start;
+    blob->_end = (const char*)start + length;
+    blob->_name = name_copy;
+    __atomic_store_n(&s->tail, s->tail + 1, __ATOMIC_RELEASE);
+
+    if (start < _min_address) _min_address = start;
+    if (blob->_end > _max_address) _max_address = blob->_end;
+}
+
+bool StubCache::findBlobByAddress(const void* address, CodeBlob* blob) {
+    StubSnapshot* s = __atomic_load_n(&_snapshot, __ATOMIC_ACQUIRE);
+    bool found = false;
+
+    if (s != NULL) {
+        // The last stub starting at or below the address, then earlier ones that may still enclose it
+        int low = 0;
+        int high = s->count - 1;
+        while (low <= high) {
+            int mid = (unsigned int)(low + high) >> 1;
+            if (s->blobs[mid]._start <= address) {
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+        for (int i = low - 1; i >= 0 && address < s->max_end[i]; i--) {
+            if (address < s->blobs[i]._end) {
+                *blob = s->blobs[i];
+                found = true;
+                break;
+            }
+        }
+
+        int end = s->count + __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+        for (int i = s->count; !found && i < end; i++) {
+            if (address >= s->blobs[i]._start && address < s->blobs[i]._end) {
+                *blob = s->blobs[i];
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+bool StubCache::findBlob(const char* name, CodeBlob* blob) {
+    StubSnapshot* s = __atomic_load_n(&_snapshot, __ATOMIC_ACQUIRE);
+    bool found = false;
+
+    if (s != NULL) {
+        for (u32 slot = hashName(name) & s->hash_mask; s->hash[slot] >= 0; slot = (slot + 1) & s->hash_mask) {
+            CodeBlob* b = &s->blobs[s->hash[slot]];
+            if (strcmp(b->_name, name) == 0) {
+                *blob = *b;
+                found = true;
+                break;
+            }
+        }
+
+        int end = s->count + __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+        for (int i = s->count; !found && i < end; i++) {
+            if (strcmp(s->blobs[i]._name, name) == 0) {
+                *blob = s->blobs[i];
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
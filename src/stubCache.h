@@ -0,0 +1,72 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _STUBCACHE_H
+#define _STUBCACHE_H
+
+#include "codeCache.h"
+
+
+const int STUB_TAIL_CAPACITY = 32;
+
+// Stubs sorted by address, followed by room for a few stubs appended in arrival order.
+// Fields other than tail are immutable once the snapshot is published.
+struct StubSnapshot {
+    StubSnapshot* next_retired;
+    const void** max_end;  // max_end[i] is the largest end among sorted blobs[0..i]
+    int* hash;        // name index over the sorted part: positions in blobs, -1 if empty
+    u32 hash_mask;
+    int count;        // sorted blobs
+    volatile int tail;
+    CodeBlob blobs[1];
+};
+
+// Runtime stubs reported by DynamicCodeGenerated.
+// Additions must be serialized by the caller; lookups are lock-free, async signal safe and do not write.
+// A full tail is merged into a new snapshot; the replaced one is retired, and the caller
+// frees it once no lookup can be searching it anymore.
+class StubCache {
+  private:
+    StubSnapshot* volatile _snapshot;
+    StubSnapshot* _retired;
+    const void* _min_address;
+    const void* _max_address;
+    NameArena _names;
+    size_t _snapshot_size;
+
+    StubSnapshot* rebuild(StubSnapshot* old);
+
+  public:
+    StubCache() : _snapshot(NULL), _retired(NULL),
+                  _min_address(NO_MIN_ADDRESS), _max_address(NO_MAX_ADDRESS), _snapshot_size(0) {
+    }
+
+    ~StubCache();
+
+    bool contains(const void* address) const {
+        return address >= _min_address && address < _max_address;
+    }
+
+    void add(const void* start, int length, const char* name);
+
+    // Detaches snapshots replaced by add(); serialized with add() like it
+    StubSnapshot* takeRetired() {
+        StubSnapshot* retired = _retired;
+        _retired = NULL;
+        return retired;
+    }
+
+    static void freeRetired(StubSnapshot* retired);
+
+    // Copy the matching stub into blob, since the snapshot it lives in may be freed afterwards
+    bool findBlobByAddress(const void* address, CodeBlob* blob);
+    bool findBlob(const char* name, CodeBlob* blob);
+
+    size_t usedMemory() {
+        return _snapshot_size + _names.usedMemory() + sizeof(StubCache);
+    }
+};
+
+#endif // _STUBCACHE_H
@@ -0,0 +1,297 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "symbolCache.h"
+#include "dwarf.h"
+#include "log.h"
+
+
+const u32 SYMBOL_CACHE_MAGIC = 0x4d595341;  // "ASYM"
+const u32 SYMBOL_CACHE_VERSION = 2;
+
+const u32 FLAG_DEBUG_SYMBOLS = 1;
+
+// File layout: header, then
+//   u32 starts[count + 1], u32 lengths[count + 1], u32 name_offsets[count + 1]  (Eytzinger order, slot 0 unused)
+//   FrameDesc rules[rule_count], FrameRecord records[frame_count], u32 pages[page_count + 1]  (FrameTable)
+//   char names[names_size]  (NUL-terminated strings)
+struct SymbolCacheHeader {
+    u32 magic;
+    u32 version;
+    u32 frame_desc_size;
+    u32 flags;
+    u32 count;
+    u32 plt_offset;
+    u32 plt_size;
+    u32 rule_count;
+    u32 frame_count;
+    u32 page_count;
+    u32 page_bits;
+    u32 reserved;
+    u64 index_base;  // offset of the index base from the image base, may wrap around
+    u64 names_size;
+};
+
+static u64 frameTableSize(const SymbolCacheHeader* h) {
+    if (h->frame_count == 0) {
+        return 0;
+    }
+    return (u64)h->rule_count * sizeof(FrameDesc) + (u64)h->frame_count * sizeof(FrameRecord)
+        + ((u64)h->page_count + 1) * sizeof(u32);
+}
+
+static u64 fileSize(const SymbolCacheHeader* h) {
+    return sizeof(SymbolCacheHeader) + (u64)(h->count + 1) * 3 * sizeof(u32) + frameTableSize(h) + h->names_size;
+}
+
+// Checks that every record refers to an existing rule and pages are ordered, so that lookups stay in bounds
+static bool validFrameTable(const SymbolCacheHeader* h, const FrameRecord* records, const u32* pages) {
+    if (h->frame_count == 0) {
+        return true;
+    }
+    if (h->rule_count == 0 || h->frame_count >= 0x7fffffff || h->page_count == 0 ||
+        h->page_count >= 0x7fffffff || h->page_bits >= 32) {
+        return false;
+    }
+    for (u32 i = 0; i < h->frame_count; i++) {
+        if (records[i].rule >= h->rule_count) return false;
+    }
+    for (u32 p = 0; p < h->page_count; p++) {
+        if (pages[p] > pages[p + 1]) return false;
+    }
+    return pages[h->page_count] == h->frame_count;
+}
+
+// Checks that symbols of the index lie within the image, relative to its base
+static bool validSymbols(u64 index_base, const u32* starts, const u32* lengths, int count, u64 image_size) {
+    for (int k = 1; k <= count; k++) {
+        u64 start = index_base + starts[k];
+        if (start > image_size || image_size - start < lengths[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool SymbolCache::load(CodeCache* cc, const char* path, const char* image_end) {
+    if (cc->_image_base == NULL || image_end <= cc->_image_base || cc->_count != 0 || cc->_index_names != NULL) {
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(SymbolCacheHeader)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const SymbolCacheHeader* h = (const SymbolCacheHeader*)map;
+    if (h->magic != SYMBOL_CACHE_MAGIC || h->version != SYMBOL_CACHE_VERSION ||
+        h->frame_desc_size != sizeof(FrameDesc) || h->count == 0 || h->count >= 0x7fffffff ||
+        fileSize(h) != (u64)st.st_size) {
+        Log::debug("Ignoring stale symbol cache %s", path);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    int count = h->count;
+    const u32* file_starts = (const u32*)(h + 1);
+    const u32* file_lengths = file_starts + count + 1;
+    const u32* file_names = file_lengths + count + 1;
+    const FrameDesc* file_rules = (const FrameDesc*)(file_names + count + 1);
+    const FrameRecord* file_records = (const FrameRecord*)(file_rules + h->rule_count);
+    const u32* file_pages = (const u32*)(file_records + h->frame_count);
+    const char* names = (const char*)file_rules + frameTableSize(h);
+
+    bool valid = h->names_size > 0 && names[h->names_size - 1] == 0 && validFrameTable(h, file_records, file_pages) &&
+                 validSymbols(h->index_base, file_starts, file_lengths, count, image_end - cc->_image_base);
+    for (int k = 1; valid && k <= count; k++) {
+        valid = file_names[k] < h->names_size;
+    }
+
+    u32* starts = NULL;
+    u32* lengths = NULL;
+    char** index_names = NULL;
+    FrameTable* frames = NULL;
+    if (valid) {
+        starts = (u32*)malloc((count + 1) * sizeof(u32));
+        lengths = (u32*)malloc((count + 1) * sizeof(u32));
+        index_names = (char**)malloc((count + 1) * sizeof(char*));
+        valid = starts != NULL && lengths != NULL && index_names != NULL;
+    }
+    if (valid && h->frame_count > 0) {
+        frames = new FrameTable();
+        frames->_rules = (FrameDesc*)malloc(h->rule_count * sizeof(FrameDesc));
+        frames->_records = (FrameRecord*)malloc(h->frame_count * sizeof(FrameRecord));
+        frames->_pages = (u32*)malloc((h->page_count + 1) * sizeof(u32));
+        valid = frames->_rules != NULL && frames->_records != NULL && frames->_pages != NULL;
+    }
+
+    NameArena arena;
+    if (valid) {
+        memcpy(starts, file_starts, (count + 1) * sizeof(u32));
+        memcpy(lengths, file_lengths, (count + 1) * sizeof(u32));
+        if (frames != NULL) {
+            memcpy(frames->_rules, file_rules, h->rule_count * sizeof(FrameDesc));
+            memcpy(frames->_records, file_records, h->frame_count * sizeof(FrameRecord));
+            memcpy(frames->_pages, file_pages, (h->page_count + 1) * sizeof(u32));
+            frames->_rule_count = h->rule_count;
+            frames->_count = h->frame_count;
+            frames->_page_count = h->page_count;
+            frames->_page_bits = h->page_bits;
+        }
+
+        index_names[0] = NULL;
+        for (int k = 1; valid && k <= count; k++) {
+            valid = (index_names[k] = NativeFunc::create(names + file_names[k], cc->_lib_index, &arena)) != NULL;
+        }
+    }
+
+    if (!valid) {
+        Log::debug("Could not load symbol cache %s", path);
+        free(starts);
+        free(lengths);
+        free(index_names);
+        delete frames;
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    cc->_names.swap(arena);
+    cc->_index_base = cc->_image_base + h->index_base;
+    cc->_index_starts = starts;
+    cc->_index_lengths = lengths;
+    cc->_index_names = index_names;
+    cc->_count = count;
+
+    size_t index_size = (count + 1) * (2 * sizeof(u32) + sizeof(char*));
+    size_t blobs_size = count * (sizeof(CodeBlob) + MALLOC_OVERHEAD);
+    cc->_saved_memory = blobs_size > index_size ? blobs_size - index_size : 0;
+
+    delete[] cc->_blobs;
+    cc->_blobs = NULL;
+    cc->_capacity = 0;
+
+    cc->_text_base = cc->_image_base;
+    cc->_plt_offset = h->plt_offset;
+    cc->_plt_size = h->plt_size;
+    cc->_debug_symbols = (h->flags & FLAG_DEBUG_SYMBOLS) != 0;
+    cc->_frame_table = frames;
+
+    munmap(map, st.st_size);
+    return true;
+}
+
+bool SymbolCache::save(CodeCache* cc, const char* path, const char* image_end) {
+    // DWARF locations are relative to the text base; only the common case where it is the image base is cached
+    if (cc->_image_base == NULL || image_end <= cc->_image_base || cc->_index_names == NULL ||
+        (cc->_frame_table != NULL && cc->_text_base != cc->_image_base)) {
+        return false;
+    }
+
+    int count = cc->_count;
+    u64 index_base = (u64)(cc->_index_base - cc->_image_base);
+    if (!validSymbols(index_base, cc->_index_starts, cc->_index_lengths, count, image_end - cc->_image_base)) {
+        return false;
+    }
+
+    const FrameTable* frames = cc->_frame_table;
+    u32* name_offsets = (u32*)malloc((count + 1) * sizeof(u32));
+    if (name_offsets == NULL) {
+        return false;
+    }
+
+    u64 names_size = 0;
+    name_offsets[0] = 0;
+    for (int k = 1; k <= count; k++) {
+        name_offsets[k] = (u32)names_size;
+        names_size += strlen(cc->_index_names[k]) + 1;
+        if (names_size > 0xffffffffULL) {
+            free(name_offsets);
+            return false;
+        }
+    }
+
+    SymbolCacheHeader h;
+    h.magic = SYMBOL_CACHE_MAGIC;
+    h.version = SYMBOL_CACHE_VERSION;
+    h.frame_desc_size = sizeof(FrameDesc);
+    h.flags = cc->_debug_symbols ? FLAG_DEBUG_SYMBOLS : 0;
+    h.count = count;
+    h.plt_offset = cc->_plt_offset;
+    h.plt_size = cc->_plt_size;
+    h.rule_count = frames != NULL ? frames->_rule_count : 0;
+    h.frame_count = frames != NULL ? frames->_count : 0;
+    h.page_count = frames != NULL ? frames->_page_count : 0;
+    h.page_bits = frames != NULL ? frames->_page_bits : 0;
+    h.reserved = 0;
+    h.index_base = index_base;
+    h.names_size = names_size;
+
+    // Writers in other processes may save the same library at the same time
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path)) {
+        free(name_offsets);
+        return false;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        Log::debug("Could not create symbol cache %s: %s", tmp_path, strerror(errno));
+        free(name_offsets);
+        return false;
+    }
+
+    // mkstemp creates the file readable only by the owner; the cache may be shared
+    fchmod(fd, 0644);
+    FILE* f = fdopen(fd, "wb");
+    if (f == NULL) {
+        close(fd);
+        unlink(tmp_path);
+        free(name_offsets);
+        return false;
+    }
+
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+        && fwrite(cc->_index_starts, sizeof(u32), count + 1, f) == (size_t)(count + 1)
+        && fwrite(cc->_index_lengths, sizeof(u32), count + 1, f) == (size_t)(count + 1)
+        && fwrite(name_offsets, sizeof(u32), count + 1, f) == (size_t)(count + 1);
+    if (ok && frames != NULL) {
+        ok = fwrite(frames->_rules, sizeof(FrameDesc), h.rule_count, f) == h.rule_count
+            && fwrite(frames->_records, sizeof(FrameRecord), h.frame_count, f) == h.frame_count
+            && fwrite(frames->_pages, sizeof(u32), h.page_count + 1, f) == h.page_count + 1;
+    }
+    for (int k = 1; ok && k <= count; k++) {
+        ok = fputs(cc->_index_names[k], f) >= 0 && fputc(0, f) == 0;
+    }
+    free(name_offsets);
+
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        Log::debug("Could not write symbol cache %s", path);
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
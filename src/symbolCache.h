@@ -0,0 +1,26 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SYMBOLCACHE_H
+#define _SYMBOLCACHE_H
+
+#include "codeCache.h"
+
+
+// On-disk copy of a parsed library: the compact symbol index and the DWARF table,
+// with addresses relative to the image base, so that any process mapping the same
+// build of a library can load it without parsing ELF and .eh_frame again.
+class SymbolCache {
+  public:
+    // Returns false if the file is missing, stale or malformed; cc is left untouched then.
+    // Every symbol must lie between the image base and image_end.
+    static bool load(CodeCache* cc, const char* path, const char* image_end);
+
+    // Stores a sorted cache. The file is written aside and renamed, so readers never see a partial file.
+    // Libraries with symbols outside of the image are not cached, since load() would reject them.
+    static bool save(CodeCache* cc, const char* path, const char* image_end);
+};
+
+#endif // _SYMBOLCACHE_H
@@ -15,11 +15,39 @@ class Symbols {
     static Mutex _parse_lock;
     static bool _have_kernel_symbols;
     static bool _libs_limit_reported;
+    static bool _lazy;
+    static const char* _cache_dir;
 
   public:
     static void parseKernelSymbols(CodeCache* cc);
     static void parseLibraries(CodeCacheArray* array, bool kernel_symbols);
 
+    // Parses every mapped library into array on up to max_threads threads, including libraries
+    // that parseLibraries has already seen. Returns the number of threads that ran.
+    // Linux only; used by tests to check that parsing does not depend on scheduling
+    static int parseAllLibraries(CodeCacheArray* array, int max_threads);
+
+    // In lazy mode, parseLibraries records only mappings and imports of new libraries.
+    // Symbols and DWARF tables are loaded on first use. After lazy mode is turned off,
+    // the next parse also loads the libraries that are still pending.
+    static void setLazy(bool lazy) {
+        _lazy = lazy;
+    }
+
+    // Stops the thread that loads lazy symbols. parseLibraries starts it again when needed
+    static void stopLoader();
+
+    // Libraries with a build-id are saved to and loaded from this directory. Linux only
+    static void setCacheDir(const char* dir);
+
+    static const char* cacheDir() {
+        return _cache_dir;
+    }
+
+    static void loadSymbols(CodeCache* cc);
+    static void loadDwarf(CodeCache* cc);
+    static void wakeupLoader();
+
     static bool haveKernelSymbols() {
         return _have_kernel_symbols;
     }
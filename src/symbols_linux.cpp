@@ -6,8 +6,10 @@
 #ifdef __linux__
 
 #include <dlfcn.h>
+#include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,7 +22,9 @@
 #include <fcntl.h>
 #include <link.h>
 #include <linux/limits.h>
+#include <pthread.h>
 #include <sys/auxv.h>
+#include "symbolCache.h"
 #include "symbols.h"
 #include "dwarf.h"
 #include "fdtransferClient.h"
@@ -208,6 +212,14 @@ typedef Elf32_Dyn  ElfDyn;
 
 static char _debuginfod_cache_buf[PATH_MAX] = {0};
 
+// Parts of in-memory program headers to parse
+enum ElfParts {
+    ELF_DYNAMIC_SYMBOLS = 1,
+    ELF_IMPORTS         = 2,
+    ELF_DWARF           = 4,
+    ELF_ALL             = 7
+};
+
 class ElfParser {
   private:
     CodeCache* _cc;
@@ -264,7 +276,7 @@ class ElfParser {
     ElfProgramHeader* findProgramHeader(uint32_t type);
 
     void calcVirtualLoadAddress();
-    void parseDynamicSection();
+    void parseDynamicSection(int parts);
     void parseDwarfInfo();
     uint32_t getSymbolCount(uint32_t* gnu_hash);
     void loadSymbols(bool use_debug);
@@ -274,10 +286,12 @@ class ElfParser {
     bool loadSymbolsUsingDebugLink();
     void loadSymbolTable(const char* symbols, size_t total_size, size_t ent_size, const char* strings);
     void addRelocationSymbols(ElfSection* reltab, const char* plt);
-    const char* getDebuginfodCache();
 
   public:
-    static void parseProgramHeaders(CodeCache* cc, const char* base, const char* end, bool relocate_dyn);
+    static const char* getDebuginfodCache();
+    static bool getBuildId(const char* base, const char* end, char* hex, size_t size);
+    static const char* getImageEnd(const char* base, const char* end);
+    static void parseProgramHeaders(CodeCache* cc, const char* base, const char* end, bool relocate_dyn, int parts = ELF_ALL);
     static bool parseFile(CodeCache* cc, const char* base, const char* file_name, bool use_debug);
 };
 
@@ -333,16 +347,75 @@ bool ElfParser::parseFile(CodeCache* cc, const char* base, const char* file_name
     return true;
 }
 
-void ElfParser::parseProgramHeaders(CodeCache* cc, const char* base, const char* end, bool relocate_dyn) {
+void ElfParser::parseProgramHeaders(CodeCache* cc, const char* base, const char* end, bool relocate_dyn, int parts) {
     ElfParser elf(cc, base, base, NULL, relocate_dyn);
     if (elf.validHeader() && base + elf._header->e_phoff < end) {
         cc->setTextBase(base);
         elf.calcVirtualLoadAddress();
-        elf.parseDynamicSection();
-        elf.parseDwarfInfo();
+        if (parts & (ELF_DYNAMIC_SYMBOLS | ELF_IMPORTS)) {
+            elf.parseDynamicSection(parts);
+        }
+        if (parts & ELF_DWARF) {
+            elf.parseDwarfInfo();
+        }
     }
 }
 
+// Formats the GNU build-id note of a loaded library as a hex string
+bool ElfParser::getBuildId(const char* base, const char* end, char* hex, size_t size) {
+    ElfParser elf(NULL, base, base, NULL, false);
+    if (!elf.validHeader() || base + elf._header->e_phoff >= end) {
+        return false;
+    }
+    elf.calcVirtualLoadAddress();
+
+    const char* pheaders = (const char*)elf._header + elf._header->e_phoff;
+    for (int i = 0; i < elf._header->e_phnum; i++) {
+        ElfProgramHeader* pheader = (ElfProgramHeader*)(pheaders + i * elf._header->e_phentsize);
+        if (pheader->p_type != PT_NOTE) continue;
+
+        const char* note_start = elf.at(pheader);
+        const char* note_end = note_start + pheader->p_filesz;
+        if (note_start < base || note_end > end) continue;
+
+        while (note_start + sizeof(ElfNote) <= note_end) {
+            ElfNote* note = (ElfNote*)note_start;
+            const char* name = note_start + sizeof(ElfNote);
+            const char* desc = name + ((note->n_namesz + 3) & ~3);
+            note_start = desc + ((note->n_descsz + 3) & ~3);
+            if (note_start > note_end) break;
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(name, "GNU", 4) == 0 &&
+                note->n_descsz >= 2 && note->n_descsz * 2 < size) {
+                for (unsigned int j = 0; j < note->n_descsz; j++) {
+                    snprintf(hex + j * 2, 3, "%02hhx", desc[j]);
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// End of the last loadable segment, including .bss, or NULL if program headers are not readable
+const char* ElfParser::getImageEnd(const char* base, const char* end) {
+    ElfParser elf(NULL, base, base, NULL, false);
+    if (!elf.validHeader() || base + elf._header->e_phoff >= end) {
+        return NULL;
+    }
+    elf.calcVirtualLoadAddress();
+
+    const char* image_end = NULL;
+    const char* pheaders = (const char*)elf._header + elf._header->e_phoff;
+    for (int i = 0; i < elf._header->e_phnum; i++) {
+        ElfProgramHeader* pheader = (ElfProgramHeader*)(pheaders + i * elf._header->e_phentsize);
+        if (pheader->p_type == PT_LOAD && elf.at(pheader) + pheader->p_memsz > image_end) {
+            image_end = elf.at(pheader) + pheader->p_memsz;
+        }
+    }
+    return image_end;
+}
+
 void ElfParser::calcVirtualLoadAddress() {
     // Find a difference between the virtual load address (often zero) and the actual DSO base
     const char* pheaders = (const char*)_header + _header->e_phoff;
@@ -356,7 +429,7 @@ void ElfParser::calcVirtualLoadAddress() {
     _vaddr_diff = _base;
 }
 
-void ElfParser::parseDynamicSection() {
+void ElfParser::parseDynamicSection(int parts) {
     ElfProgramHeader* dynamic = findProgramHeader(PT_DYNAMIC);
     if (dynamic != NULL) {
         const char* symtab = NULL;
@@ -420,10 +493,14 @@ void ElfParser::parseDynamicSection() {
             return;
         }
 
-        if (!_cc->hasDebugSymbols() && nsyms > 0) {
+        if ((parts & ELF_DYNAMIC_SYMBOLS) && !_cc->hasDebugSymbols() && nsyms > 0) {
             loadSymbolTable(symtab, syment * nsyms, syment, strtab);
         }
 
+        if (!(parts & ELF_IMPORTS)) {
+            return;
+        }
+
         const char* base = this->base();
         if (jmprel != NULL && pltrelsz != 0) {
             // Parse .rela.plt table
@@ -675,13 +752,206 @@ void ElfParser::addRelocationSymbols(ElfSection* reltab, const char* plt) {
 Mutex Symbols::_parse_lock;
 bool Symbols::_have_kernel_symbols = false;
 bool Symbols::_libs_limit_reported = false;
+bool Symbols::_lazy = false;
+const char* Symbols::_cache_dir = NULL;
 static std::unordered_set<u64> _parsed_inodes;
 static bool _in_parse_libraries = false;
 
+// Lazy loading: samplers write to the pipe to wake up the loader thread.
+// _lazy_array stays set after the loader stops, since its libraries may still be pending,
+// until a parse in eager mode loads them
+static CodeCacheArray* _lazy_array = NULL;
+static int _loader_pipe[2] = {-1, -1};
+static pthread_t _loader_thread;
+
+static void* loaderThreadEntry(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    char buf[64];
+    ssize_t r;
+    // The thread exits when stopLoader() closes the write end of the pipe
+    while ((r = read(fd, buf, sizeof(buf))) != 0) {
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Lazy mode may be turned off while a stopping loader drains the pipe
+        CodeCacheArray* array = _lazy_array;
+        int count = array != NULL ? array->count() : 0;
+        for (int i = 0; i < count; i++) {
+            CodeCache* cc = (*array)[i];
+            if (cc->symbolsRequested()) {
+                Symbols::loadSymbols(cc);
+            }
+            if (cc->dwarfRequested()) {
+                Symbols::loadDwarf(cc);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void loadPendingLibraries(CodeCacheArray* array) {
+    int count = array->count();
+    for (int i = 0; i < count; i++) {
+        CodeCache* cc = (*array)[i];
+        if (cc->symbolsPending()) {
+            Symbols::loadSymbols(cc);
+        }
+        if (cc->dwarfPending()) {
+            Symbols::loadDwarf(cc);
+        }
+    }
+}
+
+static bool startLoaderThread() {
+    if (pipe2(_loader_pipe, O_CLOEXEC) != 0) {
+        Log::warn("Could not create lazy symbol loader: %s", strerror(errno));
+        return false;
+    }
+    fcntl(_loader_pipe[1], F_SETFL, O_NONBLOCK);
+
+    if (pthread_create(&_loader_thread, NULL, loaderThreadEntry, (void*)(intptr_t)_loader_pipe[0]) != 0) {
+        Log::warn("Could not start lazy symbol loader");
+        close(_loader_pipe[0]);
+        close(_loader_pipe[1]);
+        _loader_pipe[0] = _loader_pipe[1] = -1;
+        return false;
+    }
+    return true;
+}
+
+void Symbols::stopLoader() {
+    int pipe_fds[2];
+    pthread_t thread;
+    {
+        // The loader itself may wait for _parse_lock, so it is not joined under the lock
+        MutexLocker ml(_parse_lock);
+        if (_loader_pipe[1] < 0) {
+            return;
+        }
+        pipe_fds[0] = _loader_pipe[0];
+        pipe_fds[1] = _loader_pipe[1];
+        thread = _loader_thread;
+        _loader_pipe[0] = _loader_pipe[1] = -1;
+    }
+
+    // Requests already in the pipe are served before the loader sees the end of file
+    close(pipe_fds[1]);
+    pthread_join(thread, NULL);
+    close(pipe_fds[0]);
+}
+
+void Symbols::wakeupLoader() {
+    if (_loader_pipe[1] >= 0) {
+        char c = 0;
+        ssize_t r = write(_loader_pipe[1], &c, 1);
+        (void)r;
+    }
+}
+
+void Symbols::loadSymbols(CodeCache* cc) {
+    MutexLocker ml(_parse_lock);
+    if (!cc->symbolsPending()) {
+        return;
+    }
+
+    CodeCache* symbols = new CodeCache(cc->name(), cc->libIndex(), cc->minAddress(), cc->maxAddress(), cc->imageBase());
+    if (cc->imageBase() == NULL) {
+        ElfParser::parseFile(symbols, (const char*)cc->minAddress(), cc->name(), true);
+    } else {
+        ElfParser::parseFile(symbols, cc->imageBase(), cc->name(), true);
+        if (!symbols->hasDebugSymbols()) {
+            UnloadProtection handle(cc);
+            if (handle.isValid()) {
+                ElfParser::parseProgramHeaders(symbols, cc->imageBase(), (const char*)cc->maxAddress(),
+                                               OS::isMusl(), ELF_DYNAMIC_SYMBOLS);
+            }
+        }
+    }
+    symbols->sort();
+
+    cc->adoptSymbols(symbols);
+    delete symbols;
+
+    // Drop cached placeholder frames
+    if (_lazy_array != NULL) {
+        _lazy_array->invalidate();
+    }
+}
+
+void Symbols::loadDwarf(CodeCache* cc) {
+    MutexLocker ml(_parse_lock);
+    if (!cc->dwarfPending()) {
+        return;
+    }
+
+    UnloadProtection handle(cc);
+    if (handle.isValid()) {
+        ElfParser::parseProgramHeaders(cc, cc->imageBase(), (const char*)cc->maxAddress(), OS::isMusl(), ELF_DWARF);
+    }
+    cc->finishLazyDwarf();
+}
+
+static bool isKallsymsImage(int fd) {
+    unsigned int magic;
+    return pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == KALLSYMS_IMAGE_MAGIC;
+}
+
+// Maps the kernel symbol image shared by the fdtransfer server. Only the array of name pointers is private
+static bool loadKallsymsImage(CodeCache* cc, int fd) {
+    struct kallsyms_image header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.version != KALLSYMS_IMAGE_VERSION ||
+        header.count == 0 || header.count >= 0x7fffffff || header.names_size <= 4 ||
+        fstat(fd, &st) != 0 || (size_t)st.st_size != kallsymsImageSize(&header)) {
+        Log::warn("Unsupported kernel symbol image");
+        return false;
+    }
+
+    // Private writable mapping: marking a frame copies only the touched page
+    size_t size = st.st_size;
+    char* image = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        Log::warn("mmap(kallsyms): %s", strerror(errno));
+        return false;
+    }
+
+    int count = header.count;
+    u32* starts = (u32*)(image + sizeof(header));
+    u32* lengths = starts + count + 1;
+    u32* name_offsets = lengths + count + 1;
+    char* names = (char*)(name_offsets + count + 1);
+
+    char** index_names = (char**)malloc((count + 1) * sizeof(char*));
+    bool valid = index_names != NULL && names[header.names_size - 1] == 0;
+    for (int k = 1; valid && k <= count; k++) {
+        valid = name_offsets[k] < header.names_size - 4;
+        index_names[k] = names + name_offsets[k] + 4;
+    }
+
+    if (!valid) {
+        Log::warn("Malformed kernel symbol image");
+        free(index_names);
+        munmap(image, size);
+        return false;
+    }
+
+    index_names[0] = NULL;
+    cc->adoptMappedIndex(image, size, (const char*)header.base, starts, lengths, index_names, count);
+    cc->updateBounds((const char*)header.base, (const char*)header.max_address);
+    return true;
+}
+
 void Symbols::parseKernelSymbols(CodeCache* cc) {
     int fd;
     if (FdTransferClient::hasPeer()) {
         fd = FdTransferClient::requestKallsymsFd();
+        if (fd != -1 && isKallsymsImage(fd)) {
+            _have_kernel_symbols = loadKallsymsImage(cc, fd);
+            close(fd);
+            return;
+        }
     } else {
         fd = open("/proc/kallsyms", O_RDONLY);
     }
@@ -723,7 +993,7 @@ void Symbols::parseKernelSymbols(CodeCache* cc) {
     fclose(f);
 }
 
-static void collectSharedLibraries(std::unordered_map<u64, SharedLibrary>& libs, int max_count) {
+static void collectSharedLibraries(std::unordered_map<u64, SharedLibrary>& libs, int max_count, bool skip_parsed) {
     FILE* f = fopen("/proc/self/maps", "r");
     if (f == NULL) {
         return;
@@ -744,7 +1014,7 @@ static void collectSharedLibraries(std::unordered_map<u64, SharedLibrary>& libs,
         }
 
         u64 inode = u64(map.dev()) << 32 | map.inode();
-        if (_parsed_inodes.find(inode) != _parsed_inodes.end()) {
+        if (skip_parsed && _parsed_inodes.find(inode) != _parsed_inodes.end()) {
             continue;  // shared object is already parsed
         }
         if (inode == 0 && strcmp(map.file(), "[vdso]") != 0) {
@@ -777,6 +1047,183 @@ static void collectSharedLibraries(std::unordered_map<u64, SharedLibrary>& libs,
     fclose(f);
 }
 
+void Symbols::setCacheDir(const char* dir) {
+    // The previous string is not freed, since parsing threads may still look at it
+    if (_cache_dir == NULL || strcmp(_cache_dir, dir) != 0) {
+        _cache_dir = strdup(dir);
+    }
+}
+
+// External debuginfo found by Build ID, see ElfParser::loadSymbolsUsingBuildId
+static bool hasDebugFile(const char* build_id) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "/usr/lib/debug/.build-id/%.2s/%s.debug", build_id, build_id + 2) < (int)sizeof(path) &&
+        access(path, F_OK) == 0) {
+        return true;
+    }
+    const char* debuginfod_cache = ElfParser::getDebuginfodCache();
+    return debuginfod_cache != NULL && debuginfod_cache[0] &&
+           snprintf(path, sizeof(path), "%s%s/debuginfo", debuginfod_cache, build_id) < (int)sizeof(path) &&
+           access(path, F_OK) == 0;
+}
+
+// Stripped and unstripped copies of a library share the Build ID, and debuginfo may be installed
+// after the cache is written. Both affect the symbols, so the file size and the presence of
+// external debuginfo are a part of the cache key.
+static bool getCachePath(const SharedLibrary& lib, char* path, size_t size) {
+    const char* dir = Symbols::cacheDir();
+    char build_id[129];
+    struct stat st;
+    if (dir == NULL || !ElfParser::getBuildId(lib.image_base, lib.map_end, build_id, sizeof(build_id)) ||
+        stat(lib.file, &st) != 0) {
+        return false;
+    }
+    return snprintf(path, size, "%s/%s-%llx%s.sym", dir, build_id, (unsigned long long)st.st_size,
+                    hasDebugFile(build_id) ? "-debug" : "") < (int)size;
+}
+
+static void parseLibrary(CodeCache* cc, const SharedLibrary& lib, bool lazy) {
+    if (strchr(lib.file, ':') != NULL) {
+        // Do not try to parse pseudofiles like anon_inode:name, /memfd:name
+    } else if (strcmp(lib.file, "[vdso]") == 0) {
+        ElfParser::parseProgramHeaders(cc, lib.map_start, lib.map_end, true);
+    } else if (lib.image_base == NULL) {
+        // Unlikely case when image base has not been found: not safe to access program headers.
+        // Be careful: executable file is not always ELF, e.g. classes.jsa
+        if (lazy) {
+            cc->setLazy(true, false);
+        } else {
+            ElfParser::parseFile(cc, lib.map_start, lib.file, true);
+        }
+    } else if (lazy) {
+        // Imports are needed right away for hooks
+        cc->setLazy(true, true);
+        UnloadProtection handle(cc);
+        if (handle.isValid()) {
+            ElfParser::parseProgramHeaders(cc, lib.image_base, lib.map_end, OS::isMusl(), ELF_IMPORTS);
+        }
+    } else {
+        UnloadProtection handle(cc);
+
+        char cache_path[PATH_MAX];
+        const char* image_end = NULL;
+        bool use_cache = handle.isValid() && getCachePath(lib, cache_path, sizeof(cache_path)) &&
+                         (image_end = ElfParser::getImageEnd(lib.image_base, lib.map_end)) != NULL;
+        if (use_cache && SymbolCache::load(cc, cache_path, image_end)) {
+            ElfParser::parseProgramHeaders(cc, lib.image_base, lib.map_end, OS::isMusl(), ELF_IMPORTS);
+            return;
+        }
+
+        // Parse debug symbols first
+        ElfParser::parseFile(cc, lib.image_base, lib.file, true);
+
+        if (handle.isValid()) {
+            ElfParser::parseProgramHeaders(cc, lib.image_base, lib.map_end, OS::isMusl());
+        }
+
+        if (use_cache) {
+            cc->sort();
+            SymbolCache::save(cc, cache_path, image_end);
+        }
+    }
+
+    cc->sort();
+}
+
+const int MAX_PARSE_THREADS = 8;
+
+// Libraries to parse; each worker takes the next unparsed one
+struct ParseJob {
+    SharedLibrary* libs;
+    CodeCache** caches;
+    int count;
+    volatile int next;
+    volatile int workers;  // threads that ran the job, whether or not any library was left for them
+    bool lazy;
+};
+
+static void* parseWorker(void* arg) {
+    ParseJob* job = (ParseJob*)arg;
+    __sync_fetch_and_add(&job->workers, 1);
+
+    int i;
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+        parseLibrary(job->caches[i], job->libs[i], job->lazy);
+    }
+    return NULL;
+}
+
+// Parses libraries on up to max_threads threads, including the current one
+static void runParseJob(ParseJob* job, int max_threads) {
+    int threads = std::min(std::min(max_threads, MAX_PARSE_THREADS), job->count);
+
+    // Initialize shared state before workers may read it
+    ElfParser::getDebuginfodCache();
+
+    pthread_t workers[MAX_PARSE_THREADS];
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, parseWorker, job) == 0) {
+        started++;
+    }
+
+    parseWorker(job);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+// Creates caches for libs in address order starting at array->count(), and parses them.
+// Returns the number of threads that took part; the caches are not yet added to the array
+static int parseSharedLibraries(CodeCacheArray* array, std::unordered_map<u64, SharedLibrary>& libs,
+                                std::vector<CodeCache*>& caches, bool lazy, int max_threads) {
+    // Libraries are added in address order, so that lib_index does not depend on hash map layout
+    std::vector<SharedLibrary> sorted;
+    sorted.reserve(libs.size());
+    for (auto& it : libs) {
+        sorted.push_back(it.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const SharedLibrary& a, const SharedLibrary& b) {
+        return a.map_start < b.map_start;
+    });
+
+    int base_index = array->count();
+    caches.resize(sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        SharedLibrary& lib = sorted[i];
+        caches[i] = new CodeCache(lib.file, base_index + i, lib.map_start, lib.map_end, lib.image_base);
+    }
+
+    ParseJob job;
+    job.libs = sorted.data();
+    job.caches = caches.data();
+    job.count = (int)sorted.size();
+    job.next = 0;
+    job.workers = 0;
+    job.lazy = lazy;
+    runParseJob(&job, max_threads);
+
+    for (size_t i = 0; i < sorted.size(); i++) {
+        free(sorted[i].file);
+    }
+    return job.workers;
+}
+
+int Symbols::parseAllLibraries(CodeCacheArray* array, int max_threads) {
+    MutexLocker ml(_parse_lock);
+
+    std::unordered_map<u64, SharedLibrary> libs;
+    collectSharedLibraries(libs, MAX_NATIVE_LIBS - array->count(), false);
+
+    std::vector<CodeCache*> caches;
+    int workers = parseSharedLibraries(array, libs, caches, false, max_threads);
+    for (size_t i = 0; i < caches.size(); i++) {
+        array->add(caches[i]);
+    }
+    array->publish();
+    return workers;
+}
+
 void Symbols::parseLibraries(CodeCacheArray* array, bool kernel_symbols) {
     MutexLocker ml(_parse_lock);
 
@@ -785,6 +1232,21 @@ void Symbols::parseLibraries(CodeCacheArray* array, bool kernel_symbols) {
     }
     _in_parse_libraries = true;
 
+    bool lazy = _lazy;
+    if (lazy && _loader_pipe[1] < 0) {
+        if (startLoaderThread()) {
+            _lazy_array = array;
+        } else {
+            lazy = _lazy = false;
+        }
+    }
+
+    // Lazy mode has been turned off since the last parse: nothing loads pending libraries in the background
+    if (!lazy && _lazy_array != NULL) {
+        loadPendingLibraries(_lazy_array);
+        _lazy_array = NULL;
+    }
+
     if (kernel_symbols && !haveKernelSymbols()) {
         CodeCache* cc = new CodeCache("[kernel]");
         parseKernelSymbols(cc);
@@ -798,40 +1260,20 @@ void Symbols::parseLibraries(CodeCacheArray* array, bool kernel_symbols) {
     }
 
     std::unordered_map<u64, SharedLibrary> libs;
-    collectSharedLibraries(libs, MAX_NATIVE_LIBS - array->count());
-
+    collectSharedLibraries(libs, MAX_NATIVE_LIBS - array->count(), true);
     for (auto& it : libs) {
-        u64 inode = it.first;
-        _parsed_inodes.insert(inode);
-
-        SharedLibrary& lib = it.second;
-        CodeCache* cc = new CodeCache(lib.file, array->count(), lib.map_start, lib.map_end, lib.image_base);
-
-        if (strchr(lib.file, ':') != NULL) {
-            // Do not try to parse pseudofiles like anon_inode:name, /memfd:name
-        } else if (strcmp(lib.file, "[vdso]") == 0) {
-            ElfParser::parseProgramHeaders(cc, lib.map_start, lib.map_end, true);
-        } else if (lib.image_base == NULL) {
-            // Unlikely case when image base has not been found: not safe to access program headers.
-            // Be careful: executable file is not always ELF, e.g. classes.jsa
-            ElfParser::parseFile(cc, lib.map_start, lib.file, true);
-        } else {
-            // Parse debug symbols first
-            ElfParser::parseFile(cc, lib.image_base, lib.file, true);
-
-            UnloadProtection handle(cc);
-            if (handle.isValid()) {
-                ElfParser::parseProgramHeaders(cc, lib.image_base, lib.map_end, OS::isMusl());
-            }
-        }
-
-        free(lib.file);
+        _parsed_inodes.insert(it.first);
+    }
 
-        cc->sort();
-        applyPatch(cc);
-        array->add(cc);
+    std::vector<CodeCache*> caches;
+    parseSharedLibraries(array, libs, caches, lazy, OS::getCpuCount());
+    for (size_t i = 0; i < caches.size(); i++) {
+        applyPatch(caches[i]);
+        array->add(caches[i]);
     }
 
+    array->publish();
+
     if (array->count() >= MAX_NATIVE_LIBS && !_libs_limit_reported) {
         Log::warn("Number of parsed libraries reached the limit of %d", MAX_NATIVE_LIBS);
         _libs_limit_reported = true;
@@ -176,11 +176,30 @@ class MachOParser {
 Mutex Symbols::_parse_lock;
 bool Symbols::_have_kernel_symbols = false;
 bool Symbols::_libs_limit_reported = false;
+bool Symbols::_lazy = false;
+const char* Symbols::_cache_dir = NULL;
 static std::unordered_set<const void*> _parsed_libraries;
 
 void Symbols::parseKernelSymbols(CodeCache* cc) {
 }
 
+// Mach-O images are always parsed eagerly
+void Symbols::setCacheDir(const char* dir) {
+    // Not supported
+}
+
+void Symbols::loadSymbols(CodeCache* cc) {
+}
+
+void Symbols::loadDwarf(CodeCache* cc) {
+}
+
+void Symbols::wakeupLoader() {
+}
+
+void Symbols::stopLoader() {
+}
+
 void Symbols::parseLibraries(CodeCacheArray* array, bool kernel_symbols) {
     MutexLocker ml(_parse_lock);
     uint32_t images = _dyld_image_count();
@@ -218,6 +237,13 @@ void Symbols::parseLibraries(CodeCacheArray* array, bool kernel_symbols) {
             delete cc;
         }
     }
+
+    array->publish();
+}
+
+int Symbols::parseAllLibraries(CodeCacheArray* array, int max_threads) {
+    // Not supported
+    return 0;
 }
 
 #endif // __APPLE__
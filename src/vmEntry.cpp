@@ -15,6 +15,7 @@
 #include "javaApi.h"
 #include "os.h"
 #include "profiler.h"
+#include "symbols.h"
 #include "instrument.h"
 #include "lockTracer.h"
 #include "log.h"
@@ -182,7 +183,7 @@ bool VM::init(JavaVM* vm, bool attach) {
     Profiler* profiler = Profiler::instance();
     if (VMStructs::libjvm() == NULL) {
         profiler->updateSymbols(false);
-        VMStructs::init(profiler->findLibraryByAddress((const void*)_asyncGetCallTrace));
+        VMStructs::init(profiler->nativeLibs()->scanLibraries((const void*)_asyncGetCallTrace));
     }
 
     _openj9 = !is_hotspot && J9Ext::initialize(_jvmti, profiler->resolveSymbol("j9thread_self"));
@@ -253,6 +254,7 @@ bool VM::init(JavaVM* vm, bool attach) {
     callbacks.ClassPrepare = ClassPrepare;
     callbacks.ClassFileLoadHook = Instrument::ClassFileLoadHook;
     callbacks.CompiledMethodLoad = Profiler::CompiledMethodLoad;
+    callbacks.CompiledMethodUnload = Profiler::CompiledMethodUnload;
     callbacks.DynamicCodeGenerated = Profiler::DynamicCodeGenerated;
     callbacks.ThreadStart = Profiler::ThreadStart;
     callbacks.ThreadEnd = Profiler::ThreadEnd;
@@ -268,6 +270,7 @@ bool VM::init(JavaVM* vm, bool attach) {
     _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_LOAD, NULL);
     _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, NULL);
     _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_DYNAMIC_CODE_GENERATED, NULL);
+    _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_COMPILED_METHOD_UNLOAD, NULL);
     _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH, NULL);
 
     if (hotspot_version() == 0 || !CodeHeap::available()) {
@@ -471,6 +474,14 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved) {
         }
     }
 
+    // Must be known before the first library is parsed
+    if (_global_args._lazy_symbols) {
+        Symbols::setLazy(true);
+    }
+    if (_global_args._symcache != NULL) {
+        Symbols::setCacheDir(_global_args._symcache);
+    }
+
     if (!VM::init(vm, false)) {
         Log::error("JVM does not support Tool Interface");
         return COMMAND_ERROR;
@@ -491,6 +502,13 @@ Agent_OnAttach(JavaVM* vm, char* options, void* reserved) {
         return ARGUMENTS_ERROR;
     }
 
+    if (args._lazy_symbols) {
+        Symbols::setLazy(true);
+    }
+    if (args._symcache != NULL) {
+        Symbols::setCacheDir(args._symcache);
+    }
+
     if (!VM::init(vm, true)) {
         Log::error("JVM does not support Tool Interface");
         return COMMAND_ERROR;
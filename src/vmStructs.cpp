@@ -59,6 +59,7 @@ int VMStructs::_nmethod_method_offset = -1;
 int VMStructs::_nmethod_entry_offset = -1;
 int VMStructs::_nmethod_state_offset = -1;
 int VMStructs::_nmethod_level_offset = -1;
+int VMStructs::_nmethod_compile_id_offset = -1;
 int VMStructs::_nmethod_metadata_offset = -1;
 int VMStructs::_nmethod_immutable_offset = -1;
 int VMStructs::_method_constmethod_offset = -1;
@@ -206,6 +207,8 @@ void VMStructs::initOffsets() {
                     _nmethod_state_offset = *(int*)(entry + offset_offset);
                 } else if (strcmp(field, "_comp_level") == 0) {
                     _nmethod_level_offset = *(int*)(entry + offset_offset);
+                } else if (strcmp(field, "_compile_id") == 0) {
+                    _nmethod_compile_id_offset = *(int*)(entry + offset_offset);
                 } else if (strcmp(field, "_metadata_offset") == 0) {
                     _nmethod_metadata_offset = *(int*)(entry + offset_offset);
                 } else if (strcmp(field, "_immutable_data") == 0) {
@@ -569,10 +572,10 @@ void VMStructs::initJvmFunctions() {
     }
 
     if (VM::hotspot_version() > 0) {
-        CodeBlob* blob = _libjvm->findBlob("_ZNK5frame26is_interpreted_frame_validEP10JavaThread");
-        if (blob != NULL) {
-            _interpreted_frame_valid_start = blob->_start;
-            _interpreted_frame_valid_end = blob->_end;
+        CodeBlob blob;
+        if (_libjvm->findBlob("_ZNK5frame26is_interpreted_frame_validEP10JavaThread", &blob)) {
+            _interpreted_frame_valid_start = blob._start;
+            _interpreted_frame_valid_end = blob._end;
         }
     }
 }
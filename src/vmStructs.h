@@ -65,6 +65,7 @@ class VMStructs {
     static int _nmethod_entry_offset;
     static int _nmethod_state_offset;
     static int _nmethod_level_offset;
+    static int _nmethod_compile_id_offset;
     static int _nmethod_metadata_offset;
     static int _nmethod_immutable_offset;
     static int _method_constmethod_offset;
@@ -184,6 +185,10 @@ class VMStructs {
         return _tid != NULL;
     }
 
+    static bool hasNMethodCompileId() {
+        return _nmethod_compile_id_offset >= 0;
+    }
+
     static bool isInterpretedFrameValidFunc(const void* pc) {
         return pc >= _interpreted_frame_valid_start && pc < _interpreted_frame_valid_end;
     }
@@ -542,6 +547,11 @@ class NMethod : VMStructs {
         return _nmethod_level_offset >= 0 ? *(signed char*) at(_nmethod_level_offset) : 0;
     }
 
+    // Unique per compilation, unlike the address of an nmethod
+    int compileId() {
+        return _nmethod_compile_id_offset >= 0 ? *(int*) at(_nmethod_compile_id_offset) : 0;
+    }
+
     VMMethod** metadata() {
         if (_mutable_data_offset >= 0) {
             // Since JDK 25
@@ -114,9 +114,10 @@ ThreadState WallClock::getThreadState(void* ucontext) {
         return THREAD_SLEEPING;
     }
 
-    // Make sure the previous instruction address is readable
+    // Make sure the previous instruction address is readable. No sampler slot is held yet,
+    // so libraries are scanned instead of searching the lookup index
     uintptr_t prev_pc = pc - SYSCALL_SIZE;
-    if ((pc & 0xfff) >= SYSCALL_SIZE || Profiler::instance()->findLibraryByAddress((instruction_t*)prev_pc) != NULL) {
+    if ((pc & 0xfff) >= SYSCALL_SIZE || Profiler::instance()->nativeLibs()->scanLibraries((instruction_t*)prev_pc) != NULL) {
         if (StackFrame::isSyscall((instruction_t*)prev_pc) && frame.checkInterruptedSyscall()) {
             return THREAD_SLEEPING;
         }
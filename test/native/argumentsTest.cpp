@@ -89,3 +89,42 @@ TEST_CASE(Parse_proc_with_units) {
     Error error = args.parse(argument);
     ASSERT_EQ(args._proc, 120);
 }
+
+TEST_CASE(Parse_perf_counters) {
+    Arguments args;
+    char argument[] = "start,event=cycles,counters=instructions+LLC-load-misses,file=%f.jfr";
+    Error error = args.parse(argument);
+    ASSERT_EQ(error, false);
+    ASSERT_EQ(args._event, "cycles");
+    ASSERT_EQ(args._counters, "instructions+LLC-load-misses");
+
+    char empty[] = "start,counters=";
+    CHECK_EQ(args.parse(empty), true);
+}
+
+TEST_CASE(Parse_perf_counters_weight) {
+    Arguments args;
+    char argument[] = "start,event=cycles,counters=instructions,weight=instructions,collapsed";
+    Error error = args.parse(argument);
+    ASSERT_EQ(error, false);
+    ASSERT_EQ(args._weight, "instructions");
+    CHECK_EQ(args._counter, COUNTER_TOTAL);
+
+    char empty[] = "start,counters=instructions,weight=";
+    CHECK_EQ(args.parse(empty), true);
+}
+
+TEST_CASE(Parse_user_stack) {
+    Arguments args;
+    char argument[] = "start,event=cpu,nosignal,userstack=16k,file=%f.jfr";
+    Error error = args.parse(argument);
+    ASSERT_EQ(error, false);
+    ASSERT_EQ(args._nosignal, true);
+    ASSERT_EQ(args._user_stack, 16384);
+
+    char too_small[] = "start,userstack=4k";
+    CHECK_EQ(args.parse(too_small), true);
+
+    char too_large[] = "start,userstack=128k";
+    CHECK_EQ(args.parse(too_large), true);
+}
@@ -0,0 +1,440 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "arguments.h"
+#include "callTraceStorage.h"
+#include "os.h"
+#include "testRunner.hpp"
+
+static int makeTrace(ASGCT_CallFrame* frames, int num_frames, int seed) {
+    for (int i = 0; i < num_frames; i++) {
+        frames[i].bci = i;
+        frames[i].method_id = (jmethodID)(uintptr_t)(seed * 1000 + i + 1);
+    }
+    return num_frames;
+}
+
+static u64 totalCounter(CallTraceStorage& storage, u64* samples) {
+    std::vector<CallTraceSample*> values;
+    storage.swapEpoch();
+    storage.collectSamples(values);
+
+    u64 counter = 0;
+    *samples = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        *samples += values[i]->samples;
+        counter += values[i]->counter;
+    }
+    return counter;
+}
+
+TEST_CASE(CallTraceStorage_same_trace_same_id) {
+    CallTraceStorage storage;
+    ASGCT_CallFrame frames[8];
+
+    u32 id1 = storage.put(makeTrace(frames, 8, 1), frames, 10);
+    u32 id2 = storage.put(makeTrace(frames, 8, 1), frames, 20);
+    u32 id3 = storage.put(makeTrace(frames, 8, 2), frames, 30);
+
+    CHECK_EQ(id1, id2);
+    CHECK_NE(id1, id3);
+
+    u64 samples;
+    CHECK_EQ(totalCounter(storage, &samples), 60);
+    CHECK_EQ(samples, 3);
+}
+
+TEST_CASE(CallTraceStorage_sharded_counters_are_merged) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_SHARDED, 4);
+    ASGCT_CallFrame frames[8];
+
+    u32 id1 = storage.put(makeTrace(frames, 8, 1), frames, 10, 0);
+    u32 id2 = storage.put(makeTrace(frames, 8, 1), frames, 20, 3);
+    u32 id3 = storage.put(makeTrace(frames, 8, 1), frames, 30);
+    storage.add(id1, 2, 40, 1);
+
+    CHECK_EQ(id1, id2);
+    CHECK_EQ(id1, id3);
+
+    std::map<u64, CallTraceSample> map;
+    storage.swapEpoch();
+    storage.collectSamples(map);
+    ASSERT_EQ(map.size(), 1);
+    CHECK_EQ(map.begin()->second.samples, 5);
+    CHECK_EQ(map.begin()->second.counter, 100);
+
+    // Counters must not be merged twice
+    map.clear();
+    storage.swapEpoch();
+    storage.collectSamples(map);
+    CHECK_EQ(map.begin()->second.samples, 5);
+}
+
+TEST_CASE(CallTraceStorage_sharded_collect_traces) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_SHARDED, 2);
+    ASGCT_CallFrame frames[8];
+
+    u32 id1 = storage.put(makeTrace(frames, 8, 1), frames, 1, 0);
+    u32 id2 = storage.put(makeTrace(frames, 4, 2), frames, 1, 1);
+
+    std::map<u32, CallTrace*> traces;
+    storage.swapEpoch();
+    storage.collectTraces(traces);
+    ASSERT_EQ(traces.size(), 2);
+    CHECK_EQ(traces[id1]->num_frames, 8);
+    CHECK_EQ(traces[id2]->num_frames, 4);
+
+    // Traces without new samples are not reported again
+    traces.clear();
+    storage.put(makeTrace(frames, 4, 2), frames, 1, 0);
+    storage.swapEpoch();
+    storage.collectTraces(traces);
+    ASSERT_EQ(traces.size(), 1);
+    CHECK_EQ(traces.begin()->first, id2);
+}
+
+TEST_CASE(CallTraceStorage_sharded_reset_counters) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_SHARDED, 2);
+    ASGCT_CallFrame frames[8];
+
+    storage.put(makeTrace(frames, 8, 1), frames, 10, 1);
+    storage.swapEpoch();
+    storage.resetCounters();
+    storage.put(makeTrace(frames, 8, 1), frames, 5, 1);
+
+    u64 samples;
+    CHECK_EQ(totalCounter(storage, &samples), 5);
+    CHECK_EQ(samples, 1);
+}
+
+TEST_CASE(CallTraceStorage_reset_after_epoch_swap) {
+    CallTraceStorage storage;
+    ASGCT_CallFrame frames[8];
+
+    // The same sequence as Profiler::tryResetCounters followed by a dump
+    storage.put(makeTrace(frames, 8, 1), frames, 10);
+    storage.put(makeTrace(frames, 8, 2), frames, 20, 0);
+    storage.swapEpoch();
+    storage.resetCounters();
+
+    storage.put(makeTrace(frames, 8, 1), frames, 5);
+    u64 samples;
+    CHECK_EQ(totalCounter(storage, &samples), 5);
+    CHECK_EQ(samples, 1);
+
+    // Counters of the epoch that was current before the reset do not come back
+    storage.put(makeTrace(frames, 8, 2), frames, 7);
+    storage.swapEpoch();
+    storage.resetCounters();
+    storage.put(makeTrace(frames, 8, 2), frames, 3);
+    CHECK_EQ(totalCounter(storage, &samples), 3);
+    CHECK_EQ(samples, 1);
+}
+
+TEST_CASE(CallTraceStorage_epoch_snapshot) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_SHARDED, 2);
+    ASGCT_CallFrame frames[8];
+
+    u32 id = storage.put(makeTrace(frames, 8, 1), frames, 10, 0);
+    storage.put(makeTrace(frames, 8, 2), frames, 20);
+    storage.swapEpoch();
+
+    // Samples of the new epoch are not visible in the frozen snapshot
+    storage.put(makeTrace(frames, 8, 1), frames, 100, 1);
+    storage.add(id, 1, 1000);
+
+    std::vector<CallTraceSample*> values;
+    storage.collectSamples(values);
+    u64 counter = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        counter += values[i]->counter;
+    }
+    CHECK_EQ(counter, 30);
+
+    u64 samples;
+    CHECK_EQ(totalCounter(storage, &samples), 1130);
+    CHECK_EQ(samples, 4);
+
+    // Reset does not hide call traces from the next JFR chunk
+    storage.put(makeTrace(frames, 8, 2), frames, 1);
+    storage.swapEpoch();
+    storage.resetCounters();
+    CHECK_EQ(totalCounter(storage, &samples), 0);
+
+    std::map<u32, CallTrace*> traces;
+    storage.collectTraces(traces);
+    CHECK_EQ(traces.size(), 2);
+}
+
+TEST_CASE(CallTraceStorage_collect_traces_of_frozen_epoch) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_SHARDED, 2);
+    ASGCT_CallFrame frames[8];
+
+    u32 id1 = storage.put(makeTrace(frames, 8, 1), frames, 1, 0);
+    storage.swapEpoch();
+
+    // A JFR chunk switch collects traces while samplers record events of the next chunk
+    u32 id2 = storage.put(makeTrace(frames, 8, 2), frames, 1, 1);
+    std::map<u32, CallTrace*> traces;
+    storage.collectTraces(traces);
+    ASSERT_EQ(traces.size(), 1);
+    CHECK_EQ(traces.begin()->first, id1);
+
+    storage.resetShard(0);
+    storage.resetShard(1);
+    storage.put(makeTrace(frames, 8, 1), frames, 1, 1);
+    storage.swapEpoch();
+
+    traces.clear();
+    storage.collectTraces(traces);
+    ASSERT_EQ(traces.size(), 2);
+    CHECK_EQ(traces.count(id2), 1);
+
+    u64 samples;
+    CHECK_EQ(totalCounter(storage, &samples), 3);
+}
+
+TEST_CASE(CallTraceStorage_prefix_shared_traces) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_PREFIX, 0);
+    ASGCT_CallFrame frames[8];
+
+    // Two traces that differ only in the top frame
+    u32 id1 = storage.put(makeTrace(frames, 8, 1), frames, 1);
+    frames[0].method_id = (jmethodID)12345;
+    u32 id2 = storage.put(8, frames, 1);
+    CHECK_NE(id1, id2);
+
+    std::map<u32, CallTrace*> traces;
+    storage.swapEpoch();
+    storage.collectTraces(traces);
+    ASSERT_EQ(traces.size(), 2);
+
+    CallTrace* t1 = traces[id1];
+    CallTrace* t2 = traces[id2];
+    ASSERT(t1->top);
+    ASSERT(t2->top);
+    CHECK_NE(t1->top, t2->top);
+    CHECK_EQ(t1->top->parent, t2->top->parent);
+
+    makeTrace(frames, 8, 1);
+    int i = 0;
+    for (CallTraceIterator it(t1); it.hasNext(); i++) {
+        const ASGCT_CallFrame& frame = it.next();
+        CHECK_EQ(frame.bci, frames[i].bci);
+        CHECK_EQ(frame.method_id, frames[i].method_id);
+    }
+    CHECK_EQ(i, 8);
+
+    std::vector<const ASGCT_CallFrame*> root_first;
+    t2->rootFirst(root_first);
+    ASSERT_EQ(root_first.size(), 8);
+    CHECK_EQ(root_first[0]->method_id, frames[7].method_id);
+    CHECK_EQ(root_first[7]->method_id, (jmethodID)12345);
+}
+
+TEST_CASE(CallTraceStorage_verified_lookup) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_VERIFY | STORAGE_PREFIX, 0);
+    ASGCT_CallFrame frames[64];
+
+    u32 id1 = storage.put(makeTrace(frames, 64, 1), frames, 1);
+    u32 id2 = storage.put(makeTrace(frames, 63, 1), frames, 1);
+    u32 id3 = storage.put(makeTrace(frames, 64, 1), frames, 1);
+
+    CHECK_NE(id1, id2);
+    CHECK_EQ(id1, id3);
+    CHECK_EQ(storage.collisions(), 0);
+}
+
+TEST_CASE(CallTraceStorage_verified_lookup_collision) {
+    const int options[] = {STORAGE_VERIFY, STORAGE_VERIFY | STORAGE_PREFIX};
+
+    for (size_t k = 0; k < sizeof(options) / sizeof(options[0]); k++) {
+        CallTraceStorage storage;
+        storage.setOptions(options[k], 0);
+        storage.setHashMask(0);  // every trace has the same hash
+        ASGCT_CallFrame frames[16];
+
+        u32 id1 = storage.put(makeTrace(frames, 16, 1), frames, 1);
+        u32 id2 = storage.put(makeTrace(frames, 16, 2), frames, 10);
+        u32 id3 = storage.put(makeTrace(frames, 15, 1), frames, 100);
+        CHECK_NE(id1, id2);
+        CHECK_NE(id1, id3);
+        CHECK_NE(id2, id3);
+
+        // Repeated lookups find the stored traces and are not counted as new collisions
+        for (int i = 0; i < 10; i++) {
+            CHECK_EQ(storage.put(makeTrace(frames, 16, 2), frames, 10), id2);
+            CHECK_EQ(storage.put(makeTrace(frames, 15, 1), frames, 100), id3);
+        }
+        CHECK_EQ(storage.collisions(), 2);
+
+        u64 samples;
+        CHECK_EQ(totalCounter(storage, &samples), 1 + 11 * 10 + 11 * 100);
+        CHECK_EQ(samples, 23);
+    }
+}
+
+TEST_CASE(CallTraceStorage_unverified_lookup_merges_collision) {
+    CallTraceStorage storage;
+    storage.setHashMask(0);
+    ASGCT_CallFrame frames[16];
+
+    u32 id1 = storage.put(makeTrace(frames, 16, 1), frames, 1);
+    u32 id2 = storage.put(makeTrace(frames, 16, 2), frames, 1);
+    CHECK_EQ(id1, id2);
+    CHECK_EQ(storage.collisions(), 0);
+}
+
+TEST_CASE(CallTraceStorage_bounded_eviction) {
+    CallTraceStorage storage;
+    storage.setMemoryLimit(64 * 1024 * 1024, 2);
+    ASGCT_CallFrame frames[8];
+
+    u32 id1 = storage.put(makeTrace(frames, 8, 1), frames, 1);
+    u32 id2 = storage.put(makeTrace(frames, 8, 2), frames, 1);
+    storage.evict();
+    storage.put(makeTrace(frames, 8, 1), frames, 1);
+    storage.evict();
+    CHECK_EQ(storage.evicted(), 0);
+
+    // The second trace has not been hit for 2 generations
+    storage.evict();
+    CHECK_EQ(storage.evicted(), 1);
+
+    u64 samples;
+    CHECK_EQ(totalCounter(storage, &samples), 2);
+
+    // A stale id must not update a trace that took the freed slot
+    u32 id3 = storage.put(makeTrace(frames, 8, 2), frames, 1);
+    CHECK_NE(id2, id3);
+    storage.add(id2, 1, 100);
+    storage.add(id1, 1, 10);
+    CHECK_EQ(totalCounter(storage, &samples), 13);
+    CHECK_EQ(samples, 4);
+}
+
+TEST_CASE(CallTraceStorage_bounded_memory_is_reused) {
+    const size_t limit = 16 * 1024 * 1024;
+    const int traces_per_round = 5000;
+    const int depth = 16;
+    const int options[] = {0, STORAGE_PREFIX};
+
+    for (size_t k = 0; k < sizeof(options) / sizeof(options[0]); k++) {
+        CallTraceStorage storage;
+        storage.setOptions(options[k], 0);
+        storage.setMemoryLimit(limit, 1);
+        ASGCT_CallFrame frames[depth];
+
+        // Without eviction, all rounds together would not fit into the limit
+        u32 id = 0;
+        for (int round = 0; round < 8; round++) {
+            for (int i = 0; i < traces_per_round; i++) {
+                id = storage.put(makeTrace(frames, depth, round * traces_per_round + i), frames, 1);
+            }
+            CHECK_EQ(storage.overflow(), 0);
+            CHECK_LTE(storage.usedMemory(), limit);
+            if (round < 7) {
+                storage.evict();
+            }
+        }
+        // Traces of the last two rounds survive
+        CHECK_EQ(storage.evicted(), traces_per_round * 6);
+
+        std::map<u32, CallTrace*> traces;
+        storage.swapEpoch();
+        storage.collectTraces(traces);
+        ASSERT_EQ(traces.size(), traces_per_round * 2);
+
+        int i = 0;
+        for (CallTraceIterator it(traces[id]); it.hasNext(); i++) {
+            CHECK_EQ(it.next().method_id, frames[i].method_id);
+        }
+        CHECK_EQ(i, depth);
+    }
+}
+
+TEST_CASE(CallTraceStorage_bounded_memory_floor) {
+    CallTraceStorage storage;
+    storage.setMemoryLimit(1024 * 1024, 1);
+    ASGCT_CallFrame frames[64];
+
+    // The initial chunk and tables alone exceed the requested limit, so the floor applies instead
+    CHECK_GT(storage.usedMemory(), 1024 * 1024);
+    for (int i = 0; i < 200000; i++) {
+        storage.put(makeTrace(frames, 64, i), frames, 1);
+    }
+    CHECK_GT(storage.overflow(), 0);
+    CHECK_LTE(storage.usedMemory(), MIN_STORAGE_LIMIT);
+}
+
+TEST_CASE(CallTraceStorage_unstored_trace_is_overflow) {
+    CallTraceStorage storage;
+    storage.setOptions(STORAGE_VERIFY, 0);
+    storage.setMemoryLimit(1024 * 1024, 1);
+    ASGCT_CallFrame frames[64];
+
+    // Fill the storage until a trace cannot be stored
+    int seed = 0;
+    u32 id = 0;
+    while (id != OVERFLOW_TRACE_ID && seed < 200000) {
+        id = storage.put(makeTrace(frames, 64, ++seed), frames, 1);
+    }
+    ASSERT_EQ(id, OVERFLOW_TRACE_ID);
+    u64 overflow = storage.overflow();
+
+    // The slot keeps a placeholder: later samples of the same trace are overflow too,
+    // not samples of a trace that is yet to be published
+    id = storage.put(makeTrace(frames, 64, seed), frames, 1);
+    CHECK_EQ(id, OVERFLOW_TRACE_ID);
+    u64 overflow_after = storage.overflow();
+    CHECK_EQ(overflow_after, overflow + 1);
+    u64 unpublished = storage.unpublished();
+    CHECK_EQ(unpublished, 0);
+
+    // Once eviction frees memory, the trace gets another chance
+    storage.evict();
+    storage.evict();
+    id = storage.put(makeTrace(frames, 64, seed), frames, 1);
+    CHECK_NE(id, OVERFLOW_TRACE_ID);
+}
+
+// Not a real test: reports the cost of put() for an already known trace
+// with and without frame verification
+static double measurePut(int options, int depth) {
+    const int iterations = 1000000;
+    CallTraceStorage storage;
+    storage.setOptions(options, 0);
+    ASGCT_CallFrame frames[256];
+    makeTrace(frames, depth, 1);
+    storage.put(depth, frames, 1);
+
+    u64 start = OS::nanotime();
+    for (int i = 0; i < iterations; i++) {
+        storage.put(depth, frames, 1);
+    }
+    return (double)(OS::nanotime() - start) / iterations;
+}
+
+// Run with BENCHMARK=1 in the environment
+TEST_CASE(CallTraceStorage_verified_lookup_benchmark, getenv("BENCHMARK") != NULL) {
+    const int depths[] = {16, 64, 256};
+    for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+        double plain = measurePut(0, depths[i]);
+        double verified = measurePut(STORAGE_VERIFY, depths[i]);
+        double verified_prefix = measurePut(STORAGE_VERIFY | STORAGE_PREFIX, depths[i]);
+        printf("put() of %d frames: %.1f ns, verified: %.1f ns, verified prefix-shared: %.1f ns\n",
+               depths[i], plain, verified, verified_prefix);
+        CHECK_GT(verified, 0);
+    }
+}
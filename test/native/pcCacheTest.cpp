@@ -0,0 +1,44 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "pcCache.h"
+#include "testRunner.hpp"
+#include <stdlib.h>
+
+TEST_CASE(PcCache_hit_after_put) {
+    PcCache* cache = (PcCache*)calloc(1, sizeof(PcCache));
+    const void* pc = (const void*)0x7f0012345678;
+    const char* name = "some_function";
+
+    cache->validate(1);
+    ASSERT_EQ(cache->lookup(pc), (PcCacheEntry*)NULL);
+    cache->put(pc, name, 2);
+
+    PcCacheEntry* e = cache->lookup(pc);
+    ASSERT_NE(e, (PcCacheEntry*)NULL);
+    CHECK_EQ(e->name, name);
+    CHECK_EQ(e->mark, 2);
+    CHECK_EQ(cache->hits(), 1);
+    CHECK_EQ(cache->misses(), 1);
+
+    free(cache);
+}
+
+TEST_CASE(PcCache_dropped_on_new_generation) {
+    PcCache* cache = (PcCache*)calloc(1, sizeof(PcCache));
+    const void* pc = (const void*)0x7f0012345678;
+
+    cache->validate(1);
+    cache->put(pc, NULL, 0);
+    ASSERT_NE(cache->lookup(pc), (PcCacheEntry*)NULL);
+
+    cache->validate(1);
+    ASSERT_NE(cache->lookup(pc), (PcCacheEntry*)NULL);
+
+    cache->validate(2);
+    CHECK_EQ(cache->lookup(pc), (PcCacheEntry*)NULL);
+
+    free(cache);
+}
@@ -6,10 +6,12 @@
 #ifdef __linux__
 
 #include "callTraceStorage.h"
+#include "perfRingBuffer.h"
 #include "profiler.h"
 #include "testRunner.hpp"
 #include <dlfcn.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define ASSERT_EVENT_TYPE(event_type, name_, type_, default_interval_, config_, config1_, config2_, counter_arg_) \
     ASSERT_NE(event_type, NULL);                                                                                  \
@@ -286,4 +288,208 @@ TEST_CASE(ForName_kernel_tracepoint, fileReadable("/sys/kernel/tracing/events/oo
     ASSERT_EVENT_TYPE_NONZERO_CONFIG(event_type, "trace:tracepoint", PERF_TYPE_TRACEPOINT, 1);
 }
 
+// Zero-filled header page followed by the data area
+static struct perf_event_mmap_page* allocateRing(size_t data_size) {
+    return (struct perf_event_mmap_page*)calloc(1, OS::page_size + data_size);
+}
+
+static u64* ringWord(struct perf_event_mmap_page* page, size_t offset) {
+    return (u64*)((char*)page + OS::page_size + offset);
+}
+
+TEST_CASE(RingBuffer_bytes_wrap_around) {
+    size_t data_size = OS::page_size;
+    struct perf_event_mmap_page* page = allocateRing(data_size);
+
+    // A record starting 3 words before the end: header, size, then 8 words of stack data
+    size_t record = data_size - 24;
+    *ringWord(page, record + 8) = 64;
+    for (u64 i = 0; i < 8; i++) {
+        *ringWord(page, (record + 16 + i * 8) % data_size) = 100 + i;
+    }
+    *ringWord(page, 56) = 0xabc;
+
+    RingBuffer ring(page, data_size);
+    ring.seek(record);
+    CHECK_EQ(ring.next(), 64);
+
+    char buf[64];
+    const u64* data = (const u64*)ring.bytes(64, buf);
+    CHECK_EQ((const char*)data, buf);
+    for (u64 i = 0; i < 8; i++) {
+        CHECK_EQ(data[i], 100 + i);
+    }
+
+    // The word right after the copy is read from the start of the ring
+    CHECK_EQ(ring.next(), 0xabc);
+    free(page);
+}
+
+TEST_CASE(RingBuffer_bytes_in_place) {
+    size_t data_size = OS::page_size;
+    struct perf_event_mmap_page* page = allocateRing(data_size);
+
+    *ringWord(page, 16) = 32;
+    for (u64 i = 0; i < 4; i++) {
+        *ringWord(page, 24 + i * 8) = i + 1;
+    }
+    *ringWord(page, 56) = 0xdef;
+
+    RingBuffer ring(page, data_size);
+    ring.seek(8);
+    CHECK_EQ(ring.next(), 32);
+
+    // Without wrap around, the data is not copied
+    char buf[32];
+    const u64* data = (const u64*)ring.bytes(32, buf);
+    CHECK_EQ((const char*)data, (const char*)ringWord(page, 24));
+    CHECK_EQ(data[3], 4);
+    CHECK_EQ(ring.next(), 0xdef);
+    free(page);
+}
+
+
+// Header of a PERF_RECORD_SWITCH followed by sample_id: pid/tid, time
+static size_t putSwitch(struct perf_event_mmap_page* page, size_t data_size, size_t offset, bool out, u64 time) {
+    struct perf_event_header* hdr = (struct perf_event_header*)ringWord(page, offset % data_size);
+    hdr->type = PERF_RECORD_SWITCH;
+    hdr->misc = out ? PERF_RECORD_MISC_SWITCH_OUT : 0;
+    hdr->size = 24;
+    *ringWord(page, (offset + 8) % data_size) = 123;
+    *ringWord(page, (offset + 16) % data_size) = time;
+    return offset + 24;
+}
+
+TEST_CASE(RingBuffer_find_switch_in) {
+    size_t data_size = OS::page_size;
+    struct perf_event_mmap_page* page = allocateRing(data_size);
+
+    // Switch-out sample, then the thread is switched out, in, and out again
+    struct perf_event_header* sample = (struct perf_event_header*)ringWord(page, 0);
+    sample->type = PERF_RECORD_SAMPLE;
+    sample->size = 32;
+    size_t offset = putSwitch(page, data_size, 32, true, 1000);
+    size_t switch_in = offset;
+    offset = putSwitch(page, data_size, offset, false, 2000);
+    offset = putSwitch(page, data_size, offset, true, 3000);
+
+    RingBuffer ring(page, data_size);
+    CHECK_EQ(ring.findSwitchIn(32, offset), 2000);
+
+    // The thread is still off CPU until the switch-in record is written
+    CHECK_EQ(ring.findSwitchIn(32, switch_in), 0);
+    CHECK_EQ(ring.findSwitchIn(32, 32), 0);
+    free(page);
+}
+
+TEST_CASE(RingBuffer_find_switch_in_wrap_around) {
+    size_t data_size = OS::page_size;
+    struct perf_event_mmap_page* page = allocateRing(data_size);
+
+    // Positions grow beyond the data size; the switch-in record wraps around the end
+    u64 tail = data_size * 3 - 32;
+    size_t offset = putSwitch(page, data_size, tail, true, 1000);
+    offset = putSwitch(page, data_size, offset, false, 5000);
+
+    RingBuffer ring(page, data_size);
+    CHECK_EQ(ring.findSwitchIn(tail, offset), 5000);
+    free(page);
+}
+
+TEST_CASE(ParseCgroupLine_unified) {
+    char line[] = "0::/user.slice/user-1000.slice/session-2.scope\n";
+    bool unified = false;
+    const char* path = PerfEvents::parseCgroupLine(line, &unified);
+    ASSERT_NE(path, (const char*)NULL);
+    CHECK_EQ(path, "/user.slice/user-1000.slice/session-2.scope");
+    CHECK_EQ(unified, true);
+}
+
+TEST_CASE(ParseCgroupLine_perf_event_controller) {
+    char line[] = "5:cpu,perf_event,net_cls:/docker/0123abcd\n";
+    bool unified = true;
+    const char* path = PerfEvents::parseCgroupLine(line, &unified);
+    ASSERT_NE(path, (const char*)NULL);
+    CHECK_EQ(path, "/docker/0123abcd");
+    CHECK_EQ(unified, false);
+
+    // Paths may contain colons
+    char colon[] = "7:perf_event:/kubepods/pod:1\n";
+    CHECK_EQ(PerfEvents::parseCgroupLine(colon, &unified), "/kubepods/pod:1");
+}
+
+TEST_CASE(ParseCgroupLine_other_controllers) {
+    bool unified;
+    char cpu[] = "4:cpu,cpuacct:/docker/0123abcd\n";
+    CHECK_EQ(PerfEvents::parseCgroupLine(cpu, &unified), (const char*)NULL);
+
+    char named[] = "1:name=systemd:/init.scope\n";
+    CHECK_EQ(PerfEvents::parseCgroupLine(named, &unified), (const char*)NULL);
+
+    char malformed[] = "garbage\n";
+    CHECK_EQ(PerfEvents::parseCgroupLine(malformed, &unified), (const char*)NULL);
+}
+
+__attribute__((noinline))
+static void callchainLeaf() {
+    asm volatile("");
+}
+
+__attribute__((noinline))
+static void callchainRoot() {
+    callchainLeaf();
+    asm volatile("");
+}
+
+static bool isFrame(const ASGCT_CallFrame& frame, const char* name) {
+    const char* frame_name = (const char*)frame.method_id;
+    return frame.bci == BCI_NATIVE_FRAME && frame_name != NULL && strstr(frame_name, name) != NULL;
+}
+
+// PERF_SAMPLE_CALLCHAIN part of a sample record: nr, then instruction pointers
+static void putCallchain(struct perf_event_mmap_page* page, const u64* ips, u64 nr) {
+    *ringWord(page, 8) = nr;
+    for (u64 i = 0; i < nr; i++) {
+        *ringWord(page, 16 + i * 8) = ips[i];
+    }
+    *ringWord(page, 16 + nr * 8) = 0xabc;
+}
+
+TEST_CASE(ConvertCallchain_native_frames) {
+    Profiler::instance()->updateSymbols(false);
+    struct perf_event_mmap_page* page = allocateRing(OS::page_size);
+
+    // Context markers are skipped; addresses are return addresses inside the functions
+    u64 ips[] = {PERF_CONTEXT_USER, (u64)(uintptr_t)callchainLeaf + 1, (u64)(uintptr_t)callchainRoot + 1};
+    putCallchain(page, ips, 3);
+
+    RingBuffer ring(page, OS::page_size);
+    ASGCT_CallFrame frames[8];
+    ring.seek(0);
+    ASSERT_EQ(PerfEvents::convertCallchain(ring, frames, 8), 2);
+    CHECK_EQ(isFrame(frames[0], "callchainLeaf"), true);
+    CHECK_EQ(isFrame(frames[1], "callchainRoot"), true);
+
+    // The word after the callchain is next
+    CHECK_EQ(ring.next(), 0xabc);
+    free(page);
+}
+
+TEST_CASE(ConvertCallchain_max_depth) {
+    Profiler::instance()->updateSymbols(false);
+    struct perf_event_mmap_page* page = allocateRing(OS::page_size);
+
+    u64 ips[] = {(u64)(uintptr_t)callchainLeaf + 1, (u64)(uintptr_t)callchainRoot + 1, (u64)(uintptr_t)callchainRoot + 1};
+    putCallchain(page, ips, 3);
+
+    // Entries beyond max_depth are consumed but not converted
+    RingBuffer ring(page, OS::page_size);
+    ASGCT_CallFrame frames[8];
+    ring.seek(0);
+    ASSERT_EQ(PerfEvents::convertCallchain(ring, frames, 1), 1);
+    CHECK_EQ(isFrame(frames[0], "callchainLeaf"), true);
+    CHECK_EQ(ring.next(), 0xabc);
+    free(page);
+}
+
 #endif // __linux__
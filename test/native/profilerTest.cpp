@@ -0,0 +1,41 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "os.h"
+#include "profiler.h"
+#include "testRunner.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+TEST_CASE(Profiler_slots_follow_cpu_count) {
+    CHECK_EQ(Profiler::slotsForCpus(1), CONCURRENCY_LEVEL);
+    CHECK_EQ(Profiler::slotsForCpus(CONCURRENCY_LEVEL), CONCURRENCY_LEVEL);
+    CHECK_EQ(Profiler::slotsForCpus(CONCURRENCY_LEVEL + 1), CONCURRENCY_LEVEL * 2);
+    CHECK_EQ(Profiler::slotsForCpus(96), 128);
+    CHECK_EQ(Profiler::slotsForCpus(MAX_CONCURRENCY_LEVEL), MAX_CONCURRENCY_LEVEL);
+    CHECK_EQ(Profiler::slotsForCpus(MAX_CONCURRENCY_LEVEL * 4), MAX_CONCURRENCY_LEVEL);
+
+    int slots = Profiler::instance()->concurrencyLevel();
+    CHECK_EQ(slots, Profiler::slotsForCpus(OS::getCpuCount()));
+}
+
+TEST_CASE(Profiler_slot_memory_metric) {
+    Profiler* profiler = Profiler::instance();
+    int slots = profiler->concurrencyLevel();
+
+    // Locks and per-slot pointers are there even before the first start
+    size_t bytes = profiler->slotMemory();
+    CHECK_GTE(bytes, slots * (sizeof(SlotLock) + 3 * sizeof(void*)));
+
+    BufferWriter out;
+    profiler->writeMetrics(out);
+    std::string metrics(out.buf(), out.size());
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\nsampler_slots %d\n", slots);
+    CHECK_NE(metrics.find(expected), std::string::npos);
+    CHECK_NE(metrics.find("\nmem_samplerslots_kb "), std::string::npos);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "scopeCache.h"
+#include "testRunner.hpp"
+#include <stdlib.h>
+
+static NMethod* const TEST_NMETHOD = (NMethod*)0x7f0012340000;
+static VMMethod* const TEST_METHOD = (VMMethod*)0x800001000;
+static const int TEST_COMPILE_ID = 42;
+
+// Yields a synthetic inlining chain of the given depth; method IDs start at 0x1000
+class TestDecoder {
+  private:
+    int _depth;
+    int _null_at;
+    int _index;
+
+  public:
+    int calls;
+
+    TestDecoder(int depth, int null_at = -1) : _depth(depth), _null_at(null_at), _index(0), calls(0) {
+    }
+
+    bool next(int* bci, jmethodID* method_id) {
+        calls++;
+        if (_index == _depth) {
+            return false;
+        }
+        *bci = _index * 10;
+        *method_id = _index == _null_at ? NULL : (jmethodID)(uintptr_t)(0x1000 * (_index + 1));
+        _index++;
+        return true;
+    }
+};
+
+TEST_CASE(ScopeCache_hit_after_commit) {
+    ScopeCache* cache = (ScopeCache*)calloc(1, sizeof(ScopeCache));
+    const void* pc = (const void*)0x7f0012345678;
+
+    cache->validate(1);
+    ASSERT_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+
+    ScopeCacheEntry* e = cache->reserve(pc);
+    e->bci[0] = 5;
+    e->method_id[0] = (jmethodID)0x1000;
+    e->bci[1] = 17;
+    e->method_id[1] = (jmethodID)0x2000;
+    e->count = 2;
+
+    // Not visible until committed
+    CHECK_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+    cache->commit(e, TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID);
+
+    ScopeCacheEntry* hit = cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID);
+    ASSERT_EQ(hit, e);
+    CHECK_EQ(hit->count, 2);
+    CHECK_EQ(hit->bci[1], 17);
+    CHECK_EQ((const void*)hit->method_id[1], (const void*)0x2000);
+    CHECK_EQ(cache->hits(), 1);
+    CHECK_EQ(cache->misses(), 2);
+
+    // Same address reused by another nmethod, another method or another compilation of the same method
+    CHECK_EQ(cache->lookup(TEST_NMETHOD + 1, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+    CHECK_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD + 1, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+    CHECK_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID + 1), (ScopeCacheEntry*)NULL);
+
+    free(cache);
+}
+
+TEST_CASE(ScopeCache_dropped_on_new_epoch) {
+    ScopeCache* cache = (ScopeCache*)calloc(1, sizeof(ScopeCache));
+    const void* pc = (const void*)0x7f0012345678;
+
+    cache->validate(0);
+    cache->commit(cache->reserve(pc), TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID);
+    ASSERT_NE(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+
+    cache->validate(0);
+    ASSERT_NE(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+
+    cache->validate(1);
+    CHECK_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+
+    free(cache);
+}
+
+TEST_CASE(ScopeCache_find_decodes_once) {
+    ScopeCache* cache = (ScopeCache*)calloc(1, sizeof(ScopeCache));
+    const void* pc = (const void*)0x7f0012345678;
+
+    TestDecoder decoder(3);
+    ScopeCacheEntry* e = cache->find(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID, decoder);
+    ASSERT_NE(e, (ScopeCacheEntry*)NULL);
+    CHECK_EQ(e->count, 3);
+    CHECK_EQ(e->bci[2], 20);
+    CHECK_EQ((const void*)e->method_id[2], (const void*)0x3000);
+
+    TestDecoder unused(3);
+    CHECK_EQ(cache->find(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID, unused), e);
+    CHECK_EQ(unused.calls, 0);
+
+    // A pc without inlined scopes is cached as an empty chain
+    const void* other_pc = (const void*)0x7f0012345000;
+    TestDecoder empty(0);
+    e = cache->find(TEST_NMETHOD, other_pc, TEST_METHOD, TEST_COMPILE_ID, empty);
+    ASSERT_NE(e, (ScopeCacheEntry*)NULL);
+    CHECK_EQ(e->count, 0);
+
+    free(cache);
+}
+
+TEST_CASE(ScopeCache_find_not_cacheable) {
+    ScopeCache* cache = (ScopeCache*)calloc(1, sizeof(ScopeCache));
+    const void* pc = (const void*)0x7f0012345678;
+
+    // Chains deeper than the cache entry are decoded by the caller
+    TestDecoder deep(SCOPE_CACHE_MAX_FRAMES + 1);
+    CHECK_EQ(cache->find(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID, deep), (ScopeCacheEntry*)NULL);
+    CHECK_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+
+    // The deepest chain that fits is still cached
+    TestDecoder fits(SCOPE_CACHE_MAX_FRAMES);
+    ScopeCacheEntry* e = cache->find(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID, fits);
+    ASSERT_NE(e, (ScopeCacheEntry*)NULL);
+    CHECK_EQ(e->count, SCOPE_CACHE_MAX_FRAMES);
+
+    // A method ID that is not yet assigned must not be remembered; the previous entry is gone as well
+    TestDecoder unassigned(3, 1);
+    CHECK_EQ(cache->find(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID + 1, unassigned), (ScopeCacheEntry*)NULL);
+    CHECK_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID), (ScopeCacheEntry*)NULL);
+    CHECK_EQ(cache->lookup(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID + 1), (ScopeCacheEntry*)NULL);
+
+    free(cache);
+}
+
+TEST_CASE(ScopeCache_expand_max_depth) {
+    ScopeCache* cache = (ScopeCache*)calloc(1, sizeof(ScopeCache));
+    const void* pc = (const void*)0x7f0012345678;
+
+    TestDecoder decoder(4);
+    ScopeCacheEntry* e = cache->find(TEST_NMETHOD, pc, TEST_METHOD, TEST_COMPILE_ID, decoder);
+    ASSERT_NE(e, (ScopeCacheEntry*)NULL);
+
+    ASGCT_CallFrame frames[4];
+    ASSERT_EQ(e->expand(frames, 4, FRAME_INLINED, FRAME_C1_COMPILED), 4);
+    CHECK_EQ(FrameType::decode(frames[0].bci), FRAME_INLINED);
+    CHECK_EQ(FrameType::decode(frames[3].bci), FRAME_C1_COMPILED);
+    CHECK_EQ(frames[3].bci & 0xffffff, 30);
+    CHECK_EQ((const void*)frames[3].method_id, (const void*)0x4000);
+
+    // Truncated chain ends before the compiled frame
+    memset(frames, 0, sizeof(frames));
+    ASSERT_EQ(e->expand(frames, 2, FRAME_INLINED, FRAME_C1_COMPILED), 2);
+    CHECK_EQ(FrameType::decode(frames[1].bci), FRAME_INLINED);
+    CHECK_EQ((const void*)frames[1].method_id, (const void*)0x2000);
+    CHECK_EQ((const void*)frames[2].method_id, (const void*)NULL);
+
+    CHECK_EQ(e->expand(frames, 0, FRAME_INLINED, FRAME_C1_COMPILED), 0);
+
+    free(cache);
+}
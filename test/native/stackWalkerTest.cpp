@@ -0,0 +1,150 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arch.h"
+#include "dwarf.h"
+#include "profiler.h"
+#include "stackWalker.h"
+#include "testRunner.hpp"
+
+static const size_t SNAPSHOT_SIZE = 16384;
+
+static StackSnapshot snapshot;
+static char snapshot_data[SNAPSHOT_SIZE];
+
+// Copies the stack of the caller as the kernel does with PERF_SAMPLE_STACK_USER
+__attribute__((noinline))
+static void takeSnapshot() {
+    const void* pc = callerPC();
+    uintptr_t sp = (uintptr_t)callerSP();
+    uintptr_t fp = (uintptr_t)callerFP();
+
+    // Like the kernel, do not copy past the end of the stack
+    size_t size = SNAPSHOT_SIZE;
+    pthread_attr_t attr;
+    void* stack_addr;
+    size_t stack_size;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0) {
+            uintptr_t stack_end = (uintptr_t)stack_addr + stack_size;
+            if (stack_end - sp < size) {
+                size = stack_end - sp;
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    memcpy(snapshot_data, (const void*)sp, size);
+    snapshot.pc = pc;
+    snapshot.sp = sp;
+    snapshot.fp = fp;
+    snapshot.lr = 0;
+    snapshot.data = snapshot_data;
+    snapshot.size = size;
+}
+
+__attribute__((noinline))
+static int snapshotLevel3(int n) {
+    takeSnapshot();
+    return n + 3;
+}
+
+__attribute__((noinline))
+static int snapshotLevel2(int n) {
+    return snapshotLevel3(n * 2) + 2;
+}
+
+__attribute__((noinline))
+static int snapshotLevel1(int n) {
+    return snapshotLevel2(n * 3) + 1;
+}
+
+static int findFrame(ASGCT_CallFrame* frames, int depth, const char* name) {
+    for (int i = 0; i < depth; i++) {
+        const char* frame_name = (const char*)frames[i].method_id;
+        if (frames[i].bci == BCI_NATIVE_FRAME && frame_name != NULL && strstr(frame_name, name) != NULL) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+TEST_CASE(StackWalker_walk_snapshot) {
+    Profiler::instance()->updateSymbols(false);
+
+    volatile int result = snapshotLevel1(1);
+    CHECK_EQ(result, 12);
+
+    // The stack has changed since the copy, so the walker can only succeed by reading the copy
+    ASGCT_CallFrame frames[64];
+    int depth = StackWalker::walkSnapshot(&snapshot, frames, 64);
+
+    int level2 = findFrame(frames, depth, "snapshotLevel2");
+    int level1 = findFrame(frames, depth, "snapshotLevel1");
+    ASSERT_GTE(level2, 0);
+    CHECK_EQ(level1, level2 + 1);
+    CHECK_GT(findFrame(frames, depth, "StackWalker_walk_snapshot"), level1);
+}
+
+TEST_CASE(StackWalker_walk_truncated_snapshot) {
+    Profiler::instance()->updateSymbols(false);
+
+    volatile int result = snapshotLevel1(1);
+    CHECK_EQ(result, 12);
+
+    ASGCT_CallFrame frames[64];
+    StackSnapshot full = snapshot;
+    int full_depth = StackWalker::walkSnapshot(&full, frames, 64);
+
+    // Frames beyond the copied part of the stack are not unwound
+    StackSnapshot truncated = snapshot;
+    truncated.size = 64;
+    int depth = StackWalker::walkSnapshot(&truncated, frames, 64);
+    CHECK_GTE(depth, 1);
+    CHECK_LT(depth, full_depth);
+
+    // Nothing is read without a copy
+    truncated.size = 0;
+    CHECK_EQ(StackWalker::walkSnapshot(&truncated, frames, 64), 1);
+}
+
+#ifdef __x86_64__
+
+// Return addresses outside of any library are unwound by the default frame layout
+static int walkSyntheticChain(size_t copied, int levels) {
+    const uintptr_t base = 0x7f0000100000;
+    uintptr_t stack[64] = {0};
+
+    StackSnapshot s = {0};
+    s.pc = (const void*)0x10000000;
+    s.sp = base;
+    s.fp = base + 16;
+    s.data = (const char*)stack;
+    s.size = copied;
+
+    // Saved FP and return address right above each frame pointer
+    uintptr_t fp = s.fp;
+    for (int i = 1; i <= levels; i++) {
+        uintptr_t next_fp = i < levels ? fp + 48 : 0;
+        stack[(fp - base) / sizeof(uintptr_t)] = next_fp;
+        stack[(fp - base) / sizeof(uintptr_t) + 1] = i < levels ? 0x10000000 + i * 0x1000 : 0;
+        fp = next_fp;
+    }
+
+    ASGCT_CallFrame frames[16];
+    return StackWalker::walkSnapshot(&s, frames, 16);
+}
+
+TEST_CASE(StackWalker_walk_synthetic_fp_chain) {
+    CHECK_EQ(walkSyntheticChain(64 * sizeof(uintptr_t), 5), 5);
+
+    // The third frame lies past the end of the copy
+    CHECK_EQ(walkSyntheticChain(16 + 2 * 48, 5), 3);
+}
+
+#endif // __x86_64__
@@ -0,0 +1,144 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "spinLock.h"
+#include "stubCache.h"
+#include "testRunner.hpp"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* const STUB_BASE = (const char*)0x7f0000000000;
+
+TEST_CASE(StubCache_lookup_sorted_and_tail) {
+    StubCache stubs;
+    char name[32];
+
+    CodeBlob blob;
+    CHECK_EQ(stubs.findBlobByAddress(STUB_BASE, &blob), false);
+    CHECK_EQ(stubs.findBlob("stub_0", &blob), false);
+
+    // Added out of address order, enough to go through several merges and leave a partial tail
+    const int count = STUB_TAIL_CAPACITY * 3 + 5;
+    for (int i = 0; i < count; i++) {
+        int n = (i * 37) % count;
+        snprintf(name, sizeof(name), "stub_%d", n);
+        stubs.add(STUB_BASE + n * 0x100, 0x80, name);
+    }
+
+    CHECK_EQ(stubs.contains(STUB_BASE), true);
+    CHECK_EQ(stubs.contains(STUB_BASE - 1), false);
+    CHECK_EQ(stubs.contains(STUB_BASE + (count - 1) * 0x100 + 0x80), false);
+
+    for (int n = 0; n < count; n++) {
+        snprintf(name, sizeof(name), "stub_%d", n);
+        ASSERT_EQ(stubs.findBlobByAddress(STUB_BASE + n * 0x100 + 0x10, &blob), true);
+        CHECK_EQ(strcmp(blob._name, name), 0);
+        CHECK_EQ(blob._start, (const void*)(STUB_BASE + n * 0x100));
+
+        ASSERT_EQ(stubs.findBlob(name, &blob), true);
+        CHECK_EQ(blob._start, (const void*)(STUB_BASE + n * 0x100));
+
+        // Gaps between stubs
+        CHECK_EQ(stubs.findBlobByAddress(STUB_BASE + n * 0x100 + 0x80, &blob), false);
+    }
+    CHECK_EQ(stubs.findBlob("stub_x", &blob), false);
+}
+
+struct StubReaderArgs {
+    StubCache* stubs;
+    SpinLock slot;
+    volatile bool* done;
+    int errors;
+};
+
+// Searches the stubs while holding its slot, like a sampler in a signal handler
+static void* stubReader(void* arg) {
+    StubReaderArgs* args = (StubReaderArgs*)arg;
+    CodeBlob blob;
+    while (!*args->done) {
+        args->slot.lock();
+        for (int n = 0; n < 64; n++) {
+            if (args->stubs->findBlobByAddress(STUB_BASE + n * 0x100, &blob) && blob._start != STUB_BASE + n * 0x100) {
+                args->errors++;
+            }
+        }
+        args->slot.unlock();
+    }
+    return NULL;
+}
+
+TEST_CASE(StubCache_concurrent_readers) {
+    const int num_readers = 2;
+    StubCache stubs;
+    volatile bool done = false;
+
+    StubReaderArgs args[num_readers];
+    pthread_t readers[num_readers];
+    for (int i = 0; i < num_readers; i++) {
+        args[i].stubs = &stubs;
+        args[i].done = &done;
+        args[i].errors = 0;
+        pthread_create(&readers[i], NULL, stubReader, &args[i]);
+    }
+
+    // Replaced snapshots are freed as soon as every reader has passed through its slot,
+    // as Profiler::addRuntimeStub does, so they never pile up
+    char name[32];
+    int freed = 0;
+    for (int n = 0; n < 2000; n++) {
+        snprintf(name, sizeof(name), "stub_%d", n);
+        stubs.add(STUB_BASE + n * 0x100, 0x80, name);
+
+        StubSnapshot* retired = stubs.takeRetired();
+        if (retired != NULL) {
+            CHECK_EQ(retired->next_retired, (StubSnapshot*)NULL);
+            for (int i = 0; i < num_readers; i++) {
+                args[i].slot.lock();
+                args[i].slot.unlock();
+            }
+            StubCache::freeRetired(retired);
+            freed++;
+        }
+    }
+    CHECK_EQ(freed, 2000 / STUB_TAIL_CAPACITY);
+
+    done = true;
+    for (int i = 0; i < num_readers; i++) {
+        pthread_join(readers[i], NULL);
+        CHECK_EQ(args[i].errors, 0);
+    }
+
+    CodeBlob blob;
+    ASSERT_EQ(stubs.findBlobByAddress(STUB_BASE + 1999 * 0x100, &blob), true);
+    CHECK_EQ(strcmp(blob._name, "stub_1999"), 0);
+}
+
+TEST_CASE(StubCache_lookup_enclosing_stub) {
+    StubCache stubs;
+    char name[32];
+
+    // A large stub region with small stubs inside, merged into the sorted part
+    stubs.add(STUB_BASE, 0x10000, "region");
+    for (int n = 1; n <= STUB_TAIL_CAPACITY; n++) {
+        snprintf(name, sizeof(name), "stub_%d", n);
+        stubs.add(STUB_BASE + n * 0x100, 0x80, name);
+    }
+    stubs.add(STUB_BASE + 0x20000, 0x100, "after");
+
+    CodeBlob blob;
+    ASSERT_EQ(stubs.findBlobByAddress(STUB_BASE + 0x210, &blob), true);
+    CHECK_EQ(strcmp(blob._name, "stub_2"), 0);
+
+    // Between the small stubs and past the last one, the address still belongs to the region
+    ASSERT_EQ(stubs.findBlobByAddress(STUB_BASE + 0x290, &blob), true);
+    CHECK_EQ(strcmp(blob._name, "region"), 0);
+    ASSERT_EQ(stubs.findBlobByAddress(STUB_BASE + 0x8000, &blob), true);
+    CHECK_EQ(strcmp(blob._name, "region"), 0);
+
+    CHECK_EQ(stubs.findBlobByAddress(STUB_BASE + 0x10000, &blob), false);
+    ASSERT_EQ(stubs.findBlobByAddress(STUB_BASE + 0x20010, &blob), true);
+    CHECK_EQ(strcmp(blob._name, "after"), 0);
+}
@@ -10,9 +10,19 @@
 #endif
 
 #include "codeCache.h"
+#include "dwarf.h"
 #include "profiler.h"
+#include "symbolCache.h"
+#include "symbols.h"
 #include "testRunner.hpp"
+#include <dirent.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 const void* resolveSymbol(const char* lib, const char* name) {
     void* result = dlopen(lib, RTLD_NOW);
@@ -43,8 +53,448 @@ TEST_CASE(ResolveFromRela_dyn_R_GLOB_DAT) {
     ASSERT_RESOLVE(im_pthread_setspecific);
 }
 
+TEST_CASE(CodeCache_compact_index_lookup) {
+    const char* base = (const char*)0x7f0000000000;
+    CodeCache cc("libtest.so", 0, base, base + 0x100000);
+
+    // Non-overlapping symbols with gaps, a zero-size one, and names added out of order
+    char name[32];
+    for (int i = 999; i >= 0; i--) {
+        snprintf(name, sizeof(name), "func_%d", i);
+        cc.add(base + i * 0x100, i == 500 ? 0 : 0x80, name);
+    }
+    cc.sort();
+    CHECK_GT(cc.savedMemory(), 0);
+
+    CHECK_EQ(cc.binarySearch(base - 1), cc.name());
+    CHECK_EQ(strcmp(cc.binarySearch(base), "func_0"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x7f), "func_0"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x80), "func_0"), 0);  // return address right past the end
+    CHECK_EQ(cc.binarySearch(base + 0x81), cc.name());
+    CHECK_EQ(strcmp(cc.binarySearch(base + 500 * 0x100 + 0x40), "func_500"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 999 * 0x100 + 0x10), "func_999"), 0);
+    CHECK_EQ(cc.binarySearch(base + 0x200000), cc.name());
+
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "func_%d", i);
+        CHECK_EQ(strcmp(cc.binarySearch(base + i * 0x100 + 0x10), name), 0);
+        CHECK_EQ(cc.findSymbol(name), base + i * 0x100);
+    }
+
+    // Sorted order is kept for prefix search
+    CHECK_EQ(cc.findSymbolByPrefix("func_1"), base + 0x100);
+
+    CodeBlob blob;
+    ASSERT_EQ(cc.findBlob("func_42", &blob), true);
+    CHECK_EQ(blob._start, base + 42 * 0x100);
+    CHECK_EQ(blob._end, base + 42 * 0x100 + 0x80);
+}
+
+TEST_CASE(CodeCache_nested_symbol_lookup) {
+    const char* base = (const char*)0x7f0000000000;
+    CodeCache cc("libtest.so", 0, base, base + 0x100000);
+
+    // A large function with smaller local symbols inside
+    cc.add(base, 0x1000, "outer");
+    cc.add(base + 0x100, 0x10, "inner_1");
+    cc.add(base + 0x200, 0x10, "inner_2");
+    cc.add(base + 0x2000, 0x100, "next");
+    cc.sort();
+
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x50), "outer"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x108), "inner_1"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x180), "outer"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x800), "outer"), 0);
+    CHECK_EQ(cc.binarySearch(base + 0x1800), cc.name());
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x2010), "next"), 0);
+}
+
+TEST_CASE(CodeCache_nested_symbol_lookup_without_index) {
+    // Symbols more than 4 GB apart do not fit in the compact index
+    const char* base = (const char*)0x7f0000000000;
+    CodeCache cc("libtest.so", 0, base, base + 0x200000000ULL);
+
+    cc.add(base, 0x1000, "outer");
+    cc.add(base + 0x100, 0x10, "inner");
+    cc.add(base + 0x100000000ULL, 0x100, "far");
+    cc.sort();
+    CHECK_EQ(cc.savedMemory(), 0);
+
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x108), "inner"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x800), "outer"), 0);
+    CHECK_EQ(cc.binarySearch(base + 0x1800), cc.name());
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x100000010ULL), "far"), 0);
+}
+
+TEST_CASE(CodeCache_add_after_sort) {
+    const char* base = (const char*)0x7f0000000000;
+    CodeCache cc("libtest.so", 0, base, base + 0x100000);
+
+    cc.add(base, 0x100, "first");
+    cc.add(base + 0x1000, 0x100, "second");
+    cc.sort();
+    ASSERT_GT(cc.savedMemory(), 0);
+
+    // Symbols added to the immutable index are still found
+    cc.add(base + 0x500, 0x100, "late");
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x510), "late"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x1010), "second"), 0);
+    CHECK_EQ(cc.binarySearch(base + 0x800), cc.name());
+    CHECK_EQ(cc.findSymbol("late"), base + 0x500);
+    CHECK_EQ(cc.findSymbolByPrefix("lat"), base + 0x500);
+
+    CodeBlob* blob = cc.findBlobByAddress(base + 0x5ff);
+    ASSERT_NE(blob, (CodeBlob*)NULL);
+    CHECK_EQ(strcmp(blob->_name, "late"), 0);
+}
+
+static const FrameDesc* linearFrameDesc(const FrameDesc* table, int count, u32 loc) {
+    const FrameDesc* result = NULL;
+    for (int i = 0; i < count && table[i].loc <= loc; i++) {
+        result = &table[i];
+    }
+    return result;
+}
+
+TEST_CASE(FrameTable_matches_linear_search) {
+    // Sparse and dense regions, so that some pages have no records at all
+    const int count = 3000;
+    FrameDesc* table = (FrameDesc*)malloc(count * sizeof(FrameDesc));
+    u32 loc = 0x400;
+    for (int i = 0; i < count; i++) {
+        table[i].loc = loc;
+        table[i].cfa = DW_REG_SP | ((i % 7) * 8) << 8;
+        table[i].fp_off = i % 3 == 0 ? DW_SAME_FP : -16;
+        table[i].pc_off = -8;
+        loc += i % 100 == 99 ? 0x5000 : 1 + i % 13;
+    }
+
+    FrameTable* ft = FrameTable::build(table, count);
+    ASSERT_NE(ft, (FrameTable*)NULL);
+    CHECK_EQ(ft->count(), count);
+    CHECK_EQ(ft->ruleCount(), 14);
+    CHECK_GT(count * sizeof(FrameDesc), ft->usedMemory());
+
+    for (u32 target = 0; target < loc + 0x2000; target += 3) {
+        const FrameDesc* expected = linearFrameDesc(table, count, target);
+        FrameDesc* f = ft->find(target);
+        if (expected == NULL) {
+            CHECK_EQ(f, (FrameDesc*)NULL);
+        } else {
+            ASSERT_NE(f, (FrameDesc*)NULL);
+            CHECK_EQ(f->cfa, expected->cfa);
+            CHECK_EQ(f->fp_off, expected->fp_off);
+            CHECK_EQ(f->pc_off, expected->pc_off);
+        }
+    }
+    CHECK_EQ(ft->find(0xffffffff)->cfa, table[count - 1].cfa);
+
+    delete ft;
+    free(table);
+}
+
+TEST_CASE(SymbolCache_roundtrip_at_other_base) {
+    const char* base = (const char*)0x7f0000000000;
+    CodeCache cc("libtest.so", 0, base, base + 0x100000, base);
+    char name[32];
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "func_%d", i);
+        cc.add(base + 0x1000 + i * 0x100, 0x80, name);
+    }
+    FrameDesc* table = (FrameDesc*)malloc(2 * sizeof(FrameDesc));
+    table[0] = FrameDesc::empty_frame;
+    table[0].loc = 0x1000;
+    table[1] = FrameDesc::default_frame;
+    table[1].loc = 0x2000;
+    cc.setDwarfTable(table, 2);
+    cc.setTextBase(base);
+    cc.sort();
+
+    char path[] = "/tmp/symcache-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+    ASSERT_EQ(SymbolCache::save(&cc, path, base + 0x100000), true);
+
+    const char* other = (const char*)0x7e0000000000;
+    CodeCache loaded("libtest.so", 3, other, other + 0x100000, other);
+    ASSERT_EQ(SymbolCache::load(&loaded, path, other + 0x100000), true);
+
+    for (int i = 0; i < 100; i++) {
+        snprintf(name, sizeof(name), "func_%d", i);
+        const char* found = loaded.binarySearch(other + 0x1000 + i * 0x100 + 0x10);
+        CHECK_EQ(strcmp(found, name), 0);
+        CHECK_EQ(NativeFunc::libIndex(found), 3);
+    }
+    CHECK_EQ(loaded.binarySearch(other + 0x800), loaded.name());
+    CHECK_EQ(loaded.findFrameDesc(other + 0x1800)->cfa, FrameDesc::empty_frame.cfa);
+    CHECK_EQ(loaded.findFrameDesc(other + 0x2800)->cfa, FrameDesc::default_frame.cfa);
+
+    // Symbols past the end of a smaller image are rejected
+    CodeCache smaller("libtest.so", 4, other, other + 0x4000, other);
+    CHECK_EQ(SymbolCache::load(&smaller, path, other + 0x4000), false);
+    CHECK_EQ(smaller.binarySearch(other + 0x1010), smaller.name());
+    unlink(path);
+
+    // A truncated file is rejected
+    CodeCache truncated("libtest.so", 4, other, other + 0x100000, other);
+    CHECK_EQ(SymbolCache::load(&truncated, "/dev/null", other + 0x100000), false);
+}
+
+TEST_CASE(SymbolCache_symbols_outside_image_not_saved) {
+    const char* base = (const char*)0x7f0000000000;
+    CodeCache cc("libtest.so", 0, base, base + 0x100000, base);
+    cc.add(base + 0x1000, 0x80, "inside");
+    cc.add(base + 0x3ff0, 0x20, "crosses_end");
+    cc.sort();
+
+    char path[] = "/tmp/symcache-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    close(fd);
+    unlink(path);
+
+    CHECK_EQ(SymbolCache::save(&cc, path, base + 0x4000), false);
+    CHECK_EQ(access(path, F_OK), -1);
+    CHECK_EQ(SymbolCache::save(&cc, path, base + 0x4010), true);
+    CHECK_EQ(access(path, F_OK), 0);
+    unlink(path);
+}
+
+TEST_CASE(CodeCache_mapped_index) {
+    // Three zero-size symbols in Eytzinger order: k=1 is the middle one
+    const char* sorted_names[] = {"a_[k]", "b_[k]", "c_[k]"};
+    size_t size = 4096;
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(mapping, MAP_FAILED);
+
+    u32* starts = (u32*)mapping;
+    u32* lengths = starts + 4;
+    char* names = (char*)(lengths + 4);
+    char** index_names = (char**)malloc(4 * sizeof(char*));
+    index_names[0] = NULL;
+    for (int k = 1; k <= 3; k++) {
+        int i = k == 1 ? 1 : (k - 2) * 2;
+        starts[k] = i * 0x100;
+        lengths[k] = 0;
+        char* entry = names + i * 16;
+        *(short*)entry = -1;
+        strcpy(entry + 4, sorted_names[i]);
+        index_names[k] = entry + 4;
+    }
+
+    const char* base = (const char*)0xffffffff81000000;
+    CodeCache cc("[kernel]");
+    cc.adoptMappedIndex(mapping, size, base, starts, lengths, index_names, 3);
+
+    CHECK_EQ(cc.binarySearch(base - 1), cc.name());
+    CHECK_EQ(strcmp(cc.binarySearch(base), "a_[k]"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x1ff), "b_[k]"), 0);
+    CHECK_EQ(strcmp(cc.binarySearch(base + 0x5000), "c_[k]"), 0);
+    CHECK_EQ(cc.findSymbol("b_[k]"), (const void*)(base + 0x100));
+    CHECK_EQ(NativeFunc::libIndex(cc.binarySearch(base)), -1);
+}
+
+TEST_CASE(FindLibraryByAddress_matches_linear_scan) {
+    Profiler::instance()->updateSymbols(false);
+    CodeCacheArray* libs = Profiler::instance()->nativeLibs();
+    ASSERT_GT(libs->count(), 0);
+
+    for (int i = 0; i < libs->count(); i++) {
+        CodeCache* lib = (*libs)[i];
+        if (lib->minAddress() >= lib->maxAddress()) continue;
+
+        const char* min = (const char*)lib->minAddress();
+        const char* max = (const char*)lib->maxAddress();
+        const void* probes[] = {min, max - 1, min + (max - min) / 2};
+        for (const void* probe : probes) {
+            CodeCache* expected = NULL;
+            for (int j = 0; j < libs->count(); j++) {
+                if ((*libs)[j]->contains(probe)) {
+                    expected = (*libs)[j];
+                    break;
+                }
+            }
+            CHECK_EQ(libs->findLibrary(probe), expected);
+        }
+    }
+}
+
+TEST_CASE(FindLibraryByAddress_overlapping_and_unpublished) {
+    CodeCacheArray* libs = new CodeCacheArray();
+    CodeCache* outer = new CodeCache("outer", 0, (const void*)0x1000, (const void*)0x9000);
+    CodeCache* inner = new CodeCache("inner", 1, (const void*)0x2000, (const void*)0x3000);
+    CodeCache* empty = new CodeCache("empty", 2);
+    CodeCache* high = new CodeCache("high", 3, (const void*)0xa000, (const void*)0xb000);
+    libs->add(outer);
+    libs->add(inner);
+    libs->add(empty);
+    libs->publish();
+    libs->add(high);
+
+    CHECK_EQ(libs->findLibrary((const void*)0x0fff), (CodeCache*)NULL);
+    CHECK_EQ(libs->findLibrary((const void*)0x2800), outer);
+    CHECK_EQ(libs->findLibrary((const void*)0x8fff), outer);
+    CHECK_EQ(libs->findLibrary((const void*)0x9000), (CodeCache*)NULL);
+    CHECK_EQ(libs->findLibrary((const void*)0xa800), high);
+
+    libs->publish();
+    CHECK_EQ(libs->findLibrary((const void*)0x2800), outer);
+    CHECK_EQ(libs->findLibrary((const void*)0xa800), high);
+    CHECK_EQ(libs->findLibrary((const void*)0xb000), (CodeCache*)NULL);
+
+    delete libs;
+    delete outer;
+    delete inner;
+    delete empty;
+    delete high;
+}
+
+struct LibraryReaderArgs {
+    CodeCacheArray* libs;
+    CodeCache* first;
+    SpinLock slot;
+    volatile bool* done;
+    int errors;
+};
+
+// Searches the index while holding its slot, like a sampler in a signal handler
+static void* libraryReader(void* arg) {
+    LibraryReaderArgs* args = (LibraryReaderArgs*)arg;
+    while (!*args->done) {
+        args->slot.lock();
+        if (args->libs->findLibrary((const void*)0x1800) != args->first) {
+            args->errors++;
+        }
+        args->slot.unlock();
+    }
+    return NULL;
+}
+
+TEST_CASE(FindLibraryByAddress_replaced_snapshots_freed) {
+    const int count = 200;
+    const int num_readers = 2;
+    CodeCacheArray* libs = new CodeCacheArray();
+    CodeCache* caches[count];
+    volatile bool done = false;
+
+    caches[0] = new CodeCache("lib_0", 0, (const void*)0x1000, (const void*)0x2000);
+    libs->add(caches[0]);
+    libs->publish();
+    CHECK_EQ(libs->takeRetired(), (CodeCacheIndex*)NULL);
+
+    LibraryReaderArgs args[num_readers];
+    pthread_t readers[num_readers];
+    for (int i = 0; i < num_readers; i++) {
+        args[i].libs = libs;
+        args[i].first = caches[0];
+        args[i].done = &done;
+        args[i].errors = 0;
+        pthread_create(&readers[i], NULL, libraryReader, &args[i]);
+    }
+
+    // Like dlopen of one library after another. Each replaced snapshot is freed
+    // once every reader has passed through its slot, as Profiler::updateSymbols does
+    for (int i = 1; i < count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "lib_%d", i);
+        caches[i] = new CodeCache(name, i, (const void*)(uintptr_t)(0x1000 + i * 0x1000),
+                                  (const void*)(uintptr_t)(0x2000 + i * 0x1000));
+        libs->add(caches[i]);
+        libs->publish();
+
+        CodeCacheIndex* retired = libs->takeRetired();
+        for (int j = 0; j < num_readers; j++) {
+            args[j].slot.lock();
+            args[j].slot.unlock();
+        }
+        libs->freeRetired(retired);
+    }
+
+    done = true;
+    for (int i = 0; i < num_readers; i++) {
+        pthread_join(readers[i], NULL);
+        CHECK_EQ(args[i].errors, 0);
+    }
+
+    // Only the current snapshot is left
+    size_t libs_memory = 0;
+    for (int i = 0; i < libs->count(); i++) {
+        libs_memory += (*libs)[i]->usedMemory();
+    }
+    size_t snapshot_size = sizeof(CodeCacheIndex) + (count - 1) * sizeof(CodeCacheRange);
+    CHECK_EQ(libs->usedMemory() - libs_memory, snapshot_size);
+    CHECK_EQ(libs->findLibrary((const void*)(uintptr_t)(0x1800 + 150 * 0x1000)), caches[150]);
+    CHECK_EQ(libs->scanLibraries((const void*)(uintptr_t)(0x1800 + 150 * 0x1000)), caches[150]);
+    CHECK_EQ(libs->scanLibraries((const void*)0x100000), (CodeCache*)NULL);
+
+    delete libs;
+    for (int i = 0; i < count; i++) {
+        delete caches[i];
+    }
+}
+
 #ifdef __linux__
 
+TEST_CASE(ParseLibraries_stable_lib_index) {
+    void* handle = dlopen("libreladyn" EXT, RTLD_NOW);
+    ASSERT(handle);
+    Profiler::instance()->updateSymbols(false);
+
+    CodeCacheArray* libs = Profiler::instance()->nativeLibs();
+    ASSERT_GT(libs->count(), 0);
+    for (int i = 0; i < libs->count(); i++) {
+        CHECK_EQ((*libs)[i]->libIndex(), i);
+    }
+}
+
+// Returns the index of the first library that differs between two parses, or -1
+static int findMismatch(CodeCacheArray& expected, CodeCacheArray& actual, const void* address) {
+    if (actual.count() != expected.count()) {
+        return 0;
+    }
+    for (int i = 0; i < expected.count(); i++) {
+        CodeCache* e = expected[i];
+        CodeCache* a = actual[i];
+        if (strcmp(a->name(), e->name()) != 0 || a->libIndex() != i
+                || a->minAddress() != e->minAddress() || a->maxAddress() != e->maxAddress()
+                || a->usedMemory() != e->usedMemory()) {
+            return i;
+        }
+        if (e->contains(address) && strcmp(a->binarySearch(address), e->binarySearch(address)) != 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+TEST_CASE(ParseLibraries_parallel_deterministic) {
+    void* handle = dlopen("libreladyn" EXT, RTLD_NOW);
+    ASSERT(handle);
+
+    const void* address = (const void*)findMismatch;
+    CodeCacheArray serial;
+    int workers = Symbols::parseAllLibraries(&serial, 1);
+    CHECK_EQ(workers, 1);
+    ASSERT_GT(serial.count(), 1);
+
+    // The index must not depend on the number of threads or on which thread parsed which library
+    CodeCacheArray parallel;
+    workers = Symbols::parseAllLibraries(&parallel, 4);
+    CHECK_GT(workers, 1);
+    CHECK_EQ(findMismatch(serial, parallel, address), -1);
+
+    CodeCacheArray again;
+    Symbols::parseAllLibraries(&again, 4);
+    CHECK_EQ(findMismatch(serial, again, address), -1);
+
+    CodeCache* self = serial.findLibrary(address);
+    ASSERT(self);
+    const char* name = self->binarySearch(address);
+    ASSERT(name);
+    CHECK_NE(strstr(name, "findMismatch"), (const char*)NULL);
+}
+
 TEST_CASE(ResolveFromRela_dyn_R_ABS64) {
     ASSERT_RESOLVE(im_pthread_exit);
 }
@@ -66,6 +516,75 @@ TEST_CASE(MappedTwiceAtZeroOffset) {
     hello();
 }
 
+TEST_CASE(LazySymbols_loaded_on_first_lookup) {
+    const void* sym = resolveSymbol("libvaddrdif" EXT, "vaddrdif_square");
+    ASSERT(sym);
+    CodeCache* eager = Profiler::instance()->findLibraryByName("libvaddrdif");
+    ASSERT(eager);
+
+    CodeCache lazy(eager->name(), eager->libIndex(), eager->minAddress(), eager->maxAddress(), eager->imageBase());
+    lazy.setLazy(true, true);
+
+    // A sample gets the library name and requests symbols from the loader thread
+    CHECK_EQ(lazy.binarySearch(sym), lazy.name());
+    CHECK_EQ(lazy.symbolsRequested(), true);
+    CHECK_EQ(lazy.findFrameDesc(sym), &FrameDesc::default_frame);
+    CHECK_EQ(lazy.dwarfRequested(), true);
+
+    // Regular lookups load symbols synchronously
+    CHECK_EQ(lazy.findSymbol("vaddrdif_square"), sym);
+    CHECK_EQ(lazy.symbolsPending(), false);
+    CHECK_EQ(strcmp(lazy.binarySearch(sym), "vaddrdif_square"), 0);
+
+    Symbols::loadDwarf(&lazy);
+    CHECK_EQ(lazy.dwarfPending(), false);
+}
+
+// Counts threads or file descriptors of the current process
+static int countEntries(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+TEST_CASE(LazySymbols_loader_stopped) {
+    int threads = countEntries("/proc/self/task");
+    int fds = countEntries("/proc/self/fd");
+
+    Symbols::setLazy(true);
+    void* handle = dlopen("libjninativelocks" EXT, RTLD_NOW);
+    Profiler::instance()->updateSymbols(false);
+    Symbols::setLazy(false);
+    ASSERT(handle);
+
+    CodeCache* cc = Profiler::instance()->findLibraryByName("libjninativelocks");
+    ASSERT(cc);
+    CHECK_EQ(cc->symbolsPending(), true);
+    CHECK_EQ(countEntries("/proc/self/task"), threads + 1);
+
+    // The loader thread and both ends of its pipe are gone; stopping again does nothing
+    Symbols::stopLoader();
+    Symbols::stopLoader();
+    CHECK_EQ(countEntries("/proc/self/task"), threads);
+    CHECK_EQ(countEntries("/proc/self/fd"), fds);
+
+    // With lazy mode off, the next parse loads what is still pending
+    CHECK_EQ(cc->symbolsPending(), true);
+    Profiler::instance()->updateSymbols(false);
+    CHECK_EQ(cc->symbolsPending(), false);
+    CHECK_EQ(cc->dwarfPending(), false);
+}
+
 TEST_CASE(MultipleMatchingSymbols) {
     const void* sym = resolveSymbol("multiplematching" EXT, "Class::function");
     ASSERT(sym);
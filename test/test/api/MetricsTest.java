@@ -24,7 +24,12 @@ public class MetricsTest {
             String[] pair = line.split(" ");
             assert pair.length == 2 : line;
             if (pair[1].startsWith("0")) {
-                assert "samples_skipped_total".equals(pair[0]) || "calltracestorage_overflows_total".equals(pair[0]) : line;
+                assert "samples_skipped_total".equals(pair[0]) || "calltracestorage_overflows_total".equals(pair[0]) ||
+                       "calltracestorage_unpublished_total".equals(pair[0]) ||
+                       "calltracestorage_collisions_total".equals(pair[0]) ||
+                       "calltracestorage_evicted_total".equals(pair[0]) ||
+                       "pccache_hits_total".equals(pair[0]) || "pccache_misses_total".equals(pair[0]) ||
+                       "scopecache_hits_total".equals(pair[0]) || "scopecache_misses_total".equals(pair[0]) : line;
             }
 
             if (pair[0].equals("samples_total")) {
@@ -34,5 +39,20 @@ public class MetricsTest {
 
         // Should be found since we used features=stats
         assert metrics.contains("stackwalk_ns_total") : metrics;
+
+        // Each sampler slot owns a pair of 64 KB JFR event buffers at least
+        long slots = metricValue(metrics, "sampler_slots");
+        assert slots >= 16 && Long.bitCount(slots) == 1 : metrics;
+        assert metricValue(metrics, "mem_samplerslots_kb") >= slots * 128 : metrics;
+    }
+
+    private static long metricValue(String metrics, String name) {
+        for (String line : metrics.split("\n")) {
+            String[] pair = line.split(" ");
+            if (pair[0].equals(name)) {
+                return Long.parseLong(pair[1]);
+            }
+        }
+        throw new AssertionError(name + " not found in " + metrics);
     }
 }
@@ -82,6 +82,21 @@ public class CpuTests {
         assertCloseTo(outRightCpu.total(), 2_000_000_000, "perf_events total should match profiling duration");
     }
 
+    @Test(mainClass = CpuBurner.class, os = Os.LINUX, jvmArgs = "-XX:+PreserveFramePointer")
+    public void perfEventsNoSignal(TestProcess p) throws Exception {
+        Output out = p.profile("-d 2 -e cpu-clock -i 10ms --nosignal --total -o collapsed");
+        assert out.contains("test/cpu/CpuBurner.burn");
+        assertCloseTo(out.total(), 2_000_000_000, "nosignal total should match profiling duration");
+    }
+
+    @Test(mainClass = CpuBurner.class, os = Os.LINUX, jvmArgs = "-Xint -XX:+PreserveFramePointer")
+    public void perfEventsNoSignalInterpreted(TestProcess p) throws Exception {
+        // The kernel callchain has no method of an interpreted frame
+        Output out = p.profile("-d 2 -e cpu-clock -i 10ms --nosignal -o collapsed");
+        assert out.contains(";Interpreter");
+        assert !out.contains("test/cpu/CpuBurner.burn");
+    }
+
     @Test(mainClass = CpuBurner.class, os = Os.LINUX)
     public void itimerDoesNotSupportTargetCpu(TestProcess p) throws Exception {
         try {
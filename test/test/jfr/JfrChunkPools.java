@@ -0,0 +1,193 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package test.jfr;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.util.*;
+
+/**
+ * Raw headers and constant pools of every chunk in a recording written by async-profiler.
+ * JFR parsers merge or overwrite pool entries, so they cannot tell whether
+ * a chunk refers to an entry it does not contain, or contains one twice.
+ */
+public class JfrChunkPools {
+    // Type ids as in jfrMetadata.h
+    static final int T_CPOOL = 1;
+    static final int T_STRING = 20;
+    static final int T_CLASS = 21;
+    static final int T_THREAD = 22;
+    static final int T_STACK_TRACE = 26;
+    static final int T_METHOD = 28;
+    static final int T_PACKAGE = 30;
+    static final int T_SYMBOL = 31;
+
+    private static final int CHUNK_SIGNATURE = 0x464c5200;
+    private static final int CHUNK_HEADER_SIZE = 68;
+
+    public static class Chunk {
+        public long size;
+        public long startNanos;
+        public long durationNanos;
+        // Ids in the order they appear in each pool, duplicates included
+        public final Map<Integer, List<Long>> ids = new HashMap<>();
+        // Fields of pool entries that refer to other pools
+        public final Map<Long, Long> methodClass = new HashMap<>();
+        public final Map<Long, long[]> methodSymbols = new HashMap<>();
+        public final Map<Long, Long> classSymbol = new HashMap<>();
+        public final Map<Long, Long> classPackage = new HashMap<>();
+        public final Map<Long, Long> packageSymbol = new HashMap<>();
+        public final Map<Long, String> symbols = new HashMap<>();
+        public final Set<Long> stackTraceMethods = new HashSet<>();
+
+        public List<Long> ids(int type) {
+            return ids.getOrDefault(type, Collections.emptyList());
+        }
+    }
+
+    private final ByteBuffer buf;
+
+    private JfrChunkPools(ByteBuffer buf) {
+        this.buf = buf;
+    }
+
+    public static List<Chunk> read(Path file) throws IOException {
+        JfrChunkPools reader = new JfrChunkPools(ByteBuffer.wrap(Files.readAllBytes(file)));
+        List<Chunk> chunks = new ArrayList<>();
+        for (int pos = 0; pos < reader.buf.limit(); ) {
+            if (reader.buf.getInt(pos) != CHUNK_SIGNATURE) {
+                throw new IOException("Not a valid JFR chunk at " + pos);
+            }
+            long size = reader.buf.getLong(pos + 8);
+            long cpOffset = reader.buf.getLong(pos + 16);
+            if (size < CHUNK_HEADER_SIZE || cpOffset == 0) {
+                throw new IOException("Incomplete JFR chunk at " + pos);
+            }
+            JfrChunkPools.Chunk chunk = reader.readConstantPool(pos + (int) cpOffset);
+            chunk.size = size;
+            chunk.startNanos = reader.buf.getLong(pos + 32);
+            chunk.durationNanos = reader.buf.getLong(pos + 40);
+            chunks.add(chunk);
+            pos += (int) size;
+        }
+        return chunks;
+    }
+
+    private Chunk readConstantPool(int offset) throws IOException {
+        buf.position(offset);
+        getVarint();  // size
+        if (getVarint() != T_CPOOL) {
+            throw new IOException("No constant pool at " + offset);
+        }
+        getVarlong();  // start
+        getVarlong();  // duration
+        if (getVarlong() != 0) {
+            throw new IOException("Constant pool is expected in a single event");
+        }
+        getVarint();  // flush
+
+        Chunk chunk = new Chunk();
+        int poolCount = getVarint();
+        for (int i = 0; i < poolCount; i++) {
+            int type = getVarint();
+            List<Long> ids = chunk.ids.computeIfAbsent(type, k -> new ArrayList<>());
+            for (int count = getVarint(); count > 0; count--) {
+                long id = getVarlong();
+                ids.add(id);
+                readEntry(chunk, type, id);
+            }
+        }
+        return chunk;
+    }
+
+    private void readEntry(Chunk chunk, int type, long id) {
+        switch (type) {
+            case T_THREAD:
+                getString();   // OS name
+                getVarlong();  // OS thread id
+                getString();   // Java name
+                getVarlong();  // Java thread id
+                break;
+            case T_STACK_TRACE:
+                getVarint();   // truncated
+                for (int depth = getVarint(); depth > 0; depth--) {
+                    chunk.stackTraceMethods.add(getVarlong());
+                    getVarint();  // line
+                    getVarint();  // bci
+                    buf.get();    // frame type
+                }
+                break;
+            case T_METHOD:
+                chunk.methodClass.put(id, getVarlong());
+                chunk.methodSymbols.put(id, new long[]{getVarlong(), getVarlong()});
+                getVarint();  // modifiers
+                getVarint();  // hidden
+                break;
+            case T_CLASS:
+                getVarlong();  // class loader
+                chunk.classSymbol.put(id, getVarlong());
+                chunk.classPackage.put(id, getVarlong());
+                getVarint();   // access flags
+                break;
+            case T_PACKAGE:
+                chunk.packageSymbol.put(id, getVarlong());
+                break;
+            case T_SYMBOL:
+                chunk.symbols.put(id, getString());
+                break;
+            default:
+                // Enumerations and the placeholder for an empty pool
+                getString();
+        }
+    }
+
+    private int getVarint() {
+        int result = 0;
+        for (int shift = 0; ; shift += 7) {
+            byte b = buf.get();
+            result |= (b & 0x7f) << shift;
+            if (b >= 0) {
+                return result;
+            }
+        }
+    }
+
+    private long getVarlong() {
+        long result = 0;
+        for (int shift = 0; shift < 56; shift += 7) {
+            byte b = buf.get();
+            result |= (b & 0x7fL) << shift;
+            if (b >= 0) {
+                return result;
+            }
+        }
+        return result | (buf.get() & 0xffL) << 56;
+    }
+
+    private String getString() {
+        switch (buf.get()) {
+            case 0:
+                return null;
+            case 1:
+                return "";
+            case 3:
+                return new String(getBytes(), StandardCharsets.UTF_8);
+            case 5:
+                return new String(getBytes(), StandardCharsets.ISO_8859_1);
+            default:
+                throw new IllegalArgumentException("Unexpected string encoding");
+        }
+    }
+
+    private byte[] getBytes() {
+        byte[] bytes = new byte[getVarint()];
+        buf.get(bytes);
+        return bytes;
+    }
+}
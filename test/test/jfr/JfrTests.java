@@ -71,6 +71,8 @@ public class JfrTests {
      * @throws Exception Any exception thrown during profiling JFR output parsing.
      */
     @Test(mainClass = JfrMultiModeProfiling.class, agentArgs = "start,event=cpu,alloc,lock=0,quiet,jfr,file=%f", output = true)
+    @Test(mainClass = JfrMultiModeProfiling.class, agentArgs = "start,event=cpu,alloc,lock=0,quiet,jfropts=mem+async,file=%f", output = true, nameSuffix = "asyncWriter")
+    @Test(mainClass = JfrMultiModeProfiling.class, agentArgs = "start,event=cpu,alloc,lock=0,quiet,jfrring=16m,file=%f", output = true, nameSuffix = "ringBuffer")
     public void parseMultiModeRecording(TestProcess p) throws Exception {
         Output output = p.waitForExit(TestProcess.STDOUT);
         assert p.exitCode() == 0;
@@ -227,6 +229,137 @@ public class JfrTests {
         assert out.contains("begin and end symbols should not resolve to the same address");
     }
 
+    /**
+     * Constant pool dictionaries live for the whole recording, and each chunk writes
+     * only the entries its own events refer to. Every chunk must still be self-contained.
+     */
+    @Test(mainClass = JfrCpuProfiling.class)
+    public void cpoolPerChunkTime(TestProcess p) throws Exception {
+        p.profile("-d 12 -e cpu -i 1ms --chunktime 5 -f %f.jfr");
+        checkChunkPools(p);
+    }
+
+    @Test(mainClass = JfrCpuProfiling.class)
+    public void cpoolPerChunkSize(TestProcess p) throws Exception {
+        // Wall clock samples of all threads fill the smallest allowed chunks quickly
+        p.profile("-d 6 -e wall -i 1ms --chunksize 256k -f %f.jfr");
+        checkChunkPools(p);
+    }
+
+    @Test(mainClass = JfrCpuProfiling.class)
+    public void ringBufferWrap(TestProcess p) throws Exception {
+        // The requested chunk size does not fit the ring, so chunks are capped at a quarter of it
+        p.profile("start -e cpu -i 100us --chunksize 4m --jfrring 1m -f %f.jfr");
+        long startedAt = System.currentTimeMillis();
+        Thread.sleep(12000);
+
+        long dumpedAt = System.currentTimeMillis();
+        p.profile("dump -f %f.jfr");
+        List<JfrChunkPools.Chunk> chunks = checkRing(p, startedAt, dumpedAt);
+
+        // Allow for samples taken right before the chunk switch
+        long firstStart = chunks.get(0).startNanos;
+        long minEventTime = firstStart - 100_000_000;
+        int samples = 0;
+        try (RecordingFile recordingFile = new RecordingFile(p.getFile("%f").toPath())) {
+            while (recordingFile.hasMoreEvents()) {
+                RecordedEvent event = recordingFile.readEvent();
+                if (event.getEventType().getName().equals("jdk.ExecutionSample")) {
+                    assert toNanos(event.getStartTime()) >= minEventTime : "Event from a dropped chunk: " + event;
+                    samples++;
+                }
+            }
+        }
+        Assert.isGreater(samples, 0);
+
+        // The window keeps moving after a dump; stop writes the newest chunks again
+        Thread.sleep(5000);
+        long stoppedAt = System.currentTimeMillis();
+        p.profile("stop -f %f.jfr");
+        List<JfrChunkPools.Chunk> last = checkRing(p, startedAt, stoppedAt);
+        assert last.get(0).startNanos > firstStart : "The window did not move";
+    }
+
+    // Retained chunks must be the newest ones: a contiguous run up to the dump that fits the ring
+    private static List<JfrChunkPools.Chunk> checkRing(TestProcess p, long startedAt, long dumpedAt) throws Exception {
+        final long ringSize = 1024 * 1024;
+        List<JfrChunkPools.Chunk> chunks = JfrChunkPools.read(p.getFile("%f").toPath());
+        Assert.isGreaterOrEqual(chunks.size(), 2);
+
+        long totalSize = 0;
+        for (int i = 0; i < chunks.size(); i++) {
+            JfrChunkPools.Chunk chunk = chunks.get(i);
+            totalSize += chunk.size;
+            // The size limit is checked periodically, so a chunk may go somewhat beyond it
+            Assert.isLess(chunk.size, ringSize / 2, "Chunk " + i + " is not capped");
+            if (i > 0) {
+                JfrChunkPools.Chunk prev = chunks.get(i - 1);
+                assert chunk.startNanos == prev.startNanos + prev.durationNanos : "Gap before chunk " + i;
+            }
+        }
+        Assert.isLessOrEqual(totalSize, ringSize);
+
+        // The first chunk of the recording has been dropped, and the last one ends with the dump
+        assert chunks.get(0).startNanos > startedAt * 1_000_000 : "The oldest chunk is kept";
+        JfrChunkPools.Chunk lastChunk = chunks.get(chunks.size() - 1);
+        assert lastChunk.startNanos + lastChunk.durationNanos >= dumpedAt * 1_000_000 : "The newest chunk is missing";
+        return chunks;
+    }
+
+    private static long toNanos(Instant instant) {
+        return instant.getEpochSecond() * 1_000_000_000 + instant.getNano();
+    }
+
+    private static void checkChunkPools(TestProcess p) throws Exception {
+        List<JfrChunkPools.Chunk> chunks = JfrChunkPools.read(p.getFile("%f").toPath());
+        Assert.isGreaterOrEqual(chunks.size(), 3);
+
+        for (int i = 0; i < chunks.size(); i++) {
+            JfrChunkPools.Chunk chunk = chunks.get(i);
+            for (int type : new int[]{JfrChunkPools.T_CLASS, JfrChunkPools.T_PACKAGE, JfrChunkPools.T_SYMBOL}) {
+                List<Long> ids = chunk.ids(type);
+                assert new HashSet<>(ids).size() == ids.size() : "Duplicate entries of type " + type + " in chunk " + i;
+            }
+
+            for (long method : chunk.stackTraceMethods) {
+                assert chunk.methodClass.containsKey(method) : "Method " + method + " missing in chunk " + i;
+            }
+            for (Map.Entry<Long, Long> e : chunk.methodClass.entrySet()) {
+                assert e.getValue() == 0 || chunk.classSymbol.containsKey(e.getValue()) : "Class " + e.getValue() + " missing in chunk " + i;
+                for (long symbol : chunk.methodSymbols.get(e.getKey())) {
+                    assert chunk.symbols.containsKey(symbol) : "Method symbol " + symbol + " missing in chunk " + i;
+                }
+            }
+            for (Map.Entry<Long, Long> e : chunk.classSymbol.entrySet()) {
+                assert chunk.symbols.containsKey(e.getValue()) : "Class symbol " + e.getValue() + " missing in chunk " + i;
+                long pkg = chunk.classPackage.get(e.getKey());
+                assert pkg == 0 || chunk.packageSymbol.containsKey(pkg) : "Package " + pkg + " missing in chunk " + i;
+            }
+            for (long symbol : chunk.packageSymbol.values()) {
+                assert chunk.symbols.containsKey(symbol) : "Package symbol " + symbol + " missing in chunk " + i;
+            }
+        }
+
+        // Classes seen in the first chunk are written again when later chunks refer to them
+        assert chunks.subList(1, chunks.size()).stream().anyMatch(c -> c.symbols.containsValue("test/jfr/JfrCpuProfiling"))
+                : "JfrCpuProfiling class missing in later chunks";
+
+        // The JDK parser resolves stack traces chunk by chunk as well
+        int samples = 0;
+        try (RecordingFile recordingFile = new RecordingFile(p.getFile("%f").toPath())) {
+            while (recordingFile.hasMoreEvents()) {
+                RecordedEvent event = recordingFile.readEvent();
+                if (event.getStackTrace() != null) {
+                    event.getStackTrace().getFrames().forEach(frame -> {
+                        assert frame.getMethod().getType().getName() != null : event;
+                    });
+                    samples++;
+                }
+            }
+        }
+        Assert.isGreater(samples, 100);
+    }
+
     private boolean containsSamplesOutsideWindow(TestProcess p) throws Exception {
         TreeMap<Instant, Instant> profilerWindows = new TreeMap<>();
         List<RecordedEvent> samples = new ArrayList<>();
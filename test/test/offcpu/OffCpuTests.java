@@ -0,0 +1,56 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package test.offcpu;
+
+import one.profiler.test.Assert;
+import one.profiler.test.Os;
+import one.profiler.test.Output;
+import one.profiler.test.Test;
+import one.profiler.test.TestProcess;
+
+import java.io.IOException;
+
+public class OffCpuTests {
+
+    // Tracepoints may not be available in the test environment
+    private static boolean unavailable(TestProcess p) throws IOException {
+        Output err = p.readFile(TestProcess.PROFERR);
+        return err.contains("sched_switch tracepoint is not accessible") || err.contains("Perf events unavailable");
+    }
+
+    @Test(mainClass = Sleeper.class, os = Os.LINUX)
+    public void sleepingThread(TestProcess p) throws Exception {
+        Output out;
+        try {
+            out = p.profile("-e offcpu -d 3 --total -o collapsed");
+        } catch (IOException e) {
+            if (unavailable(p)) return;
+            throw e;
+        }
+
+        // The whole profiling interval is spent in sleep, including the sleep in progress at stop
+        long sleeping = out.samples("test/offcpu/Sleeper.sleepLoop");
+        Assert.isGreater(sleeping, 2_000_000_000L);
+        Assert.isLess(sleeping, 4_000_000_000L);
+    }
+
+    @Test(mainClass = Sleeper.class, os = Os.LINUX)
+    public void jfr(TestProcess p) throws Exception {
+        try {
+            p.profile("-e offcpu -d 3 -f %f.jfr");
+        } catch (IOException e) {
+            if (unavailable(p)) return;
+            throw e;
+        }
+
+        Output out = Output.convertJfrToCollapsed(p.getFilePath("%f"), "--offcpu", "--total");
+        Assert.isGreater(out.samples("test/offcpu/Sleeper.sleepLoop"), 2_000_000_000L);
+
+        // Off-CPU samples are not mixed with wall clock samples
+        out = Output.convertJfrToCollapsed(p.getFilePath("%f"), "--wall");
+        assert !out.contains("test/offcpu/Sleeper.sleepLoop");
+    }
+}
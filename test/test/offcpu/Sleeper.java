@@ -0,0 +1,19 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package test.offcpu;
+
+public class Sleeper {
+
+    static void sleepLoop() throws InterruptedException {
+        while (true) {
+            Thread.sleep(500);
+        }
+    }
+
+    public static void main(String[] args) throws Exception {
+        sleepLoop();
+    }
+}
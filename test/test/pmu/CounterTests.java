@@ -0,0 +1,66 @@
+/*
+ * Copyright The async-profiler authors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package test.pmu;
+
+import one.profiler.test.Assert;
+import one.profiler.test.Os;
+import one.profiler.test.Output;
+import one.profiler.test.Test;
+import one.profiler.test.TestProcess;
+
+import java.io.IOException;
+
+public class CounterTests {
+
+    // Software counters only, so that the tests also run in VMs without a PMU
+    private static final String COUNTERS = "-e cpu --counters cpu-clock,page-faults ";
+
+    @Test(mainClass = Dictionary.class, os = Os.LINUX)
+    public void jfr(TestProcess p) throws Exception {
+        try {
+            p.profile(COUNTERS + "-d 3 -f %f.jfr");
+        } catch (IOException e) {
+            if (p.readFile(TestProcess.PROFERR).contains("Perf events unavailable")) return;
+            throw e;
+        }
+
+        // The cpu-clock counter runs along with the sampling event, so both yield the same profile
+        Output out = Output.convertJfrToCollapsed(p.getFilePath("%f"), "--counter", "cpu-clock", "--total");
+        Assert.isGreater(out.total(), 1_000_000_000L);
+        Assert.isGreater(out.ratio("test/pmu/Dictionary.test16K"), 0.3);
+        Assert.isGreater(out.ratio("test/pmu/Dictionary.test8M"), 0.3);
+
+        // Counter samples have no thread state and must not break state filtering
+        out = Output.convertJfrToCollapsed(p.getFilePath("%f"), "--counter", "cpu", "--state", "runnable");
+        assert out.contains("test/pmu/Dictionary.test");
+    }
+
+    @Test(mainClass = Dictionary.class, os = Os.LINUX)
+    public void weight(TestProcess p) throws Exception {
+        Output out;
+        try {
+            out = p.profile(COUNTERS + "--weight cpu-clock -d 3 -o collapsed");
+        } catch (IOException e) {
+            if (p.readFile(TestProcess.PROFERR).contains("Perf events unavailable")) return;
+            throw e;
+        }
+
+        // Text output is weighted by the counter in nanoseconds rather than by the number of samples
+        Assert.isGreater(out.total(), 1_000_000_000L);
+        Assert.isGreater(out.ratio("test/pmu/Dictionary.test16K"), 0.3);
+        Assert.isGreater(out.ratio("test/pmu/Dictionary.test8M"), 0.3);
+    }
+
+    @Test(mainClass = Dictionary.class, os = Os.LINUX)
+    public void unknownWeight(TestProcess p) throws Exception {
+        try {
+            p.profile(COUNTERS + "--weight instructions -d 1 -o collapsed");
+            throw new AssertionError("weight must be one of the counters");
+        } catch (IOException e) {
+            assert p.readFile(TestProcess.PROFERR).contains("weight must be the sampling event or one of the counters");
+        }
+    }
+}